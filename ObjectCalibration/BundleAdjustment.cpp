@@ -1,22 +1,97 @@
 #include "BundleAdjustment.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
 #include <QtDebug>
 
+#include "Similarity.h"
+
 #include <dlib/optimization.h>
 
 using namespace dlib;
 
-BundleAdjustment::BundleAdjustment(ViewerWidget* viewerWidget) :
-	m_viewerWidget(viewerWidget)
+namespace
+{
+	/**
+	 * \brief Descriptor of the target at the working resolution of a renderer, like the renderer builds it
+	 */
+	TargetDescriptor workingTargetDescriptor(const Renderer* renderer, const QImage& targetImage)
+	{
+		const auto size = renderer->workingResolution().isValid() ? renderer->workingResolution() : targetImage.size();
+
+		if (size == targetImage.size())
+		{
+			return TargetDescriptor(targetImage);
+		}
+
+		return TargetDescriptor(targetImage.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+	}
+
+	/**
+	 * \brief Draw one pixel at random in each cell of a grid covering an image
+	 * \param size Size of the image
+	 * \param spacing Size of the cells in pixels
+	 * \param generator Source of randomness
+	 * \return The positions of the pixels, from the top left corner
+	 */
+	std::vector<QPoint> stratifiedSamples(const QSize& size, int spacing, std::mt19937& generator)
+	{
+		std::vector<QPoint> samples;
+		samples.reserve(std::size_t((size.width() + spacing - 1) / spacing) * std::size_t((size.height() + spacing - 1) / spacing));
+
+		for (int y = 0; y < size.height(); y += spacing)
+		{
+			std::uniform_int_distribution<int> row(y, std::min(size.height(), y + spacing) - 1);
+
+			for (int x = 0; x < size.width(); x += spacing)
+			{
+				std::uniform_int_distribution<int> column(x, std::min(size.width(), x + spacing) - 1);
+
+				samples.emplace_back(column(generator), row(generator));
+			}
+		}
+
+		return samples;
+	}
+}
+
+BundleAdjustment::BundleAdjustment(Renderer* renderer, EvaluationCache* cache, RefinementMonitor* monitor) :
+	m_renderer(renderer),
+	m_cache(cache),
+	m_monitor(monitor),
+	m_settings(EvaluationCache::hashSettings(renderer->workingResolution(),
+	                                         renderer->supersampling(),
+	                                         renderer->silhouetteOnly(),
+	                                         renderer->levelOfDetailTolerance()))
 {
 	
 }
 
 double BundleAdjustment::operator()(const ColumnVector& parameters) const
 {
+	double cachedSimilarity;
+	if (m_cache && m_cache->find(m_settings, parameters, cachedSimilarity))
+	{
+		if (m_monitor)
+		{
+			m_monitor->record(parameters, cachedSimilarity, 0);
+		}
+
+		return cachedSimilarity;
+	}
+
+	// Without budget, the line search ends without rendering and the stop strategy stops the search
+	if (m_monitor && m_monitor->isExhausted())
+	{
+		return -1.0;
+	}
+
 	const auto pose = parametersToObjectPose(parameters);
 
-	auto similarity = m_viewerWidget->renderAndComputeSimilarityGpu(pose);
+	auto similarity = m_renderer->renderAndComputeSimilarity(pose);
 	
 	
 	if (isnan(similarity))
@@ -29,10 +104,93 @@ double BundleAdjustment::operator()(const ColumnVector& parameters) const
 		
 		similarity = -1.0;
 	}
+
+	if (m_cache)
+	{
+		m_cache->insert(m_settings, parameters, similarity);
+	}
+
+	if (m_monitor)
+	{
+		m_monitor->record(parameters, similarity);
+	}
 	
 	return similarity;
 }
 
+BundleAdjustment::ColumnVector BundleAdjustment::gradient(const ColumnVector& parameters, double eps) const
+{
+	if (m_monitor && m_monitor->isExhausted())
+	{
+		return zeros_matrix<double>(parameters.size(), 1);
+	}
+
+	// Same steps as dlib::derivative(): +eps and -eps on each parameter
+	std::vector<double> similarities(2 * parameters.size());
+
+	// Only the poses missing from the cache are rendered
+	std::vector<ColumnVector> missingParameters;
+	std::vector<long> missingIndices;
+	std::vector<ObjectPose> poses;
+	poses.reserve(2 * parameters.size());
+
+	auto shifted = parameters;
+	for (long i = 0; i < 2 * parameters.size(); i++)
+	{
+		const long parameter = i / 2;
+		const double oldValue = shifted(parameter);
+
+		shifted(parameter) = i % 2 == 0 ? oldValue + eps : oldValue - eps;
+
+		if (!m_cache || !m_cache->find(m_settings, shifted, similarities[i]))
+		{
+			poses.push_back(parametersToObjectPose(shifted));
+			missingParameters.push_back(shifted);
+			missingIndices.push_back(i);
+		}
+		else if (m_monitor)
+		{
+			m_monitor->record(shifted, similarities[i], 0);
+		}
+
+		shifted(parameter) = oldValue;
+	}
+
+	const auto renderedSimilarities = poses.empty() ? std::vector<float>() : m_renderer->renderAndComputeSimilarityBatch(poses);
+
+	for (std::size_t i = 0; i < renderedSimilarities.size(); i++)
+	{
+		double similarity = renderedSimilarities[i];
+
+		if (isnan(similarity))
+		{
+			qWarning() << "nan objective function detected in the gradient";
+			similarity = -1.0;
+		}
+
+		similarities[missingIndices[i]] = similarity;
+
+		if (m_cache)
+		{
+			m_cache->insert(m_settings, missingParameters[i], similarity);
+		}
+
+		if (m_monitor)
+		{
+			m_monitor->record(missingParameters[i], similarity);
+		}
+	}
+
+	ColumnVector der(parameters.size());
+	for (long i = 0; i < parameters.size(); i++)
+	{
+		const double oldValue = parameters(i);
+		der(i) = (similarities[2 * i] - similarities[2 * i + 1]) / ((oldValue + eps) - (oldValue - eps));
+	}
+
+	return der;
+}
+
 BundleAdjustment::ColumnVector BundleAdjustment::objectPoseToParameters(const ObjectPose& pose)
 {
 	const auto translation = pose.normalizedTranslation();
@@ -69,25 +227,637 @@ ObjectPose BundleAdjustment::parametersToObjectPose(const ColumnVector& paramete
 	return pose;
 }
 
+DifferentiableBundleAdjustment::DifferentiableBundleAdjustment(DifferentiableRenderer* renderer, RefinementMonitor* monitor) :
+	m_renderer(renderer),
+	m_monitor(monitor),
+	m_value(0.0)
+{
+
+}
+
+double DifferentiableBundleAdjustment::operator()(const ColumnVector& parameters) const
+{
+	evaluate(parameters);
+
+	return m_value;
+}
+
+DifferentiableBundleAdjustment::ColumnVector DifferentiableBundleAdjustment::gradient(const ColumnVector& parameters) const
+{
+	evaluate(parameters);
+
+	return m_gradient;
+}
+
+void DifferentiableBundleAdjustment::evaluate(const ColumnVector& parameters) const
+{
+	if (m_parameters.size() == parameters.size() && m_parameters == parameters)
+	{
+		return;
+	}
+
+	// Without budget, the line search ends without rendering and the stop strategy stops the search
+	if (m_monitor && m_monitor->isExhausted())
+	{
+		m_value = -1.0;
+		m_gradient = zeros_matrix<double>(6, 1);
+		m_parameters = parameters;
+		return;
+	}
+
+	double gradient[6];
+	m_value = m_renderer->evaluate(BundleAdjustment::parametersToObjectPose(parameters), gradient);
+	m_gradient = mat(gradient, 6);
+
+	if (isnan(m_value))
+	{
+		qWarning() << "nan objective function detected";
+
+		m_value = -1.0;
+		m_gradient = zeros_matrix<double>(6, 1);
+	}
+
+	m_parameters = parameters;
+
+	if (m_monitor)
+	{
+		m_monitor->record(parameters, m_value);
+	}
+}
+
+LeastSquaresBundleAdjustment::LeastSquaresBundleAdjustment(
+	Renderer* renderer,
+	const QImage& targetImage,
+	int tileSize,
+	double eps,
+	RefinementMonitor* monitor) :
+	m_renderer(renderer),
+	m_tileSize(std::max(1, tileSize)),
+	m_eps(eps),
+	m_silhouetteOnly(renderer->silhouetteOnly()),
+	m_monitor(monitor)
+{
+	// Same target as the renderer at the working resolution
+	m_target = workingTargetDescriptor(renderer, targetImage);
+
+	const auto size = m_target.size();
+	const long tileCount = long((size.width() + m_tileSize - 1) / m_tileSize) * long((size.height() + m_tileSize - 1) / m_tileSize);
+	m_scale = 1.0 / std::sqrt(double(std::max(1L, tileCount)));
+
+	m_residualIndices.resize((m_silhouetteOnly ? 1 : 2) * tileCount);
+	for (std::size_t i = 0; i < m_residualIndices.size(); i++)
+	{
+		m_residualIndices[i] = long(i);
+	}
+}
+
+double LeastSquaresBundleAdjustment::residual(long index, const ColumnVector& parameters) const
+{
+	evaluateResiduals(parameters);
+
+	return m_scale * m_residuals[index];
+}
+
+LeastSquaresBundleAdjustment::ColumnVector LeastSquaresBundleAdjustment::residualDerivative(long index, const ColumnVector& parameters) const
+{
+	evaluateJacobian(parameters);
+
+	return mat(m_jacobian.data() + 6 * std::size_t(index), 6);
+}
+
+void LeastSquaresBundleAdjustment::evaluateResiduals(const ColumnVector& parameters) const
+{
+	if (m_residualParameters.size() == parameters.size() && m_residualParameters == parameters)
+	{
+		return;
+	}
+
+	m_residuals = residuals(m_renderer->renderToImage(BundleAdjustment::parametersToObjectPose(parameters)));
+	m_residualParameters = parameters;
+
+	record(parameters, m_residuals);
+}
+
+void LeastSquaresBundleAdjustment::evaluateJacobian(const ColumnVector& parameters) const
+{
+	if (m_jacobianParameters.size() == parameters.size() && m_jacobianParameters == parameters)
+	{
+		return;
+	}
+
+	// +eps and -eps on each parameter, and the parameters themselves if needed
+	std::vector<ObjectPose> poses;
+	poses.reserve(2 * parameters.size() + 1);
+
+	auto shifted = parameters;
+	for (long i = 0; i < parameters.size(); i++)
+	{
+		const double oldValue = shifted(i);
+
+		shifted(i) = oldValue + m_eps;
+		poses.push_back(BundleAdjustment::parametersToObjectPose(shifted));
+		shifted(i) = oldValue - m_eps;
+		poses.push_back(BundleAdjustment::parametersToObjectPose(shifted));
+
+		shifted(i) = oldValue;
+	}
+
+	const bool withResiduals = !(m_residualParameters.size() == parameters.size() && m_residualParameters == parameters);
+	if (withResiduals)
+	{
+		poses.push_back(BundleAdjustment::parametersToObjectPose(parameters));
+	}
+
+	const auto images = m_renderer->renderToImageBatch(poses);
+
+	if (withResiduals)
+	{
+		m_residuals = residuals(images.back());
+		m_residualParameters = parameters;
+
+		record(parameters, m_residuals);
+	}
+
+	const auto residualCount = m_residualIndices.size();
+	m_jacobian.assign(6 * residualCount, 0.0);
+
+	for (long i = 0; i < parameters.size(); i++)
+	{
+		const auto plus = residuals(images[2 * i]);
+		const auto minus = residuals(images[2 * i + 1]);
+		const double step = (parameters(i) + m_eps) - (parameters(i) - m_eps);
+
+		if (m_monitor)
+		{
+			auto shifted = parameters;
+			shifted(i) = parameters(i) + m_eps;
+			record(shifted, plus);
+			shifted(i) = parameters(i) - m_eps;
+			record(shifted, minus);
+		}
+
+		for (std::size_t r = 0; r < residualCount; r++)
+		{
+			m_jacobian[6 * r + i] = m_scale * (double(plus[r]) - double(minus[r])) / step;
+		}
+	}
+
+	m_jacobianParameters = parameters;
+}
+
+std::vector<float> LeastSquaresBundleAdjustment::residuals(const QImage& image) const
+{
+	return computeTileResiduals(image, m_target, m_tileSize, m_silhouetteOnly);
+}
+
+void LeastSquaresBundleAdjustment::record(const ColumnVector& parameters, const std::vector<float>& residuals) const
+{
+	if (!m_monitor)
+	{
+		return;
+	}
+
+	double sumOfSquares = 0.0;
+	for (const auto residual : residuals)
+	{
+		sumOfSquares += double(residual) * double(residual);
+	}
+
+	m_monitor->record(parameters, -m_scale * m_scale * sumOfSquares);
+}
+
 ObjectPose runBundleAdjustment(
-	ViewerWidget* viewerWidget,
+	Renderer* renderer,
 	const QImage& targetImage,
 	const ObjectPose& pose)
 {
-	viewerWidget->setTargetImage(targetImage);
+	renderer->setTargetImage(targetImage);
 
-	const BundleAdjustment problem(viewerWidget);
+	const BundleAdjustment problem(renderer);
 	
 	// Initial configuration
 	auto parameters = BundleAdjustment::objectPoseToParameters(pose);
 
+	// The poses of the gradient are evaluated in one batch
 	const float eps = 1e-2;
-	find_max_using_approximate_derivatives(bfgs_search_strategy(),
-		                                   objective_delta_stop_strategy(1e-8),
-		                                   problem,
-		                                   parameters,
-		                                   1.0,
-		                                   eps);
+	find_max(bfgs_search_strategy(),
+	         objective_delta_stop_strategy(1e-8),
+	         problem,
+	         [&problem, eps](const BundleAdjustment::ColumnVector& x) { return problem.gradient(x, eps); },
+	         parameters,
+	         1.0);
+
+	return BundleAdjustment::parametersToObjectPose(parameters);
+}
+
+ObjectPose runBundleAdjustmentSpsa(
+	Renderer* renderer,
+	const QImage& targetImage,
+	const ObjectPose& pose,
+	const SpsaSettings& settings)
+{
+	renderer->setTargetImage(targetImage);
+
+	const auto target = workingTargetDescriptor(renderer, targetImage);
+	const bool silhouetteOnly = renderer->silhouetteOnly();
+
+	std::mt19937 generator(settings.seed);
+	std::bernoulli_distribution coin(0.5);
+
+	auto parameters = BundleAdjustment::objectPoseToParameters(pose);
+
+	// Best sampled similarity of the perturbed poses, logged without rendering the result again
+	double bestSimilarity = 0.0;
+
+	for (unsigned long k = 0; k < settings.iterations; k++)
+	{
+		// Gain sequences of Spall: the steps decrease slowly enough to average out the noise
+		const double gain = settings.a / std::pow(double(k + 1) + settings.stabilityConstant, settings.alpha);
+		const double perturbation = settings.c / std::pow(double(k + 1), settings.gamma);
+
+		// The sample becomes denser as the steps become smaller
+		const double initialGain = settings.a / std::pow(1.0 + settings.stabilityConstant, settings.alpha);
+		const int spacing = std::max(1, int(std::lround(settings.initialSampleSpacing * gain / initialGain)));
+
+		// Both sides are scored on the same pixels, so that the sampling noise mostly cancels
+		const auto samples = stratifiedSamples(target.size(), spacing, generator);
+		const double weight = double(spacing) * double(spacing);
+
+		BundleAdjustment::ColumnVector delta(parameters.size());
+		for (long i = 0; i < delta.size(); i++)
+		{
+			delta(i) = coin(generator) ? 1.0 : -1.0;
+		}
+
+		const BundleAdjustment::ColumnVector plus = parameters + perturbation * delta;
+		const BundleAdjustment::ColumnVector minus = parameters - perturbation * delta;
+
+		const auto images = renderer->renderToImageBatch({ BundleAdjustment::parametersToObjectPose(plus),
+		                                                   BundleAdjustment::parametersToObjectPose(minus) });
+
+		const double plusSimilarity = computeSampledSimilarity(images[0], target, samples, weight, silhouetteOnly);
+		const double minusSimilarity = computeSampledSimilarity(images[1], target, samples, weight, silhouetteOnly);
+		const double difference = plusSimilarity - minusSimilarity;
+
+		bestSimilarity = std::max({ bestSimilarity, plusSimilarity, minusSimilarity });
+
+		// All the parameters move from the same two evaluations, 1 / delta(i) = delta(i)
+		parameters += gain * difference / (2.0 * perturbation) * delta;
+	}
+
+	qDebug() << "SPSA" << settings.iterations << "iterations, best sampled similarity =" << bestSimilarity;
 
 	return BundleAdjustment::parametersToObjectPose(parameters);
 }
+
+ObjectPose runBundleAdjustmentCmaEs(
+	Renderer* renderer,
+	const QImage& targetImage,
+	const ObjectPose& pose,
+	const CmaEsSettings& settings)
+{
+	using Matrix = dlib::matrix<double>;
+	using ColumnVector = BundleAdjustment::ColumnVector;
+
+	renderer->setTargetImage(targetImage);
+
+	const long n = 6;
+	const auto center = BundleAdjustment::objectPoseToParameters(pose);
+
+	// Half widths of the box in normalized parameters, the search works in the box scaled to [-1, 1]
+	ColumnVector halfWidths(n);
+	for (long i = 0; i < n; i++)
+	{
+		halfWidths(i) = i < 3 ? settings.translationNeighborhood : settings.rotationNeighborhood;
+	}
+
+	const auto toParameters = [&](const ColumnVector& y) -> ColumnVector
+	{
+		return center + pointwise_multiply(halfWidths, clamp(y, -1.0, 1.0));
+	};
+
+	// Selection and recombination
+	const int lambda = std::max(4, settings.populationSize);
+	const int mu = lambda / 2;
+
+	ColumnVector weights(mu);
+	for (int i = 0; i < mu; i++)
+	{
+		weights(i) = std::log(mu + 0.5) - std::log(i + 1.0);
+	}
+	weights /= sum(weights);
+	const double mueff = 1.0 / sum(squared(weights));
+
+	// Adaptation rates of the tutorial
+	const double cc = (4.0 + mueff / n) / (n + 4.0 + 2.0 * mueff / n);
+	const double cs = (mueff + 2.0) / (n + mueff + 5.0);
+	const double c1 = 2.0 / ((n + 1.3) * (n + 1.3) + mueff);
+	const double cmu = std::min(1.0 - c1, 2.0 * (mueff - 2.0 + 1.0 / mueff) / ((n + 2.0) * (n + 2.0) + mueff));
+	const double damps = 1.0 + 2.0 * std::max(0.0, std::sqrt((mueff - 1.0) / (n + 1.0)) - 1.0) + cs;
+	const double chiN = std::sqrt(double(n)) * (1.0 - 1.0 / (4.0 * n) + 1.0 / (21.0 * n * n));
+
+	// The box has a width of 2 in the search space
+	ColumnVector mean = zeros_matrix<double>(n, 1);
+	double sigma = 2.0 * settings.initialStepSize;
+	Matrix covariance = identity_matrix<double>(n);
+	ColumnVector pathSigma = zeros_matrix<double>(n, 1);
+	ColumnVector pathCovariance = zeros_matrix<double>(n, 1);
+
+	std::mt19937 generator(settings.seed);
+	std::normal_distribution<double> normal;
+
+	ColumnVector bestY = mean;
+	double bestSimilarity = -std::numeric_limits<double>::infinity();
+
+	int evaluations = 0;
+	int generation = 0;
+
+	while (evaluations + lambda <= settings.evaluationBudget)
+	{
+		// C = B D^2 B^T
+		const eigenvalue_decomposition<Matrix> eigen(make_symmetric(covariance));
+		const Matrix B = eigen.get_pseudo_v();
+		const ColumnVector D = sqrt(max_pointwise(eigen.get_real_eigenvalues(), zeros_matrix<double>(n, 1)));
+
+		std::vector<ColumnVector> samples(lambda);
+		std::vector<ObjectPose> poses(lambda);
+
+		for (int k = 0; k < lambda; k++)
+		{
+			ColumnVector z(n);
+			for (long i = 0; i < n; i++)
+			{
+				z(i) = normal(generator);
+			}
+
+			samples[k] = mean + sigma * B * pointwise_multiply(D, z);
+			poses[k] = BundleAdjustment::parametersToObjectPose(toParameters(samples[k]));
+		}
+
+		const auto similarities = renderer->renderAndComputeSimilarityBatch(poses);
+		evaluations += lambda;
+
+		std::vector<std::pair<double, int>> ranking(lambda);
+		for (int k = 0; k < lambda; k++)
+		{
+			const double similarity = isnan(similarities[k]) ? -1.0 : double(similarities[k]);
+
+			// Samples outside of the box are evaluated on its border and penalized
+			const double outside = length_squared(samples[k] - clamp(samples[k], -1.0, 1.0));
+			ranking[k] = { similarity - outside, k };
+
+			if (similarity > bestSimilarity)
+			{
+				bestSimilarity = similarity;
+				bestY = clamp(samples[k], -1.0, 1.0);
+			}
+		}
+
+		std::sort(ranking.begin(), ranking.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+		const ColumnVector previousMean = mean;
+		mean = zeros_matrix<double>(n, 1);
+		for (int i = 0; i < mu; i++)
+		{
+			mean += weights(i) * samples[ranking[i].second];
+		}
+
+		const ColumnVector step = (mean - previousMean) / sigma;
+
+		// C^-1/2 = B D^-1 B^T, directions of null variance are ignored
+		ColumnVector inverseD(n);
+		for (long i = 0; i < n; i++)
+		{
+			inverseD(i) = D(i) > 0.0 ? 1.0 / D(i) : 0.0;
+		}
+		const Matrix inverseSquareRoot = B * diagm(inverseD) * trans(B);
+
+		pathSigma = (1.0 - cs) * pathSigma + std::sqrt(cs * (2.0 - cs) * mueff) * inverseSquareRoot * step;
+
+		generation++;
+		const double pathSigmaNorm = length(pathSigma);
+		const bool stalled = pathSigmaNorm / std::sqrt(1.0 - std::pow(1.0 - cs, 2.0 * generation)) / chiN >= 1.4 + 2.0 / (n + 1.0);
+
+		pathCovariance = (1.0 - cc) * pathCovariance;
+		if (!stalled)
+		{
+			pathCovariance += std::sqrt(cc * (2.0 - cc) * mueff) * step;
+		}
+
+		Matrix rankMu = zeros_matrix<double>(n, n);
+		for (int i = 0; i < mu; i++)
+		{
+			const ColumnVector y = (samples[ranking[i].second] - previousMean) / sigma;
+			rankMu += weights(i) * y * trans(y);
+		}
+
+		covariance = (1.0 - c1 - cmu) * covariance
+		           + c1 * (pathCovariance * trans(pathCovariance) + (stalled ? cc * (2.0 - cc) : 0.0) * covariance)
+		           + cmu * rankMu;
+
+		sigma *= std::exp((cs / damps) * (pathSigmaNorm / chiN - 1.0));
+
+		if (sigma * max(D) < 2.0 * settings.stepTolerance)
+		{
+			break;
+		}
+	}
+
+	auto parameters = toParameters(bestY);
+
+	qDebug() << "CMA-ES" << evaluations << "evaluations in" << generation << "generations, similarity =" << bestSimilarity;
+
+	if (settings.polishIterations > 0)
+	{
+		// Local refinement from the best sample, the poses of the gradient are evaluated in one batch
+		const BundleAdjustment problem(renderer);
+
+		find_max(bfgs_search_strategy(),
+		         objective_delta_stop_strategy(1e-8, settings.polishIterations),
+		         problem,
+		         [&problem, &settings](const BundleAdjustment::ColumnVector& x) { return problem.gradient(x, settings.polishDerivativeEps); },
+		         parameters,
+		         1.0);
+	}
+
+	return BundleAdjustment::parametersToObjectPose(parameters);
+}
+
+std::vector<PyramidLevel> defaultPyramidLevels()
+{
+	// Coarse levels only need to bring the pose close to the optimum, the silhouettes
+	// and coarser meshes are enough. Close to it, Gauss-Newton steps on the residuals of
+	// the tiles converge in a few iterations
+	return {
+		{ 8, 1e-5, 50, 4e-2, true, 1.0f, true, 0 },
+		{ 4, 1e-6, 50, 2e-2, true, 1.0f, true, 0 },
+		{ 2, 1e-7, 20, 1e-2, false, 0.5f, false, 4 },
+		{ 1, 1e-8, 20, 1e-2, false, 0.25f, false, 8 }
+	};
+}
+
+ObjectPose runBundleAdjustmentPyramid(
+	Renderer* renderer,
+	const QImage& targetImage,
+	const ObjectPose& pose,
+	const std::vector<PyramidLevel>& levels,
+	DifferentiableRenderer* differentiableRenderer,
+	EvaluationCache* cache,
+	RefinementMonitor* monitor)
+{
+	// Initial configuration
+	auto parameters = BundleAdjustment::objectPoseToParameters(pose);
+
+	// The frame buffer follows the working resolution of each level
+	const auto previousResolution = renderer->workingResolution();
+	const auto previousSilhouetteOnly = renderer->silhouetteOnly();
+	const auto previousLevelOfDetailTolerance = renderer->levelOfDetailTolerance();
+	renderer->setTargetImage(targetImage);
+
+	if (cache)
+	{
+		// Loads the values of a previous run on the same image
+		cache->setTargetImage(targetImage);
+	}
+
+	if (differentiableRenderer)
+	{
+		differentiableRenderer->setTargetImage(targetImage);
+	}
+
+	for (std::size_t i = 0; i < levels.size(); i++)
+	{
+		const auto& level = levels[i];
+
+		if (monitor)
+		{
+			// The remaining levels are skipped, the pose stays at the best one of the last level
+			if (monitor->isBudgetExhausted())
+			{
+				break;
+			}
+
+			monitor->beginStage(int(levels.size() - i));
+		}
+
+		const QSize levelSize(std::max(1, targetImage.width() / level.downscale),
+		                      std::max(1, targetImage.height() / level.downscale));
+
+		renderer->setWorkingResolution(levelSize);
+		renderer->setSilhouetteOnly(level.silhouetteOnly);
+		renderer->setLevelOfDetailTolerance(level.levelOfDetailTolerance);
+
+		const auto previousHits = cache ? cache->hits() : 0;
+		const auto previousMisses = cache ? cache->misses() : 0;
+
+		// Value returned by the optimizer, logged without rendering the pose again: the similarity,
+		// or half the sum of the squared residuals on the least squares levels
+		double objective = 0.0;
+
+		if (level.analyticGradient && level.silhouetteOnly && differentiableRenderer)
+		{
+			differentiableRenderer->setWorkingResolution(levelSize);
+			differentiableRenderer->setLevelOfDetailTolerance(level.levelOfDetailTolerance);
+
+			const DifferentiableBundleAdjustment softProblem(differentiableRenderer, monitor);
+
+			// Warm start from the result of the previous level, the value and the gradient come from one pass
+			objective = find_max(bfgs_search_strategy(),
+			                     budgetStopStrategy(objective_delta_stop_strategy(level.minDelta, level.maxIterations), monitor),
+			                     softProblem,
+			                     [&softProblem](const BundleAdjustment::ColumnVector& x) { return softProblem.gradient(x); },
+			                     parameters,
+			                     1.0);
+		}
+		else if (level.residualTileSize > 0)
+		{
+			const LeastSquaresBundleAdjustment leastSquaresProblem(renderer, targetImage, level.residualTileSize,
+			                                                       level.derivativeEps, monitor);
+
+			// Warm start from the result of the previous level, the poses of the Jacobian are rendered in one batch.
+			// The residuals do not stop rendering when the budget is exhausted, the iteration in progress finishes
+			objective = solve_least_squares_lm(budgetStopStrategy(objective_delta_stop_strategy(level.minDelta, level.maxIterations), monitor),
+			                                   [&leastSquaresProblem](long index, const BundleAdjustment::ColumnVector& x)
+			                                   {
+			                                       return leastSquaresProblem.residual(index, x);
+			                                   },
+			                                   [&leastSquaresProblem](long index, const BundleAdjustment::ColumnVector& x)
+			                                   {
+			                                       return leastSquaresProblem.residualDerivative(index, x);
+			                                   },
+			                                   leastSquaresProblem.residualIndices(),
+			                                   parameters,
+			                                   1.0);
+		}
+		else
+		{
+			const BundleAdjustment problem(renderer, cache, monitor);
+
+			// Warm start from the result of the previous level, the poses of the gradient are evaluated in one batch
+			objective = find_max(bfgs_search_strategy(),
+			                     budgetStopStrategy(objective_delta_stop_strategy(level.minDelta, level.maxIterations), monitor),
+			                     problem,
+			                     [&problem, &level](const BundleAdjustment::ColumnVector& x) { return problem.gradient(x, level.derivativeEps); },
+			                     parameters,
+			                     1.0);
+		}
+
+		if (monitor)
+		{
+			// The best evaluation may be a probe of a line search or of the finite differences
+			if (monitor->hasBest())
+			{
+				parameters = monitor->bestParameters();
+			}
+
+			// No additional render under a budget, the value is the one of the objective of the level
+			qDebug() << "Pyramid level 1 /" << level.downscale
+			         << (level.silhouetteOnly ? "silhouette" : "textured")
+			         << "objective =" << monitor->bestValue()
+			         << "after" << monitor->evaluations() << "evaluations and" << monitor->elapsed() << "ms";
+		}
+		else
+		{
+			qDebug() << "Pyramid level 1 /" << level.downscale
+			         << (level.silhouetteOnly ? "silhouette" : "textured")
+			         << "objective =" << objective;
+		}
+
+		if (cache)
+		{
+			qDebug() << "Evaluation cache:" << cache->hits() - previousHits << "hits,"
+			         << cache->misses() - previousMisses << "misses";
+		}
+	}
+
+	if (cache && cache->isPersistent())
+	{
+		cache->save();
+	}
+
+	renderer->setWorkingResolution(previousResolution);
+	renderer->setSilhouetteOnly(previousSilhouetteOnly);
+	renderer->setLevelOfDetailTolerance(previousLevelOfDetailTolerance);
+
+	return BundleAdjustment::parametersToObjectPose(parameters);
+}
+
+RefinementResult runBundleAdjustmentWithBudget(
+	Renderer* renderer,
+	const QImage& targetImage,
+	const ObjectPose& pose,
+	const RefinementBudget& budget,
+	const std::vector<PyramidLevel>& levels,
+	DifferentiableRenderer* differentiableRenderer,
+	EvaluationCache* cache)
+{
+	RefinementMonitor monitor(budget);
+
+	RefinementResult result;
+	result.pose = runBundleAdjustmentPyramid(renderer, targetImage, pose, levels, differentiableRenderer, cache, &monitor);
+	result.status = monitor.status();
+	result.evaluations = monitor.evaluations();
+	result.elapsed = monitor.elapsed();
+
+	return result;
+}
@@ -1,9 +1,15 @@
 #pragma once
 
+#include <vector>
+
 #include <dlib/matrix/matrix.h>
 
+#include "DifferentiableRenderer.h"
+#include "EvaluationCache.h"
 #include "ObjectPose.h"
-#include "ViewerWidget.h"
+#include "RefinementMonitor.h"
+#include "Renderer.h"
+#include "TargetDescriptor.h"
 
 class BundleAdjustment
 {
@@ -13,23 +19,414 @@ public:
 	 */
 	using ColumnVector = dlib::matrix<double, 0, 1>;
 
-	BundleAdjustment(ViewerWidget* viewerWidget);
+	/**
+	 * \brief Create the objective function of a renderer, with the settings it has now
+	 * \param renderer Backend used to render poses
+	 * \param cache Values already computed for the target of the renderer, or nullptr
+	 * \param monitor Records the evaluations and stops rendering when its budget is exhausted, or nullptr
+	 */
+	BundleAdjustment(Renderer* renderer, EvaluationCache* cache = nullptr, RefinementMonitor* monitor = nullptr);
 
 	/**
-	 * \brief Compute the value of the objective function
+	 * \brief Compute the value of the objective function, or find it in the cache
 	 * \return The value of the objective function
 	 */
 	double operator()(const ColumnVector& parameters) const;
 
+	/**
+	 * \brief Approximate the gradient of the objective function with central differences
+	 *
+	 * The two poses of each parameter are rendered and compared in a single batch,
+	 * except the poses whose value is in the cache.
+	 * \param parameters Point at which the gradient is approximated
+	 * \param eps Step of the finite differences
+	 * \return The gradient of the objective function
+	 */
+	ColumnVector gradient(const ColumnVector& parameters, double eps) const;
+
 	static ColumnVector objectPoseToParameters(const ObjectPose& pose);
 
 	static ObjectPose parametersToObjectPose(const ColumnVector& parameters);
 	
 private:
 
-	ViewerWidget* m_viewerWidget;
+	Renderer* m_renderer;
+
+	EvaluationCache* m_cache;
+	RefinementMonitor* m_monitor;
+
+	// Hash of the settings of the renderer, part of the keys of the cache
+	quint64 m_settings;
+};
+
+/**
+ * \brief Objective of the soft silhouettes, with its analytic gradient
+ *
+ * The value and the gradient come from the same pass of the renderer, and dlib asks for both
+ * at the same parameters, so the last evaluation is kept.
+ */
+class DifferentiableBundleAdjustment
+{
+public:
+
+	using ColumnVector = BundleAdjustment::ColumnVector;
+
+	DifferentiableBundleAdjustment(DifferentiableRenderer* renderer, RefinementMonitor* monitor = nullptr);
+
+	/**
+	 * \brief Compute the soft Dice coefficient of the silhouettes
+	 */
+	double operator()(const ColumnVector& parameters) const;
+
+	/**
+	 * \brief Compute the gradient of the soft Dice coefficient with respect to the parameters
+	 */
+	ColumnVector gradient(const ColumnVector& parameters) const;
+
+private:
+
+	/**
+	 * \brief Evaluate the renderer, unless the parameters are the same as the last time
+	 */
+	void evaluate(const ColumnVector& parameters) const;
+
+	DifferentiableRenderer* m_renderer;
+	RefinementMonitor* m_monitor;
+
+	mutable ColumnVector m_parameters;
+	mutable double m_value;
+	mutable ColumnVector m_gradient;
+};
+
+/**
+ * \brief Least squares formulation of the refinement, on residuals of tiles
+ *
+ * The silhouettes and the intensities of a pose are compared to the target on small tiles
+ * (see computeTileResiduals()), so that the optimization sees where they differ instead of a single
+ * scalar, and Levenberg-Marquardt converges in a few iterations. dlib asks for the residuals and their
+ * derivatives one at a time: they are computed for all the tiles at once and kept for the last parameters.
+ */
+class LeastSquaresBundleAdjustment
+{
+public:
+
+	using ColumnVector = BundleAdjustment::ColumnVector;
+
+	/**
+	 * \brief Create the residuals of a renderer, with the settings it has now
+	 * \param renderer Backend used to render poses
+	 * \param targetImage Target image, at any resolution
+	 * \param tileSize Size of the tiles in pixels of the working resolution
+	 * \param eps Step of the central differences of the Jacobian
+	 * \param monitor Records the evaluations, with minus the sum of the squares as value, or nullptr
+	 */
+	LeastSquaresBundleAdjustment(Renderer* renderer,
+	                             const QImage& targetImage,
+	                             int tileSize,
+	                             double eps,
+	                             RefinementMonitor* monitor = nullptr);
+
+	/**
+	 * \brief Indices of the residuals, the list of samples given to dlib
+	 */
+	const std::vector<long>& residualIndices() const { return m_residualIndices; }
+
+	/**
+	 * \brief Compute a residual, scaled so that the sum of their squares is a mean over the tiles
+	 */
+	double residual(long index, const ColumnVector& parameters) const;
+
+	/**
+	 * \brief Compute the derivatives of a residual with respect to the parameters
+	 */
+	ColumnVector residualDerivative(long index, const ColumnVector& parameters) const;
+
+private:
+
+	/**
+	 * \brief Render the residuals, unless the parameters are the same as the last time
+	 */
+	void evaluateResiduals(const ColumnVector& parameters) const;
+
+	/**
+	 * \brief Render the central differences of all the parameters in one batch, unless the parameters
+	 *        are the same as the last time, with the residuals if they are not known yet
+	 */
+	void evaluateJacobian(const ColumnVector& parameters) const;
+
+	std::vector<float> residuals(const QImage& image) const;
+
+	/**
+	 * \brief Record an evaluation in the monitor, with minus the sum of the squares of the scaled residuals
+	 */
+	void record(const ColumnVector& parameters, const std::vector<float>& residuals) const;
+
+	Renderer* m_renderer;
+	TargetDescriptor m_target;
+	int m_tileSize;
+	double m_eps;
+	bool m_silhouetteOnly;
+	RefinementMonitor* m_monitor;
+
+	// Makes the sum of the squares a mean over the tiles
+	double m_scale;
+
+	std::vector<long> m_residualIndices;
+
+	mutable ColumnVector m_residualParameters;
+	mutable std::vector<float> m_residuals;
+
+	// Derivatives of each residual with respect to the 6 parameters, one row per residual
+	mutable ColumnVector m_jacobianParameters;
+	mutable std::vector<double> m_jacobian;
 };
 
-ObjectPose runBundleAdjustment(ViewerWidget* viewerWidget,
+ObjectPose runBundleAdjustment(Renderer* renderer,
 	                           const QImage& targetImage,
 	                           const ObjectPose& pose);
+
+/**
+ * \brief Parameters of the simultaneous perturbation stochastic approximation
+ *
+ * The gains follow Spall's recommendations: a_k = a / (k + 1 + A)^alpha and c_k = c / (k + 1)^gamma.
+ */
+struct SpsaSettings
+{
+	unsigned long iterations = 400;
+
+	/**
+	 * \brief Scale of the steps, in normalized parameters per unit of similarity gradient
+	 */
+	double a = 0.05;
+
+	/**
+	 * \brief Amplitude of the perturbations, in normalized parameters
+	 */
+	double c = 2e-2;
+
+	/**
+	 * \brief Stability constant A, about 10% of the iterations
+	 */
+	double stabilityConstant = 40.0;
+
+	double alpha = 0.602;
+	double gamma = 0.101;
+
+	/**
+	 * \brief Distance in pixels between the samples of the first iterations, decreases with the steps
+	 */
+	int initialSampleSpacing = 8;
+
+	unsigned int seed = 0;
+};
+
+/**
+ * \brief Refine the pose with simultaneous perturbation stochastic approximation
+ *
+ * The gradient is estimated from two evaluations, at the pose moved by a random perturbation
+ * of all the parameters in both directions, whatever the number of parameters. The evaluations only
+ * compare a stratified random sample of the pixels, which becomes denser as the steps shrink:
+ * iterations are cheap and noisy, the decreasing steps average the noise out.
+ * The renderer keeps its working resolution and silhouette mode.
+ *
+ * Source: Spall, J. C. (1998). Implementation of the simultaneous perturbation algorithm for stochastic
+ * optimization. IEEE Transactions on Aerospace and Electronic Systems, 34(3), 817-823.
+ * \param renderer Backend used to render poses
+ * \param targetImage Target image at full resolution
+ * \param pose Initial pose
+ * \param settings Gains and sampling of the iterations
+ * \return The refined pose
+ */
+ObjectPose runBundleAdjustmentSpsa(Renderer* renderer,
+	                               const QImage& targetImage,
+	                               const ObjectPose& pose,
+	                               const SpsaSettings& settings = SpsaSettings());
+
+/**
+ * \brief Parameters of the CMA-ES search around an initial pose
+ */
+struct CmaEsSettings
+{
+	/**
+	 * \brief Half width of the searched box around the initial pose, as a fraction of ObjectPose::TranslationRange
+	 */
+	double translationNeighborhood = 0.25;
+
+	/**
+	 * \brief Half width of the searched box around the initial pose, as a fraction of ObjectPose::RotationRange
+	 */
+	double rotationNeighborhood = 0.4;
+
+	/**
+	 * \brief Number of poses of each generation, evaluated in one batch
+	 */
+	int populationSize = 32;
+
+	/**
+	 * \brief Maximum number of evaluations of the search, without the polish
+	 */
+	int evaluationBudget = 1600;
+
+	/**
+	 * \brief Initial step size, as a fraction of the width of the box
+	 */
+	double initialStepSize = 0.3;
+
+	/**
+	 * \brief Stop when the steps are smaller than this fraction of the box
+	 */
+	double stepTolerance = 1e-3;
+
+	/**
+	 * \brief Maximum number of iterations of the final BFGS polish, 0 to skip it
+	 */
+	unsigned long polishIterations = 20;
+
+	/**
+	 * \brief Step of the finite differences of the polish
+	 */
+	double polishDerivativeEps = 1e-2;
+
+	unsigned int seed = 0;
+};
+
+/**
+ * \brief Search the pose with CMA-ES in a box around the initial pose, then polish it with BFGS
+ *
+ * The covariance matrix adaptation evolution strategy samples a population of poses from a normal
+ * distribution, and moves and shapes the distribution towards the best of them. Being global in the box,
+ * it escapes the local optima in which BFGS stops when the initial pose is far from the solution.
+ * Each generation is evaluated in one batch, which EvaluationContextPool spreads over its contexts.
+ * Samples outside of the box are evaluated on its border, with a penalty growing with the distance.
+ * The renderer keeps its working resolution and silhouette mode.
+ *
+ * Source: Hansen, N. (2016). The CMA evolution strategy: A tutorial. arXiv preprint arXiv:1604.00772.
+ * \param renderer Backend used to render poses
+ * \param targetImage Target image at full resolution
+ * \param pose Initial pose, center of the searched box
+ * \param settings Box, population and budget of the search
+ * \return The best pose found
+ */
+ObjectPose runBundleAdjustmentCmaEs(Renderer* renderer,
+	                                const QImage& targetImage,
+	                                const ObjectPose& pose,
+	                                const CmaEsSettings& settings = CmaEsSettings());
+
+/**
+ * \brief Parameters of one level of the coarse-to-fine refinement
+ */
+struct PyramidLevel
+{
+	/**
+	 * \brief The target image and the frame buffer are downscaled by this factor
+	 */
+	int downscale;
+
+	/**
+	 * \brief Stop when the objective improves less than this value in one iteration
+	 */
+	double minDelta;
+
+	/**
+	 * \brief Maximum number of iterations, 0 for no limit
+	 */
+	unsigned long maxIterations;
+
+	/**
+	 * \brief Step used to approximate derivatives with finite differences
+	 */
+	double derivativeEps;
+
+	/**
+	 * \brief Only compare the silhouettes, without texture and mean absolute error
+	 */
+	bool silhouetteOnly;
+
+	/**
+	 * \brief Error in pixels accepted when selecting the level of detail of the mesh
+	 */
+	float levelOfDetailTolerance;
+
+	/**
+	 * \brief Use the analytic gradient of the soft silhouettes instead of finite differences,
+	 *        only for silhouette levels and if a differentiable renderer is given
+	 */
+	bool analyticGradient;
+
+	/**
+	 * \brief Size in pixels of the tiles of the residuals of Levenberg-Marquardt,
+	 *        or 0 to maximize the similarity with BFGS
+	 */
+	int residualTileSize;
+};
+
+/**
+ * \brief Default pyramid: silhouettes at 1/8 and 1/4, then textured at 1/2 and full resolution
+ *        with Levenberg-Marquardt
+ */
+std::vector<PyramidLevel> defaultPyramidLevels();
+
+/**
+ * \brief Refine the pose from coarse to fine resolutions
+ *
+ * Each level is optimized with a frame buffer of the size of the downscaled target,
+ * and starts from the pose found at the previous level. Coarse levels can compare only
+ * the silhouettes, the texture is only needed close to the optimum.
+ * Silhouette levels can follow the analytic gradient of the soft silhouettes, which costs one
+ * evaluation instead of twelve renderings for the finite differences. Levels with residual tiles
+ * solve the least squares problem of LeastSquaresBundleAdjustment instead.
+ * \param renderer Backend used to render poses
+ * \param targetImage Target image at full resolution
+ * \param pose Initial pose
+ * \param levels Levels of the pyramid, from the coarsest to the finest
+ * \param differentiableRenderer Renderer of the soft silhouettes for the levels with an analytic gradient,
+ *        or nullptr to always use finite differences
+ * \param cache Values of the objective function reused between evaluations and runs, or nullptr
+ * \param monitor Budget shared between the levels, each level continues from the best pose evaluated
+ *        at the previous one, or nullptr for no limit
+ * \return The refined pose
+ */
+ObjectPose runBundleAdjustmentPyramid(Renderer* renderer,
+	                                  const QImage& targetImage,
+	                                  const ObjectPose& pose,
+	                                  const std::vector<PyramidLevel>& levels = defaultPyramidLevels(),
+	                                  DifferentiableRenderer* differentiableRenderer = nullptr,
+	                                  EvaluationCache* cache = nullptr,
+	                                  RefinementMonitor* monitor = nullptr);
+
+/**
+ * \brief Result of a refinement with a budget
+ */
+struct RefinementResult
+{
+	/**
+	 * \brief Best pose evaluated at the last level reached
+	 */
+	ObjectPose pose;
+
+	RefinementStatus status;
+
+	long evaluations;
+
+	/**
+	 * \brief Wall-clock time of the refinement in milliseconds
+	 */
+	qint64 elapsed;
+};
+
+/**
+ * \brief Refine the pose from coarse to fine resolutions within a time or evaluation budget
+ *
+ * Each level of the pyramid gets an equal share of what remains of the budget when it starts.
+ * When a level runs out of budget, the best pose it has evaluated, line search probes included,
+ * is passed to the next level, and the refinement returns when the whole budget is spent.
+ * \param budget Time and evaluation limits of the whole refinement
+ * \see runBundleAdjustmentPyramid() for the other parameters
+ */
+RefinementResult runBundleAdjustmentWithBudget(Renderer* renderer,
+	                                           const QImage& targetImage,
+	                                           const ObjectPose& pose,
+	                                           const RefinementBudget& budget,
+	                                           const std::vector<PyramidLevel>& levels = defaultPyramidLevels(),
+	                                           DifferentiableRenderer* differentiableRenderer = nullptr,
+	                                           EvaluationCache* cache = nullptr);
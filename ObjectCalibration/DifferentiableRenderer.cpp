@@ -0,0 +1,647 @@
+#include "DifferentiableRenderer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+#include <QtMath>
+#include <QVector4D>
+
+#include "Renderer.h"
+
+namespace
+{
+	// Beyond this value of d^2 / softness^2, a triangle covers a pixel with a probability
+	// smaller than 1e-5 outside, or greater than 1 - 1e-5 inside
+	constexpr double Cutoff = 11.5;
+
+	// Pixels with a smaller log transparency are considered opaque, covering them with
+	// more triangles or moving a triangle changes their coverage by less than 1e-7
+	constexpr float OpaqueLogTransparency = -16.0f;
+
+	/**
+	 * \brief Row-major 3x3 matrix
+	 */
+	struct Matrix3
+	{
+		double m[3][3];
+	};
+
+	Matrix3 multiply(const Matrix3& a, const Matrix3& b)
+	{
+		Matrix3 result;
+
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				result.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j];
+			}
+		}
+
+		return result;
+	}
+
+	/**
+	 * \brief Rotation around an axis and its derivative with respect to the angle
+	 * \param axis 0, 1 or 2 for x, y or z
+	 * \param angle Angle in radians
+	 * \param rotation The rotation matrix
+	 * \param derivative Its derivative
+	 */
+	void axisRotation(int axis, double angle, Matrix3& rotation, Matrix3& derivative)
+	{
+		const double c = std::cos(angle);
+		const double s = std::sin(angle);
+
+		// Indices of the two other axes, in the direction of the rotation
+		const int u = (axis + 1) % 3;
+		const int v = (axis + 2) % 3;
+
+		rotation = {};
+		derivative = {};
+
+		rotation.m[axis][axis] = 1.0;
+		rotation.m[u][u] = c;
+		rotation.m[u][v] = -s;
+		rotation.m[v][u] = s;
+		rotation.m[v][v] = c;
+
+		derivative.m[u][u] = -s;
+		derivative.m[u][v] = -c;
+		derivative.m[v][u] = c;
+		derivative.m[v][v] = -s;
+	}
+
+	/**
+	 * \brief Closest point of a segment to a point
+	 * \return The position of the closest point on the segment, between 0 (a) and 1 (b)
+	 */
+	double closestOnSegment(double px, double py, double ax, double ay, double bx, double by)
+	{
+		const double ex = bx - ax;
+		const double ey = by - ay;
+		const double lengthSquared = ex * ex + ey * ey;
+
+		if (lengthSquared <= 0.0)
+		{
+			return 0.0;
+		}
+
+		return std::min(1.0, std::max(0.0, ((px - ax) * ex + (py - ay) * ey) / lengthSquared));
+	}
+
+	/**
+	 * \brief Signed squared distance from a pixel to a triangle, and the closest edge
+	 *
+	 * Inside the triangle, the closest point of the boundary is the projection on the closest line.
+	 * Outside, the distance to the lines of the edges the pixel is outside of is a lower bound,
+	 * so the distances to the segments are only computed close to the triangle.
+	 * \param triangle Vertices and edge lines of the triangle
+	 * \param px Position of the pixel
+	 * \param py Position of the pixel
+	 * \param limit Squared distance outside of the triangle beyond which the result is only a bound
+	 * \param edge Index of the first vertex of the closest edge
+	 * \param t Position of the closest point on the edge
+	 * \return d^2 inside the triangle, -d^2 outside
+	 */
+	template <typename Triangle>
+	double signedDistanceSquared(const Triangle& triangle, double px, double py, double limit, int& edge, double& t)
+	{
+		double lineDistances[3];
+		for (int i = 0; i < 3; i++)
+		{
+			lineDistances[i] = triangle.edges[i][0] * px + triangle.edges[i][1] * py + triangle.edges[i][2];
+		}
+
+		const int closest = int(std::min_element(lineDistances, lineDistances + 3) - lineDistances);
+
+		if (lineDistances[closest] >= 0.0)
+		{
+			const int j = (closest + 1) % 3;
+
+			edge = closest;
+			t = closestOnSegment(px, py, triangle.x[closest], triangle.y[closest], triangle.x[j], triangle.y[j]);
+
+			return lineDistances[closest] * lineDistances[closest];
+		}
+
+		const double lowerBound = -lineDistances[closest];
+
+		if (lowerBound * lowerBound > limit)
+		{
+			return -lowerBound * lowerBound;
+		}
+
+		double minDistanceSquared = std::numeric_limits<double>::max();
+
+		for (int i = 0; i < 3; i++)
+		{
+			const int j = (i + 1) % 3;
+			const double ax = triangle.x[i];
+			const double ay = triangle.y[i];
+			const double bx = triangle.x[j];
+			const double by = triangle.y[j];
+
+			const double s = closestOnSegment(px, py, ax, ay, bx, by);
+			const double dx = px - (ax + s * (bx - ax));
+			const double dy = py - (ay + s * (by - ay));
+			const double distanceSquared = dx * dx + dy * dy;
+
+			if (distanceSquared < minDistanceSquared)
+			{
+				minDistanceSquared = distanceSquared;
+				edge = i;
+				t = s;
+			}
+		}
+
+		return -minDistanceSquared;
+	}
+}
+
+DifferentiableRenderer::DifferentiableRenderer(const Mesh& object, const QMatrix4x4& objectMatrix) :
+	m_object(object),
+	m_objectMatrix(objectMatrix),
+	m_softness(1.0f),
+	m_levelOfDetailTolerance(1.0f),
+	m_tilesX(0),
+	m_tilesY(0)
+{
+	updateTarget();
+}
+
+void DifferentiableRenderer::setTargetImage(const QImage& targetImage)
+{
+	m_targetImage = targetImage;
+
+	updateTarget();
+}
+
+void DifferentiableRenderer::setWorkingResolution(const QSize& size)
+{
+	m_workingResolution = size;
+
+	updateTarget();
+}
+
+QSize DifferentiableRenderer::workingResolution() const
+{
+	return m_workingResolution;
+}
+
+void DifferentiableRenderer::setSoftness(float pixels)
+{
+	m_softness = pixels;
+}
+
+float DifferentiableRenderer::softness() const
+{
+	return m_softness;
+}
+
+void DifferentiableRenderer::setLevelOfDetailTolerance(float pixels)
+{
+	m_levelOfDetailTolerance = pixels;
+}
+
+float DifferentiableRenderer::levelOfDetailTolerance() const
+{
+	return m_levelOfDetailTolerance;
+}
+
+double DifferentiableRenderer::evaluate(const ObjectPose& pose, double gradient[6])
+{
+	assert(!m_target.isEmpty());
+
+	std::fill(gradient, gradient + 6, 0.0);
+
+	const double targetSum = m_target.alphaSum() / 255.0;
+
+	if (!setupTriangles(pose))
+	{
+		return 0.0;
+	}
+
+	// Soft coverage of the pixels
+	double intersection = 0.0;
+	double coverage = 0.0;
+
+	#pragma omp parallel for schedule(dynamic) reduction(+: intersection, coverage)
+	for (int tile = 0; tile < m_tilesX * m_tilesY; tile++)
+	{
+		rasterizeTile(tile, intersection, coverage);
+	}
+
+	const double denominator = coverage + targetSum;
+
+	if (denominator <= 0.0)
+	{
+		return 0.0;
+	}
+
+	const double dice = 2.0 * intersection / denominator;
+
+	// Derivatives of the Dice coefficient with respect to the coverage of each pixel,
+	// then to the vertices and to the pose
+	double g0 = 0.0;
+	double g1 = 0.0;
+	double g2 = 0.0;
+	double g3 = 0.0;
+	double g4 = 0.0;
+	double g5 = 0.0;
+
+	#pragma omp parallel for schedule(dynamic) reduction(+: g0, g1, g2, g3, g4, g5)
+	for (int tile = 0; tile < m_tilesX * m_tilesY; tile++)
+	{
+		double tileGradient[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+		differentiateTile(tile, dice, denominator, tileGradient);
+
+		g0 += tileGradient[0];
+		g1 += tileGradient[1];
+		g2 += tileGradient[2];
+		g3 += tileGradient[3];
+		g4 += tileGradient[4];
+		g5 += tileGradient[5];
+	}
+
+	gradient[0] = g0;
+	gradient[1] = g1;
+	gradient[2] = g2;
+	gradient[3] = g3;
+	gradient[4] = g4;
+	gradient[5] = g5;
+
+	return dice;
+}
+
+bool DifferentiableRenderer::setupTriangles(const ObjectPose& pose)
+{
+	const int width = m_size.width();
+	const int height = m_size.height();
+
+	const auto camera = evaluationCamera(float(width) / float(height));
+	const QMatrix4x4 pvMatrix = camera.projectionMatrix() * camera.viewMatrix();
+	const auto pvmMatrix = pvMatrix * objectWorldMatrix(pose, m_objectMatrix);
+
+	// Same rotation as QQuaternion::fromEulerAngles(): roll around z, then pitch around x, then yaw around y
+	Matrix3 rotations[3];
+	Matrix3 derivatives[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		axisRotation(axis, qDegreesToRadians(double(pose.rotation[axis])), rotations[axis], derivatives[axis]);
+	}
+
+	const Matrix3 rotationDerivatives[3] = {
+		multiply(multiply(rotations[1], derivatives[0]), rotations[2]),
+		multiply(multiply(derivatives[1], rotations[0]), rotations[2]),
+		multiply(multiply(rotations[1], rotations[0]), derivatives[2])
+	};
+
+	// Chain rule from the degrees to the normalized parameters
+	const double rotationScales[3] = {
+		qDegreesToRadians(double(ObjectPose::RotationRange.x())),
+		qDegreesToRadians(double(ObjectPose::RotationRange.y())),
+		qDegreesToRadians(double(ObjectPose::RotationRange.z()))
+	};
+
+	const auto& vertices = m_object.vertices();
+	const int vertexCount = int(vertices.size());
+
+	std::vector<QVector4D> clipPositions(vertexCount);
+	m_vertexJacobians.resize(std::size_t(vertexCount) * 12);
+
+	#pragma omp parallel for
+	for (int i = 0; i < vertexCount; i++)
+	{
+		const auto clip = pvmMatrix * QVector4D(vertices[i], 1.0f);
+		clipPositions[i] = clip;
+
+		// Position in the frame of the object, before its rotation
+		const auto objectPosition = m_objectMatrix * QVector4D(vertices[i], 1.0f);
+		const double position[3] = { objectPosition.x(), objectPosition.y(), objectPosition.z() };
+
+		// Derivatives of the window coordinates with respect to the world position
+		const double w = clip.w();
+		double windowDerivatives[2][3];
+		for (int k = 0; k < 3; k++)
+		{
+			windowDerivatives[0][k] = 0.5 * width * (pvMatrix(0, k) * w - clip.x() * pvMatrix(3, k)) / (w * w);
+			windowDerivatives[1][k] = 0.5 * height * (pvMatrix(1, k) * w - clip.y() * pvMatrix(3, k)) / (w * w);
+		}
+
+		double* jacobian = m_vertexJacobians.data() + std::size_t(i) * 12;
+
+		for (int row = 0; row < 2; row++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				// Translation: the world position moves with the translation
+				jacobian[6 * row + k] = windowDerivatives[row][k] * ObjectPose::TranslationRange[k];
+
+				// Rotation: the world position moves with the rotated position in the object frame
+				const auto& derivative = rotationDerivatives[k].m;
+				double sum = 0.0;
+				for (int j = 0; j < 3; j++)
+				{
+					const double worldDerivative = derivative[j][0] * position[0] + derivative[j][1] * position[1] + derivative[j][2] * position[2];
+					sum += windowDerivatives[row][j] * worldDerivative;
+				}
+
+				jacobian[6 * row + 3 + k] = sum * rotationScales[k];
+			}
+		}
+	}
+
+	// Coarsest level of detail within the tolerance at the working resolution
+	const QRect viewport(0, 0, width, height);
+	const auto level = m_object.selectLevelOfDetail(pvmMatrix, viewport, m_levelOfDetailTolerance);
+	const auto& levelOfDetail = m_object.levelsOfDetail()[level];
+	const auto indices = m_object.levelOfDetailIndexData() + levelOfDetail.firstIndex;
+
+	// Pixels further than this from a triangle are not covered by it
+	const int margin = int(std::ceil(std::sqrt(Cutoff) * m_softness)) + 1;
+	const float nearPlane = camera.nearPlane();
+
+	m_triangles.clear();
+	for (auto& tileTriangles : m_tileTriangles)
+	{
+		tileTriangles.clear();
+	}
+
+	for (std::size_t t = 0; t < levelOfDetail.indexCount / 3; t++)
+	{
+		ScreenTriangle triangle;
+		bool visible = true;
+
+		for (int k = 0; k < 3; k++)
+		{
+			const auto vertex = indices[3 * t + k];
+			const auto& clip = clipPositions[vertex];
+
+			// Triangles crossing the near plane are not drawn
+			if (clip.w() < nearPlane)
+			{
+				visible = false;
+				break;
+			}
+
+			triangle.vertices[k] = vertex;
+			triangle.x[k] = (0.5 * clip.x() / clip.w() + 0.5) * width;
+			triangle.y[k] = (0.5 * clip.y() / clip.w() + 0.5) * height;
+		}
+
+		if (!visible)
+		{
+			continue;
+		}
+
+		// Degenerate triangles do not cover any pixel
+		const double area = (triangle.x[1] - triangle.x[0]) * (triangle.y[2] - triangle.y[0])
+		                  - (triangle.x[2] - triangle.x[0]) * (triangle.y[1] - triangle.y[0]);
+
+		if (std::abs(area) < 1e-12)
+		{
+			continue;
+		}
+
+		// Lines of the edges, normalized so that the distance is positive inside
+		const double orientation = area > 0.0 ? 1.0 : -1.0;
+		for (int i = 0; i < 3; i++)
+		{
+			const int j = (i + 1) % 3;
+			const double ex = triangle.x[j] - triangle.x[i];
+			const double ey = triangle.y[j] - triangle.y[i];
+			const double scale = orientation / std::sqrt(ex * ex + ey * ey);
+
+			triangle.edges[i][0] = -ey * scale;
+			triangle.edges[i][1] = ex * scale;
+			triangle.edges[i][2] = (ey * triangle.x[i] - ex * triangle.y[i]) * scale;
+		}
+
+		triangle.minX = std::max(0, int(std::floor(std::min({ triangle.x[0], triangle.x[1], triangle.x[2] }))) - margin);
+		triangle.minY = std::max(0, int(std::floor(std::min({ triangle.y[0], triangle.y[1], triangle.y[2] }))) - margin);
+		triangle.maxX = std::min(width - 1, int(std::ceil(std::max({ triangle.x[0], triangle.x[1], triangle.x[2] }))) + margin);
+		triangle.maxY = std::min(height - 1, int(std::ceil(std::max({ triangle.y[0], triangle.y[1], triangle.y[2] }))) + margin);
+
+		if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+		{
+			continue;
+		}
+
+		const int index = int(m_triangles.size());
+		m_triangles.push_back(triangle);
+
+		for (int tileY = triangle.minY / TileSize; tileY <= triangle.maxY / TileSize; tileY++)
+		{
+			for (int tileX = triangle.minX / TileSize; tileX <= triangle.maxX / TileSize; tileX++)
+			{
+				m_tileTriangles[std::size_t(tileY) * m_tilesX + tileX].push_back(index);
+			}
+		}
+	}
+
+	return !m_triangles.empty();
+}
+
+QRect DifferentiableRenderer::tileRect(int tile) const
+{
+	const QRect rect((tile % m_tilesX) * TileSize, (tile / m_tilesX) * TileSize, TileSize, TileSize);
+
+	return rect.intersected(QRect(QPoint(0, 0), m_size));
+}
+
+void DifferentiableRenderer::rasterizeTile(int tile, double& intersection, double& coverage)
+{
+	const auto& tileTriangles = m_tileTriangles[tile];
+
+	if (tileTriangles.empty())
+	{
+		return;
+	}
+
+	const auto rect = tileRect(tile);
+	const int width = m_size.width();
+	const int height = m_size.height();
+	const double inverseSoftness = 1.0 / (double(m_softness) * m_softness);
+	const double limit = Cutoff * m_softness * m_softness;
+
+	for (int y = rect.top(); y <= rect.bottom(); y++)
+	{
+		std::fill_n(m_logTransparency.begin() + std::size_t(y) * width + rect.left(), rect.width(), 0.0f);
+	}
+
+	for (const int index : tileTriangles)
+	{
+		const auto& triangle = m_triangles[index];
+
+		const int minX = std::max(triangle.minX, rect.left());
+		const int maxX = std::min(triangle.maxX, rect.right());
+		const int minY = std::max(triangle.minY, rect.top());
+		const int maxY = std::min(triangle.maxY, rect.bottom());
+
+		for (int y = minY; y <= maxY; y++)
+		{
+			float* logTransparency = m_logTransparency.data() + std::size_t(y) * width;
+
+			for (int x = minX; x <= maxX; x++)
+			{
+				// Already opaque
+				if (logTransparency[x] < OpaqueLogTransparency)
+				{
+					continue;
+				}
+
+				int edge;
+				double t;
+				const double z = signedDistanceSquared(triangle, x + 0.5, y + 0.5, limit, edge, t) * inverseSoftness;
+
+				if (z < -Cutoff)
+				{
+					continue;
+				}
+
+				// log(1 - sigmoid(z)), a pixel deep inside the triangle is opaque
+				logTransparency[x] = z > Cutoff ? -std::numeric_limits<float>::infinity()
+				                                : logTransparency[x] - float(std::log1p(std::exp(z)));
+			}
+		}
+	}
+
+	// Rows of the target go from the top to the bottom
+	for (int y = rect.top(); y <= rect.bottom(); y++)
+	{
+		const float* logTransparency = m_logTransparency.data() + std::size_t(y) * width;
+		const uchar* alpha = m_target.alphaRow(height - 1 - y);
+
+		for (int x = rect.left(); x <= rect.right(); x++)
+		{
+			const double pixelCoverage = 1.0 - std::exp(double(logTransparency[x]));
+
+			intersection += pixelCoverage * alpha[x] / 255.0;
+			coverage += pixelCoverage;
+		}
+	}
+}
+
+void DifferentiableRenderer::differentiateTile(int tile, double dice, double denominator, double gradient[6]) const
+{
+	const auto& tileTriangles = m_tileTriangles[tile];
+
+	if (tileTriangles.empty())
+	{
+		return;
+	}
+
+	const auto rect = tileRect(tile);
+	const int width = m_size.width();
+	const int height = m_size.height();
+	const double inverseSoftness = 1.0 / (double(m_softness) * m_softness);
+	const double limit = Cutoff * m_softness * m_softness;
+
+	for (const int index : tileTriangles)
+	{
+		const auto& triangle = m_triangles[index];
+
+		const int minX = std::max(triangle.minX, rect.left());
+		const int maxX = std::min(triangle.maxX, rect.right());
+		const int minY = std::max(triangle.minY, rect.top());
+		const int maxY = std::min(triangle.maxY, rect.bottom());
+
+		// Derivatives of the signed squared distance with respect to the window coordinates of the vertices
+		double vertexGradients[3][2] = {};
+
+		for (int y = minY; y <= maxY; y++)
+		{
+			const float* logTransparency = m_logTransparency.data() + std::size_t(y) * width;
+			const uchar* alpha = m_target.alphaRow(height - 1 - y);
+
+			for (int x = minX; x <= maxX; x++)
+			{
+				// Opaque pixels do not change when a single triangle moves
+				if (logTransparency[x] < OpaqueLogTransparency)
+				{
+					continue;
+				}
+
+				const double transparency = std::exp(double(logTransparency[x]));
+
+				const double px = x + 0.5;
+				const double py = y + 0.5;
+
+				int edge;
+				double t;
+				const double signedSquared = signedDistanceSquared(triangle, px, py, limit, edge, t);
+				const double z = signedSquared * inverseSoftness;
+
+				if (z < -Cutoff || z > Cutoff)
+				{
+					continue;
+				}
+
+				// dDice/dCoverage * dCoverage/dD * dD/dz * dz/d(d^2), with
+				// dCoverage/dD = transparency / (1 - D) and dD/dz = D * (1 - D)
+				const double d = 1.0 / (1.0 + std::exp(-z));
+				const double diceDerivative = (2.0 * alpha[x] / 255.0 - dice) / denominator;
+				const double sign = signedSquared >= 0.0 ? 1.0 : -1.0;
+				const double weight = diceDerivative * transparency * d * sign * inverseSoftness;
+
+				// The squared distance to the closest point q of the edge (a, b) changes with
+				// -2 (1 - t) (p - q) when a moves and -2 t (p - q) when b moves
+				const int a = edge;
+				const int b = (edge + 1) % 3;
+				const double qx = triangle.x[a] + t * (triangle.x[b] - triangle.x[a]);
+				const double qy = triangle.y[a] + t * (triangle.y[b] - triangle.y[a]);
+
+				vertexGradients[a][0] -= weight * 2.0 * (1.0 - t) * (px - qx);
+				vertexGradients[a][1] -= weight * 2.0 * (1.0 - t) * (py - qy);
+				vertexGradients[b][0] -= weight * 2.0 * t * (px - qx);
+				vertexGradients[b][1] -= weight * 2.0 * t * (py - qy);
+			}
+		}
+
+		for (int k = 0; k < 3; k++)
+		{
+			const double* jacobian = m_vertexJacobians.data() + std::size_t(triangle.vertices[k]) * 12;
+
+			for (int parameter = 0; parameter < 6; parameter++)
+			{
+				gradient[parameter] += vertexGradients[k][0] * jacobian[parameter] + vertexGradients[k][1] * jacobian[6 + parameter];
+			}
+		}
+	}
+}
+
+void DifferentiableRenderer::updateTarget()
+{
+	QSize size(4032, 3024);
+
+	if (!m_targetImage.isNull())
+	{
+		size = m_workingResolution.isValid() ? m_workingResolution : m_targetImage.size();
+
+		if (size == m_targetImage.size())
+		{
+			m_target = TargetDescriptor(m_targetImage);
+		}
+		else
+		{
+			m_target = TargetDescriptor(m_targetImage.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+		}
+	}
+	else if (m_workingResolution.isValid())
+	{
+		size = m_workingResolution;
+	}
+
+	if (m_size != size)
+	{
+		m_size = size;
+
+		m_tilesX = (size.width() + TileSize - 1) / TileSize;
+		m_tilesY = (size.height() + TileSize - 1) / TileSize;
+		m_tileTriangles.assign(std::size_t(m_tilesX) * m_tilesY, std::vector<int>());
+		m_logTransparency.assign(std::size_t(size.width()) * size.height(), 0.0f);
+	}
+}
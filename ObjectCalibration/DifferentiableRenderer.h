@@ -0,0 +1,154 @@
+#pragma once
+
+#include <vector>
+
+#include <QImage>
+#include <QMatrix4x4>
+#include <QRect>
+#include <QSize>
+
+#include "Mesh.h"
+#include "ObjectPose.h"
+#include "TargetDescriptor.h"
+
+/**
+ * \brief Soft rasterizer of the silhouette on the CPU, differentiable with respect to the pose
+ *
+ * Each triangle covers a pixel with a probability D = sigmoid(+-d^2 / softness^2), where d is
+ * the distance from the pixel to the edges of the triangle, positive inside. The coverage of a pixel
+ * aggregates the triangles as 1 - prod(1 - D), so it does not depend on their order.
+ * The soft Dice coefficient with the alpha of the target and its gradient with respect
+ * to the 6 parameters of the pose are computed in the same pass over the pixels.
+ *
+ * Source: Liu, S., Li, T., Chen, W., & Li, H. (2019). Soft rasterizer: A differentiable renderer
+ * for image-based 3D reasoning. In Proceedings of the IEEE International Conference on Computer Vision (pp. 7708-7717).
+ */
+class DifferentiableRenderer
+{
+public:
+
+	/**
+	 * \brief Create a renderer for an object
+	 * \param object The mesh of the object
+	 * \param objectMatrix Transformation of the mesh in the frame of the object
+	 */
+	DifferentiableRenderer(const Mesh& object, const QMatrix4x4& objectMatrix);
+
+	/**
+	 * \brief Set the target image, its alpha channel is compared to the soft silhouette
+	 */
+	void setTargetImage(const QImage& targetImage);
+
+	/**
+	 * \brief Set the resolution at which poses are compared to the target
+	 * \param size The working resolution, or an invalid size to use the resolution of the target
+	 */
+	void setWorkingResolution(const QSize& size);
+	QSize workingResolution() const;
+
+	/**
+	 * \brief Set the width of the soft edges
+	 * \param pixels Distance to an edge, in pixels of the working resolution, at which the coverage
+	 *        is sigmoid(1) inside and sigmoid(-1) outside
+	 */
+	void setSoftness(float pixels);
+	float softness() const;
+
+	/**
+	 * \brief Set the error on the screen accepted when selecting the level of detail of the mesh
+	 */
+	void setLevelOfDetailTolerance(float pixels);
+	float levelOfDetailTolerance() const;
+
+	/**
+	 * \brief Compute the soft Dice coefficient of a pose and its gradient
+	 * \param pose The pose of the object
+	 * \param gradient Derivatives with respect to the normalized translation (x, y, z),
+	 *        then the normalized rotation (x, y, z), like the parameters of BundleAdjustment
+	 * \return The soft Dice coefficient between the silhouette and the alpha of the target
+	 */
+	double evaluate(const ObjectPose& pose, double gradient[6]);
+
+private:
+
+	/**
+	 * \brief Size in pixels of the square tiles processed by each thread
+	 */
+	static constexpr int TileSize = 32;
+
+	/**
+	 * \brief Triangle in window coordinates
+	 */
+	struct ScreenTriangle
+	{
+		double x[3];
+		double y[3];
+		unsigned int vertices[3];
+
+		// Lines of the edges (a, b, c), a x + b y + c is the signed distance to the edge, positive inside
+		double edges[3][3];
+
+		// Pixels close enough to be covered, in OpenGL window coordinates
+		int minX;
+		int minY;
+		int maxX;
+		int maxY;
+	};
+
+	/**
+	 * \brief Project the vertices and the triangles of the level of detail, and sort them in tiles
+	 * \param pose The pose of the object
+	 * \return True if at least one triangle is visible
+	 */
+	bool setupTriangles(const ObjectPose& pose);
+
+	/**
+	 * \brief Pixels of a tile, in OpenGL window coordinates
+	 */
+	QRect tileRect(int tile) const;
+
+	/**
+	 * \brief Accumulate the transparency of the triangles on the pixels of a tile
+	 * \param tile Index of the tile
+	 * \param intersection Sum of the coverage times the alpha of the target on the tile
+	 * \param coverage Sum of the coverage on the tile
+	 */
+	void rasterizeTile(int tile, double& intersection, double& coverage);
+
+	/**
+	 * \brief Accumulate the gradient of the soft Dice coefficient on the pixels of a tile
+	 * \param tile Index of the tile
+	 * \param dice Soft Dice coefficient
+	 * \param denominator Sum of the coverage and of the alpha of the target
+	 * \param gradient Gradient with respect to the 6 parameters, incremented
+	 */
+	void differentiateTile(int tile, double dice, double denominator, double gradient[6]) const;
+
+	/**
+	 * \brief Update the descriptor of the target and the tiles at the working resolution
+	 */
+	void updateTarget();
+
+	Mesh m_object;
+	QMatrix4x4 m_objectMatrix;
+
+	QImage m_targetImage;
+	QSize m_workingResolution;
+	TargetDescriptor m_target;
+
+	float m_softness;
+	float m_levelOfDetailTolerance;
+
+	QSize m_size;
+	int m_tilesX;
+	int m_tilesY;
+
+	// Derivatives of the window coordinates of each vertex with respect to the parameters, 2 x 6 per vertex
+	std::vector<double> m_vertexJacobians;
+
+	std::vector<ScreenTriangle> m_triangles;
+	std::vector<std::vector<int>> m_tileTriangles;
+
+	// Sum of log(1 - D) over the triangles, for each pixel in OpenGL order
+	std::vector<float> m_logTransparency;
+};
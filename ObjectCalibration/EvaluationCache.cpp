@@ -0,0 +1,372 @@
+#include "EvaluationCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtDebug>
+
+namespace
+{
+	constexpr char Magic[8] = { 'O', 'C', 'E', 'V', 'A', 'L', '\0', '\0' };
+
+	// Increment when the layout of the file changes
+	constexpr quint32 Version = 1;
+
+	// Increment when the values of the objective function change: shaders, similarity, rasterization...
+	constexpr quint32 ObjectiveVersion = 1;
+
+	constexpr quint64 HashOffset = 14695981039346656037ull;
+	constexpr quint64 HashPrime = 1099511628211ull;
+
+	/**
+	 * \brief Header at the beginning of a cache file, followed by the entries from the least recently used
+	 */
+	struct Header
+	{
+		char magic[8];
+		quint32 version;
+		quint32 reserved;
+		double tolerance;
+		quint64 key;
+		quint64 entryCount;
+	};
+
+	/**
+	 * \brief Entry in the file, with a fixed size
+	 */
+	struct StoredEntry
+	{
+		quint64 settings;
+		qint64 parameters[6];
+		double value;
+	};
+
+	/**
+	 * \brief Continue a 64 bits FNV-1a hash with some bytes
+	 */
+	quint64 hashBytes(const void* data, std::size_t size, quint64 hash = HashOffset)
+	{
+		const auto bytes = static_cast<const unsigned char*>(data);
+
+		for (std::size_t i = 0; i < size; i++)
+		{
+			hash ^= bytes[i];
+			hash *= HashPrime;
+		}
+
+		return hash;
+	}
+}
+
+EvaluationCache::EvaluationCache(double tolerance, std::size_t capacity) :
+	m_tolerance(tolerance),
+	m_capacity(std::max<std::size_t>(1, capacity)),
+	m_persistent(false),
+	m_objectHash(HashOffset),
+	m_targetHash(0),
+	m_hasTarget(false),
+	m_key(0),
+	m_hits(0),
+	m_misses(0)
+{
+
+}
+
+EvaluationCache::~EvaluationCache()
+{
+	if (m_persistent && m_hasTarget)
+	{
+		save();
+	}
+}
+
+void EvaluationCache::setPersistent(bool persistent)
+{
+	if (persistent && !m_persistent && m_hasTarget)
+	{
+		// Values computed before are kept, the file only adds those of previous runs
+		load();
+	}
+
+	m_persistent = persistent;
+}
+
+void EvaluationCache::setObject(const Mesh& object, const QMatrix4x4& objectMatrix)
+{
+	quint64 hash = HashOffset;
+	hash = hashBytes(object.vertices().data(), object.vertices().size() * sizeof(QVector3D), hash);
+	hash = hashBytes(object.uvs().data(), object.uvs().size() * sizeof(QVector3D), hash);
+	hash = hashBytes(object.indices().data(), object.indices().size() * sizeof(unsigned int), hash);
+	hash = hashBytes(objectMatrix.constData(), 16 * sizeof(float), hash);
+
+	if (!object.textureLevels().empty())
+	{
+		const auto textureHash = hashImage(object.textureLevels().front());
+		hash = hashBytes(&textureHash, sizeof(textureHash), hash);
+	}
+
+	if (hash != m_objectHash)
+	{
+		m_objectHash = hash;
+
+		if (m_hasTarget)
+		{
+			selectKey(hashBytes(&m_objectHash, sizeof(m_objectHash), m_targetHash));
+		}
+	}
+}
+
+void EvaluationCache::setTargetImage(const QImage& targetImage)
+{
+	m_targetHash = hashImage(targetImage);
+
+	const auto key = hashBytes(&m_objectHash, sizeof(m_objectHash), m_targetHash);
+
+	if (!m_hasTarget || key != m_key)
+	{
+		selectKey(key);
+	}
+}
+
+bool EvaluationCache::find(quint64 settings, const ColumnVector& parameters, double& value)
+{
+	const auto it = m_index.find(makeKey(settings, parameters));
+
+	if (it == m_index.end())
+	{
+		m_misses++;
+		return false;
+	}
+
+	// Move to the front of the recently used values
+	m_entries.splice(m_entries.begin(), m_entries, it->second);
+
+	value = it->second->value;
+	m_hits++;
+
+	return true;
+}
+
+void EvaluationCache::insert(quint64 settings, const ColumnVector& parameters, double value)
+{
+	insert(makeKey(settings, parameters), value);
+}
+
+void EvaluationCache::insert(const Key& key, double value)
+{
+	const auto it = m_index.find(key);
+
+	if (it != m_index.end())
+	{
+		it->second->value = value;
+		m_entries.splice(m_entries.begin(), m_entries, it->second);
+		return;
+	}
+
+	if (m_entries.size() >= m_capacity)
+	{
+		m_index.erase(m_entries.back().key);
+		m_entries.pop_back();
+	}
+
+	m_entries.push_front({ key, value });
+	m_index.emplace(key, m_entries.begin());
+}
+
+void EvaluationCache::clear()
+{
+	m_entries.clear();
+	m_index.clear();
+}
+
+void EvaluationCache::resetCounters()
+{
+	m_hits = 0;
+	m_misses = 0;
+}
+
+bool EvaluationCache::save() const
+{
+	if (!m_hasTarget)
+	{
+		return false;
+	}
+
+	Header header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = Version;
+	header.tolerance = m_tolerance;
+	header.key = m_key;
+	header.entryCount = m_entries.size();
+
+	// Oldest first, so that loading them in order restores the order of use
+	std::vector<StoredEntry> storedEntries;
+	storedEntries.reserve(m_entries.size());
+
+	for (auto it = m_entries.rbegin(); it != m_entries.rend(); ++it)
+	{
+		StoredEntry storedEntry;
+		storedEntry.settings = it->key.settings;
+		std::copy(it->key.parameters.begin(), it->key.parameters.end(), storedEntry.parameters);
+		storedEntry.value = it->value;
+
+		storedEntries.push_back(storedEntry);
+	}
+
+	const auto filename = cacheFilename(m_key);
+	QDir().mkpath(QFileInfo(filename).absolutePath());
+
+	// The file only replaces a previous cache when it is complete
+	QSaveFile file(filename);
+
+	if (!file.open(QIODevice::WriteOnly))
+	{
+		return false;
+	}
+
+	const qint64 entriesSize = qint64(storedEntries.size() * sizeof(StoredEntry));
+
+	const bool success = file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == qint64(sizeof(header))
+	                  && file.write(reinterpret_cast<const char*>(storedEntries.data()), entriesSize) == entriesSize;
+
+	return success && file.commit();
+}
+
+quint64 EvaluationCache::hashImage(const QImage& image)
+{
+	const qint32 size[2] = { image.width(), image.height() };
+	quint64 hash = hashBytes(size, sizeof(size));
+
+	// Rows are hashed without their padding, in a fixed format
+	const auto converted = image.convertToFormat(QImage::Format_ARGB32);
+
+	for (int y = 0; y < converted.height(); y++)
+	{
+		hash = hashBytes(converted.constScanLine(y), 4 * std::size_t(converted.width()), hash);
+	}
+
+	return hash;
+}
+
+quint64 EvaluationCache::hashSettings(const QSize& workingResolution,
+	                                     int supersampling,
+	                                     bool silhouetteOnly,
+	                                     float levelOfDetailTolerance)
+{
+	const qint32 size[2] = { workingResolution.width(), workingResolution.height() };
+	const qint32 samples = supersampling;
+	const quint8 silhouette = silhouetteOnly ? 1 : 0;
+
+	quint64 hash = hashBytes(&ObjectiveVersion, sizeof(ObjectiveVersion));
+	hash = hashBytes(size, sizeof(size), hash);
+	hash = hashBytes(&samples, sizeof(samples), hash);
+	hash = hashBytes(&silhouette, sizeof(silhouette), hash);
+	hash = hashBytes(&levelOfDetailTolerance, sizeof(levelOfDetailTolerance), hash);
+
+	return hash;
+}
+
+QString EvaluationCache::cacheFilename(quint64 key)
+{
+	const QDir directory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+
+	return directory.filePath(QString("evaluations/%1.cache").arg(key, 16, 16, QChar('0')));
+}
+
+std::size_t EvaluationCache::KeyHash::operator()(const Key& key) const
+{
+	quint64 hash = hashBytes(&key.settings, sizeof(key.settings));
+	hash = hashBytes(key.parameters.data(), sizeof(key.parameters), hash);
+
+	return std::size_t(hash);
+}
+
+EvaluationCache::Key EvaluationCache::makeKey(quint64 settings, const ColumnVector& parameters) const
+{
+	Q_ASSERT(parameters.size() == 6);
+
+	Key key;
+	key.settings = settings;
+
+	for (long i = 0; i < 6; i++)
+	{
+		key.parameters[i] = std::llround(parameters(i) / m_tolerance);
+	}
+
+	return key;
+}
+
+void EvaluationCache::selectKey(quint64 key)
+{
+	if (m_persistent && m_hasTarget)
+	{
+		save();
+	}
+
+	clear();
+
+	m_key = key;
+	m_hasTarget = true;
+
+	if (m_persistent)
+	{
+		load();
+	}
+}
+
+bool EvaluationCache::load()
+{
+	QFile file(cacheFilename(m_key));
+
+	if (!file.open(QIODevice::ReadOnly))
+	{
+		return false;
+	}
+
+	const auto data = file.readAll();
+
+	if (data.size() < qint64(sizeof(Header)))
+	{
+		return false;
+	}
+
+	Header header;
+	std::memcpy(&header, data.constData(), sizeof(header));
+
+	// Values quantized with another tolerance would not be found at the same keys
+	const bool validHeader = std::memcmp(header.magic, Magic, sizeof(Magic)) == 0
+	                      && header.version == Version
+	                      && header.tolerance == m_tolerance
+	                      && header.key == m_key
+	                      && quint64(data.size()) == sizeof(Header) + header.entryCount * sizeof(StoredEntry);
+
+	if (!validHeader)
+	{
+		qWarning() << "Invalid evaluation cache" << file.fileName();
+		return false;
+	}
+
+	const char* storedEntries = data.constData() + sizeof(Header);
+
+	for (quint64 i = 0; i < header.entryCount; i++)
+	{
+		StoredEntry storedEntry;
+		std::memcpy(&storedEntry, storedEntries + i * sizeof(StoredEntry), sizeof(StoredEntry));
+
+		Key key;
+		key.settings = storedEntry.settings;
+		std::copy(storedEntry.parameters, storedEntry.parameters + 6, key.parameters.begin());
+
+		insert(key, storedEntry.value);
+	}
+
+	return true;
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+
+#include <QImage>
+#include <QMatrix4x4>
+#include <QSize>
+#include <QString>
+
+#include <dlib/matrix/matrix.h>
+
+#include "Mesh.h"
+
+/**
+ * \brief Bounded cache of the values of the objective function, keyed by the quantized parameters
+ *
+ * The line search and the finite differences of the optimizations evaluate the same parameters
+ * several times, and so does a refinement run again on the same images. Parameters are rounded
+ * to a multiple of the tolerance, so that nearly identical vectors share a value, and the least
+ * recently used values are dropped beyond the capacity. Values depend on the settings of the renderer
+ * (working resolution, silhouettes only...) which are part of the key, and on the object and the target
+ * image: the cache holds the values of one target at a time, and can keep them on disk for each target.
+ */
+class EvaluationCache
+{
+public:
+
+	using ColumnVector = dlib::matrix<double, 0, 1>;
+
+	/**
+	 * \brief Create an empty cache
+	 * \param tolerance Step of the quantization of the normalized parameters
+	 * \param capacity Maximum number of values
+	 */
+	explicit EvaluationCache(double tolerance = 1e-7, std::size_t capacity = 65536);
+	~EvaluationCache();
+
+	EvaluationCache(const EvaluationCache&) = delete;
+	EvaluationCache& operator=(const EvaluationCache&) = delete;
+
+	double tolerance() const { return m_tolerance; }
+	std::size_t capacity() const { return m_capacity; }
+	std::size_t size() const { return m_entries.size(); }
+
+	/**
+	 * \brief Keep the values of each target image in a file of the cache directory of the application
+	 *
+	 * Off by default: saved values are only valid as long as the objective function computes
+	 * the same values, see hashSettings().
+	 */
+	void setPersistent(bool persistent);
+	bool isPersistent() const { return m_persistent; }
+
+	/**
+	 * \brief Set the object whose poses are evaluated, its geometry and texture are hashed
+	 * \param object The mesh of the object
+	 * \param objectMatrix Transformation of the mesh in the frame of the object
+	 */
+	void setObject(const Mesh& object, const QMatrix4x4& objectMatrix);
+
+	/**
+	 * \brief Select the target to which the cached values belong
+	 *
+	 * Nothing changes if the image is the same as the current target. Otherwise the values of the
+	 * previous target are saved if the cache is persistent, and replaced by the saved values of the new one.
+	 * \param targetImage The target image
+	 */
+	void setTargetImage(const QImage& targetImage);
+
+	/**
+	 * \brief Look for the value of parameters, and count a hit or a miss
+	 * \param settings Hash of the settings of the renderer
+	 * \param parameters The 6 parameters of the pose
+	 * \param value Set to the cached value if there is one
+	 * \return True if the value is in the cache
+	 */
+	bool find(quint64 settings, const ColumnVector& parameters, double& value);
+
+	/**
+	 * \brief Add the value of parameters, dropping the least recently used value if the cache is full
+	 */
+	void insert(quint64 settings, const ColumnVector& parameters, double value);
+
+	void clear();
+
+	quint64 hits() const { return m_hits; }
+	quint64 misses() const { return m_misses; }
+	void resetCounters();
+
+	/**
+	 * \brief Write the values of the current target in its cache file
+	 * \return True if the file has been written
+	 */
+	bool save() const;
+
+	/**
+	 * \brief Hash the size and the pixels of an image (64 bits FNV-1a)
+	 */
+	static quint64 hashImage(const QImage& image);
+
+	/**
+	 * \brief Hash the settings of a renderer on which the objective function depends
+	 *
+	 * The version of the objective function is part of the hash, so that values computed
+	 * by previous versions of the shaders and of the similarity are not reused.
+	 */
+	static quint64 hashSettings(const QSize& workingResolution,
+	                            int supersampling,
+	                            bool silhouetteOnly,
+	                            float levelOfDetailTolerance);
+
+	/**
+	 * \brief Path of the cache file of a target image, in the cache directory of the application
+	 * \param key Hash of the object and of the target image
+	 */
+	static QString cacheFilename(quint64 key);
+
+private:
+
+	struct Key
+	{
+		quint64 settings;
+		std::array<qint64, 6> parameters;
+
+		bool operator==(const Key& other) const
+		{
+			return settings == other.settings && parameters == other.parameters;
+		}
+	};
+
+	struct KeyHash
+	{
+		std::size_t operator()(const Key& key) const;
+	};
+
+	struct Entry
+	{
+		Key key;
+		double value;
+	};
+
+	Key makeKey(quint64 settings, const ColumnVector& parameters) const;
+
+	void insert(const Key& key, double value);
+
+	/**
+	 * \brief Replace the values by those of another object or target, saving the current ones if persistent
+	 */
+	void selectKey(quint64 key);
+
+	/**
+	 * \brief Read the values of the current target from its cache file
+	 */
+	bool load();
+
+	double m_tolerance;
+	std::size_t m_capacity;
+	bool m_persistent;
+
+	quint64 m_objectHash;
+	quint64 m_targetHash;
+
+	// Hash of the object and of the target, names the cache file
+	bool m_hasTarget;
+	quint64 m_key;
+
+	// Most recently used first
+	std::list<Entry> m_entries;
+	std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_index;
+
+	quint64 m_hits;
+	quint64 m_misses;
+};
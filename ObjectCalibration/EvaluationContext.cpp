@@ -0,0 +1,1068 @@
+#include "EvaluationContext.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include <QFile>
+#include <QOpenGLContext>
+#include <QOpenGLPixelTransferOptions>
+
+#include "Similarity.h"
+
+namespace
+{
+	/**
+	 * \brief Partial sums of one workgroup of the similarity compute shader (std430 layout)
+	 */
+	struct SimilarityPartial
+	{
+		GLuint truePositives;
+		GLuint falsePositives;
+		GLuint diceNumerator;
+		GLuint diceDenominator;
+		GLuint meanAbsoluteErrorSum;
+	};
+
+	static_assert(sizeof(SimilarityPartial) == 5 * sizeof(GLuint), "SimilarityPartial must match the layout of the shader");
+
+	/**
+	 * \brief Finish the reduction of the partial sums of the workgroups that compared one image
+	 * \param begin First partial sum
+	 * \param end Past the last partial sum
+	 * \param target Descriptor of the target, for the pixels not covered by the object
+	 * \param silhouetteOnly true if only the silhouettes have been compared
+	 * \return The similarity of the image
+	 */
+	float similarityFromPartials(const SimilarityPartial* begin,
+	                             const SimilarityPartial* end,
+	                             const TargetDescriptor& target,
+	                             bool silhouetteOnly)
+	{
+		// Sum with 64 bits integers
+		SimilarityStatistics statistics;
+		for (auto partial = begin; partial != end; ++partial)
+		{
+			statistics.truePositives += partial->truePositives;
+			statistics.falsePositives += partial->falsePositives;
+			statistics.diceNumerator += partial->diceNumerator;
+			statistics.diceDenominator += partial->diceDenominator;
+			statistics.meanAbsoluteErrorSum += partial->meanAbsoluteErrorSum;
+		}
+
+		// The shader only visits pixels covered by the object, the rest comes from the target descriptor
+		statistics.falseNegatives = target.area() - statistics.truePositives;
+		statistics.diceDenominator += target.alphaSum();
+
+		if (silhouetteOnly)
+		{
+			return silhouetteSimilarityFromStatistics(statistics);
+		}
+
+		return similarityFromStatistics(statistics);
+	}
+
+	/**
+	 * \brief Compile a shader with preprocessor definitions inserted after its #version line
+	 * \param program The program to which the shader is added
+	 * \param type The type of shader
+	 * \param fileName Path of the source of the shader
+	 * \param defines Names of the macros to define
+	 * \return true if the shader has been compiled
+	 */
+	bool addShaderFromSourceFileWithDefines(QOpenGLShaderProgram* program,
+		                                    QOpenGLShader::ShaderType type,
+		                                    const QString& fileName,
+		                                    const QStringList& defines)
+	{
+		QFile file(fileName);
+		if (!file.open(QIODevice::ReadOnly))
+		{
+			qWarning() << "Cannot open shader" << fileName;
+			return false;
+		}
+
+		auto source = file.readAll();
+
+		QByteArray definitions;
+		for (const auto& define : defines)
+		{
+			definitions += "#define " + define.toLatin1() + "\n";
+		}
+
+		// #version must stay the first statement of the shader
+		const auto versionEnd = source.indexOf('\n') + 1;
+		source.insert(versionEnd, definitions);
+
+		return program->addShaderFromSourceCode(type, source);
+	}
+}
+
+EvaluationContext::MeshObjects::MeshObjects() :
+	vbo(QOpenGLBuffer::VertexBuffer),
+	ebo(QOpenGLBuffer::IndexBuffer),
+	texture(QOpenGLTexture::Target2D)
+{
+
+}
+
+EvaluationContext::EvaluationContext(const Mesh& object, const QMatrix4x4& objectMatrix) :
+	m_object(object),
+	m_objectMatrix(objectMatrix),
+	m_camera(evaluationCamera(4.0f / 3.0f)),
+	m_batchFrameBuffer(0),
+	m_batchColorTexture(0),
+	m_batchDepthTexture(0),
+	m_batchColorFormat(GL_RGBA8),
+	m_batchLayers(0),
+	m_batchPoseBuffer(0),
+	m_supersampling(1),
+	m_silhouetteOnly(false),
+	m_levelOfDetailTolerance(0.5f),
+	m_similarityPartialsBuffer(0),
+	m_similarityPartialsCapacity(0),
+	m_targetTexture(QOpenGLTexture::Target2D)
+{
+
+}
+
+EvaluationContext::~EvaluationContext()
+{
+	// The owner of the context must call destroy() while it is current
+	assert(!isInitialized());
+}
+
+void EvaluationContext::initialize(const EvaluationContext* shareMeshObjects)
+{
+	initializeOpenGLFunctions();
+
+	const QString shader_dir = ":/MainWindow/Shaders/";
+
+	// Init shaders
+	m_program = std::make_unique<QOpenGLShaderProgram>();
+	m_program->addShaderFromSourceFile(QOpenGLShader::Vertex, shader_dir + "object_vs.glsl");
+	m_program->addShaderFromSourceFile(QOpenGLShader::Fragment, shader_dir + "object_fs.glsl");
+	m_program->link();
+	m_program->bind();
+
+	// Same vertices without texture for the silhouettes
+	m_silhouetteProgram = std::make_unique<QOpenGLShaderProgram>();
+	m_silhouetteProgram->addShaderFromSourceFile(QOpenGLShader::Vertex, shader_dir + "object_vs.glsl");
+	m_silhouetteProgram->addShaderFromSourceFile(QOpenGLShader::Fragment, shader_dir + "silhouette_fs.glsl");
+	m_silhouetteProgram->link();
+
+	// Until a target is set, render at the resolution of the camera of a Google Pixel 3
+	initializeFrameBuffer(m_target.isEmpty() ? QSize(4032, 3024) : m_target.size());
+
+	// Initialize vertices, unless another context of the share group already did
+	if (shareMeshObjects && shareMeshObjects->m_meshObjects)
+	{
+		m_meshObjects = shareMeshObjects->m_meshObjects;
+	}
+	else
+	{
+		m_meshObjects = std::make_shared<MeshObjects>();
+		initializeVbo();
+		initializeEbo();
+		initializeTexture();
+	}
+
+	initializeTargetTexture();
+	initializeComputeShader();
+	m_readbackRing.initialize(QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_4_3_Core>());
+
+	// Init VAO
+	m_objectVao.create();
+	QOpenGLVertexArrayObject::Binder vaoBinder(&m_objectVao);
+
+	// Configure VBO, integer UV coordinates are normalized by setAttributeBuffer
+	m_meshObjects->vbo.bind();
+	const auto posLoc = 0;
+	const auto uvLoc = 1;
+	const auto layout = vertexLayout(m_object.vertexFormat());
+	const GLenum uvType = m_object.vertexFormat() == VertexFormat::Unorm16Uv ? GL_UNSIGNED_SHORT : GL_FLOAT;
+	m_program->enableAttributeArray(posLoc);
+	m_program->enableAttributeArray(uvLoc);
+	m_program->setAttributeBuffer(posLoc, GL_FLOAT, layout.positionOffset, 3, layout.stride);
+	m_program->setAttributeBuffer(uvLoc, uvType, layout.uvOffset, 2, layout.stride);
+
+	// Configure EBO
+	m_meshObjects->ebo.bind();
+
+	m_program->release();
+}
+
+void EvaluationContext::destroy()
+{
+	if (!isInitialized())
+	{
+		return;
+	}
+
+	m_objectVao.destroy();
+	m_program.reset(nullptr);
+	m_frameBuffer.reset(nullptr);
+	m_resolveFrameBuffers.clear();
+	m_silhouetteFrameBuffer.reset(nullptr);
+	m_silhouetteResolveFrameBuffers.clear();
+	m_readbackRing.destroy();
+	m_computeSimilarityProgram.reset(nullptr);
+	m_batchProgram.reset(nullptr);
+	m_computeSimilarityBatchProgram.reset(nullptr);
+	m_silhouetteProgram.reset(nullptr);
+	m_silhouetteBatchProgram.reset(nullptr);
+	m_computeSilhouetteProgram.reset(nullptr);
+	m_computeSilhouetteBatchProgram.reset(nullptr);
+	m_targetTexture.destroy();
+	destroyBatchFrameBuffer();
+
+	glDeleteBuffers(1, &m_similarityPartialsBuffer);
+	m_similarityPartialsBuffer = 0;
+	m_similarityPartialsCapacity = 0;
+
+	glDeleteBuffers(1, &m_batchPoseBuffer);
+	m_batchPoseBuffer = 0;
+
+	// The last context of the share group frees the mesh
+	if (m_meshObjects.use_count() == 1)
+	{
+		m_meshObjects->vbo.destroy();
+		m_meshObjects->ebo.destroy();
+		m_meshObjects->texture.destroy();
+	}
+
+	m_meshObjects.reset();
+}
+
+void EvaluationContext::setTargetImage(const QImage& targetImage)
+{
+	m_targetImage = targetImage;
+
+	updateTarget();
+}
+
+void EvaluationContext::setWorkingResolution(const QSize& size)
+{
+	m_workingResolution = size;
+
+	updateTarget();
+}
+
+QSize EvaluationContext::workingResolution() const
+{
+	return m_workingResolution;
+}
+
+void EvaluationContext::setSupersampling(int factor)
+{
+	// Samples are averaged by blocks of 2 x 2, the factor must be a power of two
+	m_supersampling = 1;
+	while (2 * m_supersampling <= factor)
+	{
+		m_supersampling *= 2;
+	}
+
+	updateTarget();
+}
+
+int EvaluationContext::supersampling() const
+{
+	return m_supersampling;
+}
+
+void EvaluationContext::setSilhouetteOnly(bool silhouetteOnly)
+{
+	m_silhouetteOnly = silhouetteOnly;
+
+	// Allocate or free the 8 bits frame buffers, at the resolution of the current ones
+	if (isInitialized())
+	{
+		initializeFrameBuffer(comparisonFrameBuffer()->size());
+	}
+}
+
+bool EvaluationContext::silhouetteOnly() const
+{
+	return m_silhouetteOnly;
+}
+
+void EvaluationContext::setLevelOfDetailTolerance(float pixels)
+{
+	m_levelOfDetailTolerance = pixels;
+}
+
+float EvaluationContext::levelOfDetailTolerance() const
+{
+	return m_levelOfDetailTolerance;
+}
+
+void EvaluationContext::updateTarget()
+{
+	if (m_targetImage.isNull())
+	{
+		return;
+	}
+
+	const auto size = m_workingResolution.isValid() ? m_workingResolution : m_targetImage.size();
+
+	if (size == m_targetImage.size())
+	{
+		m_target = TargetDescriptor(m_targetImage);
+	}
+	else
+	{
+		m_target = TargetDescriptor(m_targetImage.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+	}
+
+	// The frame buffers are created with the target when OpenGL is initialized
+	if (!isInitialized())
+	{
+		return;
+	}
+
+	initializeFrameBuffer(size);
+	initializeTargetTexture();
+}
+
+QOpenGLFramebufferObject* EvaluationContext::comparisonFrameBuffer(bool silhouetteOnly) const
+{
+	const auto& resolveFrameBuffers = silhouetteOnly ? m_silhouetteResolveFrameBuffers : m_resolveFrameBuffers;
+
+	if (!resolveFrameBuffers.empty())
+	{
+		return resolveFrameBuffers.back().get();
+	}
+
+	return silhouetteOnly ? m_silhouetteFrameBuffer.get() : m_frameBuffer.get();
+}
+
+void EvaluationContext::moveObject(const ObjectPose& pose)
+{
+	m_objectWorldMatrix = objectWorldMatrix(pose, m_objectMatrix);
+}
+
+QRect EvaluationContext::render(const ObjectPose& pose, bool onlyObjectRegion, bool silhouetteOnly)
+{
+	auto f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_4_3_Core>();
+
+	moveObject(pose);
+
+	// Silhouettes go to their own 8 bits frame buffers
+	const auto& frameBuffer = silhouetteOnly ? m_silhouetteFrameBuffer : m_frameBuffer;
+	const auto& resolveFrameBuffers = silhouetteOnly ? m_silhouetteResolveFrameBuffers : m_resolveFrameBuffers;
+	const auto& program = silhouetteOnly ? m_silhouetteProgram : m_program;
+
+	// Region of the frame buffer in which the object is rendered
+	QRect region;
+	
+	if (frameBuffer)
+	{
+		// Attach the frame buffer and set the resolution of the viewport
+		frameBuffer->bind();
+		glViewport(0, 0, frameBuffer->width(), frameBuffer->height());
+		setupEvaluationCamera(frameBuffer->size());
+
+		// Region at the working resolution
+		region = QRect(QPoint(0, 0), comparisonFrameBuffer(silhouetteOnly)->size());
+	}
+
+	// Setup matrices
+	const auto normalMatrix = m_objectWorldMatrix.normalMatrix();
+	const auto viewMatrix = m_camera.viewMatrix();
+	const auto projectionMatrix = m_camera.projectionMatrix();
+	const auto pvMatrix = projectionMatrix * viewMatrix;
+	const auto pvmMatrix = pvMatrix * m_objectWorldMatrix;
+
+	// Coarsest level of detail within the tolerance at the working resolution
+	const auto level = m_object.selectLevelOfDetail(pvmMatrix, region, m_levelOfDetailTolerance);
+	const auto& levelOfDetail = m_object.levelsOfDetail()[level];
+
+	if (onlyObjectRegion && frameBuffer)
+	{
+		// Restrict clearing and rasterization to the projected bounding box of the object
+		region = m_object.projectedBoundingBox(pvmMatrix, region);
+		glEnable(GL_SCISSOR_TEST);
+		glScissor(m_supersampling * region.x(),
+		          m_supersampling * region.y(),
+		          m_supersampling * region.width(),
+		          m_supersampling * region.height());
+	}
+
+	// Transparent background
+	glClearColor(0.0, 0.0, 0.0, 0.0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_DEPTH_TEST);
+
+	// Enable transparency, silhouettes are opaque
+	if (silhouetteOnly)
+	{
+		glDisable(GL_BLEND);
+	}
+	else
+	{
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	}
+
+	// Paint the object in the frame buffer
+	if (program)
+	{
+		program->bind();
+
+		// Update matrices
+		program->setUniformValue("P", projectionMatrix);
+		program->setUniformValue("V", viewMatrix);
+		program->setUniformValue("M", m_objectWorldMatrix);
+		program->setUniformValue("N", normalMatrix);
+		program->setUniformValue("PV", pvMatrix);
+		program->setUniformValue("PVM", pvmMatrix);
+
+		// Bind the VAO containing the patches
+		QOpenGLVertexArrayObject::Binder vaoBinder(&m_objectVao);
+
+		// Bind the texture
+		if (!silhouetteOnly)
+		{
+			const auto textureUnit = 0;
+			program->setUniformValue("image", textureUnit);
+			m_meshObjects->texture.bind(textureUnit);
+		}
+
+		// The levels of detail are consecutive ranges of the element buffer
+		f->glDrawElements(GL_TRIANGLES,
+			GLsizei(levelOfDetail.indexCount),
+			GL_UNSIGNED_INT,
+			reinterpret_cast<const void*>(levelOfDetail.firstIndex * sizeof(GLuint)));
+
+		program->release();
+	}
+
+	glDisable(GL_SCISSOR_TEST);
+
+	if (frameBuffer)
+	{
+		frameBuffer->release();
+
+		// Average blocks of 2 x 2 samples until reaching the working resolution
+		auto source = frameBuffer.get();
+		QRect sourceRegion(m_supersampling * region.topLeft(), m_supersampling * region.size());
+
+		for (const auto& destination : resolveFrameBuffers)
+		{
+			const QRect destinationRegion(sourceRegion.topLeft() / 2, sourceRegion.size() / 2);
+
+			QOpenGLFramebufferObject::blitFramebuffer(destination.get(), destinationRegion,
+			                                          source, sourceRegion,
+			                                          GL_COLOR_BUFFER_BIT, GL_LINEAR);
+
+			source = destination.get();
+			sourceRegion = destinationRegion;
+		}
+	}
+
+	return region;
+}
+
+QRect EvaluationContext::renderBatch(const ObjectPose* poses, int count, bool silhouetteOnly)
+{
+	auto f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_4_3_Core>();
+
+	// Same resolution as the comparison frame buffer
+	const auto size = comparisonFrameBuffer()->size();
+	initializeBatchFrameBuffer(size, count, silhouetteOnly ? GL_R8 : GL_RGBA8);
+
+	const auto& program = silhouetteOnly ? m_silhouetteBatchProgram : m_batchProgram;
+
+	// Attach the layered frame buffer and set the resolution of the viewport
+	f->glBindFramebuffer(GL_FRAMEBUFFER, m_batchFrameBuffer);
+	glViewport(0, 0, size.width(), size.height());
+	setupEvaluationCamera(size);
+
+	// Setup matrices of all the poses
+	const auto pvMatrix = m_camera.projectionMatrix() * m_camera.viewMatrix();
+	const QRect viewport(QPoint(0, 0), size);
+
+	std::vector<GLfloat> matrices(16 * std::size_t(count));
+	QRect region;
+
+	// All the instances share the finest level of detail needed by one of them
+	int level = int(m_object.levelsOfDetail().size()) - 1;
+
+	for (int i = 0; i < count; i++)
+	{
+		moveObject(poses[i]);
+		const auto pvmMatrix = pvMatrix * m_objectWorldMatrix;
+
+		// QMatrix4x4 is stored in column-major order, like GLSL matrices
+		std::memcpy(matrices.data() + 16 * std::size_t(i), pvmMatrix.constData(), 16 * sizeof(GLfloat));
+
+		region = region.united(m_object.projectedBoundingBox(pvmMatrix, viewport));
+		level = std::min(level, m_object.selectLevelOfDetail(pvmMatrix, viewport, m_levelOfDetailTolerance));
+	}
+
+	const auto& levelOfDetail = m_object.levelsOfDetail()[level];
+
+	f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_batchPoseBuffer);
+	f->glBufferData(GL_SHADER_STORAGE_BUFFER, matrices.size() * sizeof(GLfloat), matrices.data(), GL_STREAM_DRAW);
+	f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_batchPoseBuffer);
+	f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	// Restrict clearing and rasterization to the region covered by the objects, in all the layers
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(region.x(), region.y(), region.width(), region.height());
+
+	// Transparent background
+	glClearColor(0.0, 0.0, 0.0, 0.0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_DEPTH_TEST);
+
+	// Enable transparency, silhouettes are opaque
+	if (silhouetteOnly)
+	{
+		glDisable(GL_BLEND);
+	}
+	else
+	{
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	}
+
+	// Paint one instance of the object per layer
+	program->bind();
+
+	// Bind the VAO containing the patches
+	QOpenGLVertexArrayObject::Binder vaoBinder(&m_objectVao);
+
+	// Bind the texture
+	if (!silhouetteOnly)
+	{
+		const auto textureUnit = 0;
+		program->setUniformValue("image", textureUnit);
+		m_meshObjects->texture.bind(textureUnit);
+	}
+
+	// The levels of detail are consecutive ranges of the element buffer
+	f->glDrawElementsInstanced(GL_TRIANGLES,
+		GLsizei(levelOfDetail.indexCount),
+		GL_UNSIGNED_INT,
+		reinterpret_cast<const void*>(levelOfDetail.firstIndex * sizeof(GLuint)),
+		count);
+
+	program->release();
+
+	glDisable(GL_SCISSOR_TEST);
+
+	f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, 0);
+	f->glBindFramebuffer(GL_FRAMEBUFFER, QOpenGLContext::currentContext()->defaultFramebufferObject());
+
+	return region;
+}
+
+void EvaluationContext::setupEvaluationCamera(const QSize& size)
+{
+	m_camera = evaluationCamera(float(size.width()) / float(size.height()));
+}
+
+QImage EvaluationContext::readFrameBuffer(const QRect& region)
+{
+	QImage image(region.size(), QImage::Format_ARGB32);
+
+	if (!region.isEmpty())
+	{
+		// BGRA bytes are ARGB32 pixels on little endian machines
+		comparisonFrameBuffer()->bind();
+		glReadPixels(region.x(), region.y(), region.width(), region.height(), GL_BGRA, GL_UNSIGNED_BYTE, image.bits());
+		comparisonFrameBuffer()->release();
+	}
+
+	// OpenGL rows go from the bottom to the top
+	return image.mirrored();
+}
+
+QImage EvaluationContext::renderToImage(const ObjectPose& pose)
+{
+	const auto readback = renderAsync(pose);
+
+	// Output the content of the frame buffer
+	const auto result = mapReadback(readback).toImage();
+	releaseReadback(readback);
+
+	return result;
+}
+
+std::vector<QImage> EvaluationContext::renderToImageBatch(const std::vector<ObjectPose>& poses)
+{
+	std::vector<QImage> images;
+	images.reserve(poses.size());
+
+	// As many renders in flight as pixel buffers in the ring
+	const std::size_t groupSize = std::size_t(m_readbackRing.size());
+
+	for (std::size_t first = 0; first < poses.size(); first += groupSize)
+	{
+		const auto last = std::min(poses.size(), first + groupSize);
+
+		std::vector<PixelBufferReadback> readbacks;
+		for (auto i = first; i < last; i++)
+		{
+			readbacks.push_back(renderAsync(poses[i]));
+		}
+
+		for (const auto& readback : readbacks)
+		{
+			images.push_back(mapReadback(readback).toImage());
+			releaseReadback(readback);
+		}
+	}
+
+	return images;
+}
+
+PixelBufferReadback EvaluationContext::renderAsync(const ObjectPose& pose)
+{
+	render(pose);
+
+	// The copy to the pixel buffer happens on the GPU, after the rendering
+	comparisonFrameBuffer()->bind();
+	const auto readback = m_readbackRing.enqueue(QRect(QPoint(0, 0), comparisonFrameBuffer()->size()));
+	comparisonFrameBuffer()->release();
+
+	return readback;
+}
+
+PixelBufferView EvaluationContext::mapReadback(const PixelBufferReadback& readback)
+{
+	return m_readbackRing.map(readback);
+}
+
+void EvaluationContext::releaseReadback(const PixelBufferReadback& readback)
+{
+	m_readbackRing.release(readback);
+}
+
+float EvaluationContext::renderAndComputeSimilarityCpu(const ObjectPose& pose)
+{
+	// Only read back the region covered by the object
+	const auto region = render(pose, true);
+	const auto image = readFrameBuffer(region);
+	const auto frameHeight = comparisonFrameBuffer()->height();
+
+	// The frame buffer follows the working resolution of the target
+	assert(comparisonFrameBuffer()->size() == m_target.size());
+
+	// The region starts from the bottom of the frame buffer, the image from the top
+	const QPoint offset(region.x(), frameHeight - region.y() - region.height());
+	const auto imageMask = SilhouetteMask::fromAlpha(image);
+
+	const auto statistics = computeSimilarityStatistics(image, imageMask, m_target, offset);
+
+	return similarityFromStatistics(statistics);
+}
+
+float EvaluationContext::renderAndComputeSimilarityGpu(const ObjectPose& pose)
+{
+	float similarity = 0.0f;
+	
+	// Render the object in the frame buffer, only in the region it covers
+	const auto region = render(pose, true, m_silhouetteOnly);
+
+	auto f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_4_3_Core>();
+
+	const auto& program = m_silhouetteOnly ? m_computeSilhouetteProgram : m_computeSimilarityProgram;
+	const GLenum frameBufferFormat = m_silhouetteOnly ? GL_R8 : GL_RGBA8;
+	
+	// Use the compute shader
+	if (program)
+	{
+		// Local size in the compute shader
+		const int localSizeX = 16;
+		const int localSizeY = 16;
+
+		program->bind();
+
+		// Pixels outside of the region are not covered by the object
+		// The uniforms are ivec2, the QPoint and QSize overloads of setUniformValue() would set floats
+		f->glUniform2i(program->uniformLocation("region_offset"), region.x(), region.y());
+		f->glUniform2i(program->uniformLocation("region_size"), region.width(), region.height());
+
+		// Bind the target texture as an image
+		const auto targetImageUnit = 0;
+		f->glBindImageTexture(targetImageUnit, m_targetTexture.textureId(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG8);
+
+		// Bind the frame buffer texture as an image
+		const auto frameBufferImageUnit = 1;
+		f->glBindImageTexture(frameBufferImageUnit, comparisonFrameBuffer(m_silhouetteOnly)->texture(), 0, GL_FALSE, 0, GL_READ_ONLY, frameBufferFormat);
+
+		// Compute the number of blocks in each dimensions
+		const int blocksX = std::max(1, 1 + ((region.width() - 1) / localSizeX));
+		const int blocksY = std::max(1, 1 + ((region.height() - 1) / localSizeY));
+		const int blockCount = blocksX * blocksY;
+
+		// One record of partial sums per workgroup (binding = 2), grown when the region is larger
+		f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_similarityPartialsBuffer);
+		if (blockCount > m_similarityPartialsCapacity)
+		{
+			f->glBufferData(GL_SHADER_STORAGE_BUFFER, blockCount * sizeof(SimilarityPartial), nullptr, GL_DYNAMIC_READ);
+			m_similarityPartialsCapacity = blockCount;
+		}
+		f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_similarityPartialsBuffer);
+
+		// Launch the compute shader and wait for it to finish
+		f->glDispatchCompute(blocksX, blocksY, 1);
+		f->glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		// Read back the partial sums of every workgroup
+		std::vector<SimilarityPartial> partials(blockCount);
+		f->glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, blockCount * sizeof(SimilarityPartial), partials.data());
+
+		// Unbind storage buffer and textures
+		f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+		f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		f->glBindImageTexture(frameBufferImageUnit, 0, 0, GL_FALSE, 0, GL_READ_ONLY, frameBufferFormat);
+		f->glBindImageTexture(targetImageUnit, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG8);
+
+		program->release();
+
+		similarity = similarityFromPartials(partials.data(), partials.data() + partials.size(), m_target, m_silhouetteOnly);
+	}
+
+	return similarity;
+}
+
+float EvaluationContext::renderAndComputeSimilarity(const ObjectPose& pose)
+{
+	return renderAndComputeSimilarityGpu(pose);
+}
+
+std::vector<float> EvaluationContext::renderAndComputeSimilarityBatch(const std::vector<ObjectPose>& poses)
+{
+	std::vector<float> similarities;
+	similarities.reserve(poses.size());
+
+	// Only the programs of the current mode are needed
+	const auto& renderProgram = m_silhouetteOnly ? m_silhouetteBatchProgram : m_batchProgram;
+	const auto& program = m_silhouetteOnly ? m_computeSilhouetteBatchProgram : m_computeSimilarityBatchProgram;
+
+	// The layered frame buffer has no sample to resolve, supersampled renders go one by one
+	if (!renderProgram || !program || m_supersampling > 1)
+	{
+		for (const auto& pose : poses)
+		{
+			similarities.push_back(renderAndComputeSimilarityGpu(pose));
+		}
+
+		return similarities;
+	}
+
+	auto f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_4_3_Core>();
+
+	const GLenum frameBufferFormat = m_silhouetteOnly ? GL_R8 : GL_RGBA8;
+
+	// Local size in the compute shader
+	const int localSizeX = 16;
+	const int localSizeY = 16;
+
+	for (std::size_t first = 0; first < poses.size(); first += MaxBatchLayers)
+	{
+		const int count = int(std::min<std::size_t>(MaxBatchLayers, poses.size() - first));
+
+		// Render all the poses, the region covers the objects of every layer
+		const auto region = renderBatch(poses.data() + first, count, m_silhouetteOnly);
+
+		program->bind();
+
+		// Pixels outside of the region are not covered by any object
+		// The uniforms are ivec2, the QPoint and QSize overloads of setUniformValue() would set floats
+		f->glUniform2i(program->uniformLocation("region_offset"), region.x(), region.y());
+		f->glUniform2i(program->uniformLocation("region_size"), region.width(), region.height());
+
+		// Bind the target texture as an image
+		const auto targetImageUnit = 0;
+		f->glBindImageTexture(targetImageUnit, m_targetTexture.textureId(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG8);
+
+		// Bind all the layers of the frame buffer as an image array
+		const auto frameBufferImageUnit = 1;
+		f->glBindImageTexture(frameBufferImageUnit, m_batchColorTexture, 0, GL_TRUE, 0, GL_READ_ONLY, frameBufferFormat);
+
+		// Compute the number of blocks in each dimensions, one slice of blocks per layer
+		const int blocksX = std::max(1, 1 + ((region.width() - 1) / localSizeX));
+		const int blocksY = std::max(1, 1 + ((region.height() - 1) / localSizeY));
+		const int blocksPerLayer = blocksX * blocksY;
+		const int blockCount = blocksPerLayer * count;
+
+		// One record of partial sums per workgroup (binding = 2), grown when the region is larger
+		f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_similarityPartialsBuffer);
+		if (blockCount > m_similarityPartialsCapacity)
+		{
+			f->glBufferData(GL_SHADER_STORAGE_BUFFER, blockCount * sizeof(SimilarityPartial), nullptr, GL_DYNAMIC_READ);
+			m_similarityPartialsCapacity = blockCount;
+		}
+		f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_similarityPartialsBuffer);
+
+		// Launch the compute shader on all the layers and wait for it to finish
+		f->glDispatchCompute(blocksX, blocksY, count);
+		f->glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		// Read back the partial sums of every layer in a single transfer
+		std::vector<SimilarityPartial> partials(blockCount);
+		f->glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, blockCount * sizeof(SimilarityPartial), partials.data());
+
+		// Unbind storage buffer and textures
+		f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+		f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		f->glBindImageTexture(frameBufferImageUnit, 0, 0, GL_TRUE, 0, GL_READ_ONLY, frameBufferFormat);
+		f->glBindImageTexture(targetImageUnit, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG8);
+
+		program->release();
+
+		for (int layer = 0; layer < count; layer++)
+		{
+			const auto begin = partials.data() + std::size_t(layer) * blocksPerLayer;
+			similarities.push_back(similarityFromPartials(begin, begin + blocksPerLayer, m_target, m_silhouetteOnly));
+		}
+	}
+
+	return similarities;
+}
+
+void EvaluationContext::initializeFrameBuffer(const QSize& size)
+{
+	const auto initializeFrameBuffers = [this, &size](GLenum internalFormat,
+	                                                  std::unique_ptr<QOpenGLFramebufferObject>& frameBuffer,
+	                                                  std::vector<std::unique_ptr<QOpenGLFramebufferObject>>& resolveFrameBuffers)
+	{
+		// Nothing to do if the frame buffers already have the right resolution
+		const auto comparison = resolveFrameBuffers.empty() ? frameBuffer.get() : resolveFrameBuffers.back().get();
+		if (frameBuffer
+		 && frameBuffer->size() == m_supersampling * size
+		 && comparison->size() == size)
+		{
+			return;
+		}
+
+		// Initialize the frame buffer with a depth buffer, with all the samples
+		QOpenGLFramebufferObjectFormat fboFormat;
+		fboFormat.setAttachment(QOpenGLFramebufferObject::Depth);
+		fboFormat.setInternalTextureFormat(internalFormat);
+		frameBuffer = std::make_unique<QOpenGLFramebufferObject>(m_supersampling * size, fboFormat);
+
+		// Intermediate frame buffers without depth, down to the working resolution
+		QOpenGLFramebufferObjectFormat resolveFormat;
+		resolveFormat.setInternalTextureFormat(internalFormat);
+
+		resolveFrameBuffers.clear();
+		for (int factor = m_supersampling / 2; factor >= 1; factor /= 2)
+		{
+			resolveFrameBuffers.push_back(std::make_unique<QOpenGLFramebufferObject>(factor * size, resolveFormat));
+		}
+	};
+
+	initializeFrameBuffers(GL_RGBA8, m_frameBuffer, m_resolveFrameBuffers);
+
+	// The 8 bits frame buffers only exist in the silhouette-only mode
+	if (m_silhouetteOnly)
+	{
+		initializeFrameBuffers(GL_R8, m_silhouetteFrameBuffer, m_silhouetteResolveFrameBuffers);
+	}
+	else
+	{
+		m_silhouetteFrameBuffer.reset(nullptr);
+		m_silhouetteResolveFrameBuffers.clear();
+	}
+}
+
+void EvaluationContext::initializeBatchFrameBuffer(const QSize& size, int layers, GLenum colorFormat)
+{
+	const bool sameTextures = m_batchFrameBuffer && m_batchSize == size && m_batchColorFormat == colorFormat;
+
+	// Nothing to do if the layered frame buffer has enough layers of the right resolution
+	if (sameTextures && m_batchLayers >= layers)
+	{
+		return;
+	}
+
+	// Keep the largest number of layers seen so far
+	if (sameTextures)
+	{
+		layers = std::max(layers, m_batchLayers);
+	}
+
+	destroyBatchFrameBuffer();
+
+	auto f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_4_3_Core>();
+
+	m_batchSize = size;
+	m_batchLayers = layers;
+	m_batchColorFormat = colorFormat;
+
+	// One color layer and one depth layer per pose
+	f->glGenTextures(1, &m_batchColorTexture);
+	f->glBindTexture(GL_TEXTURE_2D_ARRAY, m_batchColorTexture);
+	f->glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, m_batchColorFormat, size.width(), size.height(), m_batchLayers);
+
+	f->glGenTextures(1, &m_batchDepthTexture);
+	f->glBindTexture(GL_TEXTURE_2D_ARRAY, m_batchDepthTexture);
+	f->glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT24, size.width(), size.height(), m_batchLayers);
+
+	f->glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	// Attaching the whole arrays makes the frame buffer layered
+	f->glGenFramebuffers(1, &m_batchFrameBuffer);
+	f->glBindFramebuffer(GL_FRAMEBUFFER, m_batchFrameBuffer);
+	f->glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_batchColorTexture, 0);
+	f->glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_batchDepthTexture, 0);
+
+	if (f->glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		qWarning() << "Incomplete layered frame buffer";
+	}
+
+	f->glBindFramebuffer(GL_FRAMEBUFFER, QOpenGLContext::currentContext()->defaultFramebufferObject());
+}
+
+void EvaluationContext::destroyBatchFrameBuffer()
+{
+	if (m_batchFrameBuffer)
+	{
+		auto f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_4_3_Core>();
+
+		f->glDeleteFramebuffers(1, &m_batchFrameBuffer);
+		f->glDeleteTextures(1, &m_batchColorTexture);
+		f->glDeleteTextures(1, &m_batchDepthTexture);
+	}
+
+	m_batchFrameBuffer = 0;
+	m_batchColorTexture = 0;
+	m_batchDepthTexture = 0;
+	m_batchSize = QSize();
+	m_batchLayers = 0;
+}
+
+void EvaluationContext::initializeVbo()
+{	
+	// Packed vertices and UV coordinates, possibly in the mapped cache of the mesh
+	const auto size = m_object.vertices().size() * vertexLayout(m_object.vertexFormat()).stride;
+
+	// Init VBO
+	m_meshObjects->vbo.create();
+	m_meshObjects->vbo.bind();
+	m_meshObjects->vbo.allocate(m_object.vertexData(), int(size));
+	m_meshObjects->vbo.release();
+}
+
+void EvaluationContext::initializeEbo()
+{
+	// Indices of faces, for all the levels of detail
+	const auto size = m_object.levelOfDetailIndexCount() * sizeof(GLuint);
+
+	// Init VBO
+	m_meshObjects->ebo.create();
+	m_meshObjects->ebo.bind();
+	m_meshObjects->ebo.allocate(m_object.levelOfDetailIndexData(), int(size));
+	m_meshObjects->ebo.release();
+}
+
+void EvaluationContext::initializeTexture()
+{
+	// Already in OpenGL order, possibly in the mapped cache of the mesh
+	const auto& levels = m_object.textureLevels();
+	
+	m_meshObjects->texture.destroy();
+	m_meshObjects->texture.create();
+
+	if (levels.empty())
+	{
+		return;
+	}
+
+	m_meshObjects->texture.setFormat(QOpenGLTexture::RGBA8_UNorm);
+	m_meshObjects->texture.setMinificationFilter(levels.size() > 1 ? QOpenGLTexture::LinearMipMapLinear : QOpenGLTexture::Linear);
+	m_meshObjects->texture.setMagnificationFilter(QOpenGLTexture::Linear);
+	m_meshObjects->texture.setWrapMode(QOpenGLTexture::ClampToEdge);
+	m_meshObjects->texture.setSize(levels.front().width(), levels.front().height());
+	m_meshObjects->texture.setMipLevels(int(levels.size()));
+	m_meshObjects->texture.allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8);
+
+	// The texels are read from the images without conversion
+	for (int level = 0; level < int(levels.size()); level++)
+	{
+		const auto image = levels[level].convertToFormat(QImage::Format_RGBA8888);
+		m_meshObjects->texture.setData(level, QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, image.constBits());
+	}
+}
+
+void EvaluationContext::initializeTargetTexture()
+{
+	if (!m_target.isEmpty())
+	{
+		// Alpha in the red channel and binary value in the green channel
+		const auto texels = m_target.alphaValueTexture();
+
+		QOpenGLPixelTransferOptions transferOptions;
+		transferOptions.setAlignment(1);
+
+		m_targetTexture.destroy();
+		m_targetTexture.create();
+		m_targetTexture.setFormat(QOpenGLTexture::RG8_UNorm);
+		m_targetTexture.setMinificationFilter(QOpenGLTexture::Nearest);
+		m_targetTexture.setMagnificationFilter(QOpenGLTexture::Nearest);
+		m_targetTexture.setWrapMode(QOpenGLTexture::ClampToEdge);
+		m_targetTexture.setSize(m_target.width(), m_target.height());
+		m_targetTexture.allocateStorage(QOpenGLTexture::RG, QOpenGLTexture::UInt8);
+		m_targetTexture.setData(QOpenGLTexture::RG, QOpenGLTexture::UInt8, texels.data(), &transferOptions);
+	}
+}
+
+void EvaluationContext::initializeComputeShader()
+{
+	const QString shader_dir = ":/MainWindow/Shaders/";
+	
+	// Init similarity compute shader
+	m_computeSimilarityProgram = std::make_unique<QOpenGLShaderProgram>();
+	m_computeSimilarityProgram->addShaderFromSourceFile(QOpenGLShader::Compute, shader_dir + "similarity_cs.glsl");
+	m_computeSimilarityProgram->link();
+
+	auto f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_4_3_Core>();
+
+	// Declare and generate a buffer object name, its storage depends on the region to reduce
+	f->glGenBuffers(1, &m_similarityPartialsBuffer);
+	m_similarityPartialsCapacity = 0;
+
+	// Batches: instances are sent to the layers of the frame buffer by the geometry shader
+	m_batchProgram = std::make_unique<QOpenGLShaderProgram>();
+	m_batchProgram->addShaderFromSourceFile(QOpenGLShader::Vertex, shader_dir + "object_batch_vs.glsl");
+	m_batchProgram->addShaderFromSourceFile(QOpenGLShader::Geometry, shader_dir + "object_batch_gs.glsl");
+	m_batchProgram->addShaderFromSourceFile(QOpenGLShader::Fragment, shader_dir + "object_fs.glsl");
+	m_batchProgram->link();
+
+	// Same similarity, reading one pose per layer
+	m_computeSimilarityBatchProgram = std::make_unique<QOpenGLShaderProgram>();
+	addShaderFromSourceFileWithDefines(m_computeSimilarityBatchProgram.get(),
+	                                   QOpenGLShader::Compute,
+	                                   shader_dir + "similarity_cs.glsl",
+	                                   { "LAYERED" });
+	m_computeSimilarityBatchProgram->link();
+
+	// Silhouette-only variants: 8 bits frame buffers and no mean absolute error
+	m_silhouetteBatchProgram = std::make_unique<QOpenGLShaderProgram>();
+	m_silhouetteBatchProgram->addShaderFromSourceFile(QOpenGLShader::Vertex, shader_dir + "object_batch_vs.glsl");
+	m_silhouetteBatchProgram->addShaderFromSourceFile(QOpenGLShader::Geometry, shader_dir + "object_batch_gs.glsl");
+	m_silhouetteBatchProgram->addShaderFromSourceFile(QOpenGLShader::Fragment, shader_dir + "silhouette_fs.glsl");
+	m_silhouetteBatchProgram->link();
+
+	m_computeSilhouetteProgram = std::make_unique<QOpenGLShaderProgram>();
+	addShaderFromSourceFileWithDefines(m_computeSilhouetteProgram.get(),
+	                                   QOpenGLShader::Compute,
+	                                   shader_dir + "similarity_cs.glsl",
+	                                   { "SILHOUETTE" });
+	m_computeSilhouetteProgram->link();
+
+	m_computeSilhouetteBatchProgram = std::make_unique<QOpenGLShaderProgram>();
+	addShaderFromSourceFileWithDefines(m_computeSilhouetteBatchProgram.get(),
+	                                   QOpenGLShader::Compute,
+	                                   shader_dir + "similarity_cs.glsl",
+	                                   { "LAYERED", "SILHOUETTE" });
+	m_computeSilhouetteBatchProgram->link();
+
+	f->glGenBuffers(1, &m_batchPoseBuffer);
+}
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <QOpenGLFunctions_4_3_Core>
+
+#include <QOpenGLShaderProgram>
+#include <QOpenGLVertexArrayObject>
+#include <QOpenGLBuffer>
+#include <QOpenGLTexture>
+#include <QOpenGLFramebufferObject>
+
+#include "Camera.h"
+#include "ObjectPose.h"
+#include "Mesh.h"
+#include "PixelBufferRing.h"
+#include "Renderer.h"
+#include "SilhouetteMask.h"
+#include "TargetDescriptor.h"
+
+/**
+ * \brief OpenGL objects rendering poses of the object and comparing them to the target
+ *
+ * Owns the frame buffers, the programs and the storage buffers of one OpenGL context, and does not
+ * depend on the surface: it is used by the context of ViewerWidget and by the offscreen contexts
+ * of EvaluationContextPool. Every method, including the setters once initialize() has been called,
+ * needs the context to be current on the calling thread.
+ */
+class EvaluationContext : public Renderer, protected QOpenGLFunctions_4_3_Core
+{
+public:
+
+	/**
+	 * \brief Create the evaluation of an object, no OpenGL object is allocated until initialize()
+	 * \param object The mesh of the object, must outlive the evaluation context
+	 * \param objectMatrix Transformation of the mesh in the frame of the object
+	 */
+	EvaluationContext(const Mesh& object, const QMatrix4x4& objectMatrix);
+	~EvaluationContext();
+
+	EvaluationContext(const EvaluationContext&) = delete;
+	EvaluationContext& operator=(const EvaluationContext&) = delete;
+
+	/**
+	 * \brief Allocate the OpenGL objects in the current context
+	 * \param shareMeshObjects Evaluation context whose vertex, index buffers and texture are reused
+	 *        instead of uploading the mesh again, its context must share objects with the current one
+	 */
+	void initialize(const EvaluationContext* shareMeshObjects = nullptr);
+
+	/**
+	 * \brief Free the OpenGL objects, the mesh objects are freed with the last context using them
+	 */
+	void destroy();
+
+	bool isInitialized() const { return m_program != nullptr; }
+
+	/**
+	 * \brief Set the target image, the frame buffer is resized to the working resolution
+	 * \param targetImage The target image
+	 */
+	void setTargetImage(const QImage& targetImage) override;
+
+	/**
+	 * \brief Set the resolution at which poses are compared to the target
+	 * \param size The working resolution, or an invalid size to use the resolution of the target
+	 */
+	void setWorkingResolution(const QSize& size) override;
+	QSize workingResolution() const override;
+
+	/**
+	 * \brief Render N x N samples per pixel, averaged before comparing to the target
+	 * \param factor Number of samples in each dimension, a power of two
+	 */
+	void setSupersampling(int factor);
+	int supersampling() const override;
+
+	/**
+	 * \brief Compare only the silhouettes, rendered in 8 bits frame buffers without the texture
+	 * \param silhouetteOnly true to skip the texture and the mean absolute error
+	 */
+	void setSilhouetteOnly(bool silhouetteOnly) override;
+	bool silhouetteOnly() const override;
+
+	/**
+	 * \brief Set the error on the screen accepted when selecting the level of detail of the mesh
+	 * \param pixels Largest error in pixels at the working resolution
+	 */
+	void setLevelOfDetailTolerance(float pixels) override;
+	float levelOfDetailTolerance() const override;
+
+	QImage renderToImage(const ObjectPose& pose) override;
+
+	/**
+	 * \brief Render several poses, the readbacks of a pose overlap the rendering of the next ones
+	 */
+	std::vector<QImage> renderToImageBatch(const std::vector<ObjectPose>& poses) override;
+
+	/**
+	 * \brief Render a pose and queue the readback of the frame buffer without waiting for it
+	 *
+	 * Several renders can be queued before mapping their results, up to the size of the ring.
+	 * \param pose The pose of the object
+	 * \return A handle on the readback
+	 */
+	PixelBufferReadback renderAsync(const ObjectPose& pose);
+
+	/**
+	 * \brief Wait for a queued readback and map its pixels without copying them
+	 * \param readback The handle returned by renderAsync()
+	 * \return A view on the pixels, valid until releaseReadback() is called
+	 */
+	PixelBufferView mapReadback(const PixelBufferReadback& readback);
+	void releaseReadback(const PixelBufferReadback& readback);
+
+	float renderAndComputeSimilarityCpu(const ObjectPose& pose);
+	float renderAndComputeSimilarityGpu(const ObjectPose& pose);
+
+	/**
+	 * \brief Render a pose and compute its similarity with the target, with the compute shader
+	 */
+	float renderAndComputeSimilarity(const ObjectPose& pose) override;
+
+	/**
+	 * \brief Render several poses in one pass and compute their similarity with the target
+	 *
+	 * Poses are drawn as instances in the layers of a layered frame buffer, compared to the
+	 * target in one dispatch of the compute shader and read back in a single transfer.
+	 * \param poses The poses of the object
+	 * \return The similarity of each pose, in the same order
+	 */
+	std::vector<float> renderAndComputeSimilarityBatch(const std::vector<ObjectPose>& poses) override;
+
+private:
+
+	/**
+	 * \brief Maximum number of poses rendered in one pass, larger batches are split
+	 */
+	static constexpr int MaxBatchLayers = 16;
+
+	/**
+	 * \brief Objects holding the mesh, shared by the contexts of a share group
+	 */
+	struct MeshObjects
+	{
+		MeshObjects();
+
+		QOpenGLBuffer vbo;
+		QOpenGLBuffer ebo;
+		QOpenGLTexture texture;
+	};
+
+	void initializeFrameBuffer(const QSize& size);
+	void initializeBatchFrameBuffer(const QSize& size, int layers, GLenum colorFormat);
+	void destroyBatchFrameBuffer();
+	void updateTarget();
+
+	/**
+	 * \brief The frame buffer at the working resolution, after averaging the samples
+	 * \param silhouetteOnly true for the 8 bits frame buffer of the silhouettes
+	 */
+	QOpenGLFramebufferObject* comparisonFrameBuffer(bool silhouetteOnly = false) const;
+	void initializeVbo();
+	void initializeEbo();
+	void initializeTexture();
+	void initializeTargetTexture();
+	void initializeComputeShader();
+
+	/**
+	 * \brief Place the camera used to evaluate poses
+	 * \param size Resolution of the frame buffer
+	 */
+	void setupEvaluationCamera(const QSize& size);
+
+	void moveObject(const ObjectPose& pose);
+
+	/**
+	 * \brief Render the object in the frame buffer
+	 * \param pose The pose of the object
+	 * \param onlyObjectRegion If true, only clear and rasterize the projected bounding box of the object
+	 * \param silhouetteOnly If true, only render the coverage of the object in the 8 bits frame buffer
+	 * \return The region of the frame buffer in which the object has been rendered
+	 */
+	QRect render(const ObjectPose& pose, bool onlyObjectRegion = false, bool silhouetteOnly = false);
+
+	/**
+	 * \brief Render poses in the layers of the batch frame buffer, one layer per pose
+	 * \param poses The poses of the object
+	 * \param count Number of poses, at most MaxBatchLayers
+	 * \param silhouetteOnly If true, only render the coverage of the objects in 8 bits layers
+	 * \return The region covered by the objects of all the layers
+	 */
+	QRect renderBatch(const ObjectPose* poses, int count, bool silhouetteOnly);
+
+	/**
+	 * \brief Read back a region of the frame buffer
+	 * \param region The region in OpenGL window coordinates
+	 * \return The content of the region, from top to bottom
+	 */
+	QImage readFrameBuffer(const QRect& region);
+
+	const Mesh& m_object;
+	QMatrix4x4 m_objectMatrix;
+	QMatrix4x4 m_objectWorldMatrix;
+	Camera m_camera;
+
+	std::unique_ptr<QOpenGLShaderProgram> m_program;
+	std::unique_ptr<QOpenGLShaderProgram> m_computeSimilarityProgram;
+	std::unique_ptr<QOpenGLShaderProgram> m_batchProgram;
+	std::unique_ptr<QOpenGLShaderProgram> m_computeSimilarityBatchProgram;
+
+	// Programs of the silhouette-only mode: no texture, no blending and no mean absolute error
+	std::unique_ptr<QOpenGLShaderProgram> m_silhouetteProgram;
+	std::unique_ptr<QOpenGLShaderProgram> m_silhouetteBatchProgram;
+	std::unique_ptr<QOpenGLShaderProgram> m_computeSilhouetteProgram;
+	std::unique_ptr<QOpenGLShaderProgram> m_computeSilhouetteBatchProgram;
+
+	// Vertex array objects are not shared between contexts, the buffers and the texture are
+	QOpenGLVertexArrayObject m_objectVao;
+	std::shared_ptr<MeshObjects> m_meshObjects;
+
+	// Texture in which to render
+	std::unique_ptr<QOpenGLFramebufferObject> m_frameBuffer;
+
+	// Layered frame buffer in which batches of poses are rendered
+	GLuint m_batchFrameBuffer;
+	GLuint m_batchColorTexture;
+	GLuint m_batchDepthTexture;
+	GLenum m_batchColorFormat;
+	QSize m_batchSize;
+	int m_batchLayers;
+
+	// Storage buffer of the matrices of the poses of a batch
+	GLuint m_batchPoseBuffer;
+
+	// Pixel buffers for asynchronous readbacks of the frame buffer
+	PixelBufferRing m_readbackRing;
+
+	// Frame buffers halving the resolution of the rendering down to the working resolution
+	std::vector<std::unique_ptr<QOpenGLFramebufferObject>> m_resolveFrameBuffers;
+
+	// Same frame buffers with a single 8 bits channel, only allocated in the silhouette-only mode
+	std::unique_ptr<QOpenGLFramebufferObject> m_silhouetteFrameBuffer;
+	std::vector<std::unique_ptr<QOpenGLFramebufferObject>> m_silhouetteResolveFrameBuffers;
+
+	// Resolution at which poses are compared to the target, invalid to use the resolution of the target
+	QSize m_workingResolution;
+
+	// Number of samples per pixel in each dimension
+	int m_supersampling;
+
+	// Compare only the silhouettes
+	bool m_silhouetteOnly;
+
+	// Error in pixels accepted when selecting the level of detail
+	float m_levelOfDetailTolerance;
+
+	// Storage buffer receiving the partial sums of each workgroup of the compute shader
+	GLuint m_similarityPartialsBuffer;
+	int m_similarityPartialsCapacity;
+
+	// Target texture
+	QImage m_targetImage;
+	QOpenGLTexture m_targetTexture;
+
+	// Descriptor of the target, computed once when the target is set
+	TargetDescriptor m_target;
+};
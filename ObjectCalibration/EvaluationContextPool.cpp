@@ -0,0 +1,275 @@
+#include "EvaluationContextPool.h"
+
+#include <algorithm>
+
+#include <QCoreApplication>
+#include <QtDebug>
+
+EvaluationWorker::EvaluationWorker(const Mesh& object, const QMatrix4x4& objectMatrix, QOpenGLContext* shareContext) :
+	m_surface(std::make_unique<QOffscreenSurface>()),
+	m_context(std::make_unique<QOpenGLContext>()),
+	m_evaluation(std::make_unique<EvaluationContext>(object, objectMatrix)),
+	m_valid(false),
+	m_silhouetteOnly(false),
+	m_levelOfDetailTolerance(0.5f)
+{
+	// Offscreen surfaces are created in the GUI thread, and then used from any thread
+	m_surface->setFormat(QSurfaceFormat::defaultFormat());
+	m_surface->create();
+
+	m_context->setFormat(QSurfaceFormat::defaultFormat());
+	m_context->setShareContext(shareContext);
+	m_context->create();
+}
+
+EvaluationWorker::~EvaluationWorker()
+{
+	if (m_thread.isRunning())
+	{
+		run([this](EvaluationContext& evaluation)
+		{
+			evaluation.destroy();
+			m_context->doneCurrent();
+
+			// The context and the surface are deleted in the GUI thread
+			m_context->moveToThread(QCoreApplication::instance()->thread());
+		});
+
+		m_thread.quit();
+		m_thread.wait();
+	}
+}
+
+bool EvaluationWorker::start(const EvaluationWorker* shareMeshObjects)
+{
+	if (!m_surface->isValid() || !m_context->isValid())
+	{
+		qWarning() << "Cannot create an offscreen OpenGL context";
+		return false;
+	}
+
+	m_receiver.moveToThread(&m_thread);
+	m_context->moveToThread(&m_thread);
+	m_thread.start();
+
+	m_valid = run([this, shareMeshObjects](EvaluationContext& evaluation)
+	{
+		// The context stays current on the thread of the worker
+		if (!m_context->makeCurrent(m_surface.get()))
+		{
+			qWarning() << "Cannot make an offscreen OpenGL context current";
+			return false;
+		}
+
+		const auto format = m_context->format();
+		if (format.version() < qMakePair(4, 3))
+		{
+			qWarning() << "Offscreen OpenGL context" << format.majorVersion() << "." << format.minorVersion()
+			           << "does not support compute shaders";
+			m_context->doneCurrent();
+			return false;
+		}
+
+		evaluation.initialize(shareMeshObjects ? shareMeshObjects->m_evaluation.get() : nullptr);
+
+		return true;
+	});
+
+	if (!m_valid)
+	{
+		run([this](EvaluationContext&)
+		{
+			m_context->moveToThread(QCoreApplication::instance()->thread());
+		});
+
+		m_thread.quit();
+		m_thread.wait();
+	}
+
+	return m_valid;
+}
+
+void EvaluationWorker::setTargetImage(const QImage& targetImage)
+{
+	run([&targetImage](EvaluationContext& evaluation) { evaluation.setTargetImage(targetImage); });
+}
+
+void EvaluationWorker::setWorkingResolution(const QSize& size)
+{
+	m_workingResolution = size;
+
+	run([size](EvaluationContext& evaluation) { evaluation.setWorkingResolution(size); });
+}
+
+QSize EvaluationWorker::workingResolution() const
+{
+	return m_workingResolution;
+}
+
+void EvaluationWorker::setSilhouetteOnly(bool silhouetteOnly)
+{
+	m_silhouetteOnly = silhouetteOnly;
+
+	run([silhouetteOnly](EvaluationContext& evaluation) { evaluation.setSilhouetteOnly(silhouetteOnly); });
+}
+
+bool EvaluationWorker::silhouetteOnly() const
+{
+	return m_silhouetteOnly;
+}
+
+void EvaluationWorker::setLevelOfDetailTolerance(float pixels)
+{
+	m_levelOfDetailTolerance = pixels;
+
+	run([pixels](EvaluationContext& evaluation) { evaluation.setLevelOfDetailTolerance(pixels); });
+}
+
+float EvaluationWorker::levelOfDetailTolerance() const
+{
+	return m_levelOfDetailTolerance;
+}
+
+QImage EvaluationWorker::renderToImage(const ObjectPose& pose)
+{
+	return run([&pose](EvaluationContext& evaluation) { return evaluation.renderToImage(pose); });
+}
+
+float EvaluationWorker::renderAndComputeSimilarity(const ObjectPose& pose)
+{
+	return run([&pose](EvaluationContext& evaluation) { return evaluation.renderAndComputeSimilarity(pose); });
+}
+
+std::vector<QImage> EvaluationWorker::renderToImageBatch(const std::vector<ObjectPose>& poses)
+{
+	return run([&poses](EvaluationContext& evaluation) { return evaluation.renderToImageBatch(poses); });
+}
+
+std::vector<float> EvaluationWorker::renderAndComputeSimilarityBatch(const std::vector<ObjectPose>& poses)
+{
+	return run([&poses](EvaluationContext& evaluation) { return evaluation.renderAndComputeSimilarityBatch(poses); });
+}
+
+EvaluationContextPool::EvaluationContextPool(const Mesh& object, const QMatrix4x4& objectMatrix, int workerCount) :
+	m_object(object),
+	m_objectMatrix(objectMatrix),
+	m_silhouetteOnly(false),
+	m_levelOfDetailTolerance(0.5f)
+{
+	// All the contexts share the objects of the first one, they are created
+	// before the first one is made current on its thread
+	std::vector<std::unique_ptr<EvaluationWorker>> workers;
+	for (int i = 0; i < std::max(1, workerCount); i++)
+	{
+		const auto shareContext = workers.empty() ? nullptr : workers.front()->context();
+		workers.push_back(std::make_unique<EvaluationWorker>(m_object, m_objectMatrix, shareContext));
+	}
+
+	// The first worker uploads the mesh, the others reuse its buffers and texture
+	for (auto& worker : workers)
+	{
+		const auto shareMeshObjects = m_workers.empty() ? nullptr : m_workers.front().get();
+
+		if (worker->start(shareMeshObjects))
+		{
+			m_workers.push_back(std::move(worker));
+		}
+		else if (m_workers.empty())
+		{
+			// Without the first context, the others have nothing to share
+			break;
+		}
+	}
+
+	qDebug() << "Evaluation context pool:" << m_workers.size() << "workers";
+}
+
+EvaluationContextPool::~EvaluationContextPool()
+{
+	// Each worker frees its objects on its thread, the last one also frees the mesh
+	m_workers.clear();
+}
+
+void EvaluationContextPool::setTargetImage(const QImage& targetImage)
+{
+	// The target descriptors are built in parallel
+	broadcast([&targetImage](EvaluationContext& evaluation) { evaluation.setTargetImage(targetImage); });
+}
+
+void EvaluationContextPool::setWorkingResolution(const QSize& size)
+{
+	m_workingResolution = size;
+
+	broadcast([size](EvaluationContext& evaluation) { evaluation.setWorkingResolution(size); });
+}
+
+QSize EvaluationContextPool::workingResolution() const
+{
+	return m_workingResolution;
+}
+
+void EvaluationContextPool::setSilhouetteOnly(bool silhouetteOnly)
+{
+	m_silhouetteOnly = silhouetteOnly;
+
+	broadcast([silhouetteOnly](EvaluationContext& evaluation) { evaluation.setSilhouetteOnly(silhouetteOnly); });
+}
+
+bool EvaluationContextPool::silhouetteOnly() const
+{
+	return m_silhouetteOnly;
+}
+
+void EvaluationContextPool::setLevelOfDetailTolerance(float pixels)
+{
+	m_levelOfDetailTolerance = pixels;
+
+	broadcast([pixels](EvaluationContext& evaluation) { evaluation.setLevelOfDetailTolerance(pixels); });
+}
+
+float EvaluationContextPool::levelOfDetailTolerance() const
+{
+	return m_levelOfDetailTolerance;
+}
+
+QImage EvaluationContextPool::renderToImage(const ObjectPose& pose)
+{
+	// Callers fall back to another renderer when no context could be created
+	Q_ASSERT(isValid());
+
+	if (!isValid())
+	{
+		return QImage();
+	}
+
+	return m_workers.front()->run([&pose](EvaluationContext& evaluation) { return evaluation.renderToImage(pose); });
+}
+
+std::vector<QImage> EvaluationContextPool::renderToImageBatch(const std::vector<ObjectPose>& poses)
+{
+	return split(poses, [](EvaluationContext& evaluation, const std::vector<ObjectPose>& part)
+	{
+		return evaluation.renderToImageBatch(part);
+	});
+}
+
+float EvaluationContextPool::renderAndComputeSimilarity(const ObjectPose& pose)
+{
+	Q_ASSERT(isValid());
+
+	if (!isValid())
+	{
+		return 0.0f;
+	}
+
+	return m_workers.front()->run([&pose](EvaluationContext& evaluation) { return evaluation.renderAndComputeSimilarity(pose); });
+}
+
+std::vector<float> EvaluationContextPool::renderAndComputeSimilarityBatch(const std::vector<ObjectPose>& poses)
+{
+	// Each worker renders its part in layered batches
+	return split(poses, [](EvaluationContext& evaluation, const std::vector<ObjectPose>& part)
+	{
+		return evaluation.renderAndComputeSimilarityBatch(part);
+	});
+}
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <algorithm>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include <QObject>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QThread>
+
+#include "EvaluationContext.h"
+#include "Mesh.h"
+#include "Renderer.h"
+
+/**
+ * \brief Offscreen OpenGL context bound to its own thread, with its own evaluation objects
+ *
+ * The context stays current on the thread of the worker for its whole life, calls from other
+ * threads are queued to it. The methods of Renderer block until the worker has finished, and
+ * can be called from any thread.
+ */
+class EvaluationWorker : public Renderer
+{
+public:
+
+	/**
+	 * \brief Create the surface and the context, must be called from the GUI thread
+	 * \param object The mesh of the object, must outlive the worker
+	 * \param objectMatrix Transformation of the mesh in the frame of the object
+	 * \param shareContext Context with which OpenGL objects are shared, or nullptr
+	 */
+	EvaluationWorker(const Mesh& object, const QMatrix4x4& objectMatrix, QOpenGLContext* shareContext);
+	~EvaluationWorker();
+
+	EvaluationWorker(const EvaluationWorker&) = delete;
+	EvaluationWorker& operator=(const EvaluationWorker&) = delete;
+
+	/**
+	 * \brief Start the thread and allocate the OpenGL objects on it
+	 * \param shareMeshObjects Worker whose mesh objects are reused, in the same share group, or nullptr
+	 * \return True if the context supports the evaluation
+	 */
+	bool start(const EvaluationWorker* shareMeshObjects);
+
+	bool isValid() const { return m_valid; }
+
+	QOpenGLContext* context() const { return m_context.get(); }
+
+	/**
+	 * \brief Queue a function on the thread of the worker, with its evaluation context current
+	 * \param function Called with the EvaluationContext of the worker
+	 * \return The future result of the function
+	 */
+	template <typename Function>
+	auto post(Function function) -> std::future<std::invoke_result_t<Function, EvaluationContext&>>
+	{
+		using Result = std::invoke_result_t<Function, EvaluationContext&>;
+
+		auto task = std::make_shared<std::packaged_task<Result()>>([this, function]() mutable
+		{
+			return function(*m_evaluation);
+		});
+
+		auto future = task->get_future();
+		QMetaObject::invokeMethod(&m_receiver, [task]() { (*task)(); }, Qt::QueuedConnection);
+
+		return future;
+	}
+
+	/**
+	 * \brief Run a function on the thread of the worker and wait for its result
+	 */
+	template <typename Function>
+	auto run(Function function) -> std::invoke_result_t<Function, EvaluationContext&>
+	{
+		return post(function).get();
+	}
+
+	void setTargetImage(const QImage& targetImage) override;
+
+	void setWorkingResolution(const QSize& size) override;
+	QSize workingResolution() const override;
+
+	void setSilhouetteOnly(bool silhouetteOnly) override;
+	bool silhouetteOnly() const override;
+
+	void setLevelOfDetailTolerance(float pixels) override;
+	float levelOfDetailTolerance() const override;
+
+	QImage renderToImage(const ObjectPose& pose) override;
+	std::vector<QImage> renderToImageBatch(const std::vector<ObjectPose>& poses) override;
+
+	float renderAndComputeSimilarity(const ObjectPose& pose) override;
+
+	std::vector<float> renderAndComputeSimilarityBatch(const std::vector<ObjectPose>& poses) override;
+
+private:
+
+	QThread m_thread;
+
+	// Receives the queued functions, lives in the thread of the worker
+	QObject m_receiver;
+
+	std::unique_ptr<QOffscreenSurface> m_surface;
+	std::unique_ptr<QOpenGLContext> m_context;
+	std::unique_ptr<EvaluationContext> m_evaluation;
+
+	bool m_valid;
+
+	// Copies of the settings, so that the getters do not wait for the thread
+	QSize m_workingResolution;
+	bool m_silhouetteOnly;
+	float m_levelOfDetailTolerance;
+};
+
+/**
+ * \brief Pool of offscreen OpenGL contexts evaluating poses concurrently
+ *
+ * Each worker has its own thread, context, frame buffers, storage buffers and programs,
+ * the vertex, index buffers and the texture of the mesh are uploaded once and shared by the contexts.
+ * Batches of poses (the finite differences of the gradient, candidates of a search) are split
+ * between the workers, and workers can be used directly to process independent images in parallel.
+ *
+ * No window is needed, so the pool runs on headless nodes with a software implementation
+ * of OpenGL 4.3 like Mesa's llvmpipe, with a platform plugin providing offscreen surfaces
+ * (e.g. -platform offscreen or eglfs on EGL surfaceless). llvmpipe also rasterizes with
+ * several threads per context, LP_NUM_THREADS should then be lowered to share the cores.
+ */
+class EvaluationContextPool : public Renderer
+{
+public:
+
+	/**
+	 * \brief Create the workers, must be called from the GUI thread
+	 * \param object The mesh of the object, copied by the pool
+	 * \param objectMatrix Transformation of the mesh in the frame of the object
+	 * \param workerCount Number of contexts, by default one per core
+	 */
+	EvaluationContextPool(const Mesh& object,
+	                      const QMatrix4x4& objectMatrix,
+	                      int workerCount = QThread::idealThreadCount());
+	~EvaluationContextPool();
+
+	EvaluationContextPool(const EvaluationContextPool&) = delete;
+	EvaluationContextPool& operator=(const EvaluationContextPool&) = delete;
+
+	/**
+	 * \brief Return true if at least one context could be created, an invalid pool cannot render
+	 */
+	bool isValid() const { return !m_workers.empty(); }
+
+	int workerCount() const { return int(m_workers.size()); }
+
+	/**
+	 * \brief Worker to which independent work can be given, with its own target and settings
+	 */
+	EvaluationWorker* worker(int index) const { return m_workers[index].get(); }
+
+	/**
+	 * \brief Set the target image of all the workers
+	 */
+	void setTargetImage(const QImage& targetImage) override;
+
+	void setWorkingResolution(const QSize& size) override;
+	QSize workingResolution() const override;
+
+	void setSilhouetteOnly(bool silhouetteOnly) override;
+	bool silhouetteOnly() const override;
+
+	void setLevelOfDetailTolerance(float pixels) override;
+	float levelOfDetailTolerance() const override;
+
+	QImage renderToImage(const ObjectPose& pose) override;
+
+	/**
+	 * \brief Split the poses in contiguous parts rendered concurrently by the workers
+	 */
+	std::vector<QImage> renderToImageBatch(const std::vector<ObjectPose>& poses) override;
+
+	float renderAndComputeSimilarity(const ObjectPose& pose) override;
+
+	/**
+	 * \brief Split the poses in contiguous parts evaluated concurrently by the workers
+	 * \param poses The poses of the object
+	 * \return The similarity of each pose, in the same order
+	 */
+	std::vector<float> renderAndComputeSimilarityBatch(const std::vector<ObjectPose>& poses) override;
+
+private:
+
+	/**
+	 * \brief Split poses in contiguous parts of the same size, processed concurrently by the workers
+	 * \param poses The poses of the object
+	 * \param function Called with the EvaluationContext of a worker and a part of the poses,
+	 *        returns one result per pose
+	 * \return The results of all the poses, in the same order, or none if the pool has no worker
+	 */
+	template <typename Function>
+	auto split(const std::vector<ObjectPose>& poses, Function function)
+		-> std::invoke_result_t<Function, EvaluationContext&, const std::vector<ObjectPose>&>
+	{
+		using Results = std::invoke_result_t<Function, EvaluationContext&, const std::vector<ObjectPose>&>;
+
+		Q_ASSERT(isValid());
+
+		if (poses.empty() || !isValid())
+		{
+			return {};
+		}
+
+		const std::size_t partSize = (poses.size() + m_workers.size() - 1) / m_workers.size();
+
+		std::vector<std::future<Results>> futures;
+		for (std::size_t first = 0, worker = 0; first < poses.size(); first += partSize, worker++)
+		{
+			const std::vector<ObjectPose> part(poses.begin() + first, poses.begin() + std::min(poses.size(), first + partSize));
+
+			futures.push_back(m_workers[worker]->post([part, function](EvaluationContext& evaluation)
+			{
+				return function(evaluation, part);
+			}));
+		}
+
+		Results results;
+		results.reserve(poses.size());
+
+		for (auto& future : futures)
+		{
+			auto partResults = future.get();
+			std::move(partResults.begin(), partResults.end(), std::back_inserter(results));
+		}
+
+		return results;
+	}
+
+	/**
+	 * \brief Run a function on all the workers concurrently and wait for them
+	 */
+	template <typename Function>
+	void broadcast(Function function)
+	{
+		std::vector<std::future<void>> futures;
+		futures.reserve(m_workers.size());
+
+		for (const auto& worker : m_workers)
+		{
+			futures.push_back(worker->post(function));
+		}
+
+		for (auto& future : futures)
+		{
+			future.get();
+		}
+	}
+
+	Mesh m_object;
+	QMatrix4x4 m_objectMatrix;
+
+	std::vector<std::unique_ptr<EvaluationWorker>> m_workers;
+
+	QSize m_workingResolution;
+	bool m_silhouetteOnly;
+	float m_levelOfDetailTolerance;
+};
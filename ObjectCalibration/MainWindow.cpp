@@ -1,11 +1,16 @@
 #include "MainWindow.h"
 
+#include <memory>
+
 #include <QFileDialog>
 #include <QInputDialog>
 #include <QMessageBox>
 
 #include "BundleAdjustment.h"
+#include "EvaluationContextPool.h"
+#include "SilhouetteAlignment.h"
 #include "Similarity.h"
+#include "SoftwareRenderer.h"
 
 MainWindow::MainWindow(QWidget *parent)
 	: QMainWindow(parent)
@@ -34,6 +39,27 @@ void MainWindow::render()
 	{
 		const auto fileList = directory.entryInfoList(QStringList() << "*.png", QDir::Files);
 
+		// Offscreen contexts evaluating the poses of the gradient concurrently
+		EvaluationContextPool pool(ui.viewerWidget->object(), ui.viewerWidget->objectMatrix());
+		Renderer* renderer = &pool;
+
+		// Without OpenGL 4.3 offscreen contexts, the poses are evaluated by the rasterizer on the CPU
+		std::unique_ptr<SoftwareRenderer> softwareRenderer;
+		if (!pool.isValid())
+		{
+			qWarning() << "Evaluating the poses on the CPU";
+			softwareRenderer = std::make_unique<SoftwareRenderer>(ui.viewerWidget->object(), ui.viewerWidget->objectMatrix());
+			renderer = softwareRenderer.get();
+		}
+
+		// Soft silhouettes for the analytic gradient of the coarse levels
+		DifferentiableRenderer differentiableRenderer(ui.viewerWidget->object(), ui.viewerWidget->objectMatrix());
+
+		// Values of the objective function, kept on disk on demand to reuse them when running again on the same images
+		EvaluationCache evaluationCache;
+		evaluationCache.setObject(ui.viewerWidget->object(), ui.viewerWidget->objectMatrix());
+		evaluationCache.setPersistent(ui.actionPersistentEvaluations->isChecked());
+
 		for (const auto& file : fileList)
 		{
 			// Read parameters in txt files
@@ -48,8 +74,19 @@ void MainWindow::render()
 
 				const QImage targetImage(file.canonicalFilePath());
 				
-				const auto optimPose = runBundleAdjustment(ui.viewerWidget, targetImage, predPose);
-				// const auto optimPose = predPose;
+				// Coarse pose from the silhouettes, the refinement only has to correct what remains: the moments give
+				// the depth and the in-plane rotation, then the correlation the translation on the image
+				const auto correctedPose = alignSilhouetteMoments(renderer, targetImage, predPose);
+
+				// The moments can be misled by a wrong silhouette, the prediction is kept when they do not improve it
+				const auto momentsPose = renderer->renderAndComputeSimilarity(correctedPose) > renderer->renderAndComputeSimilarity(predPose)
+				                       ? correctedPose
+				                       : predPose;
+				const auto alignedPose = alignSilhouette(renderer, targetImage, momentsPose);
+
+				const auto optimPose = runBundleAdjustmentPyramid(renderer, targetImage, alignedPose,
+				                                                  defaultPyramidLevels(), &differentiableRenderer,
+				                                                  &evaluationCache);
 
 				// Compare optimized pose to ground truth
 				predAvgMaxTranslationError += maxTranslationError(truePose, predPose);
@@ -64,10 +101,20 @@ void MainWindow::render()
 
 				// Save optimization 
 				savePose(optimPose, directory.absoluteFilePath(file.completeBaseName() + "_optim.txt"));
+
+				// The frame buffer of the widget follows the resolution of the target
+				ui.viewerWidget->setTargetImage(targetImage);
+
 				// Render each image and the error maps in a separate folder
-				const auto optimImage = ui.viewerWidget->renderToImage(optimPose);
+				// Both renders are queued before waiting for the first readback
+				const auto optimReadback = ui.viewerWidget->renderAsync(optimPose);
+				const auto predReadback = ui.viewerWidget->renderAsync(predPose);
+
+				const auto optimImage = ui.viewerWidget->mapReadback(optimReadback).toImage();
+				ui.viewerWidget->releaseReadback(optimReadback);
 				optimImage.save(directory.absoluteFilePath(file.completeBaseName() + "_optim.png"));
-				const auto predImage = ui.viewerWidget->renderToImage(predPose);
+				const auto predImage = ui.viewerWidget->mapReadback(predReadback).toImage();
+				ui.viewerWidget->releaseReadback(predReadback);
 				predImage.save(directory.absoluteFilePath(file.completeBaseName() + "_pred.png"));
 				const auto errorImage = mseSimilarityErrorMap(optimImage, targetImage);
 				errorImage.save(directory.absoluteFilePath(file.completeBaseName() + "_rror.png"));
@@ -1,5 +1,12 @@
 #pragma once
 
+#include <cassert>
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 template<typename T>
 const T& clamp(const T& v, const T& lo, const T& hi)
 {
@@ -18,3 +25,35 @@ const T& clamp(const T& v, const T& lo, const T& hi)
 		return v;
 	}
 }
+
+/**
+ * \brief Count the number of bits set in a 64 bits word
+ * \param x A 64 bits word
+ * \return The number of bits set
+ */
+inline int popcount64(uint64_t x)
+{
+#if defined(_MSC_VER)
+	return int(__popcnt64(x));
+#else
+	return __builtin_popcountll(x);
+#endif
+}
+
+/**
+ * \brief Return the index of the lowest bit set in a non-zero 64 bits word
+ * \param x A non-zero 64 bits word
+ * \return The index of the lowest bit set
+ */
+inline int countTrailingZeros64(uint64_t x)
+{
+	assert(x != 0);
+
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return int(index);
+#else
+	return __builtin_ctzll(x);
+#endif
+}
@@ -2,9 +2,15 @@
 
 #include <QDebug>
 #include <QFileInfo>
-#include <QDir>
+#include <QVector4D>
 
-#include "OBJ_Loader.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "MeshCache.h"
+#include "MeshSimplification.h"
+#include "ObjReader.h"
 
 Mesh::Mesh(std::vector<QVector3D> vertices,
 	       std::vector<QVector3D> uvs,
@@ -12,10 +18,13 @@ Mesh::Mesh(std::vector<QVector3D> vertices,
 	       QImage texture) :
 	m_vertices(std::move(vertices)),
 	m_uvs(std::move(uvs)),
-	m_indices(std::move(indices)),
-	m_texture(std::move(texture))
+	m_indices(std::move(indices))
 {
-	
+	setTexture(texture);
+	computeBoundingBox();
+	buildLevelsOfDetail();
+	optimizeVertexOrder();
+	packVertexData();
 }
 
 void Mesh::reset()
@@ -23,85 +32,325 @@ void Mesh::reset()
 	m_vertices.clear();
 	m_uvs.clear();
 	m_indices.clear();
-	m_texture = QImage();
+	m_textureLevels.clear();
+	m_boundingBoxMin = QVector3D();
+	m_boundingBoxMax = QVector3D();
+	m_levelOfDetailIndices.clear();
+	m_levelsOfDetail = { { 0, 0, 0.0f } };
+	m_vertexFormat = VertexFormat::FloatUv;
+	m_vertexData.clear();
+	m_cache.reset();
 }
 
 bool Mesh::load(const std::string& filename)
 {
-	// Initialize Loader
-	objl::Loader loader;
+	const auto objFilename = QString::fromStdString(filename);
 
-	const bool isLoaded = loader.LoadFile(filename);
-	
-	if (!isLoaded)
+	// The cache is keyed by the contents of the OBJ and MTL files, not by their paths
+	bool hashed = false;
+	const auto sourceHash = MeshCache::hashSource(objFilename, &hashed);
+	const auto cacheFilename = MeshCache::cacheFilename(sourceHash);
+
+	if (hashed)
 	{
-		qWarning() << "Could not load the OBJ file " << QString::fromStdString(filename);
-		return false;
+		auto cache = std::make_shared<MeshCache>();
+
+		if (cache->open(cacheFilename, sourceHash))
+		{
+			loadCache(std::move(cache));
+			return true;
+		}
 	}
 
-	// Only load the first mesh
-	auto currentMesh = loader.LoadedMeshes.front();
+	ObjData obj;
+
+	if (!readObj(filename, obj))
+	{
+		qWarning() << "Could not load the OBJ file " << objFilename;
+		return false;
+	}
 
 	reset();
-	
-	for (const auto& vertex : currentMesh.Vertices)
+
+	// All the objects of the file are loaded in the same mesh
+	m_vertices = std::move(obj.vertices);
+	m_uvs = std::move(obj.uvs);
+	m_indices = std::move(obj.indices);
+
+	// Only one texture is rendered, the one of the first material which has one
+	QString textureFilename;
+
+	for (const auto& group : obj.groups)
 	{
-		m_vertices.emplace_back(
-			vertex.Position.X,
-			vertex.Position.Y,
-			vertex.Position.Z
-		);
+		if (group.material < 0)
+		{
+			continue;
+		}
 
-		m_uvs.emplace_back(
-			vertex.TextureCoordinate.X,
-			vertex.TextureCoordinate.Y,
-			0.0
-		);
+		const auto& material = obj.materials[group.material];
+		const auto& texture = material.ambientTexture.empty() ? material.diffuseTexture : material.ambientTexture;
+		const auto groupTextureFilename = QString::fromStdString(texture);
+
+		if (texture.empty() || !QFileInfo(groupTextureFilename).exists())
+		{
+			continue;
+		}
+
+		if (textureFilename.isEmpty())
+		{
+			textureFilename = groupTextureFilename;
+			setTexture(QImage(textureFilename));
+		}
+		else if (groupTextureFilename != textureFilename)
+		{
+			qWarning() << "Only the texture of the first material is used, ignoring " << groupTextureFilename;
+		}
+	}
+
+	computeBoundingBox();
+	buildLevelsOfDetail();
+	optimizeVertexOrder();
+	packVertexData();
+
+	if (hashed && !MeshCache::write(cacheFilename, sourceHash, textureFilename, *this))
+	{
+		qWarning() << "Could not write the mesh cache " << cacheFilename;
 	}
 
-	for (unsigned int index : currentMesh.Indices)
+	return true;
+}
+
+void Mesh::loadCache(std::shared_ptr<const MeshCache> cache)
+{
+	reset();
+
+	// The CPU side (bounding box, software renderer) keeps its own copy of the vertices
+	m_vertexFormat = cache->vertexFormat();
+	unpackVertices(cache->vertexData(), cache->vertexCount(), m_vertexFormat, m_vertices, m_uvs);
+
+	m_levelsOfDetail = cache->levelsOfDetail();
+
+	const auto& fullResolution = m_levelsOfDetail.front();
+	m_indices.assign(cache->indices() + fullResolution.firstIndex,
+	                 cache->indices() + fullResolution.firstIndex + fullResolution.indexCount);
+
+	m_textureLevels = cache->textureLevels();
+	m_cache = std::move(cache);
+
+	computeBoundingBox();
+}
+
+const unsigned char* Mesh::vertexData() const
+{
+	return m_cache ? m_cache->vertexData() : m_vertexData.data();
+}
+
+const unsigned int* Mesh::levelOfDetailIndexData() const
+{
+	return m_cache ? m_cache->indices() : m_levelOfDetailIndices.data();
+}
+
+std::size_t Mesh::levelOfDetailIndexCount() const
+{
+	return m_cache ? m_cache->indexCount() : m_levelOfDetailIndices.size();
+}
+
+void Mesh::optimizeVertexOrder()
+{
+	const auto vertexCount = m_vertices.size();
+
+	// Each level of detail is a separate draw
+	for (const auto& level : m_levelsOfDetail)
 	{
-		m_indices.push_back(index);
+		optimizeVertexCache(m_levelOfDetailIndices.data() + level.firstIndex, level.indexCount, vertexCount);
 	}
 
-	// Load the texture
-	const auto textureFile = QString::fromStdString(currentMesh.MeshMaterial.map_Ka);
-	const QFileInfo objFileInfo(QString::fromStdString(filename));
-	const auto directory = objFileInfo.dir();
+	// The coarser levels only use vertices of the full resolution
+	const auto& fullResolution = m_levelsOfDetail.front();
+	const std::vector<unsigned int> fullResolutionIndices(m_levelOfDetailIndices.begin() + fullResolution.firstIndex,
+	                                                      m_levelOfDetailIndices.begin() + fullResolution.firstIndex + fullResolution.indexCount);
+	const auto remap = optimizeVertexFetch(fullResolutionIndices, vertexCount);
 
-	if (directory.exists(textureFile))
+	std::vector<QVector3D> vertices(vertexCount);
+	std::vector<QVector3D> uvs(vertexCount);
+
+	for (std::size_t i = 0; i < vertexCount; i++)
 	{
-		m_texture = QImage(directory.filePath(textureFile));
+		vertices[remap[i]] = m_vertices[i];
+		uvs[remap[i]] = m_uvs[i];
 	}
 
-	return true;
+	m_vertices = std::move(vertices);
+	m_uvs = std::move(uvs);
+
+	for (auto& index : m_levelOfDetailIndices)
+	{
+		index = remap[index];
+	}
+
+	m_indices.assign(m_levelOfDetailIndices.begin() + fullResolution.firstIndex,
+	                 m_levelOfDetailIndices.begin() + fullResolution.firstIndex + fullResolution.indexCount);
 }
 
-std::vector<QVector3D> Mesh::verticesAndUv() const
+void Mesh::packVertexData()
 {
-	std::vector<QVector3D> data;
+	// The UV coordinates are quantized like the vertex buffer, for the software renderer
+	m_vertexFormat = selectVertexFormat(m_uvs);
+	m_vertexData = packVertices(m_vertices, m_uvs, m_vertexFormat);
+}
 
-	data.reserve(m_vertices.size() + m_uvs.size());
+void Mesh::setTexture(const QImage& texture)
+{
+	m_textureLevels.clear();
 
-	auto itVertices = m_vertices.cbegin();
-	auto itUvs = m_uvs.cbegin();
-	
-	while (itVertices != m_vertices.cend() || itUvs != m_uvs.cend())
+	// Same orientation as the OpenGL texture
+	if (!texture.isNull())
+	{
+		m_textureLevels.push_back(texture.convertToFormat(QImage::Format_RGBA8888).mirrored());
+	}
+}
+
+void Mesh::computeBoundingBox()
+{
+	if (m_vertices.empty())
+	{
+		m_boundingBoxMin = QVector3D();
+		m_boundingBoxMax = QVector3D();
+		return;
+	}
+
+	m_boundingBoxMin = m_vertices.front();
+	m_boundingBoxMax = m_vertices.front();
+
+	for (const auto& vertex : m_vertices)
+	{
+		m_boundingBoxMin.setX(std::min(m_boundingBoxMin.x(), vertex.x()));
+		m_boundingBoxMin.setY(std::min(m_boundingBoxMin.y(), vertex.y()));
+		m_boundingBoxMin.setZ(std::min(m_boundingBoxMin.z(), vertex.z()));
+		m_boundingBoxMax.setX(std::max(m_boundingBoxMax.x(), vertex.x()));
+		m_boundingBoxMax.setY(std::max(m_boundingBoxMax.y(), vertex.y()));
+		m_boundingBoxMax.setZ(std::max(m_boundingBoxMax.z(), vertex.z()));
+	}
+}
+
+QRect Mesh::projectedBoundingBox(const QMatrix4x4& pvmMatrix, const QRect& viewport) const
+{
+	float minX = std::numeric_limits<float>::max();
+	float minY = std::numeric_limits<float>::max();
+	float maxX = std::numeric_limits<float>::lowest();
+	float maxY = std::numeric_limits<float>::lowest();
+
+	for (int corner = 0; corner < 8; corner++)
 	{
-		if (itVertices != m_vertices.cend())
+		const QVector4D point(
+			(corner & 1) ? m_boundingBoxMax.x() : m_boundingBoxMin.x(),
+			(corner & 2) ? m_boundingBoxMax.y() : m_boundingBoxMin.y(),
+			(corner & 4) ? m_boundingBoxMax.z() : m_boundingBoxMin.z(),
+			1.0
+		);
+
+		const auto clip = pvmMatrix * point;
+
+		// The projection of a corner behind the camera is not bounded
+		if (clip.w() <= 0.0f)
 		{
-			data.push_back(*itVertices);
-			++itVertices;
+			return viewport;
 		}
 
-		if (itUvs != m_uvs.cend())
+		// From normalized device coordinates to window coordinates
+		const float x = viewport.x() + (0.5f * clip.x() / clip.w() + 0.5f) * viewport.width();
+		const float y = viewport.y() + (0.5f * clip.y() / clip.w() + 0.5f) * viewport.height();
+
+		minX = std::min(minX, x);
+		minY = std::min(minY, y);
+		maxX = std::max(maxX, x);
+		maxY = std::max(maxY, y);
+	}
+
+	// Keep a margin of one pixel for the rasterization rules
+	const QRect region(QPoint(int(std::floor(minX)) - 1, int(std::floor(minY)) - 1),
+	                   QPoint(int(std::ceil(maxX)) + 1, int(std::ceil(maxY)) + 1));
+
+	return region.intersected(viewport);
+}
+
+void Mesh::buildLevelsOfDetail()
+{
+	// The full resolution comes first
+	m_levelOfDetailIndices = m_indices;
+	m_levelsOfDetail = { { 0, m_indices.size(), 0.0f } };
+
+	std::vector<std::size_t> triangleCounts;
+	for (auto count = m_indices.size() / 3 / LevelOfDetailReduction;
+	     count >= MinLevelOfDetailTriangles;
+	     count /= LevelOfDetailReduction)
+	{
+		triangleCounts.push_back(count);
+	}
+
+	if (triangleCounts.empty())
+	{
+		return;
+	}
+
+	// Identical vertices would be locked as borders, only the UV seams must stay apart
+	const auto weldedIndices = weldVertices(m_vertices, m_uvs, m_indices);
+
+	for (const auto& level : simplifyMesh(m_vertices, weldedIndices, triangleCounts))
+	{
+		// Stop when the simplification is blocked by the locked vertices
+		const auto& previous = m_levelsOfDetail.back();
+		if (level.indices.size() * LevelOfDetailReduction > 3 * previous.indexCount)
 		{
-			data.push_back(*itUvs);
-			++itUvs;
+			break;
 		}
+
+		m_levelsOfDetail.push_back({ m_levelOfDetailIndices.size(), level.indices.size(), level.error });
+		m_levelOfDetailIndices.insert(m_levelOfDetailIndices.end(), level.indices.begin(), level.indices.end());
 	}
-	
-	return data;
+}
+
+int Mesh::selectLevelOfDetail(const QMatrix4x4& pvmMatrix, const QRect& viewport, float tolerance) const
+{
+	if (m_levelsOfDetail.size() <= 1 || viewport.isEmpty())
+	{
+		return 0;
+	}
+
+	// Closest corner of the bounding box to the camera
+	float minW = std::numeric_limits<float>::max();
+
+	for (int corner = 0; corner < 8; corner++)
+	{
+		const QVector4D point(
+			(corner & 1) ? m_boundingBoxMax.x() : m_boundingBoxMin.x(),
+			(corner & 2) ? m_boundingBoxMax.y() : m_boundingBoxMin.y(),
+			(corner & 4) ? m_boundingBoxMax.z() : m_boundingBoxMin.z(),
+			1.0
+		);
+
+		minW = std::min(minW, QVector4D::dotProduct(pvmMatrix.row(3), point));
+	}
+
+	// The mesh crosses the camera plane, the error on the screen is not bounded
+	if (minW <= 0.0f)
+	{
+		return 0;
+	}
+
+	// Largest length in pixels of a unit vector of the mesh, at the closest depth
+	const auto rowX = pvmMatrix.row(0).toVector3D();
+	const auto rowY = pvmMatrix.row(1).toVector3D();
+	const float pixelsPerUnit = 0.5f * std::max(viewport.width() * rowX.length(), viewport.height() * rowY.length()) / minW;
+
+	int level = 0;
+	while (level + 1 < int(m_levelsOfDetail.size())
+	    && m_levelsOfDetail[level + 1].error * pixelsPerUnit <= tolerance)
+	{
+		level++;
+	}
+
+	return level;
 }
 
 Mesh Mesh::createCheckerBoardPattern()
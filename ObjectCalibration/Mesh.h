@@ -1,14 +1,54 @@
 #pragma once
 
+#include <cstddef>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include <QVector3D>
+#include <QMatrix4x4>
 #include <QImage>
+#include <QRect>
+
+#include "VertexLayout.h"
+
+/**
+ * \brief Simplified version of a mesh, as a range of the shared index buffer
+ */
+struct LevelOfDetail
+{
+	/**
+	 * \brief Position of the first index of the level in the index buffer
+	 */
+	std::size_t firstIndex;
+
+	/**
+	 * \brief Number of indices of the level, three per triangle
+	 */
+	std::size_t indexCount;
+
+	/**
+	 * \brief Upper bound of the distance to the full resolution surface, in the units of the mesh
+	 */
+	float error;
+};
+
+class MeshCache;
 
 class Mesh
 {
 public:
 
+	/**
+	 * \brief Each level of detail has this many times fewer triangles than the previous one
+	 */
+	static constexpr int LevelOfDetailReduction = 4;
+
+	/**
+	 * \brief No level of detail is built with fewer triangles than this
+	 */
+	static constexpr std::size_t MinLevelOfDetailTriangles = 256;
+
 	Mesh() = default;
 
 	explicit Mesh(std::vector<QVector3D> vertices,
@@ -22,7 +62,10 @@ public:
 	void reset();
 	
 	/**
-	 * \brief Load an OBJ mesh using Assimp
+	 * \brief Load all the objects of an OBJ file in the mesh
+	 *
+	 * The loaded mesh is saved in a MeshCache, which is mapped instead of parsing the file
+	 * the next times it is loaded.
 	 * \param filename Path to an OBJ file
 	 * \return True if loading was successful
 	 */
@@ -31,13 +74,59 @@ public:
 	const std::vector<QVector3D>& vertices() const { return m_vertices; }
 	const std::vector<QVector3D>& uvs() const { return m_uvs; }
 	const std::vector<unsigned int>& indices() const { return m_indices; }
-	const QImage& texture() const { return m_texture; }
 
 	/**
-	 * \brief Output the vertices and UV coordinates interleaved in a vector
-	 * \return The vertices and UV coordinates in a vector
+	 * \brief Mipmap levels of the texture, rows in OpenGL order (from the bottom to the top)
+	 *
+	 * The images may wrap the pages of the mapped cache, they are only valid as long as the mesh.
+	 * \return The levels from the full resolution to the smallest, or none if the mesh has no texture
+	 */
+	const std::vector<QImage>& textureLevels() const { return m_textureLevels; }
+
+	const QVector3D& boundingBoxMin() const { return m_boundingBoxMin; }
+	const QVector3D& boundingBoxMax() const { return m_boundingBoxMax; }
+
+	/**
+	 * \brief Compute the region of a viewport covered by the projection of the bounding box
+	 * \param pvmMatrix Projection * View * Model matrix
+	 * \param viewport The viewport in window coordinates
+	 * \return The region covered by the mesh, or the whole viewport if the box crosses the camera plane
+	 */
+	QRect projectedBoundingBox(const QMatrix4x4& pvmMatrix, const QRect& viewport) const;
+
+	/**
+	 * \brief Indices of all the levels of detail, one after the other, the first level is indices()
+	 */
+	const unsigned int* levelOfDetailIndexData() const;
+
+	/**
+	 * \brief Number of indices of all the levels of detail
+	 */
+	std::size_t levelOfDetailIndexCount() const;
+
+	/**
+	 * \brief Levels of detail, from the full resolution to the coarsest
 	 */
-	std::vector<QVector3D> verticesAndUv() const;
+	const std::vector<LevelOfDetail>& levelsOfDetail() const { return m_levelsOfDetail; }
+
+	/**
+	 * \brief Select the coarsest level of detail whose error stays under a tolerance on the screen
+	 * \param pvmMatrix Projection * View * Model matrix
+	 * \param viewport The viewport in window coordinates
+	 * \param tolerance Largest error accepted, in pixels
+	 * \return The index of the level in levelsOfDetail()
+	 */
+	int selectLevelOfDetail(const QMatrix4x4& pvmMatrix, const QRect& viewport, float tolerance) const;
+
+	/**
+	 * \brief Format of the vertices in vertexData()
+	 */
+	VertexFormat vertexFormat() const { return m_vertexFormat; }
+
+	/**
+	 * \brief Vertices and UV coordinates packed like the vertex buffer, in vertexFormat()
+	 */
+	const unsigned char* vertexData() const;
 
 	/**
 	 * \brief Create and return a checkerboard pattern mesh
@@ -47,11 +136,57 @@ public:
 	
 private:
 
+	/**
+	 * \brief Update the axis aligned bounding box of the vertices
+	 */
+	void computeBoundingBox();
+
+	/**
+	 * \brief Build the chain of simplified meshes from the indices of the mesh
+	 */
+	void buildLevelsOfDetail();
+
+	/**
+	 * \brief Reorder the triangles of each level of detail for the post-transform cache,
+	 *        then the vertices in the order the triangles fetch them
+	 */
+	void optimizeVertexOrder();
+
+	/**
+	 * \brief Pack the vertices and UV coordinates in the most compact format for the vertex buffer
+	 */
+	void packVertexData();
+
+	/**
+	 * \brief Set the texture from an image whose rows go from the top to the bottom
+	 */
+	void setTexture(const QImage& texture);
+
+	/**
+	 * \brief Use the data of a mapped cache instead of the parsed mesh
+	 * \param cache An open cache
+	 */
+	void loadCache(std::shared_ptr<const MeshCache> cache);
+
 	std::vector<QVector3D> m_vertices;
 	std::vector<QVector3D> m_uvs;
 
 	std::vector<unsigned int> m_indices;
 
-	QImage m_texture;
+	std::vector<QImage> m_textureLevels;
+
+	QVector3D m_boundingBoxMin;
+	QVector3D m_boundingBoxMax;
+
+	// There is always at least the full resolution level, even empty
+	std::vector<unsigned int> m_levelOfDetailIndices;
+	std::vector<LevelOfDetail> m_levelsOfDetail = { { 0, 0, 0.0f } };
+
+	VertexFormat m_vertexFormat = VertexFormat::FloatUv;
+	std::vector<unsigned char> m_vertexData;
+
+	// When the mesh is loaded from a cache, the packed vertices, the indices of the levels
+	// of detail and the texture are read in its mapped pages instead of the vectors above
+	std::shared_ptr<const MeshCache> m_cache;
 };
 
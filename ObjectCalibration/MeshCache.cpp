@@ -0,0 +1,460 @@
+#include "MeshCache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <vector>
+
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+namespace
+{
+	constexpr char Magic[8] = { 'O', 'C', 'M', 'E', 'S', 'H', '\0', '\0' };
+
+	// Increment when the layout of the file or the content of a section changes
+	constexpr quint32 Version = 3;
+
+	// Sections start on multiples of this many bytes
+	constexpr quint64 SectionAlignment = 64;
+
+	/**
+	 * \brief Header at the beginning of a cache file, the offsets are in bytes from the beginning
+	 */
+	struct Header
+	{
+		char magic[8];
+		quint32 version;
+
+		// Parameters of the levels of detail, the levels are built again when they change
+		quint32 levelOfDetailReduction;
+		quint64 minLevelOfDetailTriangles;
+
+		// Sources of the mesh
+		quint64 sourceHash;
+		qint64 textureFileSize;
+		qint64 textureFileModified;
+		quint64 textureFilenameOffset;
+		quint64 textureFilenameSize;
+
+		// Packed vertices, VertexFormat and size in bytes of a vertex
+		quint32 vertexFormat;
+		quint32 vertexStride;
+		quint64 vertexCount;
+		quint64 vertexOffset;
+
+		// Indices of all the levels of detail
+		quint64 indexCount;
+		quint64 indexOffset;
+
+		quint64 levelCount;
+		quint64 levelOffset;
+
+		// RGBA8 texels in OpenGL order, the mipmap levels one after the other
+		qint32 textureWidth;
+		qint32 textureHeight;
+		quint32 textureLevelCount;
+		quint32 reserved;
+		quint64 textureOffset;
+
+		// To detect a truncated file
+		quint64 fileSize;
+	};
+
+	/**
+	 * \brief Level of detail in the file, with a fixed size
+	 */
+	struct StoredLevelOfDetail
+	{
+		quint64 firstIndex;
+		quint64 indexCount;
+		float error;
+		quint32 reserved;
+	};
+
+	quint64 alignSection(quint64 offset)
+	{
+		return (offset + SectionAlignment - 1) / SectionAlignment * SectionAlignment;
+	}
+
+	/**
+	 * \brief Check that a section is inside the file
+	 */
+	bool isInside(quint64 offset, quint64 size, quint64 fileSize)
+	{
+		return offset <= fileSize && size <= fileSize - offset;
+	}
+
+	/**
+	 * \brief Check that the levels of detail are ranges of the index buffer and the indices refer to stored vertices
+	 *
+	 * The sections must already be inside the file. The mesh is drawn straight from the mapped file,
+	 * a range or an index out of bounds would read past the buffers of the GPU.
+	 */
+	bool hasValidIndices(const uchar* data, quint64 indexOffset, quint64 indexCount, quint64 levelOffset, quint64 levelCount,
+	                     quint64 vertexCount)
+	{
+		const auto levels = reinterpret_cast<const StoredLevelOfDetail*>(data + levelOffset);
+
+		for (quint64 i = 0; i < levelCount; i++)
+		{
+			if (levels[i].firstIndex > indexCount || levels[i].indexCount > indexCount - levels[i].firstIndex)
+			{
+				return false;
+			}
+		}
+
+		const auto indices = reinterpret_cast<const unsigned int*>(data + indexOffset);
+
+		return std::all_of(indices, indices + indexCount, [vertexCount](unsigned int index)
+		{
+			return index < vertexCount;
+		});
+	}
+
+	/**
+	 * \brief Size in bytes of the texture with all its mipmap levels
+	 */
+	quint64 textureSize(qint32 width, qint32 height, quint32 levelCount)
+	{
+		quint64 size = 0;
+
+		for (quint32 level = 0; level < levelCount; level++)
+		{
+			size += 4 * quint64(std::max(width >> level, 1)) * quint64(std::max(height >> level, 1));
+		}
+
+		return size;
+	}
+
+	/**
+	 * \brief Continue a 64 bits FNV-1a hash with the contents of a file
+	 * \param filename Path to the file
+	 * \param hash Hash to continue
+	 * \param materialLibraries If not null, receives the names of the mtllib lines of the file
+	 * \return False if the file cannot be read
+	 */
+	bool hashFile(const QString& filename, quint64& hash, std::vector<QString>* materialLibraries)
+	{
+		QFile file(filename);
+
+		if (!file.open(QIODevice::ReadOnly))
+		{
+			return false;
+		}
+
+		// Mapping avoids copying the whole file in a buffer, an empty file cannot be mapped
+		const auto size = file.size();
+		const uchar* data = size > 0 ? file.map(0, size) : nullptr;
+
+		if (size > 0 && !data)
+		{
+			return false;
+		}
+
+		for (qint64 i = 0; i < size; i++)
+		{
+			hash ^= data[i];
+			hash *= 1099511628211ull;
+		}
+
+		if (materialLibraries)
+		{
+			const char* p = reinterpret_cast<const char*>(data);
+			const char* end = p + size;
+
+			while (p < end)
+			{
+				const char* lineEnd = std::find(p, end, '\n');
+				const QByteArray line = QByteArray::fromRawData(p, int(lineEnd - p)).trimmed();
+
+				if (line.startsWith("mtllib") && line.size() > 6 && std::isspace(static_cast<unsigned char>(line[6])))
+				{
+					materialLibraries->push_back(QString::fromUtf8(line.mid(6).trimmed()));
+				}
+
+				p = lineEnd + (lineEnd < end ? 1 : 0);
+			}
+		}
+
+		return true;
+	}
+}
+
+MeshCache::~MeshCache()
+{
+	close();
+}
+
+quint64 MeshCache::hashSource(const QString& objFilename, bool* ok)
+{
+	quint64 hash = 14695981039346656037ull;
+	std::vector<QString> materialLibraries;
+
+	if (!hashFile(objFilename, hash, &materialLibraries))
+	{
+		*ok = false;
+		return hash;
+	}
+
+	// Editing a material invalidates the cache, a missing MTL file adds nothing like the reader ignores it
+	const auto directory = QFileInfo(objFilename).dir();
+
+	for (const auto& library : materialLibraries)
+	{
+		hashFile(directory.filePath(library), hash, nullptr);
+	}
+
+	*ok = true;
+	return hash;
+}
+
+QString MeshCache::cacheFilename(quint64 sourceHash)
+{
+	const QDir directory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+
+	return directory.filePath(QString("meshes/%1.mesh").arg(sourceHash, 16, 16, QChar('0')));
+}
+
+bool MeshCache::write(const QString& filename, quint64 sourceHash, const QString& textureFilename, const Mesh& mesh)
+{
+	const auto& levels = mesh.levelsOfDetail();
+	const auto& textureLevels = mesh.textureLevels();
+	const QByteArray textureFilenameUtf8 = textureFilename.toUtf8();
+
+	Header header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = Version;
+	header.levelOfDetailReduction = Mesh::LevelOfDetailReduction;
+	header.minLevelOfDetailTriangles = Mesh::MinLevelOfDetailTriangles;
+	header.sourceHash = sourceHash;
+
+	if (!textureFilename.isEmpty())
+	{
+		const QFileInfo textureInfo(textureFilename);
+		header.textureFileSize = textureInfo.size();
+		header.textureFileModified = textureInfo.lastModified().toMSecsSinceEpoch();
+	}
+
+	header.textureFilenameOffset = alignSection(sizeof(Header));
+	header.textureFilenameSize = quint64(textureFilenameUtf8.size());
+
+	header.vertexFormat = quint32(mesh.vertexFormat());
+	header.vertexStride = quint32(vertexLayout(mesh.vertexFormat()).stride);
+	header.vertexCount = mesh.vertices().size();
+	header.vertexOffset = alignSection(header.textureFilenameOffset + header.textureFilenameSize);
+
+	header.indexCount = mesh.levelOfDetailIndexCount();
+	header.indexOffset = alignSection(header.vertexOffset + header.vertexCount * header.vertexStride);
+
+	header.levelCount = levels.size();
+	header.levelOffset = alignSection(header.indexOffset + header.indexCount * sizeof(unsigned int));
+
+	if (!textureLevels.empty())
+	{
+		header.textureWidth = textureLevels.front().width();
+		header.textureHeight = textureLevels.front().height();
+		header.textureLevelCount = quint32(textureLevels.size());
+	}
+
+	header.textureOffset = alignSection(header.levelOffset + header.levelCount * sizeof(StoredLevelOfDetail));
+	header.fileSize = header.textureOffset + textureSize(header.textureWidth, header.textureHeight, header.textureLevelCount);
+
+	QDir().mkpath(QFileInfo(filename).absolutePath());
+
+	// The file only replaces a previous cache when it is complete
+	QSaveFile file(filename);
+
+	if (!file.open(QIODevice::WriteOnly))
+	{
+		return false;
+	}
+
+	const auto writeSection = [&file](quint64 offset, const void* data, quint64 size)
+	{
+		// Padding up to the beginning of the section
+		const QByteArray padding(int(offset - quint64(file.pos())), '\0');
+
+		return file.write(padding) == padding.size()
+		    && file.write(reinterpret_cast<const char*>(data), qint64(size)) == qint64(size);
+	};
+
+	std::vector<StoredLevelOfDetail> storedLevels;
+	for (const auto& level : levels)
+	{
+		storedLevels.push_back({ level.firstIndex, level.indexCount, level.error, 0 });
+	}
+
+	bool success = writeSection(0, &header, sizeof(header))
+	            && writeSection(header.textureFilenameOffset, textureFilenameUtf8.constData(), header.textureFilenameSize)
+	            && writeSection(header.vertexOffset, mesh.vertexData(), header.vertexCount * header.vertexStride)
+	            && writeSection(header.indexOffset, mesh.levelOfDetailIndexData(), header.indexCount * sizeof(unsigned int))
+	            && writeSection(header.levelOffset, storedLevels.data(), storedLevels.size() * sizeof(StoredLevelOfDetail));
+
+	quint64 textureOffset = header.textureOffset;
+
+	for (const auto& level : textureLevels)
+	{
+		if (!success)
+		{
+			break;
+		}
+
+		const auto image = level.convertToFormat(QImage::Format_RGBA8888);
+
+		// Rows of QImage are padded to 4 bytes, which RGBA8 texels already are
+		const quint64 levelSize = quint64(image.bytesPerLine()) * quint64(image.height());
+		success = writeSection(textureOffset, image.constBits(), levelSize);
+		textureOffset += levelSize;
+	}
+
+	// Padding up to the size in the header when the last sections are empty
+	success = success && writeSection(header.fileSize, nullptr, 0);
+
+	return success && file.commit();
+}
+
+bool MeshCache::open(const QString& filename, quint64 sourceHash)
+{
+	close();
+
+	m_file.setFileName(filename);
+
+	if (!m_file.open(QIODevice::ReadOnly) || m_file.size() < qint64(sizeof(Header)))
+	{
+		close();
+		return false;
+	}
+
+	m_data = m_file.map(0, m_file.size());
+
+	if (!m_data)
+	{
+		close();
+		return false;
+	}
+
+	const auto& header = *reinterpret_cast<const Header*>(m_data);
+	const auto fileSize = quint64(m_file.size());
+
+	const bool validHeader = std::memcmp(header.magic, Magic, sizeof(Magic)) == 0
+	                      && header.version == Version
+	                      && header.levelOfDetailReduction == quint32(Mesh::LevelOfDetailReduction)
+	                      && header.minLevelOfDetailTriangles == Mesh::MinLevelOfDetailTriangles
+	                      && header.sourceHash == sourceHash
+	                      && header.fileSize == fileSize
+	                      && header.levelCount > 0
+	                      && (header.vertexFormat == quint32(VertexFormat::FloatUv) || header.vertexFormat == quint32(VertexFormat::Unorm16Uv))
+	                      && header.vertexStride == quint32(vertexLayout(VertexFormat(header.vertexFormat)).stride)
+	                      && header.textureWidth >= 0
+	                      && header.textureHeight >= 0
+	                      && isInside(header.textureFilenameOffset, header.textureFilenameSize, fileSize)
+	                      && header.vertexCount <= fileSize / header.vertexStride
+	                      && header.indexCount <= fileSize / sizeof(unsigned int)
+	                      && header.levelCount <= fileSize / sizeof(StoredLevelOfDetail)
+	                      && isInside(header.vertexOffset, header.vertexCount * header.vertexStride, fileSize)
+	                      && isInside(header.indexOffset, header.indexCount * sizeof(unsigned int), fileSize)
+	                      && isInside(header.levelOffset, header.levelCount * sizeof(StoredLevelOfDetail), fileSize)
+	                      && isInside(header.textureOffset, textureSize(header.textureWidth, header.textureHeight, header.textureLevelCount), fileSize)
+	                      && hasValidIndices(m_data, header.indexOffset, header.indexCount, header.levelOffset, header.levelCount, header.vertexCount);
+
+	if (!validHeader)
+	{
+		close();
+		return false;
+	}
+
+	// The texture is decoded in the cache, it must be the same file as when the cache was written
+	const auto textureFilename = QString::fromUtf8(reinterpret_cast<const char*>(m_data + header.textureFilenameOffset),
+	                                               int(header.textureFilenameSize));
+
+	if (!textureFilename.isEmpty())
+	{
+		const QFileInfo textureInfo(textureFilename);
+
+		if (!textureInfo.exists()
+		 || textureInfo.size() != header.textureFileSize
+		 || textureInfo.lastModified().toMSecsSinceEpoch() != header.textureFileModified)
+		{
+			close();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void MeshCache::close()
+{
+	if (m_data)
+	{
+		m_file.unmap(const_cast<uchar*>(m_data));
+		m_data = nullptr;
+	}
+
+	m_file.close();
+}
+
+std::size_t MeshCache::vertexCount() const
+{
+	return reinterpret_cast<const Header*>(m_data)->vertexCount;
+}
+
+VertexFormat MeshCache::vertexFormat() const
+{
+	return VertexFormat(reinterpret_cast<const Header*>(m_data)->vertexFormat);
+}
+
+const unsigned char* MeshCache::vertexData() const
+{
+	return m_data + reinterpret_cast<const Header*>(m_data)->vertexOffset;
+}
+
+std::size_t MeshCache::indexCount() const
+{
+	return reinterpret_cast<const Header*>(m_data)->indexCount;
+}
+
+const unsigned int* MeshCache::indices() const
+{
+	return reinterpret_cast<const unsigned int*>(m_data + reinterpret_cast<const Header*>(m_data)->indexOffset);
+}
+
+std::vector<LevelOfDetail> MeshCache::levelsOfDetail() const
+{
+	const auto& header = *reinterpret_cast<const Header*>(m_data);
+	const auto storedLevels = reinterpret_cast<const StoredLevelOfDetail*>(m_data + header.levelOffset);
+
+	std::vector<LevelOfDetail> levels;
+
+	for (quint64 i = 0; i < header.levelCount; i++)
+	{
+		levels.push_back({ std::size_t(storedLevels[i].firstIndex), std::size_t(storedLevels[i].indexCount), storedLevels[i].error });
+	}
+
+	return levels;
+}
+
+std::vector<QImage> MeshCache::textureLevels() const
+{
+	const auto& header = *reinterpret_cast<const Header*>(m_data);
+
+	std::vector<QImage> levels;
+	const uchar* texels = m_data + header.textureOffset;
+
+	for (quint32 level = 0; level < header.textureLevelCount; level++)
+	{
+		const int width = std::max(header.textureWidth >> level, 1);
+		const int height = std::max(header.textureHeight >> level, 1);
+
+		// This constructor of QImage does not copy nor take ownership of the texels
+		levels.emplace_back(texels, width, height, 4 * width, QImage::Format_RGBA8888);
+		texels += 4 * std::size_t(width) * std::size_t(height);
+	}
+
+	return levels;
+}
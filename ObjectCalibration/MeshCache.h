@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <QFile>
+#include <QImage>
+#include <QString>
+
+#include "Mesh.h"
+
+/**
+ * \brief Binary copy of a loaded mesh, mapped in memory instead of being parsed
+ *
+ * The file holds the vertices and UV coordinates packed like the vertex buffer, the indices
+ * of all the levels of detail and the decoded texture in OpenGL order (rows from the bottom to the top),
+ * so the buffers and the texture are uploaded straight from the mapped pages.
+ * Cache files are named after a hash of the contents of the OBJ and MTL files, and are ignored when
+ * the texture file or the format of the cache changes.
+ */
+class MeshCache
+{
+public:
+
+	MeshCache() = default;
+	~MeshCache();
+
+	MeshCache(const MeshCache&) = delete;
+	MeshCache& operator=(const MeshCache&) = delete;
+
+	/**
+	 * \brief Hash the contents of an OBJ file and of its MTL files (64 bits FNV-1a)
+	 * \param objFilename Path to the OBJ file
+	 * \param ok Set to false if the OBJ file cannot be read
+	 * \return The hash of the files
+	 */
+	static quint64 hashSource(const QString& objFilename, bool* ok);
+
+	/**
+	 * \brief Path of the cache of a source file, in the cache directory of the application
+	 * \param sourceHash Hash of the contents of the source files
+	 */
+	static QString cacheFilename(quint64 sourceHash);
+
+	/**
+	 * \brief Write the cache of a mesh
+	 * \param filename Path of the cache file
+	 * \param sourceHash Hash of the contents of the OBJ and MTL files
+	 * \param textureFilename Path of the texture file, empty if the mesh has no texture
+	 * \param mesh The loaded mesh, with its levels of detail
+	 * \return True if the cache has been written
+	 */
+	static bool write(const QString& filename, quint64 sourceHash, const QString& textureFilename, const Mesh& mesh);
+
+	/**
+	 * \brief Map a cache file and check that it is still valid
+	 *
+	 * The ranges of the levels of detail and the indices are checked against the sizes stored in the file,
+	 * a corrupted file is rejected instead of being drawn.
+	 * \param filename Path of the cache file
+	 * \param sourceHash Hash of the contents of the OBJ and MTL files
+	 * \return True if the cache can be used
+	 */
+	bool open(const QString& filename, quint64 sourceHash);
+
+	/**
+	 * \brief Unmap the cache file
+	 */
+	void close();
+
+	bool isOpen() const { return m_data != nullptr; }
+
+	std::size_t vertexCount() const;
+
+	VertexFormat vertexFormat() const;
+
+	/**
+	 * \brief Vertices and UV coordinates packed in vertexFormat()
+	 */
+	const unsigned char* vertexData() const;
+
+	/**
+	 * \brief Number of indices of all the levels of detail
+	 */
+	std::size_t indexCount() const;
+
+	/**
+	 * \brief Indices of all the levels of detail, one after the other
+	 */
+	const unsigned int* indices() const;
+
+	std::vector<LevelOfDetail> levelsOfDetail() const;
+
+	/**
+	 * \brief Mipmap levels of the texture in OpenGL order, wrapping the mapped pages without copy
+	 * \return The levels, from the full resolution to the smallest, or none if the mesh has no texture
+	 */
+	std::vector<QImage> textureLevels() const;
+
+private:
+
+	QFile m_file;
+	const uchar* m_data = nullptr;
+};
@@ -0,0 +1,497 @@
+#include "MeshSimplification.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <queue>
+#include <unordered_map>
+
+namespace
+{
+	/**
+	 * \brief Symmetric 4 x 4 matrix of the squared distance to a set of planes
+	 */
+	struct Quadric
+	{
+		// a2, ab, ac, ad, b2, bc, bd, c2, cd, d2
+		double q[10] = {};
+
+		/**
+		 * \brief Quadric of the squared distance to the plane a x + b y + c z + d = 0, with a normalized normal
+		 */
+		static Quadric fromPlane(double a, double b, double c, double d)
+		{
+			Quadric quadric;
+			quadric.q[0] = a * a;
+			quadric.q[1] = a * b;
+			quadric.q[2] = a * c;
+			quadric.q[3] = a * d;
+			quadric.q[4] = b * b;
+			quadric.q[5] = b * c;
+			quadric.q[6] = b * d;
+			quadric.q[7] = c * c;
+			quadric.q[8] = c * d;
+			quadric.q[9] = d * d;
+			return quadric;
+		}
+
+		Quadric& operator+=(const Quadric& other)
+		{
+			for (int i = 0; i < 10; i++)
+			{
+				q[i] += other.q[i];
+			}
+			return *this;
+		}
+
+		/**
+		 * \brief Sum of the squared distances from a point to the planes
+		 */
+		double evaluate(const QVector3D& point) const
+		{
+			const double x = point.x();
+			const double y = point.y();
+			const double z = point.z();
+
+			return q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x
+			     + q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y
+			     + q[7] * z * z + 2.0 * q[8] * z
+			     + q[9];
+		}
+	};
+
+	/**
+	 * \brief Candidate collapse of the vertex from onto the vertex to
+	 *
+	 * The stamps are the versions of the two vertices when the cost was computed,
+	 * the candidate is outdated when one of them changed since.
+	 */
+	struct Collapse
+	{
+		double cost;
+		unsigned int from;
+		unsigned int to;
+		unsigned int fromStamp;
+		unsigned int toStamp;
+
+		bool operator>(const Collapse& other) const
+		{
+			return cost > other.cost;
+		}
+	};
+
+	/**
+	 * \brief Key of an undirected edge
+	 */
+	uint64_t edgeKey(unsigned int a, unsigned int b)
+	{
+		return (uint64_t(std::min(a, b)) << 32) | std::max(a, b);
+	}
+
+	/**
+	 * \brief Key of a position, vertices duplicated by the loader have the same bits
+	 */
+	struct PositionKey
+	{
+		uint32_t bits[3];
+
+		bool operator==(const PositionKey& other) const
+		{
+			return bits[0] == other.bits[0] && bits[1] == other.bits[1] && bits[2] == other.bits[2];
+		}
+	};
+
+	struct PositionKeyHash
+	{
+		std::size_t operator()(const PositionKey& key) const
+		{
+			return std::hash<uint64_t>()((uint64_t(key.bits[0]) << 32) ^ (uint64_t(key.bits[1]) << 16) ^ key.bits[2]);
+		}
+	};
+
+	PositionKey positionKey(const QVector3D& position)
+	{
+		const float coordinates[3] = { position.x(), position.y(), position.z() };
+
+		PositionKey key;
+		std::memcpy(key.bits, coordinates, sizeof(key.bits));
+		return key;
+	}
+
+	/**
+	 * \brief Key of a position and its texture coordinates
+	 */
+	struct VertexKey
+	{
+		PositionKey position;
+		PositionKey uv;
+
+		bool operator==(const VertexKey& other) const
+		{
+			return position == other.position && uv == other.uv;
+		}
+	};
+
+	struct VertexKeyHash
+	{
+		std::size_t operator()(const VertexKey& key) const
+		{
+			const PositionKeyHash hash;
+			return hash(key.position) ^ (hash(key.uv) * 31);
+		}
+	};
+}
+
+std::vector<unsigned int> weldVertices(const std::vector<QVector3D>& vertices,
+	                                   const std::vector<QVector3D>& uvs,
+	                                   const std::vector<unsigned int>& indices)
+{
+	const bool hasUvs = uvs.size() == vertices.size();
+
+	// First vertex of each distinct position and texture coordinates
+	std::unordered_map<VertexKey, unsigned int, VertexKeyHash> firstVertex;
+	firstVertex.reserve(vertices.size());
+
+	std::vector<unsigned int> remap(vertices.size());
+	for (unsigned int v = 0; v < static_cast<unsigned int>(vertices.size()); v++)
+	{
+		const VertexKey key = { positionKey(vertices[v]), positionKey(hasUvs ? uvs[v] : QVector3D()) };
+		remap[v] = firstVertex.emplace(key, v).first->second;
+	}
+
+	std::vector<unsigned int> weldedIndices;
+	weldedIndices.reserve(indices.size());
+
+	std::transform(indices.begin(), indices.end(), std::back_inserter(weldedIndices),
+	               [&remap](unsigned int index) { return remap[index]; });
+
+	return weldedIndices;
+}
+
+std::vector<SimplifiedMesh> simplifyMesh(const std::vector<QVector3D>& vertices,
+	                                     const std::vector<unsigned int>& indices,
+	                                     const std::vector<std::size_t>& triangleCounts)
+{
+	const auto vertexCount = static_cast<unsigned int>(vertices.size());
+	const auto triangleCount = indices.size() / 3;
+
+	std::vector<SimplifiedMesh> levels;
+	levels.reserve(triangleCounts.size());
+
+	// Triangles are edited in place, removed triangles are flagged
+	std::vector<unsigned int> triangles(indices.begin(), indices.begin() + 3 * triangleCount);
+	std::vector<bool> removedTriangles(triangleCount, false);
+	std::size_t aliveTriangles = triangleCount;
+
+	// Triangles around each vertex, they can contain removed triangles
+	std::vector<std::vector<unsigned int>> vertexTriangles(vertexCount);
+	for (std::size_t t = 0; t < triangleCount; t++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			vertexTriangles[triangles[3 * t + k]].push_back(static_cast<unsigned int>(t));
+		}
+	}
+
+	// Lock the vertices of the borders: open boundaries, UV seams and non-manifold edges
+	std::vector<bool> locked(vertexCount, false);
+	{
+		std::unordered_map<uint64_t, int> edgeTriangles;
+		edgeTriangles.reserve(3 * triangleCount);
+
+		for (std::size_t t = 0; t < triangleCount; t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				edgeTriangles[edgeKey(triangles[3 * t + k], triangles[3 * t + (k + 1) % 3])]++;
+			}
+		}
+
+		for (const auto& edge : edgeTriangles)
+		{
+			if (edge.second != 2)
+			{
+				locked[static_cast<unsigned int>(edge.first >> 32)] = true;
+				locked[static_cast<unsigned int>(edge.first & 0xFFFFFFFF)] = true;
+			}
+		}
+
+		// Vertices duplicated by the loader (UV seams, normals) must stay together
+		std::unordered_map<PositionKey, unsigned int, PositionKeyHash> firstVertex;
+		firstVertex.reserve(vertexCount);
+
+		for (unsigned int v = 0; v < vertexCount; v++)
+		{
+			// Vertices merged by weldVertices() are not referenced anymore
+			if (vertexTriangles[v].empty())
+			{
+				continue;
+			}
+
+			const auto inserted = firstVertex.emplace(positionKey(vertices[v]), v);
+			if (!inserted.second)
+			{
+				locked[v] = true;
+				locked[inserted.first->second] = true;
+			}
+		}
+	}
+
+	// Quadric of the planes of the triangles around each vertex
+	std::vector<Quadric> quadrics(vertexCount);
+	for (std::size_t t = 0; t < triangleCount; t++)
+	{
+		const auto& p0 = vertices[triangles[3 * t + 0]];
+		const auto& p1 = vertices[triangles[3 * t + 1]];
+		const auto& p2 = vertices[triangles[3 * t + 2]];
+
+		const auto normal = QVector3D::crossProduct(p1 - p0, p2 - p0);
+		const double length = normal.length();
+
+		if (length == 0.0)
+		{
+			continue;
+		}
+
+		const double a = normal.x() / length;
+		const double b = normal.y() / length;
+		const double c = normal.z() / length;
+		const double d = -(a * p0.x() + b * p0.y() + c * p0.z());
+
+		const auto quadric = Quadric::fromPlane(a, b, c, d);
+		for (int k = 0; k < 3; k++)
+		{
+			quadrics[triangles[3 * t + k]] += quadric;
+		}
+	}
+
+	// Candidate collapses, the cheapest first
+	std::vector<unsigned int> stamps(vertexCount, 0);
+	std::vector<bool> removedVertices(vertexCount, false);
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> candidates;
+
+	const auto pushCandidate = [&](unsigned int from, unsigned int to)
+	{
+		if (locked[from])
+		{
+			return;
+		}
+
+		auto quadric = quadrics[from];
+		quadric += quadrics[to];
+
+		candidates.push({ quadric.evaluate(vertices[to]), from, to, stamps[from], stamps[to] });
+	};
+
+	for (std::size_t t = 0; t < triangleCount; t++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			const auto a = triangles[3 * t + k];
+			const auto b = triangles[3 * t + (k + 1) % 3];
+
+			pushCandidate(a, b);
+			pushCandidate(b, a);
+		}
+	}
+
+	const auto hasVertex = [&triangles](unsigned int t, unsigned int v)
+	{
+		return triangles[3 * t] == v || triangles[3 * t + 1] == v || triangles[3 * t + 2] == v;
+	};
+
+	// Vertices connected to a vertex by an edge
+	std::vector<unsigned int> fromNeighbors;
+	std::vector<unsigned int> toNeighbors;
+
+	const auto collectNeighbors = [&](unsigned int v, std::vector<unsigned int>& neighbors)
+	{
+		neighbors.clear();
+		for (const auto t : vertexTriangles[v])
+		{
+			if (removedTriangles[t])
+			{
+				continue;
+			}
+
+			for (int k = 0; k < 3; k++)
+			{
+				if (triangles[3 * t + k] != v)
+				{
+					neighbors.push_back(triangles[3 * t + k]);
+				}
+			}
+		}
+
+		std::sort(neighbors.begin(), neighbors.end());
+		neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+	};
+
+	const auto isValidCollapse = [&](unsigned int from, unsigned int to)
+	{
+		// Triangles of the edge, they disappear with the collapse
+		int edgeTriangleCount = 0;
+		for (const auto t : vertexTriangles[from])
+		{
+			if (!removedTriangles[t] && hasVertex(t, to))
+			{
+				edgeTriangleCount++;
+			}
+		}
+
+		if (edgeTriangleCount == 0)
+		{
+			return false;
+		}
+
+		// Link condition: the only common neighbors are the opposite vertices of the edge triangles
+		collectNeighbors(from, fromNeighbors);
+		collectNeighbors(to, toNeighbors);
+
+		std::vector<unsigned int> commonNeighbors;
+		std::set_intersection(fromNeighbors.begin(), fromNeighbors.end(),
+		                      toNeighbors.begin(), toNeighbors.end(),
+		                      std::back_inserter(commonNeighbors));
+
+		if (int(commonNeighbors.size()) != edgeTriangleCount)
+		{
+			return false;
+		}
+
+		// The remaining triangles around the removed vertex must not fold over
+		for (const auto t : vertexTriangles[from])
+		{
+			if (removedTriangles[t] || hasVertex(t, to))
+			{
+				continue;
+			}
+
+			QVector3D before[3];
+			QVector3D after[3];
+			for (int k = 0; k < 3; k++)
+			{
+				const auto v = triangles[3 * t + k];
+				before[k] = vertices[v];
+				after[k] = vertices[v == from ? to : v];
+			}
+
+			const auto normalBefore = QVector3D::crossProduct(before[1] - before[0], before[2] - before[0]);
+			const auto normalAfter = QVector3D::crossProduct(after[1] - after[0], after[2] - after[0]);
+
+			if (QVector3D::dotProduct(normalBefore, normalAfter) <= 0.0f)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	};
+
+	const auto snapshot = [&](double error)
+	{
+		SimplifiedMesh level;
+		level.indices.reserve(3 * aliveTriangles);
+		level.error = float(error);
+
+		// Triangles keep the order of the original mesh
+		for (std::size_t t = 0; t < triangleCount; t++)
+		{
+			if (!removedTriangles[t])
+			{
+				level.indices.insert(level.indices.end(), triangles.begin() + 3 * t, triangles.begin() + 3 * t + 3);
+			}
+		}
+
+		levels.push_back(std::move(level));
+	};
+
+	// The quadrics accumulate the planes of the original surface, the error of a level
+	// is bounded by the largest distance to these planes accepted so far
+	double maxSquaredDistance = 0.0;
+
+	while (levels.size() < triangleCounts.size())
+	{
+		if (aliveTriangles <= triangleCounts[levels.size()])
+		{
+			snapshot(std::sqrt(maxSquaredDistance));
+			continue;
+		}
+
+		if (candidates.empty())
+		{
+			break;
+		}
+
+		const auto collapse = candidates.top();
+		candidates.pop();
+
+		// Outdated candidate
+		if (removedVertices[collapse.from] || removedVertices[collapse.to]
+		 || stamps[collapse.from] != collapse.fromStamp || stamps[collapse.to] != collapse.toStamp)
+		{
+			continue;
+		}
+
+		if (!isValidCollapse(collapse.from, collapse.to))
+		{
+			continue;
+		}
+
+		// Move the triangles of the removed vertex to the kept vertex
+		auto& toTriangles = vertexTriangles[collapse.to];
+
+		for (const auto t : vertexTriangles[collapse.from])
+		{
+			if (removedTriangles[t])
+			{
+				continue;
+			}
+
+			if (hasVertex(t, collapse.to))
+			{
+				removedTriangles[t] = true;
+				aliveTriangles--;
+				continue;
+			}
+
+			for (int k = 0; k < 3; k++)
+			{
+				if (triangles[3 * t + k] == collapse.from)
+				{
+					triangles[3 * t + k] = collapse.to;
+				}
+			}
+
+			toTriangles.push_back(t);
+		}
+
+		vertexTriangles[collapse.from].clear();
+		toTriangles.erase(std::remove_if(toTriangles.begin(), toTriangles.end(),
+		                                 [&removedTriangles](unsigned int t) { return bool(removedTriangles[t]); }),
+		                  toTriangles.end());
+
+		removedVertices[collapse.from] = true;
+		quadrics[collapse.to] += quadrics[collapse.from];
+		stamps[collapse.to]++;
+		maxSquaredDistance = std::max(maxSquaredDistance, collapse.cost);
+
+		// The costs of the edges around the kept vertex changed
+		collectNeighbors(collapse.to, toNeighbors);
+		for (const auto neighbor : toNeighbors)
+		{
+			pushCandidate(collapse.to, neighbor);
+			pushCandidate(neighbor, collapse.to);
+		}
+	}
+
+	// Targets that cannot be reached get the most simplified mesh
+	while (levels.size() < triangleCounts.size())
+	{
+		snapshot(std::sqrt(maxSquaredDistance));
+	}
+
+	return levels;
+}
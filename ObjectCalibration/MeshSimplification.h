@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <QVector3D>
+
+/**
+ * \brief Triangles of a simplified mesh, indexing the vertices of the original mesh
+ */
+struct SimplifiedMesh
+{
+	/**
+	 * \brief Three indices per triangle
+	 */
+	std::vector<unsigned int> indices;
+
+	/**
+	 * \brief Upper bound of the distance between the simplified surface and the original one
+	 */
+	float error = 0.0f;
+};
+
+/**
+ * \brief Simplify a triangle mesh with quadric error metrics
+ *
+ * Edges are collapsed onto one of their two vertices, so that all the simplified meshes
+ * share the vertices (and texture coordinates) of the original mesh.
+ * Vertices on a border are never removed: borders of the index topology include the UV seams,
+ * where the loader duplicates the vertices, so the texture does not tear. Collapses that would
+ * fold a triangle over or create a non-manifold edge are rejected.
+ *
+ * Source: Garland, M., & Heckbert, P. S. (1997). Surface simplification using quadric
+ * error metrics. In Proceedings of SIGGRAPH 97 (pp. 209-216).
+ * \param vertices Positions of the vertices
+ * \param indices Three indices per triangle
+ * \param triangleCounts Number of triangles of each simplified mesh, in decreasing order
+ * \return One simplified mesh per requested number of triangles, with more triangles when
+ *         the target cannot be reached without removing a locked vertex
+ */
+std::vector<SimplifiedMesh> simplifyMesh(const std::vector<QVector3D>& vertices,
+	                                     const std::vector<unsigned int>& indices,
+	                                     const std::vector<std::size_t>& triangleCounts);
+
+/**
+ * \brief Make the triangles share the vertices with the same position and texture coordinates
+ *
+ * Loaders giving each face its own vertices leave no edge shared by two triangles, and simplifyMesh()
+ * would lock all the vertices. The indices are remapped to the first of identical vertices, the
+ * vertices themselves are unchanged, so that the result still indexes the original vertices.
+ * Vertices at the same position with other texture coordinates (UV seams) stay apart.
+ * \param vertices Positions of the vertices
+ * \param uvs Texture coordinates of the vertices, or empty to compare only the positions
+ * \param indices Three indices per triangle
+ * \return The indices of the triangles on the welded vertices
+ */
+std::vector<unsigned int> weldVertices(const std::vector<QVector3D>& vertices,
+	                                   const std::vector<QVector3D>& uvs,
+	                                   const std::vector<unsigned int>& indices);
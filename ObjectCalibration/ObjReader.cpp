@@ -0,0 +1,508 @@
+#include "ObjReader.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+namespace
+{
+	// Files are split in chunks of at least this many bytes, small files are parsed by a single thread
+	constexpr qint64 ChunkSize = 1 << 20;
+
+	/**
+	 * \brief Index of a position or texture coordinates in a face, before all the chunks are parsed
+	 *
+	 * Positive indices of the file are absolute. Negative ones are relative to the last element
+	 * of the chunk, they are stored from the first element of the chunk until it is known.
+	 */
+	struct Reference
+	{
+		int index;
+		bool inChunk;
+	};
+
+	/**
+	 * \brief Corner of a triangle
+	 */
+	struct Corner
+	{
+		Reference position;
+
+		// Absolute index -1 when the face has no texture coordinates
+		Reference uv;
+	};
+
+	/**
+	 * \brief Change of object, group or material, before a given triangle of the chunk
+	 */
+	struct GroupEvent
+	{
+		std::size_t triangle;
+		bool isMaterial;
+		std::string name;
+	};
+
+	/**
+	 * \brief Content of a chunk of lines
+	 */
+	struct Chunk
+	{
+		std::vector<QVector3D> positions;
+		std::vector<QVector3D> uvs;
+
+		// Three corners per triangle
+		std::vector<Corner> corners;
+
+		std::vector<GroupEvent> events;
+		std::vector<std::string> materialLibraries;
+
+		// First line that could not be parsed
+		std::string invalidLine;
+	};
+
+	bool isSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	const char* skipSpaces(const char* p, const char* end)
+	{
+		while (p < end && isSpace(*p))
+		{
+			p++;
+		}
+
+		return p;
+	}
+
+	const char* skipWord(const char* p, const char* end)
+	{
+		while (p < end && !isSpace(*p))
+		{
+			p++;
+		}
+
+		return p;
+	}
+
+	/**
+	 * \brief The rest of a line, without the spaces around it
+	 */
+	std::string restOfLine(const char* p, const char* end)
+	{
+		p = skipSpaces(p, end);
+
+		while (end > p && isSpace(end[-1]))
+		{
+			end--;
+		}
+
+		return std::string(p, end);
+	}
+
+	bool parseFloat(const char*& p, const char* end, float& value)
+	{
+		p = skipSpaces(p, end);
+
+		// from_chars does not accept an explicit plus sign
+		if (p < end && *p == '+')
+		{
+			p++;
+		}
+
+		const auto result = std::from_chars(p, end, value);
+		p = result.ptr;
+
+		return result.ec == std::errc();
+	}
+
+	bool parseInt(const char*& p, const char* end, int& value)
+	{
+		const auto result = std::from_chars(p, end, value);
+		p = result.ptr;
+
+		return result.ec == std::errc();
+	}
+
+	/**
+	 * \brief Convert an index of the file to a reference
+	 * \param index Index in the file, from 1 or negative
+	 * \param count Number of elements already parsed in the chunk
+	 */
+	bool makeReference(int index, std::size_t count, Reference& reference)
+	{
+		if (index > 0)
+		{
+			reference = { index - 1, false };
+			return true;
+		}
+
+		if (index < 0)
+		{
+			reference = { int(count) + index, true };
+			return true;
+		}
+
+		return false;
+	}
+
+	/**
+	 * \brief Parse the corners of a face (v, v/vt, v//vn or v/vt/vn) and triangulate it as a fan
+	 */
+	bool parseFace(const char* p, const char* end, Chunk& chunk, std::vector<Corner>& polygon)
+	{
+		polygon.clear();
+
+		while ((p = skipSpaces(p, end)) < end)
+		{
+			Corner corner{ { 0, false }, { -1, false } };
+			int index = 0;
+
+			if (!parseInt(p, end, index) || !makeReference(index, chunk.positions.size(), corner.position))
+			{
+				return false;
+			}
+
+			if (p < end && *p == '/')
+			{
+				p++;
+
+				if (p < end && *p != '/')
+				{
+					if (!parseInt(p, end, index) || !makeReference(index, chunk.uvs.size(), corner.uv))
+					{
+						return false;
+					}
+				}
+
+				// Normals are not used
+				if (p < end && *p == '/')
+				{
+					p = skipWord(p, end);
+				}
+			}
+
+			if (p < end && !isSpace(*p))
+			{
+				return false;
+			}
+
+			polygon.push_back(corner);
+		}
+
+		if (polygon.size() < 3)
+		{
+			return false;
+		}
+
+		for (std::size_t i = 1; i + 1 < polygon.size(); i++)
+		{
+			chunk.corners.push_back(polygon[0]);
+			chunk.corners.push_back(polygon[i]);
+			chunk.corners.push_back(polygon[i + 1]);
+		}
+
+		return true;
+	}
+
+	/**
+	 * \brief Parse a chunk of complete lines
+	 */
+	void parseChunk(const char* begin, const char* end, Chunk& chunk)
+	{
+		std::vector<Corner> polygon;
+
+		for (const char* line = begin; line < end;)
+		{
+			const auto newline = static_cast<const char*>(std::memchr(line, '\n', end - line));
+			const char* lineEnd = newline ? newline : end;
+
+			const char* p = skipSpaces(line, lineEnd);
+			const char* keywordEnd = skipWord(p, lineEnd);
+			const std::string keyword(p, keywordEnd);
+			p = keywordEnd;
+
+			bool valid = true;
+
+			if (keyword == "v")
+			{
+				float x, y, z;
+				valid = parseFloat(p, lineEnd, x) && parseFloat(p, lineEnd, y) && parseFloat(p, lineEnd, z);
+				chunk.positions.emplace_back(x, y, z);
+			}
+			else if (keyword == "vt")
+			{
+				// The second coordinate is optional, the third one is not used
+				float u = 0.0f;
+				float v = 0.0f;
+				valid = parseFloat(p, lineEnd, u);
+
+				if (valid && skipSpaces(p, lineEnd) < lineEnd)
+				{
+					valid = parseFloat(p, lineEnd, v);
+				}
+
+				chunk.uvs.emplace_back(u, v, 0.0f);
+			}
+			else if (keyword == "f")
+			{
+				valid = parseFace(p, lineEnd, chunk, polygon);
+			}
+			else if (keyword == "o" || keyword == "g")
+			{
+				chunk.events.push_back({ chunk.corners.size() / 3, false, restOfLine(p, lineEnd) });
+			}
+			else if (keyword == "usemtl")
+			{
+				chunk.events.push_back({ chunk.corners.size() / 3, true, restOfLine(p, lineEnd) });
+			}
+			else if (keyword == "mtllib")
+			{
+				chunk.materialLibraries.push_back(restOfLine(p, lineEnd));
+			}
+
+			// Other statements (normals, smoothing groups, lines, comments...) are ignored
+			if (!valid && chunk.invalidLine.empty())
+			{
+				chunk.invalidLine = std::string(line, lineEnd);
+			}
+
+			line = lineEnd + 1;
+		}
+	}
+
+	/**
+	 * \brief Read the materials of an MTL file
+	 */
+	bool readMtl(const QString& filename, std::vector<ObjMaterial>& materials)
+	{
+		QFile file(filename);
+
+		if (!file.open(QIODevice::ReadOnly))
+		{
+			return false;
+		}
+
+		const auto directory = QFileInfo(filename).dir();
+		const QByteArray content = file.readAll();
+		const char* end = content.constData() + content.size();
+
+		// Texture paths are relative to the MTL file
+		const auto texturePath = [&directory](const std::string& name)
+		{
+			return QFileInfo(directory.filePath(QString::fromStdString(name))).absoluteFilePath().toStdString();
+		};
+
+		for (const char* line = content.constData(); line < end;)
+		{
+			const auto newline = static_cast<const char*>(std::memchr(line, '\n', end - line));
+			const char* lineEnd = newline ? newline : end;
+
+			const char* p = skipSpaces(line, lineEnd);
+			const char* keywordEnd = skipWord(p, lineEnd);
+			const std::string keyword(p, keywordEnd);
+			const auto value = restOfLine(keywordEnd, lineEnd);
+
+			if (keyword == "newmtl")
+			{
+				materials.push_back({ value, std::string(), std::string() });
+			}
+			else if (keyword == "map_Ka" && !materials.empty())
+			{
+				materials.back().ambientTexture = texturePath(value);
+			}
+			else if (keyword == "map_Kd" && !materials.empty())
+			{
+				materials.back().diffuseTexture = texturePath(value);
+			}
+
+			line = lineEnd + 1;
+		}
+
+		return true;
+	}
+
+	/**
+	 * \brief Index of an element in the whole file
+	 * \param reference Reference in a chunk
+	 * \param base Number of elements in the previous chunks
+	 */
+	std::int64_t resolve(const Reference& reference, std::size_t base)
+	{
+		return reference.inChunk ? std::int64_t(base) + reference.index : std::int64_t(reference.index);
+	}
+}
+
+bool readObj(const std::string& filename, ObjData& data)
+{
+	data = ObjData();
+
+	const auto objFilename = QString::fromStdString(filename);
+	QFile file(objFilename);
+
+	if (!file.open(QIODevice::ReadOnly))
+	{
+		qWarning() << "Could not open the OBJ file " << objFilename;
+		return false;
+	}
+
+	// An empty file cannot be mapped
+	const auto size = file.size();
+	const auto begin = size > 0 ? reinterpret_cast<const char*>(file.map(0, size)) : nullptr;
+	const auto end = begin + size;
+
+	if (size > 0 && !begin)
+	{
+		qWarning() << "Could not map the OBJ file " << objFilename;
+		return false;
+	}
+
+	// Chunks end after a new line
+	std::vector<const char*> boundaries = { begin };
+
+	while (boundaries.back() < end)
+	{
+		const char* chunkEnd = boundaries.back() + std::min(ChunkSize, qint64(end - boundaries.back()));
+		const auto newline = static_cast<const char*>(std::memchr(chunkEnd, '\n', end - chunkEnd));
+
+		boundaries.push_back(newline ? newline + 1 : end);
+	}
+
+	std::vector<Chunk> chunks(boundaries.size() - 1);
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < int(chunks.size()); i++)
+	{
+		parseChunk(boundaries[i], boundaries[i + 1], chunks[i]);
+	}
+
+	for (const auto& chunk : chunks)
+	{
+		if (!chunk.invalidLine.empty())
+		{
+			qWarning() << "Invalid line in the OBJ file " << objFilename << ": " << QString::fromStdString(chunk.invalidLine);
+			return false;
+		}
+	}
+
+	// Elements of the previous chunks
+	std::vector<std::size_t> positionBases(chunks.size() + 1, 0);
+	std::vector<std::size_t> uvBases(chunks.size() + 1, 0);
+	std::vector<std::size_t> triangleBases(chunks.size() + 1, 0);
+
+	for (std::size_t i = 0; i < chunks.size(); i++)
+	{
+		positionBases[i + 1] = positionBases[i] + chunks[i].positions.size();
+		uvBases[i + 1] = uvBases[i] + chunks[i].uvs.size();
+		triangleBases[i + 1] = triangleBases[i] + chunks[i].corners.size() / 3;
+	}
+
+	std::vector<QVector3D> positions(positionBases.back());
+	std::vector<QVector3D> uvs(uvBases.back());
+
+	#pragma omp parallel for
+	for (int i = 0; i < int(chunks.size()); i++)
+	{
+		std::copy(chunks[i].positions.begin(), chunks[i].positions.end(), positions.begin() + positionBases[i]);
+		std::copy(chunks[i].uvs.begin(), chunks[i].uvs.end(), uvs.begin() + uvBases[i]);
+	}
+
+	// Weld the corners with the same position and texture coordinates
+	std::unordered_map<std::uint64_t, unsigned int> vertexIndices;
+	vertexIndices.reserve(positions.size() + uvs.size());
+	data.indices.reserve(3 * triangleBases.back());
+
+	for (std::size_t i = 0; i < chunks.size(); i++)
+	{
+		for (const auto& corner : chunks[i].corners)
+		{
+			const auto position = resolve(corner.position, positionBases[i]);
+			const auto uv = resolve(corner.uv, uvBases[i]);
+
+			if (position < 0 || position >= std::int64_t(positions.size())
+			 || uv < -1 || (uv == -1 && corner.uv.inChunk) || uv >= std::int64_t(uvs.size()))
+			{
+				qWarning() << "Invalid index in the OBJ file " << objFilename;
+				data = ObjData();
+				return false;
+			}
+
+			const auto key = (std::uint64_t(position) << 32) | std::uint64_t(uv + 1);
+			const auto inserted = vertexIndices.emplace(key, static_cast<unsigned int>(data.vertices.size()));
+
+			if (inserted.second)
+			{
+				data.vertices.push_back(positions[position]);
+				data.uvs.push_back(uv >= 0 ? uvs[uv] : QVector3D());
+			}
+
+			data.indices.push_back(inserted.first->second);
+		}
+	}
+
+	// Materials, from the libraries in the order of the file
+	const auto directory = QFileInfo(objFilename).dir();
+
+	for (const auto& chunk : chunks)
+	{
+		for (const auto& library : chunk.materialLibraries)
+		{
+			const auto mtlFilename = directory.filePath(QString::fromStdString(library));
+
+			if (!readMtl(mtlFilename, data.materials))
+			{
+				qWarning() << "Could not read the MTL file " << mtlFilename;
+			}
+		}
+	}
+
+	std::unordered_map<std::string, int> materialIndices;
+	for (int i = 0; i < int(data.materials.size()); i++)
+	{
+		materialIndices.emplace(data.materials[i].name, i);
+	}
+
+	// Split the triangles where the object, the group or the material changes
+	std::string name;
+	int material = -1;
+	std::size_t groupBegin = 0;
+
+	const auto endGroup = [&](std::size_t triangle)
+	{
+		if (triangle > groupBegin)
+		{
+			data.groups.push_back({ name, material, 3 * groupBegin, 3 * (triangle - groupBegin) });
+		}
+
+		groupBegin = triangle;
+	};
+
+	for (std::size_t i = 0; i < chunks.size(); i++)
+	{
+		for (const auto& event : chunks[i].events)
+		{
+			endGroup(triangleBases[i] + event.triangle);
+
+			if (event.isMaterial)
+			{
+				const auto it = materialIndices.find(event.name);
+				material = it != materialIndices.end() ? it->second : -1;
+			}
+			else
+			{
+				name = event.name;
+			}
+		}
+	}
+
+	endGroup(triangleBases.back());
+
+	return true;
+}
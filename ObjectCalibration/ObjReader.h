@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <QVector3D>
+
+/**
+ * \brief Material of an OBJ file, read in its MTL files
+ */
+struct ObjMaterial
+{
+	std::string name;
+
+	/**
+	 * \brief Ambient texture (map_Ka), relative to the directory of the MTL file
+	 */
+	std::string ambientTexture;
+
+	/**
+	 * \brief Diffuse texture (map_Kd), relative to the directory of the MTL file
+	 */
+	std::string diffuseTexture;
+};
+
+/**
+ * \brief Consecutive triangles of an OBJ file with the same object, group and material
+ */
+struct ObjGroup
+{
+	/**
+	 * \brief Name of the object (o) or of the group (g) of the triangles
+	 */
+	std::string name;
+
+	/**
+	 * \brief Index of the material in ObjData::materials, or -1 if it has none
+	 */
+	int material;
+
+	/**
+	 * \brief Position of the first index of the group in ObjData::indices
+	 */
+	std::size_t firstIndex;
+
+	/**
+	 * \brief Number of indices of the group, three per triangle
+	 */
+	std::size_t indexCount;
+};
+
+/**
+ * \brief Triangles of all the objects of an OBJ file, in a single indexed mesh
+ */
+struct ObjData
+{
+	/**
+	 * \brief Positions of the vertices, welded: one vertex per distinct position and texture coordinates
+	 */
+	std::vector<QVector3D> vertices;
+
+	/**
+	 * \brief Texture coordinates of the vertices, with 0 as third coordinate
+	 */
+	std::vector<QVector3D> uvs;
+
+	/**
+	 * \brief Three indices per triangle, polygons are triangulated as fans
+	 */
+	std::vector<unsigned int> indices;
+
+	/**
+	 * \brief Ranges of indices of the objects and materials, in the order of the file
+	 */
+	std::vector<ObjGroup> groups;
+
+	std::vector<ObjMaterial> materials;
+};
+
+/**
+ * \brief Read an OBJ file and its MTL files
+ *
+ * The file is mapped in memory and split in chunks of lines, which are parsed in parallel.
+ * Corners of faces with the same position and texture coordinates share a vertex, normals are ignored.
+ * \param filename Path to an OBJ file
+ * \param data The content of the file
+ * \return True if the file has been read
+ */
+bool readObj(const std::string& filename, ObjData& data);
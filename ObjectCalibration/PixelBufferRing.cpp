@@ -0,0 +1,203 @@
+#include "PixelBufferRing.h"
+
+#include <cassert>
+#include <cstring>
+
+PixelBufferView::PixelBufferView() :
+	m_data(nullptr)
+{
+
+}
+
+PixelBufferView::PixelBufferView(const uchar* data, const QSize& size) :
+	m_data(data),
+	m_size(size)
+{
+
+}
+
+QImage PixelBufferView::toImage() const
+{
+	if (isNull())
+	{
+		return QImage();
+	}
+
+	// Same format as QOpenGLFramebufferObject::toImage(), the frame buffer holds premultiplied colors
+	QImage image(m_size, QImage::Format_ARGB32_Premultiplied);
+
+	for (int i = 0; i < height(); i++)
+	{
+		std::memcpy(image.scanLine(i), constScanLine(i), bytesPerLine());
+	}
+
+	return image;
+}
+
+PixelBufferRing::PixelBufferRing(int size) :
+	m_functions(nullptr),
+	m_slots(size),
+	m_next(0),
+	m_serial(0)
+{
+
+}
+
+PixelBufferRing::~PixelBufferRing()
+{
+	// OpenGL objects must be deleted with destroy() while the context is current
+	assert(m_functions == nullptr);
+}
+
+void PixelBufferRing::initialize(QOpenGLFunctions_4_3_Core* functions)
+{
+	destroy();
+
+	m_functions = functions;
+
+	for (auto& slot : m_slots)
+	{
+		m_functions->glGenBuffers(1, &slot.buffer);
+	}
+}
+
+void PixelBufferRing::destroy()
+{
+	if (m_functions == nullptr)
+	{
+		return;
+	}
+
+	for (auto& slot : m_slots)
+	{
+		unmap(slot);
+		deleteFence(slot);
+		m_functions->glDeleteBuffers(1, &slot.buffer);
+		slot = Slot();
+	}
+
+	m_functions = nullptr;
+	m_next = 0;
+}
+
+PixelBufferReadback PixelBufferRing::enqueue(const QRect& region)
+{
+	PixelBufferReadback readback;
+
+	if (m_functions == nullptr || m_slots.empty())
+	{
+		return readback;
+	}
+
+	auto& slot = m_slots[m_next];
+	readback.slot = m_next;
+	readback.serial = ++m_serial;
+	m_next = (m_next + 1) % int(m_slots.size());
+
+	// The oldest readback is dropped
+	unmap(slot);
+	deleteFence(slot);
+
+	slot.size = region.size();
+	slot.serial = readback.serial;
+
+	m_functions->glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+
+	// Only grow the storage, regions of the same size reuse it
+	const auto bytes = 4 * std::size_t(region.width()) * std::size_t(region.height());
+	if (bytes > slot.capacity)
+	{
+		m_functions->glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+		slot.capacity = bytes;
+	}
+
+	if (bytes > 0)
+	{
+		// With a pixel buffer bound, the copy is asynchronous: the last argument is an offset in the buffer
+		// BGRA bytes are ARGB32 pixels on little endian machines
+		m_functions->glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		m_functions->glReadPixels(region.x(), region.y(), region.width(), region.height(), GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
+	}
+
+	m_functions->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	slot.fence = m_functions->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	return readback;
+}
+
+PixelBufferView PixelBufferRing::map(const PixelBufferReadback& readback)
+{
+	if (m_functions == nullptr || !readback.isValid() || readback.slot >= int(m_slots.size()))
+	{
+		return PixelBufferView();
+	}
+
+	auto& slot = m_slots[readback.slot];
+
+	// The pixel buffer has been reused by a more recent readback
+	if (slot.serial != readback.serial)
+	{
+		return PixelBufferView();
+	}
+
+	if (slot.mapped == nullptr && slot.capacity > 0 && !slot.size.isEmpty())
+	{
+		// Wait for the copy to finish, flushing the commands the first time
+		if (slot.fence)
+		{
+			GLenum status = m_functions->glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+			while (status == GL_TIMEOUT_EXPIRED)
+			{
+				// One millisecond
+				status = m_functions->glClientWaitSync(slot.fence, 0, 1000000);
+			}
+
+			deleteFence(slot);
+		}
+
+		const auto bytes = 4 * std::size_t(slot.size.width()) * std::size_t(slot.size.height());
+
+		m_functions->glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+		slot.mapped = static_cast<const uchar*>(m_functions->glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT));
+		m_functions->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	return PixelBufferView(slot.mapped, slot.size);
+}
+
+void PixelBufferRing::release(const PixelBufferReadback& readback)
+{
+	if (m_functions == nullptr || !readback.isValid() || readback.slot >= int(m_slots.size()))
+	{
+		return;
+	}
+
+	auto& slot = m_slots[readback.slot];
+
+	if (slot.serial == readback.serial)
+	{
+		unmap(slot);
+	}
+}
+
+void PixelBufferRing::unmap(Slot& slot)
+{
+	if (slot.mapped)
+	{
+		m_functions->glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+		m_functions->glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		m_functions->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		slot.mapped = nullptr;
+	}
+}
+
+void PixelBufferRing::deleteFence(Slot& slot)
+{
+	if (slot.fence)
+	{
+		m_functions->glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+	}
+}
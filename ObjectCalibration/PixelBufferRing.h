@@ -0,0 +1,141 @@
+#pragma once
+
+#include <vector>
+
+#include <QImage>
+#include <QOpenGLFunctions_4_3_Core>
+#include <QRect>
+
+/**
+ * \brief Handle on a readback queued in a PixelBufferRing
+ */
+struct PixelBufferReadback
+{
+	/**
+	 * \brief Index of the pixel buffer holding the pixels
+	 */
+	int slot = -1;
+
+	/**
+	 * \brief Number of the readback, to detect that the pixel buffer has been reused since
+	 */
+	quint64 serial = 0;
+
+	bool isValid() const { return slot >= 0; }
+};
+
+/**
+ * \brief Zero-copy view on the pixels of a mapped pixel buffer
+ *
+ * Pixels are 32 bits premultiplied ARGB (BGRA bytes), rows are stored like OpenGL reads them: from the bottom
+ * to the top. The view is valid until the readback is released or its pixel buffer is reused.
+ */
+class PixelBufferView
+{
+public:
+
+	PixelBufferView();
+	PixelBufferView(const uchar* data, const QSize& size);
+
+	bool isNull() const { return m_data == nullptr; }
+	int width() const { return m_size.width(); }
+	int height() const { return m_size.height(); }
+	QSize size() const { return m_size; }
+	int bytesPerLine() const { return 4 * m_size.width(); }
+
+	/**
+	 * \brief Row of pixels, counted from the top of the image like QImage::constScanLine()
+	 */
+	const QRgb* constScanLine(int y) const
+	{
+		return reinterpret_cast<const QRgb*>(m_data + std::size_t(m_size.height() - 1 - y) * bytesPerLine());
+	}
+
+	/**
+	 * \brief Copy the pixels in an image, from the top to the bottom
+	 */
+	QImage toImage() const;
+
+private:
+
+	const uchar* m_data;
+	QSize m_size;
+};
+
+/**
+ * \brief Ring of pixel buffer objects to read back frame buffers without stalling the pipeline
+ *
+ * Each readback is copied by the GPU in the next pixel buffer of the ring and protected by a fence.
+ * Several renders can be queued before mapping the first result. When the ring wraps around, the
+ * oldest readback is dropped. All methods need the OpenGL context of the ring to be current.
+ */
+class PixelBufferRing
+{
+public:
+
+	/**
+	 * \brief Create an empty ring, no OpenGL object is allocated until initialize()
+	 * \param size Number of pixel buffers in the ring
+	 */
+	explicit PixelBufferRing(int size = 3);
+	~PixelBufferRing();
+
+	PixelBufferRing(const PixelBufferRing&) = delete;
+	PixelBufferRing& operator=(const PixelBufferRing&) = delete;
+
+	/**
+	 * \brief Number of readbacks that can be queued before the oldest is dropped
+	 */
+	int size() const { return int(m_slots.size()); }
+
+	/**
+	 * \brief Create the pixel buffers
+	 * \param functions OpenGL functions of the current context
+	 */
+	void initialize(QOpenGLFunctions_4_3_Core* functions);
+
+	/**
+	 * \brief Delete the pixel buffers and the fences
+	 */
+	void destroy();
+
+	/**
+	 * \brief Queue the readback of a region of the frame buffer bound for reading
+	 * \param region The region in OpenGL window coordinates
+	 * \return A handle to map the pixels once the copy is finished
+	 */
+	PixelBufferReadback enqueue(const QRect& region);
+
+	/**
+	 * \brief Wait for a readback to finish and map its pixels
+	 * \param readback The handle returned by enqueue()
+	 * \return A view on the pixels, null if the pixel buffer has been reused since
+	 */
+	PixelBufferView map(const PixelBufferReadback& readback);
+
+	/**
+	 * \brief Unmap the pixels of a readback, its view becomes invalid
+	 * \param readback The handle returned by enqueue()
+	 */
+	void release(const PixelBufferReadback& readback);
+
+private:
+
+	struct Slot
+	{
+		GLuint buffer = 0;
+		GLsync fence = nullptr;
+		std::size_t capacity = 0;
+		QSize size;
+		quint64 serial = 0;
+		const uchar* mapped = nullptr;
+	};
+
+	void unmap(Slot& slot);
+	void deleteFence(Slot& slot);
+
+	QOpenGLFunctions_4_3_Core* m_functions;
+	std::vector<Slot> m_slots;
+	int m_next;
+	quint64 m_serial;
+};
@@ -0,0 +1,68 @@
+#include "RefinementMonitor.h"
+
+#include <algorithm>
+#include <limits>
+
+RefinementMonitor::RefinementMonitor(const RefinementBudget& budget) :
+	m_budget(budget),
+	m_evaluations(0),
+	m_stageDeadline(budget.timeLimit),
+	m_stageEvaluationLimit(budget.evaluationLimit),
+	m_bestValue(-std::numeric_limits<double>::infinity()),
+	m_status(RefinementStatus::Converged)
+{
+	m_timer.start();
+}
+
+void RefinementMonitor::beginStage(int remainingStages)
+{
+	remainingStages = std::max(1, remainingStages);
+
+	if (m_budget.timeLimit > 0)
+	{
+		const auto now = m_timer.elapsed();
+		m_stageDeadline = now + std::max<qint64>(0, m_budget.timeLimit - now) / remainingStages;
+	}
+
+	if (m_budget.evaluationLimit > 0)
+	{
+		m_stageEvaluationLimit = m_evaluations + std::max(0L, m_budget.evaluationLimit - m_evaluations) / remainingStages;
+	}
+
+	m_bestParameters.set_size(0);
+	m_bestValue = -std::numeric_limits<double>::infinity();
+}
+
+bool RefinementMonitor::isExhausted()
+{
+	if (m_budget.timeLimit > 0 && m_timer.elapsed() >= m_stageDeadline)
+	{
+		m_status = RefinementStatus::TimeLimitReached;
+		return true;
+	}
+
+	if (m_budget.evaluationLimit > 0 && m_evaluations >= m_stageEvaluationLimit)
+	{
+		m_status = RefinementStatus::EvaluationLimitReached;
+		return true;
+	}
+
+	return false;
+}
+
+bool RefinementMonitor::isBudgetExhausted() const
+{
+	return (m_budget.timeLimit > 0 && m_timer.elapsed() >= m_budget.timeLimit)
+	    || (m_budget.evaluationLimit > 0 && m_evaluations >= m_budget.evaluationLimit);
+}
+
+void RefinementMonitor::record(const ColumnVector& parameters, double value, long evaluations)
+{
+	m_evaluations += evaluations;
+
+	if (value > m_bestValue)
+	{
+		m_bestValue = value;
+		m_bestParameters = parameters;
+	}
+}
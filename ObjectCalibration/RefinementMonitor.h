@@ -0,0 +1,148 @@
+#pragma once
+
+#include <QElapsedTimer>
+
+#include <dlib/matrix/matrix.h>
+
+/**
+ * \brief Limits of a refinement, a limit of 0 means no limit
+ */
+struct RefinementBudget
+{
+	/**
+	 * \brief Wall-clock time in milliseconds
+	 */
+	qint64 timeLimit = 0;
+
+	/**
+	 * \brief Number of evaluated poses, each pose of a batch counts
+	 */
+	long evaluationLimit = 0;
+};
+
+/**
+ * \brief Why a refinement stopped
+ */
+enum class RefinementStatus
+{
+	/**
+	 * \brief Every stage stopped on its own criterion
+	 */
+	Converged,
+
+	/**
+	 * \brief At least one stage has been cut short by the time limit
+	 */
+	TimeLimitReached,
+
+	/**
+	 * \brief At least one stage has been cut short by the evaluation limit
+	 */
+	EvaluationLimitReached
+};
+
+/**
+ * \brief Budget of a refinement and best parameters seen by its objective functions
+ *
+ * A refinement runs in stages (levels of a pyramid, restarts...). Each stage gets a share of what
+ * remains of the budget, so that a stage converging early leaves more to the next ones. The objective
+ * functions record every evaluation, including the probes of the line searches and of the finite
+ * differences, and stop rendering once the stage is exhausted.
+ */
+class RefinementMonitor
+{
+public:
+
+	using ColumnVector = dlib::matrix<double, 0, 1>;
+
+	/**
+	 * \brief Start the clock of a refinement
+	 */
+	explicit RefinementMonitor(const RefinementBudget& budget = RefinementBudget());
+
+	/**
+	 * \brief Start a stage with an equal share of the remaining budget, and forget the best parameters
+	 *
+	 * The values of different stages are not comparable (resolution, silhouettes...).
+	 * \param remainingStages Number of stages left, including this one
+	 */
+	void beginStage(int remainingStages);
+
+	/**
+	 * \brief Return true if the stage or the whole refinement has no budget left
+	 */
+	bool isExhausted();
+
+	/**
+	 * \brief Return true if the whole refinement has no budget left
+	 */
+	bool isBudgetExhausted() const;
+
+	/**
+	 * \brief Record the value of the objective function at some parameters
+	 * \param evaluations Number of poses rendered to compute it, 0 if it was cached
+	 */
+	void record(const ColumnVector& parameters, double value, long evaluations = 1);
+
+	bool hasBest() const { return m_bestParameters.size() > 0; }
+	const ColumnVector& bestParameters() const { return m_bestParameters; }
+	double bestValue() const { return m_bestValue; }
+
+	long evaluations() const { return m_evaluations; }
+	qint64 elapsed() const { return m_timer.elapsed(); }
+
+	RefinementStatus status() const { return m_status; }
+
+private:
+
+	RefinementBudget m_budget;
+	QElapsedTimer m_timer;
+	long m_evaluations;
+
+	// Limits of the current stage, in the time of the timer and in evaluations since the start
+	qint64 m_stageDeadline;
+	long m_stageEvaluationLimit;
+
+	ColumnVector m_bestParameters;
+	double m_bestValue;
+
+	RefinementStatus m_status;
+};
+
+/**
+ * \brief Stop strategy of dlib stopping another one early when the budget of a refinement is exhausted
+ */
+template <typename StopStrategy>
+class BudgetStopStrategy
+{
+public:
+
+	BudgetStopStrategy(StopStrategy stopStrategy, RefinementMonitor* monitor) :
+		m_stopStrategy(stopStrategy),
+		m_monitor(monitor)
+	{
+
+	}
+
+	template <typename T>
+	bool should_continue_search(const T& x, const double value, const T& gradient)
+	{
+		if (m_monitor && m_monitor->isExhausted())
+		{
+			return false;
+		}
+
+		return m_stopStrategy.should_continue_search(x, value, gradient);
+	}
+
+private:
+
+	StopStrategy m_stopStrategy;
+	RefinementMonitor* m_monitor;
+};
+
+template <typename StopStrategy>
+BudgetStopStrategy<StopStrategy> budgetStopStrategy(StopStrategy stopStrategy, RefinementMonitor* monitor)
+{
+	return BudgetStopStrategy<StopStrategy>(stopStrategy, monitor);
+}
@@ -0,0 +1,51 @@
+#include "Renderer.h"
+
+#include <QtMath>
+#include <QQuaternion>
+
+std::vector<float> Renderer::renderAndComputeSimilarityBatch(const std::vector<ObjectPose>& poses)
+{
+	std::vector<float> similarities;
+	similarities.reserve(poses.size());
+
+	for (const auto& pose : poses)
+	{
+		similarities.push_back(renderAndComputeSimilarity(pose));
+	}
+
+	return similarities;
+}
+
+std::vector<QImage> Renderer::renderToImageBatch(const std::vector<ObjectPose>& poses)
+{
+	std::vector<QImage> images;
+	images.reserve(poses.size());
+
+	for (const auto& pose : poses)
+	{
+		images.push_back(renderToImage(pose));
+	}
+
+	return images;
+}
+
+Camera evaluationCamera(float aspectRatio)
+{
+	// Field of view of the camera of the target images
+	return Camera({ 0.0, 0.0, 1.0 },
+	              { 0.0, 0.0, 0.0 },
+	              { -1.0, 0.0, 0.0 },
+	              qRadiansToDegrees(2.0 * atan(4.29 / (2.0 * 4.5))),
+	              aspectRatio, 0.01f, 10.0f);
+}
+
+QMatrix4x4 objectWorldMatrix(const ObjectPose& pose, const QMatrix4x4& objectMatrix)
+{
+	QMatrix4x4 translationMatrix;
+	translationMatrix.translate(pose.translation);
+
+	const auto rotation = QQuaternion::fromEulerAngles(pose.rotation.x(), pose.rotation.y(), pose.rotation.z());
+	const QMatrix4x4 rotationMatrix(rotation.toRotationMatrix());
+
+	return translationMatrix * rotationMatrix * objectMatrix;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <vector>
+
+#include <QImage>
+#include <QMatrix4x4>
+#include <QSize>
+
+#include "Camera.h"
+#include "ObjectPose.h"
+
+/**
+ * \brief Backend rendering poses of the object and comparing them to a target image
+ *
+ * The optimizations only go through this interface, so that they can run with an OpenGL
+ * context (ViewerWidget) or without any windowing system (SoftwareRenderer).
+ */
+class Renderer
+{
+public:
+
+	virtual ~Renderer() = default;
+
+	/**
+	 * \brief Set the target image, renders are compared to it at the working resolution
+	 * \param targetImage The target image
+	 */
+	virtual void setTargetImage(const QImage& targetImage) = 0;
+
+	/**
+	 * \brief Set the resolution at which poses are compared to the target
+	 * \param size The working resolution, or an invalid size to use the resolution of the target
+	 */
+	virtual void setWorkingResolution(const QSize& size) = 0;
+	virtual QSize workingResolution() const = 0;
+
+	/**
+	 * \brief Only compare the silhouettes, the object is rendered without its texture
+	 *
+	 * The similarity is then the fuzzy Dice coefficient alone. Images returned by
+	 * renderToImage() are not affected.
+	 * \param silhouetteOnly true to skip the texture and the mean absolute error
+	 */
+	virtual void setSilhouetteOnly(bool silhouetteOnly) = 0;
+	virtual bool silhouetteOnly() const = 0;
+
+	/**
+	 * \brief Set the error on the screen accepted when selecting the level of detail of the mesh
+	 * \param pixels Largest distance in pixels between the rendered and the full resolution surfaces
+	 */
+	virtual void setLevelOfDetailTolerance(float pixels) = 0;
+	virtual float levelOfDetailTolerance() const = 0;
+
+	/**
+	 * \brief Number of samples per pixel in each dimension, averaged before comparing to the target
+	 * \return 1 for backends which render a single sample per pixel
+	 */
+	virtual int supersampling() const { return 1; }
+
+	/**
+	 * \brief Render a pose of the object
+	 * \param pose The pose of the object
+	 * \return The rendered image, transparent where the object is not
+	 */
+	virtual QImage renderToImage(const ObjectPose& pose) = 0;
+
+	/**
+	 * \brief Render several poses of the object, backends can render them together
+	 * \param poses The poses of the object
+	 * \return The rendered images, in the same order
+	 */
+	virtual std::vector<QImage> renderToImageBatch(const std::vector<ObjectPose>& poses);
+
+	/**
+	 * \brief Render a pose and compute its similarity with the target
+	 * \param pose The pose of the object
+	 * \return The similarity: 90% fuzzy Dice coefficient and 10% mean absolute error,
+	 *         or only the fuzzy Dice coefficient when comparing silhouettes
+	 */
+	virtual float renderAndComputeSimilarity(const ObjectPose& pose) = 0;
+
+	/**
+	 * \brief Compute the similarity of several poses, backends can evaluate them together
+	 * \param poses The poses of the object
+	 * \return The similarity of each pose, in the same order
+	 */
+	virtual std::vector<float> renderAndComputeSimilarityBatch(const std::vector<ObjectPose>& poses);
+};
+
+/**
+ * \brief Camera from which poses are rendered to be compared to the target
+ * \param aspectRatio Aspect ratio of the frame buffer
+ * \return The camera of the target images
+ */
+Camera evaluationCamera(float aspectRatio);
+
+/**
+ * \brief Place the object in the world
+ * \param pose The pose of the object
+ * \param objectMatrix Transformation of the mesh in the frame of the object
+ * \return The model matrix of the object
+ */
+QMatrix4x4 objectWorldMatrix(const ObjectPose& pose, const QMatrix4x4& objectMatrix);
@@ -0,0 +1,23 @@
+#version 430
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+in vec2 vertex_uv[];
+flat in int vertex_layer[];
+
+out vec2 uv;
+
+// Send each instance to the layer of the frame buffer of its pose
+void main()
+{
+	for (int i = 0; i < 3; i++)
+	{
+		gl_Layer = vertex_layer[i];
+		gl_Position = gl_in[i].gl_Position;
+		uv = vertex_uv[i];
+		EmitVertex();
+	}
+
+	EndPrimitive();
+}
\ No newline at end of file
@@ -0,0 +1,20 @@
+#version 430
+
+layout(location = 0) in vec3 pos_attrib;
+layout(location = 1) in vec2 uv_attrib;
+
+out vec2 vertex_uv;
+flat out int vertex_layer;
+
+// One projection * view * model matrix per pose of the batch
+layout(std430, binding = 3) readonly buffer PoseMatrices
+{
+	mat4 PVM[];
+};
+
+void main()
+{
+	gl_Position = PVM[gl_InstanceID] * vec4(pos_attrib, 1.0);
+	vertex_uv = uv_attrib;
+	vertex_layer = gl_InstanceID;
+}
\ No newline at end of file
@@ -1,7 +1,7 @@
 #version 430
 
 layout(location = 0) in vec3 pos_attrib;
-layout(location = 1) in vec3 uv_attrib;
+layout(location = 1) in vec2 uv_attrib;
 
 out vec2 uv;
 
@@ -15,5 +15,5 @@ uniform mat4 PVM;
 void main()
 {
 	gl_Position = PVM * vec4(pos_attrib, 1.0);
-	uv = vec2(uv_attrib);
+	uv = uv_attrib;
 }
\ No newline at end of file
@@ -0,0 +1,9 @@
+#version 430
+
+layout(location = 0) out vec4 color;
+
+// Coverage only: no texture fetch, the frame buffer has a single 8 bits channel
+void main()
+{
+	color = vec4(1.0);
+}
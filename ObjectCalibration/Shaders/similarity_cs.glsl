@@ -1,19 +1,51 @@
-#version 460
-
-layout(local_size_x = 4, local_size_y = 4) in;
-
-layout(rgba8, binding = 0) uniform readonly image2D target;
-layout(rgba8, binding = 1) uniform readonly image2D other;
+#version 430
+
+// One workgroup reduces a block of 16 x 16 pixels
+#define LOCAL_SIZE 16
+#define INVOCATION_COUNT (LOCAL_SIZE * LOCAL_SIZE)
+
+layout(local_size_x = LOCAL_SIZE, local_size_y = LOCAL_SIZE) in;
+
+// Red: alpha of the target, green: 1 if the value of the target is greater than 0.5
+layout(rg8, binding = 0) uniform readonly image2D target;
+#ifdef SILHOUETTE
+// Coverage of the object in the red channel, the mean absolute error is not computed
+#define OTHER_FORMAT r8
+#else
+#define OTHER_FORMAT rgba8
+#endif
+#ifdef LAYERED
+// One rendered pose per layer, compared by the workgroups with the same z
+layout(OTHER_FORMAT, binding = 1) uniform readonly image2DArray other;
+#else
+layout(OTHER_FORMAT, binding = 1) uniform readonly image2D other;
+#endif
+
+// Exact sums over the block of one workgroup, alpha channels are in 1/255 units.
+// False negatives are derived from the area of the target on the CPU.
+struct SimilarityPartial
+{
+	uint truePositive;
+	uint falsePositive;
+	uint diceNumerator;
+	uint diceDenominator;
+	uint meanAbsoluteError;
+};
+
+layout(std430, binding = 2) writeonly buffer SimilarityPartials
+{
+	SimilarityPartial partials[];
+};
 
-layout(binding = 2, offset = 0) uniform atomic_uint truePositive;
-layout(binding = 2, offset = 4) uniform atomic_uint falsePositive;
-layout(binding = 2, offset = 8) uniform atomic_uint falseNegative;
-layout(binding = 2, offset = 12) uniform atomic_uint diceNumerator;
-layout(binding = 2, offset = 16) uniform atomic_uint diceDenominator;
-layout(binding = 2, offset = 20) uniform atomic_uint meanAbsoluteError;
+// Region of the images covered by the object, other pixels are not visited
+uniform ivec2 region_offset = ivec2(0, 0);
+uniform ivec2 region_size = ivec2(0, 0);
 
-// The coefficient to apply when rounding float numbers
-uniform float multiplication_before_round = 1.0;
+shared uint sharedTruePositive[INVOCATION_COUNT];
+shared uint sharedFalsePositive[INVOCATION_COUNT];
+shared uint sharedDiceNumerator[INVOCATION_COUNT];
+shared uint sharedDiceDenominator[INVOCATION_COUNT];
+shared uint sharedMeanAbsoluteError[INVOCATION_COUNT];
 
 // All components are in the range [01], including hue.
 // Source: https://stackoverflow.com/questions/15095909/from-rgb-to-hsv-in-opengl-glsl
@@ -33,56 +65,105 @@ void main()
 {
 	// Resolution of the textures
 	const ivec2 targetSize = imageSize(target);
+#ifdef LAYERED
+	const ivec2 otherSize = imageSize(other).xy;
+#else
 	const ivec2 otherSize = imageSize(other);
+#endif
 
 	// Coordinates on the texture
-	const ivec2 coords = ivec2(gl_GlobalInvocationID);
+	const ivec2 regionCoords = ivec2(gl_GlobalInvocationID.xy);
+	const ivec2 coords = region_offset + regionCoords;
 
-	if (all(lessThanEqual(coords, targetSize)) && all(lessThanEqual(coords, otherSize)))
+	uint truePositive = 0;
+	uint falsePositive = 0;
+	uint diceNumerator = 0;
+	uint diceDenominator = 0;
+	uint meanAbsoluteError = 0;
+
+	if (all(lessThan(regionCoords, region_size)) && all(lessThan(coords, targetSize)) && all(lessThan(coords, otherSize)))
 	{
-		const vec4 pixelTarget = imageLoad(target, coords);
+#ifdef LAYERED
+		const vec4 pixelOther = imageLoad(other, ivec3(coords, gl_WorkGroupID.z));
+#else
 		const vec4 pixelOther = imageLoad(other, coords);
+#endif
+#ifdef SILHOUETTE
+		const uint otherTransparency = uint(round(255.0 * pixelOther.r));
+#else
+		const uint otherTransparency = uint(round(255.0 * pixelOther.a));
+#endif
+
+		// Pixels not covered by the object only depend on the target, they are known in advance
+		if (otherTransparency > 0)
+		{
+			const vec2 pixelTarget = imageLoad(target, coords).rg;
+			const uint targetTransparency = uint(round(255.0 * pixelTarget.r));
 
-		// Compute fuzzy Dice coefficient
-		const float otherTransparency = pixelOther.a;
-		const float targetTransparency = pixelTarget.a;
-
-		const float product = otherTransparency * targetTransparency;
-		const float sum = otherTransparency + targetTransparency;
-
-		const int productInt = int(round(multiplication_before_round * product));
-		const int sumInt = int(round(multiplication_before_round * sum));
-
-		atomicCounterAdd(diceNumerator, productInt);
-		atomicCounterAdd(diceDenominator, sumInt);
+			// Fuzzy Dice coefficient
+			diceNumerator = otherTransparency * targetTransparency;
+			diceDenominator = otherTransparency;
 
-		// Compute truePositive, falsePositive, falseNegative
-		const bool targetNotTransparent = targetTransparency > 0.0;
-		const bool otherNotTransparent = otherTransparency > 0.0;
-		
-		if (otherNotTransparent && targetNotTransparent)
-		{
-			atomicCounterIncrement(truePositive);
+			if (targetTransparency > 0)
+			{
+				truePositive = 1;
 
-			// Compute Mean Absolute Error in the overlap zone
-			const vec3 pixelOtherHsv = rgb2hsv(vec3(pixelOther));
-			const vec3 pixelTargetHsv = rgb2hsv(vec3(pixelTarget));
+#ifndef SILHOUETTE
+				// Mean Absolute Error in the overlap zone
+				const vec3 pixelOtherHsv = rgb2hsv(vec3(pixelOther));
 
-			const float pixelOtherValue = (pixelOtherHsv.z > 0.5) ? 1.0 : 0.0;
-			const float pixelTargetValue = (pixelTargetHsv.z > 0.5) ? 1.0 : 0.0;
+				const float pixelOtherValue = (pixelOtherHsv.z > 0.5) ? 1.0 : 0.0;
+				const float pixelTargetValue = pixelTarget.g;
 
-			if (pixelOtherValue == pixelTargetValue)
+				if (pixelOtherValue == pixelTargetValue)
+				{
+					meanAbsoluteError = 255;
+				}
+#endif
+			}
+			else
 			{
-				atomicCounterIncrement(meanAbsoluteError);
+				falsePositive = 1;
 			}
 		}
-		else if (otherNotTransparent && !targetNotTransparent)
-		{
-			atomicCounterIncrement(falsePositive);
-		}
-		else if (!otherNotTransparent && targetNotTransparent)
+	}
+
+	// Tree reduction in shared memory, every invocation must reach the barriers
+	const uint index = gl_LocalInvocationIndex;
+
+	sharedTruePositive[index] = truePositive;
+	sharedFalsePositive[index] = falsePositive;
+	sharedDiceNumerator[index] = diceNumerator;
+	sharedDiceDenominator[index] = diceDenominator;
+	sharedMeanAbsoluteError[index] = meanAbsoluteError;
+
+	memoryBarrierShared();
+	barrier();
+
+	for (uint stride = INVOCATION_COUNT / 2; stride > 0; stride /= 2)
+	{
+		if (index < stride)
 		{
-			atomicCounterIncrement(falseNegative);
+			sharedTruePositive[index] += sharedTruePositive[index + stride];
+			sharedFalsePositive[index] += sharedFalsePositive[index + stride];
+			sharedDiceNumerator[index] += sharedDiceNumerator[index + stride];
+			sharedDiceDenominator[index] += sharedDiceDenominator[index + stride];
+			sharedMeanAbsoluteError[index] += sharedMeanAbsoluteError[index + stride];
 		}
+
+		memoryBarrierShared();
+		barrier();
+	}
+
+	// One record per workgroup, summed on the CPU with 64 bits integers
+	if (index == 0)
+	{
+		const uint workGroup = (gl_WorkGroupID.z * gl_NumWorkGroups.y + gl_WorkGroupID.y) * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+
+		partials[workGroup].truePositive = sharedTruePositive[0];
+		partials[workGroup].falsePositive = sharedFalsePositive[0];
+		partials[workGroup].diceNumerator = sharedDiceNumerator[0];
+		partials[workGroup].diceDenominator = sharedDiceDenominator[0];
+		partials[workGroup].meanAbsoluteError = sharedMeanAbsoluteError[0];
 	}
 }
\ No newline at end of file
@@ -0,0 +1,470 @@
+#include "SilhouetteAlignment.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+#include <QtDebug>
+#include <QPointF>
+#include <QQuaternion>
+#include <QtMath>
+
+#include <dlib/matrix.h>
+
+namespace
+{
+	using ComplexMatrix = dlib::matrix<std::complex<double>>;
+
+	long nextPowerOfTwo(long value)
+	{
+		long power = 1;
+		while (power < value)
+		{
+			power *= 2;
+		}
+
+		return power;
+	}
+
+	/**
+	 * \brief Alpha channel of an image in [0, 1], rows from the top
+	 */
+	std::vector<double> alphaChannel(const QImage& image)
+	{
+		const auto imageArgb = image.convertToFormat(QImage::Format_ARGB32);
+
+		std::vector<double> alpha(std::size_t(imageArgb.width()) * imageArgb.height());
+
+		for (int i = 0; i < imageArgb.height(); i++)
+		{
+			const auto row = reinterpret_cast<const QRgb*>(imageArgb.constScanLine(i));
+
+			for (int j = 0; j < imageArgb.width(); j++)
+			{
+				alpha[std::size_t(i) * imageArgb.width() + j] = qAlpha(row[j]) / 255.0;
+			}
+		}
+
+		return alpha;
+	}
+
+	/**
+	 * \brief Resample an alpha channel around the center of the image, in a zero padded matrix
+	 * \param alpha The alpha channel
+	 * \param size Size of the image of the alpha channel
+	 * \param scale Ratio between the sizes of the resampled and of the original silhouettes
+	 * \param rows Number of rows of the matrix, at least the height of the image
+	 * \param columns Number of columns of the matrix, at least the width of the image
+	 */
+	ComplexMatrix scaledAlpha(const std::vector<double>& alpha, const QSize& size, double scale, long rows, long columns)
+	{
+		ComplexMatrix matrix = dlib::zeros_matrix<std::complex<double>>(rows, columns);
+
+		const double centerX = 0.5 * size.width();
+		const double centerY = 0.5 * size.height();
+
+		for (int i = 0; i < size.height(); i++)
+		{
+			// Bilinear interpolation between the centers of the source pixels
+			const double y = centerY + (i + 0.5 - centerY) / scale - 0.5;
+			const int y0 = int(std::floor(y));
+			const double fy = y - y0;
+
+			for (int j = 0; j < size.width(); j++)
+			{
+				const double x = centerX + (j + 0.5 - centerX) / scale - 0.5;
+				const int x0 = int(std::floor(x));
+				const double fx = x - x0;
+
+				const auto sample = [&](int sampleY, int sampleX)
+				{
+					if (sampleY < 0 || sampleY >= size.height() || sampleX < 0 || sampleX >= size.width())
+					{
+						return 0.0;
+					}
+
+					return alpha[std::size_t(sampleY) * size.width() + sampleX];
+				};
+
+				const double value = (1.0 - fy) * ((1.0 - fx) * sample(y0, x0) + fx * sample(y0, x0 + 1))
+				                   + fy * ((1.0 - fx) * sample(y0 + 1, x0) + fx * sample(y0 + 1, x0 + 1));
+
+				matrix(i, j) = value;
+			}
+		}
+
+		return matrix;
+	}
+
+	double energy(const ComplexMatrix& matrix)
+	{
+		return dlib::sum(dlib::squared(dlib::real(matrix)));
+	}
+
+	/**
+	 * \brief Size of the target downscaled so that its largest dimension is at most maxResolution
+	 */
+	QSize workingSize(const QImage& targetImage, int maxResolution)
+	{
+		const double downscale = std::min(1.0, double(maxResolution) / std::max(targetImage.width(), targetImage.height()));
+
+		return QSize(std::max(1, int(std::lround(targetImage.width() * downscale))),
+		             std::max(1, int(std::lround(targetImage.height() * downscale))));
+	}
+
+	/**
+	 * \brief Axes of the evaluation camera, to move between translations and positions on the image
+	 *
+	 * Positions on the image are in pixels from its center, with y going up.
+	 */
+	struct CameraFrame
+	{
+		CameraFrame(const QSize& size)
+		{
+			const auto camera = evaluationCamera(float(size.width()) / float(size.height()));
+
+			eye = camera.eye();
+			forward = (camera.at() - camera.eye()).normalized();
+			right = camera.right();
+			up = QVector3D::crossProduct(right, forward);
+			focalLength = size.height() / (2.0 * std::tan(0.5 * qDegreesToRadians(double(camera.fovy()))));
+		}
+
+		/**
+		 * \brief Depth of a point along the axis of the camera
+		 */
+		double depth(const QVector3D& point) const
+		{
+			return QVector3D::dotProduct(point - eye, forward);
+		}
+
+		/**
+		 * \brief Position of the projection of a point in front of the camera
+		 */
+		QPointF project(const QVector3D& point) const
+		{
+			const auto offset = point - eye;
+			const double pixelsPerUnit = focalLength / depth(point);
+
+			return QPointF(QVector3D::dotProduct(offset, right) * pixelsPerUnit,
+			               QVector3D::dotProduct(offset, up) * pixelsPerUnit);
+		}
+
+		/**
+		 * \brief Point at some depth projecting to a position
+		 */
+		QVector3D unproject(const QPointF& position, double depth) const
+		{
+			const double unitsPerPixel = depth / focalLength;
+
+			return eye
+			     + float(depth) * forward
+			     + float(position.x() * unitsPerPixel) * right
+			     + float(position.y() * unitsPerPixel) * up;
+		}
+
+		QVector3D eye;
+		QVector3D forward;
+		QVector3D right;
+		QVector3D up;
+
+		/**
+		 * \brief Pixels per unit at a depth of 1
+		 */
+		double focalLength;
+	};
+
+	/**
+	 * \brief Image moments of the alpha of an image, up to the second order
+	 */
+	struct SilhouetteMoments
+	{
+		/**
+		 * \brief Sum of the alpha, in pixels
+		 */
+		double area = 0.0;
+
+		/**
+		 * \brief Centroid in pixels from the center of the image, with y going up
+		 */
+		QPointF centroid;
+
+		/**
+		 * \brief Angle of the principal axis in radians, counterclockwise from the x axis
+		 */
+		double orientation = 0.0;
+
+		/**
+		 * \brief Ratio between the minor and the major axes, 1 for a disc
+		 */
+		double axisRatio = 1.0;
+	};
+
+	SilhouetteMoments computeMoments(const QImage& image)
+	{
+		const auto imageArgb = image.convertToFormat(QImage::Format_ARGB32);
+
+		const double centerX = 0.5 * imageArgb.width();
+		const double centerY = 0.5 * imageArgb.height();
+
+		// Raw moments, all accumulated in one pass
+		double m00 = 0.0, m10 = 0.0, m01 = 0.0, m20 = 0.0, m11 = 0.0, m02 = 0.0;
+
+		for (int i = 0; i < imageArgb.height(); i++)
+		{
+			const auto row = reinterpret_cast<const QRgb*>(imageArgb.constScanLine(i));
+			const double y = centerY - (i + 0.5);
+
+			for (int j = 0; j < imageArgb.width(); j++)
+			{
+				const int alpha = qAlpha(row[j]);
+
+				if (alpha == 0)
+				{
+					continue;
+				}
+
+				const double weight = alpha / 255.0;
+				const double x = j + 0.5 - centerX;
+
+				m00 += weight;
+				m10 += weight * x;
+				m01 += weight * y;
+				m20 += weight * x * x;
+				m11 += weight * x * y;
+				m02 += weight * y * y;
+			}
+		}
+
+		SilhouetteMoments moments;
+		moments.area = m00;
+
+		if (m00 <= 0.0)
+		{
+			return moments;
+		}
+
+		const double cx = m10 / m00;
+		const double cy = m01 / m00;
+		moments.centroid = QPointF(cx, cy);
+
+		// Covariance of the silhouette, its eigenvectors are the axes
+		const double mu20 = m20 / m00 - cx * cx;
+		const double mu11 = m11 / m00 - cx * cy;
+		const double mu02 = m02 / m00 - cy * cy;
+
+		moments.orientation = 0.5 * std::atan2(2.0 * mu11, mu20 - mu02);
+
+		const double spread = std::sqrt(4.0 * mu11 * mu11 + (mu20 - mu02) * (mu20 - mu02));
+		const double major = 0.5 * (mu20 + mu02 + spread);
+		const double minor = 0.5 * (mu20 + mu02 - spread);
+
+		moments.axisRatio = major > 0.0 ? std::sqrt(std::max(0.0, minor) / major) : 1.0;
+
+		return moments;
+	}
+}
+
+ObjectPose alignSilhouette(
+	Renderer* renderer,
+	const QImage& targetImage,
+	const ObjectPose& pose,
+	const SilhouetteAlignmentSettings& settings)
+{
+	if (targetImage.isNull())
+	{
+		return pose;
+	}
+
+	// The correlation does not need the details of the silhouettes
+	const auto size = workingSize(targetImage, settings.maxResolution);
+
+	const auto previousResolution = renderer->workingResolution();
+	renderer->setTargetImage(targetImage);
+	renderer->setWorkingResolution(size);
+	const auto renderedAlpha = alphaChannel(renderer->renderToImage(pose));
+	renderer->setWorkingResolution(previousResolution);
+
+	const auto targetAlpha = alphaChannel(targetImage.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+
+	// FFTs of dlib need powers of two. Padding to twice the size keeps the circular correlation
+	// from wrapping around: every shift of less than the size of the image has its own element
+	const long rows = nextPowerOfTwo(2 * size.height());
+	const long columns = nextPowerOfTwo(2 * size.width());
+
+	const auto target = scaledAlpha(targetAlpha, size, 1.0, rows, columns);
+	const double targetEnergy = energy(target);
+
+	if (targetEnergy <= 0.0)
+	{
+		return pose;
+	}
+
+	const ComplexMatrix targetSpectrum = dlib::fft(target);
+
+	double bestScore = 0.0;
+	double bestScale = 1.0;
+	long bestShiftX = 0;
+	long bestShiftY = 0;
+
+	for (int s = 0; s < settings.scaleCount; s++)
+	{
+		const double scale = settings.scaleCount > 1
+		                   ? std::pow(settings.maxScale, 2.0 * s / (settings.scaleCount - 1) - 1.0)
+		                   : 1.0;
+
+		const auto silhouette = scaledAlpha(renderedAlpha, size, scale, rows, columns);
+		const double silhouetteEnergy = energy(silhouette);
+
+		if (silhouetteEnergy <= 0.0)
+		{
+			continue;
+		}
+
+		// correlation(d) = sum over p of target(p) silhouette(p - d)
+		const ComplexMatrix correlation = dlib::ifft(dlib::pointwise_multiply(targetSpectrum, dlib::conj(dlib::fft(silhouette))));
+
+		long peakRow = 0;
+		long peakColumn = 0;
+		for (long r = 0; r < rows; r++)
+		{
+			for (long c = 0; c < columns; c++)
+			{
+				if (correlation(r, c).real() > correlation(peakRow, peakColumn).real())
+				{
+					peakRow = r;
+					peakColumn = c;
+				}
+			}
+		}
+
+		// Normalized so that scales covering more pixels are not favored
+		const double score = correlation(peakRow, peakColumn).real() / std::sqrt(silhouetteEnergy * targetEnergy);
+
+		if (score > bestScore)
+		{
+			bestScore = score;
+			bestScale = scale;
+
+			// Shifts beyond half of the matrix wrap around to negative ones
+			bestShiftX = peakColumn < columns / 2 ? peakColumn : peakColumn - columns;
+			bestShiftY = peakRow < rows / 2 ? peakRow : peakRow - rows;
+		}
+	}
+
+	if (bestScore <= 0.0)
+	{
+		return pose;
+	}
+
+	const CameraFrame frame(size);
+	const double depth = frame.depth(pose.translation);
+
+	if (depth <= 0.0)
+	{
+		return pose;
+	}
+
+	// The projection scales as the inverse of the depth around the center of the image, rows of the images go down
+	const auto position = frame.project(pose.translation);
+
+	ObjectPose aligned = pose;
+	aligned.translation = frame.unproject(bestScale * position + QPointF(bestShiftX, -bestShiftY), depth / bestScale);
+
+	qDebug() << "Silhouette alignment: shift" << bestShiftX << bestShiftY << "pixels, scale" << bestScale
+	         << "score" << bestScore;
+
+	return aligned;
+}
+
+ObjectPose alignSilhouetteMoments(
+	Renderer* renderer,
+	const QImage& targetImage,
+	const ObjectPose& pose,
+	const SilhouetteMomentsSettings& settings)
+{
+	if (targetImage.isNull())
+	{
+		return pose;
+	}
+
+	const auto size = workingSize(targetImage, settings.maxResolution);
+	const auto target = computeMoments(targetImage.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+
+	if (target.area <= 0.0)
+	{
+		return pose;
+	}
+
+	const CameraFrame frame(size);
+	const bool alignOrientation = target.axisRatio <= settings.maxAxisRatio;
+
+	const auto previousResolution = renderer->workingResolution();
+	renderer->setTargetImage(targetImage);
+	renderer->setWorkingResolution(size);
+
+	ObjectPose aligned = pose;
+
+	for (int iteration = 0; iteration < settings.iterations; iteration++)
+	{
+		const double depth = frame.depth(aligned.translation);
+
+		if (depth <= 0.0)
+		{
+			break;
+		}
+
+		const auto rendered = computeMoments(renderer->renderToImage(aligned));
+
+		if (rendered.area <= 0.0)
+		{
+			break;
+		}
+
+		// Both principal axes are only defined up to a half turn
+		double angle = 0.0;
+
+		if (alignOrientation && rendered.axisRatio <= settings.maxAxisRatio)
+		{
+			angle = qRadiansToDegrees(std::remainder(target.orientation - rendered.orientation, M_PI));
+
+			if (std::abs(angle) > settings.maxInPlaneRotation)
+			{
+				angle = 0.0;
+			}
+		}
+
+		const double scale = std::sqrt(target.area / rendered.area);
+
+		// The centroid stays at the same place relatively to the projection of the center of the object,
+		// up to the rotation and the scale of the silhouette
+		const auto position = frame.project(aligned.translation);
+		const auto offset = rendered.centroid - position;
+		const double c = std::cos(qDegreesToRadians(angle));
+		const double s = std::sin(qDegreesToRadians(angle));
+		const QPointF rotatedOffset(c * offset.x() - s * offset.y(), s * offset.x() + c * offset.y());
+
+		aligned.translation = frame.unproject(target.centroid - scale * rotatedOffset, depth / scale);
+
+		// A counterclockwise rotation on the image is around the axis going towards the camera
+		const auto rotation = QQuaternion::fromAxisAndAngle(-frame.forward, float(angle))
+		                    * QQuaternion::fromEulerAngles(aligned.rotation);
+		aligned.rotation = rotation.normalized().toEulerAngles();
+
+		const auto shift = target.centroid - rendered.centroid;
+
+		qDebug() << "Silhouette moments" << iteration << ": shift" << shift.x() << shift.y() << "pixels, scale" << scale
+		         << "rotation" << angle;
+
+		// Corrections below a pixel, a percent of the area and a tenth of a degree do not help the refinement
+		if (std::abs(shift.x()) < 0.5 && std::abs(shift.y()) < 0.5 && std::abs(scale - 1.0) < 0.005 && std::abs(angle) < 0.1)
+		{
+			break;
+		}
+	}
+
+	renderer->setWorkingResolution(previousResolution);
+
+	return aligned;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <QImage>
+
+#include "ObjectPose.h"
+#include "Renderer.h"
+
+/**
+ * \brief Parameters of the alignment of the silhouettes before the refinement
+ */
+struct SilhouetteAlignmentSettings
+{
+	/**
+	 * \brief Largest dimension in pixels of the images correlated, the target is downscaled to it
+	 */
+	int maxResolution = 256;
+
+	/**
+	 * \brief Number of scales tried, geometrically spaced between 1 / maxScale and maxScale
+	 */
+	int scaleCount = 9;
+
+	/**
+	 * \brief Largest ratio between the sizes of the silhouettes, 1 to only align the translation on the image
+	 */
+	double maxScale = 1.25;
+};
+
+/**
+ * \brief Move the pose so that its silhouette overlaps the silhouette of the target
+ *
+ * The pose is rendered once, and its alpha is cross-correlated with the alpha of the target
+ * with FFTs: the peak of the correlation is the shift of the silhouette on the image. Moving the object
+ * along the axis of the camera scales its projection around the center of the image, so the rendered
+ * silhouette is also resampled at several scales, and the scale with the best normalized peak gives
+ * the depth. The shift and the scale are converted to a translation of the object, the rotation is kept.
+ * \param renderer Backend used to render the pose, its settings are restored
+ * \param targetImage Target image at full resolution
+ * \param pose Initial pose
+ * \param settings Resolution and scales of the search
+ * \return The pose with its translation aligned, or the initial pose if a silhouette is empty
+ */
+ObjectPose alignSilhouette(Renderer* renderer,
+	                       const QImage& targetImage,
+	                       const ObjectPose& pose,
+	                       const SilhouetteAlignmentSettings& settings = SilhouetteAlignmentSettings());
+
+/**
+ * \brief Parameters of the alignment of the image moments of the silhouettes
+ */
+struct SilhouetteMomentsSettings
+{
+	/**
+	 * \brief Largest dimension in pixels of the images compared, the target is downscaled to it
+	 */
+	int maxResolution = 256;
+
+	/**
+	 * \brief Largest number of corrections, each one renders the pose once
+	 */
+	int iterations = 3;
+
+	/**
+	 * \brief Largest ratio between the minor and the major axes of the silhouettes to correct the in-plane rotation
+	 *
+	 * The principal axis of a silhouette close to a disc is not defined.
+	 */
+	double maxAxisRatio = 0.8;
+
+	/**
+	 * \brief Largest correction of the in-plane rotation in degrees, larger ones are assumed to be wrong
+	 */
+	double maxInPlaneRotation = 45.0;
+};
+
+/**
+ * \brief Move and rotate the pose so that the image moments of its silhouette match those of the target
+ *
+ * The area, the centroid and the principal axis of the alpha of the rendered pose and of the target are
+ * computed in a single pass over each image. The ratio of the areas gives the depth, the offset of the
+ * centroids the translation in the plane of the image, and the angle between the principal axes the
+ * rotation around the axis of the camera. The correction is closed-form but assumes that the projection
+ * only scales with the depth, so it is repeated a few times on a new render.
+ * \param renderer Backend used to render the pose, its settings are restored
+ * \param targetImage Target image at full resolution
+ * \param pose Initial pose
+ * \param settings Resolution and number of corrections
+ * \return The corrected pose, or the initial pose if a silhouette is empty
+ */
+ObjectPose alignSilhouetteMoments(Renderer* renderer,
+	                              const QImage& targetImage,
+	                              const ObjectPose& pose,
+	                              const SilhouetteMomentsSettings& settings = SilhouetteMomentsSettings());
@@ -0,0 +1,244 @@
+#include "SilhouetteMask.h"
+
+#include "MathUtils.h"
+
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+#include <immintrin.h>
+#define SILHOUETTE_USE_AVX512
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SILHOUETTE_USE_SSE2
+#endif
+
+namespace
+{
+	/**
+	 * \brief Pack the silhouette of up to 64 pixels in a word, with scalar code
+	 */
+	uint64_t packPixels(const QRgb* pixels, int count)
+	{
+		uint64_t word = 0;
+
+		for (int k = 0; k < count; k++)
+		{
+			word |= uint64_t(qAlpha(pixels[k]) > 0) << k;
+		}
+
+		return word;
+	}
+
+#if defined(__AVX2__)
+	/**
+	 * \brief Pack the silhouette of 64 pixels in a word, 8 pixels at a time with AVX2
+	 */
+	uint64_t packWord(const QRgb* pixels)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+
+		uint64_t word = 0;
+		for (int k = 0; k < 64; k += 8)
+		{
+			const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pixels + k));
+			const __m256i transparent = _mm256_cmpeq_epi32(_mm256_srli_epi32(p, 24), zero);
+			const auto bits = ~_mm256_movemask_ps(_mm256_castsi256_ps(transparent)) & 0xFF;
+			word |= uint64_t(bits) << k;
+		}
+
+		return word;
+	}
+#elif defined(SILHOUETTE_USE_SSE2)
+	/**
+	 * \brief Pack the silhouette of 64 pixels in a word, 4 pixels at a time with SSE2
+	 */
+	uint64_t packWord(const QRgb* pixels)
+	{
+		const __m128i zero = _mm_setzero_si128();
+
+		uint64_t word = 0;
+		for (int k = 0; k < 64; k += 4)
+		{
+			const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + k));
+			const __m128i transparent = _mm_cmpeq_epi32(_mm_srli_epi32(p, 24), zero);
+			const auto bits = ~_mm_movemask_ps(_mm_castsi128_ps(transparent)) & 0xF;
+			word |= uint64_t(bits) << k;
+		}
+
+		return word;
+	}
+#else
+	/**
+	 * \brief Pack the silhouette of 64 pixels in a word
+	 */
+	uint64_t packWord(const QRgb* pixels)
+	{
+		return packPixels(pixels, 64);
+	}
+#endif
+
+	/**
+	 * \brief Check that the alpha channel of a row only contains 0 or 255
+	 */
+	bool isBinaryRow(const QRgb* pixels, int count)
+	{
+		bool binary = true;
+
+		for (int k = 0; k < count; k++)
+		{
+			const auto alpha = qAlpha(pixels[k]);
+			binary &= (alpha == 0 || alpha == 255);
+		}
+
+		return binary;
+	}
+}
+
+SilhouetteMask::SilhouetteMask() :
+	m_width(0),
+	m_height(0),
+	m_wordsPerRow(0),
+	m_binary(true)
+{
+
+}
+
+SilhouetteMask::SilhouetteMask(int width, int height) :
+	m_width(width),
+	m_height(height),
+	m_wordsPerRow(RowAlignment * ((width + 64 * RowAlignment - 1) / (64 * RowAlignment))),
+	m_binary(true),
+	m_words(std::size_t(m_wordsPerRow) * height, 0)
+{
+
+}
+
+SilhouetteMask SilhouetteMask::fromAlpha(const QImage& image)
+{
+	const auto imageArgb = image.convertToFormat(QImage::Format_ARGB32);
+
+	SilhouetteMask mask(imageArgb.width(), imageArgb.height());
+
+	const int fullWords = mask.m_width / 64;
+	const int remainingPixels = mask.m_width % 64;
+
+	bool binary = true;
+
+	#pragma omp parallel for reduction(&&: binary)
+	for (int i = 0; i < mask.m_height; i++)
+	{
+		const auto pixels = reinterpret_cast<const QRgb*>(imageArgb.constScanLine(i));
+		auto words = mask.row(i);
+
+		for (int w = 0; w < fullWords; w++)
+		{
+			words[w] = packWord(pixels + 64 * w);
+		}
+
+		if (remainingPixels > 0)
+		{
+			words[fullWords] = packPixels(pixels + 64 * fullWords, remainingPixels);
+		}
+
+		binary = binary && isBinaryRow(pixels, mask.m_width);
+	}
+
+	mask.m_binary = binary;
+
+	return mask;
+}
+
+void SilhouetteMask::setPixel(int x, int y, bool value)
+{
+	const uint64_t bit = uint64_t(1) << (x % 64);
+
+	if (value)
+	{
+		row(y)[x / 64] |= bit;
+	}
+	else
+	{
+		row(y)[x / 64] &= ~bit;
+	}
+}
+
+long long SilhouetteMask::area() const
+{
+	long long area = 0;
+
+	#pragma omp parallel for reduction(+: area)
+	for (int i = 0; i < m_height; i++)
+	{
+		const auto words = constRow(i);
+
+		for (int w = 0; w < m_wordsPerRow; w++)
+		{
+			area += popcount64(words[w]);
+		}
+	}
+
+	return area;
+}
+
+SilhouetteOverlap SilhouetteMask::overlap(const SilhouetteMask& target) const
+{
+	assert(m_width == target.m_width && m_height == target.m_height);
+
+	long long truePositives = 0;
+	long long falsePositives = 0;
+	long long falseNegatives = 0;
+
+	#pragma omp parallel for reduction(+: truePositives, falsePositives, falseNegatives)
+	for (int i = 0; i < m_height; i++)
+	{
+		const auto a = constRow(i);
+		const auto b = target.constRow(i);
+
+#if defined(SILHOUETTE_USE_AVX512)
+		// Rows are a multiple of 8 words, process them with VPOPCNTQ
+		__m512i tp = _mm512_setzero_si512();
+		__m512i fp = _mm512_setzero_si512();
+		__m512i fn = _mm512_setzero_si512();
+
+		for (int w = 0; w < m_wordsPerRow; w += 8)
+		{
+			const __m512i wordsA = _mm512_loadu_si512(a + w);
+			const __m512i wordsB = _mm512_loadu_si512(b + w);
+
+			tp = _mm512_add_epi64(tp, _mm512_popcnt_epi64(_mm512_and_si512(wordsA, wordsB)));
+			fp = _mm512_add_epi64(fp, _mm512_popcnt_epi64(_mm512_andnot_si512(wordsB, wordsA)));
+			fn = _mm512_add_epi64(fn, _mm512_popcnt_epi64(_mm512_andnot_si512(wordsA, wordsB)));
+		}
+
+		truePositives += _mm512_reduce_add_epi64(tp);
+		falsePositives += _mm512_reduce_add_epi64(fp);
+		falseNegatives += _mm512_reduce_add_epi64(fn);
+#else
+		for (int w = 0; w < m_wordsPerRow; w++)
+		{
+			truePositives += popcount64(a[w] & b[w]);
+			falsePositives += popcount64(a[w] & ~b[w]);
+			falseNegatives += popcount64(~a[w] & b[w]);
+		}
+#endif
+	}
+
+	SilhouetteOverlap result;
+	result.truePositives = truePositives;
+	result.falsePositives = falsePositives;
+	result.falseNegatives = falseNegatives;
+
+	return result;
+}
+
+float diceCoefficient(const SilhouetteOverlap& overlap)
+{
+	const auto denominator = 2 * overlap.truePositives + overlap.falsePositives + overlap.falseNegatives;
+
+	if (denominator == 0)
+	{
+		return 1.0f;
+	}
+
+	return float(2 * overlap.truePositives) / float(denominator);
+}
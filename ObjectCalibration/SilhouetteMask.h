@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <QImage>
+
+/**
+ * \brief Overlap between the silhouette of an image and the silhouette of a target
+ */
+struct SilhouetteOverlap
+{
+	/**
+	 * \brief Number of pixels present in the image and in the target
+	 */
+	long long truePositives = 0;
+
+	/**
+	 * \brief Number of pixels present in the image but not in the target
+	 */
+	long long falsePositives = 0;
+
+	/**
+	 * \brief Number of pixels present in the target but not in the image
+	 */
+	long long falseNegatives = 0;
+};
+
+/**
+ * \brief Binary silhouette of an image, packed with one bit per pixel
+ *
+ * Rows are padded with zeros to a multiple of 64 bytes, so that they can be processed
+ * by blocks of 8 words without handling the end of the row separately.
+ */
+class SilhouetteMask
+{
+public:
+
+	/**
+	 * \brief Number of 64 bits words each row is aligned to
+	 */
+	static constexpr int RowAlignment = 8;
+
+	SilhouetteMask();
+
+	/**
+	 * \brief Create an empty mask of a given size
+	 * \param width Width of the mask in pixels
+	 * \param height Height of the mask in pixels
+	 */
+	SilhouetteMask(int width, int height);
+
+	/**
+	 * \brief Build the silhouette of an image: all pixels with an alpha greater than 0
+	 * \param image An image with an alpha channel
+	 * \return The silhouette of the image
+	 */
+	static SilhouetteMask fromAlpha(const QImage& image);
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+	int wordsPerRow() const { return m_wordsPerRow; }
+
+	/**
+	 * \brief Return true if the alpha channel of the source image only contained 0 or 255
+	 */
+	bool isBinary() const { return m_binary; }
+
+	/**
+	 * \brief Return true if the pixel is in the silhouette
+	 */
+	bool testPixel(int x, int y) const
+	{
+		return (constRow(y)[x / 64] >> (x % 64)) & 1;
+	}
+
+	/**
+	 * \brief Add or remove a pixel from the silhouette
+	 */
+	void setPixel(int x, int y, bool value);
+
+	const uint64_t* constRow(int y) const { return m_words.data() + std::size_t(y) * m_wordsPerRow; }
+	uint64_t* row(int y) { return m_words.data() + std::size_t(y) * m_wordsPerRow; }
+
+	/**
+	 * \brief Count the number of pixels in the silhouette
+	 * \return The number of pixels in the silhouette
+	 */
+	long long area() const;
+
+	/**
+	 * \brief Count the overlap between this silhouette and the silhouette of a target
+	 * \param target The silhouette of the target, with the same size
+	 * \return The true positives, false positives and false negatives
+	 */
+	SilhouetteOverlap overlap(const SilhouetteMask& target) const;
+
+private:
+
+	int m_width;
+	int m_height;
+	int m_wordsPerRow;
+	bool m_binary;
+
+	std::vector<uint64_t> m_words;
+};
+
+/**
+ * \brief Compute the Dice coefficient of two silhouettes
+ * \param overlap Overlap between the two silhouettes
+ * \return The Dice coefficient, 1 when both silhouettes are empty
+ */
+float diceCoefficient(const SilhouetteOverlap& overlap);
@@ -1,51 +1,489 @@
 #include "Similarity.h"
 
-float computeSimilarity(const QImage& image, const QImage& target)
+#include <algorithm>
+#include <cstdlib>
+
+#include "MathUtils.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SIMILARITY_USE_SSE2
+#endif
+
+namespace
+{
+	/**
+	 * \brief Partial sums of one row
+	 *
+	 * The vectorized kernels accumulate in 32 bits lanes, with 8 bits channels
+	 * a lane cannot overflow for rows narrower than 264,000 pixels.
+	 */
+	struct RowSums
+	{
+		long long truePositives = 0;
+		long long falsePositives = 0;
+		long long falseNegatives = 0;
+		long long diceNumerator = 0;
+		long long diceDenominator = 0;
+		long long meanAbsoluteErrorSum = 0;
+	};
+
+	/**
+	 * \brief Accumulate the statistics of pixels in [begin, end) with scalar code
+	 */
+	void accumulatePixels(const QRgb* image, const QRgb* target, int begin, int end, RowSums& sums)
+	{
+		for (int j = begin; j < end; j++)
+		{
+			const auto imageAlpha = qAlpha(image[j]);
+			const auto targetAlpha = qAlpha(target[j]);
+
+			sums.diceNumerator += imageAlpha * targetAlpha;
+			sums.diceDenominator += imageAlpha + targetAlpha;
+
+			// Present in the image and in the target
+			if (imageAlpha > 0 && targetAlpha > 0)
+			{
+				// The value in HSV is the maximum of the three channels
+				const auto imageValue = std::max({ qRed(image[j]), qGreen(image[j]), qBlue(image[j]) });
+				const auto targetValue = std::max({ qRed(target[j]), qGreen(target[j]), qBlue(target[j]) });
+
+				sums.truePositives++;
+				sums.meanAbsoluteErrorSum += 255 - std::abs(imageValue - targetValue);
+			}
+			else if (imageAlpha > 0)
+			{
+				sums.falsePositives++;
+			}
+			else if (targetAlpha > 0)
+			{
+				sums.falseNegatives++;
+			}
+		}
+	}
+
+#if defined(__AVX2__)
+	/**
+	 * \brief Sum the eight 32 bits lanes of a vector
+	 */
+	long long horizontalSum(__m256i v)
+	{
+		alignas(32) unsigned int lanes[8];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), v);
+
+		long long sum = 0;
+		for (auto lane : lanes)
+		{
+			sum += lane;
+		}
+
+		return sum;
+	}
+
+	/**
+	 * \brief Accumulate the statistics of a row, 8 pixels at a time with AVX2
+	 */
+	RowSums accumulateRow(const QRgb* image, const QRgb* target, int width)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i one = _mm256_set1_epi32(1);
+		const __m256i lowByte = _mm256_set1_epi32(0xFF);
+
+		__m256i truePositives = zero;
+		__m256i falsePositives = zero;
+		__m256i falseNegatives = zero;
+		__m256i diceNumerator = zero;
+		__m256i diceDenominator = zero;
+		__m256i meanAbsoluteErrorSum = zero;
+
+		int j = 0;
+		for (; j + 8 <= width; j += 8)
+		{
+			const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(image + j));
+			const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(target + j));
+
+			const __m256i alphaA = _mm256_srli_epi32(a, 24);
+			const __m256i alphaB = _mm256_srli_epi32(b, 24);
+
+			// The value in HSV is the maximum of the blue, green and red bytes
+			const __m256i valueA = _mm256_and_si256(lowByte, _mm256_max_epu8(_mm256_max_epu8(a, _mm256_srli_epi32(a, 8)), _mm256_srli_epi32(a, 16)));
+			const __m256i valueB = _mm256_and_si256(lowByte, _mm256_max_epu8(_mm256_max_epu8(b, _mm256_srli_epi32(b, 8)), _mm256_srli_epi32(b, 16)));
+
+			// The product of two alpha values fits in the low 16 bits of each lane
+			diceNumerator = _mm256_add_epi32(diceNumerator, _mm256_mullo_epi16(alphaA, alphaB));
+			diceDenominator = _mm256_add_epi32(diceDenominator, _mm256_add_epi32(alphaA, alphaB));
+
+			// All bits set when the pixel is transparent in the image or in the target
+			const __m256i transparentA = _mm256_cmpeq_epi32(alphaA, zero);
+			const __m256i transparentB = _mm256_cmpeq_epi32(alphaB, zero);
+			const __m256i outside = _mm256_or_si256(transparentA, transparentB);
+
+			const __m256i difference = _mm256_sub_epi8(_mm256_max_epu8(valueA, valueB), _mm256_min_epu8(valueA, valueB));
+			truePositives = _mm256_add_epi32(truePositives, _mm256_andnot_si256(outside, one));
+			falsePositives = _mm256_add_epi32(falsePositives, _mm256_andnot_si256(transparentA, _mm256_and_si256(transparentB, one)));
+			falseNegatives = _mm256_add_epi32(falseNegatives, _mm256_andnot_si256(transparentB, _mm256_and_si256(transparentA, one)));
+			meanAbsoluteErrorSum = _mm256_add_epi32(meanAbsoluteErrorSum, _mm256_andnot_si256(outside, _mm256_sub_epi32(lowByte, difference)));
+		}
+
+		RowSums sums;
+		sums.truePositives = horizontalSum(truePositives);
+		sums.falsePositives = horizontalSum(falsePositives);
+		sums.falseNegatives = horizontalSum(falseNegatives);
+		sums.diceNumerator = horizontalSum(diceNumerator);
+		sums.diceDenominator = horizontalSum(diceDenominator);
+		sums.meanAbsoluteErrorSum = horizontalSum(meanAbsoluteErrorSum);
+
+		// Remaining pixels at the end of the row
+		accumulatePixels(image, target, j, width, sums);
+
+		return sums;
+	}
+#elif defined(SIMILARITY_USE_SSE2)
+	/**
+	 * \brief Sum the four 32 bits lanes of a vector
+	 */
+	long long horizontalSum(__m128i v)
+	{
+		alignas(16) unsigned int lanes[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(lanes), v);
+
+		return (long long)(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+	}
+
+	/**
+	 * \brief Accumulate the statistics of a row, 4 pixels at a time with SSE2
+	 */
+	RowSums accumulateRow(const QRgb* image, const QRgb* target, int width)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i one = _mm_set1_epi32(1);
+		const __m128i lowByte = _mm_set1_epi32(0xFF);
+
+		__m128i truePositives = zero;
+		__m128i falsePositives = zero;
+		__m128i falseNegatives = zero;
+		__m128i diceNumerator = zero;
+		__m128i diceDenominator = zero;
+		__m128i meanAbsoluteErrorSum = zero;
+
+		int j = 0;
+		for (; j + 4 <= width; j += 4)
+		{
+			const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(image + j));
+			const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(target + j));
+
+			const __m128i alphaA = _mm_srli_epi32(a, 24);
+			const __m128i alphaB = _mm_srli_epi32(b, 24);
+
+			// The value in HSV is the maximum of the blue, green and red bytes
+			const __m128i valueA = _mm_and_si128(lowByte, _mm_max_epu8(_mm_max_epu8(a, _mm_srli_epi32(a, 8)), _mm_srli_epi32(a, 16)));
+			const __m128i valueB = _mm_and_si128(lowByte, _mm_max_epu8(_mm_max_epu8(b, _mm_srli_epi32(b, 8)), _mm_srli_epi32(b, 16)));
+
+			// The product of two alpha values fits in the low 16 bits of each lane
+			diceNumerator = _mm_add_epi32(diceNumerator, _mm_mullo_epi16(alphaA, alphaB));
+			diceDenominator = _mm_add_epi32(diceDenominator, _mm_add_epi32(alphaA, alphaB));
+
+			// All bits set when the pixel is transparent in the image or in the target
+			const __m128i transparentA = _mm_cmpeq_epi32(alphaA, zero);
+			const __m128i transparentB = _mm_cmpeq_epi32(alphaB, zero);
+			const __m128i outside = _mm_or_si128(transparentA, transparentB);
+
+			const __m128i difference = _mm_sub_epi8(_mm_max_epu8(valueA, valueB), _mm_min_epu8(valueA, valueB));
+			truePositives = _mm_add_epi32(truePositives, _mm_andnot_si128(outside, one));
+			falsePositives = _mm_add_epi32(falsePositives, _mm_andnot_si128(transparentA, _mm_and_si128(transparentB, one)));
+			falseNegatives = _mm_add_epi32(falseNegatives, _mm_andnot_si128(transparentB, _mm_and_si128(transparentA, one)));
+			meanAbsoluteErrorSum = _mm_add_epi32(meanAbsoluteErrorSum, _mm_andnot_si128(outside, _mm_sub_epi32(lowByte, difference)));
+		}
+
+		RowSums sums;
+		sums.truePositives = horizontalSum(truePositives);
+		sums.falsePositives = horizontalSum(falsePositives);
+		sums.falseNegatives = horizontalSum(falseNegatives);
+		sums.diceNumerator = horizontalSum(diceNumerator);
+		sums.diceDenominator = horizontalSum(diceDenominator);
+		sums.meanAbsoluteErrorSum = horizontalSum(meanAbsoluteErrorSum);
+
+		// Remaining pixels at the end of the row
+		accumulatePixels(image, target, j, width, sums);
+
+		return sums;
+	}
+#else
+	/**
+	 * \brief Accumulate the statistics of a row with scalar code
+	 */
+	RowSums accumulateRow(const QRgb* image, const QRgb* target, int width)
+	{
+		RowSums sums;
+		accumulatePixels(image, target, 0, width, sums);
+		return sums;
+	}
+#endif
+}
+
+SimilarityStatistics computeSimilarityStatistics(const QImage& image, const QImage& target)
 {
 	assert(image.size() == target.size());
 
-	double mae = 0.0;
+	// Work on non premultiplied 32 bits pixels, like QImage::pixelColor() does
+	const auto imageArgb = image.convertToFormat(QImage::Format_ARGB32);
+	const auto targetArgb = target.convertToFormat(QImage::Format_ARGB32);
+
+	const int width = imageArgb.width();
+	const int height = imageArgb.height();
+
 	long long truePositives = 0;
+	long long falsePositives = 0;
+	long long falseNegatives = 0;
+	long long diceNumerator = 0;
+	long long diceDenominator = 0;
+	long long meanAbsoluteErrorSum = 0;
 
-	double diceNumerator = 0.0;
-	double diceDenominator = 0.0;
+	// Each thread accumulates its own integer sums, the result does not depend on the scheduling
+	#pragma omp parallel for reduction(+: truePositives, falsePositives, falseNegatives, diceNumerator, diceDenominator, meanAbsoluteErrorSum)
+	for (int i = 0; i < height; i++)
+	{
+		const auto imageRow = reinterpret_cast<const QRgb*>(imageArgb.constScanLine(i));
+		const auto targetRow = reinterpret_cast<const QRgb*>(targetArgb.constScanLine(i));
 
-	#pragma omp parallel for shared(mae, truePositives, diceNumerator, diceDenominator)
-	for (int i = 0; i < image.height(); i++)
+		const auto sums = accumulateRow(imageRow, targetRow, width);
+
+		truePositives += sums.truePositives;
+		falsePositives += sums.falsePositives;
+		falseNegatives += sums.falseNegatives;
+		diceNumerator += sums.diceNumerator;
+		diceDenominator += sums.diceDenominator;
+		meanAbsoluteErrorSum += sums.meanAbsoluteErrorSum;
+	}
+
+	SimilarityStatistics statistics;
+	statistics.truePositives = truePositives;
+	statistics.falsePositives = falsePositives;
+	statistics.falseNegatives = falseNegatives;
+	statistics.diceNumerator = diceNumerator;
+	statistics.diceDenominator = diceDenominator;
+	statistics.meanAbsoluteErrorSum = meanAbsoluteErrorSum;
+
+	return statistics;
+}
+
+SimilarityStatistics computeSimilarityStatistics(const QImage& image,
+                                                 const SilhouetteMask& imageMask,
+                                                 const TargetDescriptor& target,
+                                                 const QPoint& offset)
+{
+	assert(QRect(QPoint(0, 0), target.size()).contains(QRect(offset, image.size())) || image.isNull());
+
+	const auto imageArgb = image.convertToFormat(QImage::Format_ARGB32);
+
+	long long falsePositives = 0;
+	long long diceNumerator = 0;
+	long long diceDenominator = 0;
+	long long meanAbsoluteErrorSum = 0;
+
+	// Only visit the pixels covered by the silhouette of the image
+	#pragma omp parallel for reduction(+: falsePositives, diceNumerator, diceDenominator, meanAbsoluteErrorSum)
+	for (int i = 0; i < imageMask.height(); i++)
 	{
-		for (int j = 0; j < image.width(); j++)
-		{
-			const auto imageColor = image.pixelColor(j, i);
-			const auto targetColor = target.pixelColor(j, i);
+		const auto imageRow = reinterpret_cast<const QRgb*>(imageArgb.constScanLine(i));
+		const auto targetAlpha = target.alphaRow(offset.y() + i) + offset.x();
+		const auto targetValue = target.valueRow(offset.y() + i) + offset.x();
+		const auto imageWords = imageMask.constRow(i);
 
-			const auto imageTransparency = imageColor.alphaF();
-			const auto targetTransparency = targetColor.alphaF();
+		for (int w = 0; w < imageMask.wordsPerRow(); w++)
+		{
+			auto bits = imageWords[w];
 
-			#pragma omp atomic
-			diceNumerator += imageTransparency * targetTransparency;
-			#pragma omp atomic
-			diceDenominator += imageTransparency + targetTransparency;
-			
-			// Present in the image and in the target
-			if (imageTransparency > 0.0 && targetTransparency > 0.0)
+			while (bits != 0)
 			{
-				#pragma omp atomic
-				truePositives++;				
-				#pragma omp atomic
-				mae += 1.0 - std::abs(imageColor.valueF() - targetColor.valueF());
+				const int j = 64 * w + countTrailingZeros64(bits);
+				bits &= bits - 1;
+
+				const auto imageAlpha = qAlpha(imageRow[j]);
+
+				diceNumerator += imageAlpha * targetAlpha[j];
+				diceDenominator += imageAlpha;
+
+				// Present in the image and in the target
+				if (targetAlpha[j] > 0)
+				{
+					const auto imageValue = std::max({ qRed(imageRow[j]), qGreen(imageRow[j]), qBlue(imageRow[j]) });
+
+					meanAbsoluteErrorSum += 255 - std::abs(imageValue - targetValue[j]);
+				}
+				else
+				{
+					falsePositives++;
+				}
 			}
 		}
 	}
 
+	const auto truePositives = imageMask.area() - falsePositives;
+
+	SimilarityStatistics statistics;
+	statistics.truePositives = truePositives;
+	statistics.falsePositives = falsePositives;
+	statistics.falseNegatives = target.area() - truePositives;
+	statistics.diceNumerator = diceNumerator;
+	// Pixels outside of the silhouette of the image only contribute with the target
+	statistics.diceDenominator = diceDenominator + target.alphaSum();
+	statistics.meanAbsoluteErrorSum = meanAbsoluteErrorSum;
+
+	return statistics;
+}
+
+float similarityFromStatistics(const SimilarityStatistics& statistics)
+{
 	// mae is the mean absolute error only on the overlap zone
-	mae /= float(truePositives);
+	double mae = 0.0;
+	if (statistics.truePositives > 0)
+	{
+		mae = double(statistics.meanAbsoluteErrorSum) / (255.0 * double(statistics.truePositives));
+	}
 
 	// Overlap between the two objects
-	const auto diceCoefficient = (2.0f * diceNumerator + 1.0) / (diceDenominator + 1.0);
-	
+	const double diceCoefficient = silhouetteSimilarityFromStatistics(statistics);
+
 	return 0.9 * diceCoefficient + 0.1 * mae;
 }
 
+float silhouetteSimilarityFromStatistics(const SimilarityStatistics& statistics)
+{
+	// Fuzzy Dice coefficient
+	const auto diceNumerator = double(statistics.diceNumerator) / (255.0 * 255.0);
+	const auto diceDenominator = double(statistics.diceDenominator) / 255.0;
+
+	return (2.0 * diceNumerator + 1.0) / (diceDenominator + 1.0);
+}
+
+std::vector<float> computeTileResiduals(const QImage& image,
+	                                    const TargetDescriptor& target,
+	                                    int tileSize,
+	                                    bool silhouetteOnly)
+{
+	assert(image.size() == target.size());
+
+	const auto imageArgb = image.convertToFormat(QImage::Format_ARGB32);
+
+	const int width = target.width();
+	const int height = target.height();
+	const int tilesX = (width + tileSize - 1) / tileSize;
+	const int tilesY = (height + tileSize - 1) / tileSize;
+	const int tileCount = tilesX * tilesY;
+
+	std::vector<float> residuals((silhouetteOnly ? 1 : 2) * std::size_t(tileCount), 0.0f);
+
+	const float silhouetteScale = 1.0f / (255.0f * float(tileSize * tileSize));
+	const float intensityScale = IntensityResidualWeight / (255.0f * float(tileSize * tileSize));
+
+	// Each thread owns a row of tiles, the sums are exact integers
+	#pragma omp parallel for
+	for (int tileY = 0; tileY < tilesY; tileY++)
+	{
+		std::vector<int> alphaSums(tilesX, 0);
+		std::vector<int> valueSums(tilesX, 0);
+
+		for (int i = tileY * tileSize; i < std::min(height, (tileY + 1) * tileSize); i++)
+		{
+			const auto imageRow = reinterpret_cast<const QRgb*>(imageArgb.constScanLine(i));
+			const auto targetAlpha = target.alphaRow(i);
+			const auto targetValue = target.valueRow(i);
+
+			for (int j = 0; j < width; j++)
+			{
+				const int tileX = j / tileSize;
+				const auto imageAlpha = qAlpha(imageRow[j]);
+
+				alphaSums[tileX] += imageAlpha - targetAlpha[j];
+
+				// Present in the image and in the target
+				if (!silhouetteOnly && imageAlpha > 0 && targetAlpha[j] > 0)
+				{
+					const auto imageValue = std::max({ qRed(imageRow[j]), qGreen(imageRow[j]), qBlue(imageRow[j]) });
+
+					valueSums[tileX] += imageValue - targetValue[j];
+				}
+			}
+		}
+
+		for (int tileX = 0; tileX < tilesX; tileX++)
+		{
+			const int tile = tileY * tilesX + tileX;
+
+			residuals[tile] = float(alphaSums[tileX]) * silhouetteScale;
+
+			if (!silhouetteOnly)
+			{
+				residuals[tileCount + tile] = float(valueSums[tileX]) * intensityScale;
+			}
+		}
+	}
+
+	return residuals;
+}
+
+float computeSampledSimilarity(const QImage& image,
+	                           const TargetDescriptor& target,
+	                           const std::vector<QPoint>& samples,
+	                           double weight,
+	                           bool silhouetteOnly)
+{
+	assert(image.size() == target.size());
+
+	const auto imageArgb = image.convertToFormat(QImage::Format_ARGB32);
+
+	long long diceNumerator = 0;
+	long long imageAlphaSum = 0;
+	long long truePositives = 0;
+	long long meanAbsoluteErrorSum = 0;
+
+	for (const auto& sample : samples)
+	{
+		const auto pixel = reinterpret_cast<const QRgb*>(imageArgb.constScanLine(sample.y()))[sample.x()];
+		const auto imageAlpha = qAlpha(pixel);
+		const auto targetAlpha = target.alphaRow(sample.y())[sample.x()];
+
+		diceNumerator += imageAlpha * targetAlpha;
+		imageAlphaSum += imageAlpha;
+
+		// Present in the image and in the target
+		if (imageAlpha > 0 && targetAlpha > 0)
+		{
+			const auto imageValue = std::max({ qRed(pixel), qGreen(pixel), qBlue(pixel) });
+
+			truePositives++;
+			meanAbsoluteErrorSum += 255 - std::abs(imageValue - target.valueRow(sample.y())[sample.x()]);
+		}
+	}
+
+	// Same formulas as silhouetteSimilarityFromStatistics() and similarityFromStatistics()
+	const double estimatedNumerator = weight * double(diceNumerator) / (255.0 * 255.0);
+	const double estimatedDenominator = (weight * double(imageAlphaSum) + double(target.alphaSum())) / 255.0;
+	const double diceCoefficient = (2.0 * estimatedNumerator + 1.0) / (estimatedDenominator + 1.0);
+
+	if (silhouetteOnly)
+	{
+		return float(diceCoefficient);
+	}
+
+	// The mean absolute error on the overlap is a ratio, the weight cancels
+	double mae = 0.0;
+	if (truePositives > 0)
+	{
+		mae = double(meanAbsoluteErrorSum) / (255.0 * double(truePositives));
+	}
+
+	return float(0.9 * diceCoefficient + 0.1 * mae);
+}
+
+float computeSimilarity(const QImage& image, const QImage& target)
+{
+	return similarityFromStatistics(computeSimilarityStatistics(image, target));
+}
+
 QImage diceSimilarityErrorMap(const QImage& image, const QImage& target)
 {
 	assert(image.size() == target.size());
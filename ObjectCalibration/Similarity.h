@@ -1,6 +1,136 @@
 #pragma once
 
+#include <vector>
+
 #include <QImage>
+#include <QRect>
+
+#include "SilhouetteMask.h"
+#include "TargetDescriptor.h"
+
+/**
+ * \brief Exact sums accumulated when comparing an image to a target
+ *
+ * All values are integers expressed in units of the 8 bits channels, so that
+ * the result does not depend on the order of accumulation.
+ */
+struct SimilarityStatistics
+{
+	/**
+	 * \brief Number of pixels present in the image and in the target
+	 */
+	long long truePositives = 0;
+
+	/**
+	 * \brief Number of pixels present in the image but not in the target
+	 */
+	long long falsePositives = 0;
+
+	/**
+	 * \brief Number of pixels present in the target but not in the image
+	 */
+	long long falseNegatives = 0;
+
+	/**
+	 * \brief Sum of the products of the alpha channels (in 1/255^2 units)
+	 */
+	long long diceNumerator = 0;
+
+	/**
+	 * \brief Sum of the alpha channels (in 1/255 units)
+	 */
+	long long diceDenominator = 0;
+
+	/**
+	 * \brief Sum of 1 - |value difference| in the overlap zone (in 1/255 units)
+	 */
+	long long meanAbsoluteErrorSum = 0;
+};
+
+/**
+ * \brief Accumulate the similarity statistics between an image and a target
+ * \param image The rendered image
+ * \param target The target image, with the same size
+ * \return The statistics on the whole image
+ */
+SimilarityStatistics computeSimilarityStatistics(const QImage& image, const QImage& target);
+
+/**
+ * \brief Accumulate the similarity statistics between an image and a precomputed target
+ *
+ * Only the pixels covered by the silhouette of the image are read. The contribution of the
+ * rest of the target is known from the descriptor: false negatives = target area - true positives.
+ * The image can cover only a region of the target, the object must not be rendered outside of it.
+ * \param image The rendered image, or a region of it
+ * \param imageMask The silhouette of the rendered image
+ * \param target The descriptor of the target
+ * \param offset Position of the top left corner of the image in the target
+ * \return The statistics on the whole target
+ */
+SimilarityStatistics computeSimilarityStatistics(const QImage& image,
+                                                 const SilhouetteMask& imageMask,
+                                                 const TargetDescriptor& target,
+                                                 const QPoint& offset = QPoint(0, 0));
+
+/**
+ * \brief Compute the similarity measure from the accumulated statistics
+ * \param statistics Statistics accumulated over an image
+ * \return The similarity: 90% fuzzy Dice coefficient and 10% mean absolute error
+ */
+float similarityFromStatistics(const SimilarityStatistics& statistics);
+
+/**
+ * \brief Compute the similarity of the silhouettes from the accumulated statistics
+ *
+ * Used when the object is rendered without its texture: the mean absolute error is ignored.
+ * \param statistics Statistics accumulated over an image
+ * \return The fuzzy Dice coefficient
+ */
+float silhouetteSimilarityFromStatistics(const SimilarityStatistics& statistics);
+
+/**
+ * \brief Weight of the intensity residuals relative to the silhouette residuals
+ *
+ * The square root of the ratio of the mean absolute error and the Dice coefficient in the similarity.
+ */
+constexpr float IntensityResidualWeight = 0.3333333f;
+
+/**
+ * \brief Compare an image to a target on square tiles, for least squares
+ *
+ * The silhouette residual of a tile is the difference of the mean alpha of the image and of the target.
+ * The intensity residual is the sum of the differences of value (in HSV) on the pixels present in both,
+ * divided by the area of the tile and weighted by IntensityResidualWeight.
+ * \param image The rendered image, with the same size as the target
+ * \param target The descriptor of the target
+ * \param tileSize Size of the tiles in pixels, 1 for per-pixel residuals
+ * \param silhouetteOnly If true, only compute the silhouette residuals
+ * \return The silhouette residuals of the tiles in row-major order from the top, followed by their
+ *         intensity residuals in the same order
+ */
+std::vector<float> computeTileResiduals(const QImage& image,
+	                                    const TargetDescriptor& target,
+	                                    int tileSize,
+	                                    bool silhouetteOnly);
+
+/**
+ * \brief Estimate the similarity between an image and a target from a sample of the pixels
+ *
+ * Each sample stands for the same number of pixels, like the cells of a stratified sample.
+ * The sums over the image are estimated from the samples, the sum of the alpha of the target
+ * is exact from the descriptor.
+ * \param image The rendered image, with the same size as the target
+ * \param target The descriptor of the target
+ * \param samples Positions of the sampled pixels, from the top left corner
+ * \param weight Number of pixels represented by each sample
+ * \param silhouetteOnly If true, return the fuzzy Dice coefficient alone
+ * \return The estimated similarity, see similarityFromStatistics()
+ */
+float computeSampledSimilarity(const QImage& image,
+	                           const TargetDescriptor& target,
+	                           const std::vector<QPoint>& samples,
+	                           double weight,
+	                           bool silhouetteOnly);
 
 float computeSimilarity(const QImage& image, const QImage& target);
 
@@ -0,0 +1,638 @@
+#include "SoftwareRenderer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include <QVector4D>
+
+namespace
+{
+	/**
+	 * \brief Vertex during clipping, in clip coordinates
+	 */
+	struct ClipVertex
+	{
+		QVector4D position;
+		float u;
+		float v;
+	};
+
+	/**
+	 * \brief Clip a convex polygon against a plane (Sutherland-Hodgman)
+	 * \param input Vertices of the polygon
+	 * \param count Number of vertices of the polygon
+	 * \param output Vertices of the clipped polygon, at least count + 1 of them
+	 * \param plane Points p with dot(plane, p) >= 0 are kept
+	 * \return Number of vertices of the clipped polygon
+	 */
+	int clipPolygon(const ClipVertex* input, int count, ClipVertex* output, const QVector4D& plane)
+	{
+		int outputCount = 0;
+
+		for (int i = 0; i < count; i++)
+		{
+			const auto& current = input[i];
+			const auto& next = input[(i + 1) % count];
+
+			const float currentDistance = QVector4D::dotProduct(plane, current.position);
+			const float nextDistance = QVector4D::dotProduct(plane, next.position);
+
+			if (currentDistance >= 0.0f)
+			{
+				output[outputCount++] = current;
+			}
+
+			// The edge crosses the plane
+			if ((currentDistance >= 0.0f) != (nextDistance >= 0.0f))
+			{
+				const float t = currentDistance / (currentDistance - nextDistance);
+
+				ClipVertex intersection;
+				intersection.position = current.position + t * (next.position - current.position);
+				intersection.u = current.u + t * (next.u - current.u);
+				intersection.v = current.v + t * (next.v - current.v);
+
+				output[outputCount++] = intersection;
+			}
+		}
+
+		return outputCount;
+	}
+
+	/**
+	 * \brief Convert a color channel in [0, 1] to 8 bits like OpenGL does for normalized formats
+	 */
+	int toUnorm8(float value)
+	{
+		return int(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 255.0f));
+	}
+}
+
+SoftwareRenderer::SoftwareRenderer(const Mesh& object, const QMatrix4x4& objectMatrix) :
+	m_object(object),
+	m_objectMatrix(objectMatrix),
+	m_silhouetteOnly(false),
+	m_levelOfDetailTolerance(0.5f),
+	m_tilesX(0),
+	m_tilesY(0)
+{
+	// Same orientation as the OpenGL texture, only the full resolution is sampled
+	if (!m_object.textureLevels().empty())
+	{
+		m_texture = m_object.textureLevels().front().convertToFormat(QImage::Format_ARGB32);
+	}
+
+	updateTarget();
+}
+
+void SoftwareRenderer::setTargetImage(const QImage& targetImage)
+{
+	m_targetImage = targetImage;
+
+	updateTarget();
+}
+
+void SoftwareRenderer::setWorkingResolution(const QSize& size)
+{
+	m_workingResolution = size;
+
+	updateTarget();
+}
+
+QSize SoftwareRenderer::workingResolution() const
+{
+	return m_workingResolution;
+}
+
+void SoftwareRenderer::setSilhouetteOnly(bool silhouetteOnly)
+{
+	m_silhouetteOnly = silhouetteOnly;
+}
+
+bool SoftwareRenderer::silhouetteOnly() const
+{
+	return m_silhouetteOnly;
+}
+
+void SoftwareRenderer::setLevelOfDetailTolerance(float pixels)
+{
+	m_levelOfDetailTolerance = pixels;
+}
+
+float SoftwareRenderer::levelOfDetailTolerance() const
+{
+	return m_levelOfDetailTolerance;
+}
+
+QImage SoftwareRenderer::renderToImage(const ObjectPose& pose)
+{
+	render(pose, false);
+
+	return m_colorBuffer;
+}
+
+float SoftwareRenderer::renderAndComputeSimilarity(const ObjectPose& pose)
+{
+	assert(!m_target.isEmpty());
+
+	const int width = m_size.width();
+	const int height = m_size.height();
+	const QRect viewport(0, 0, width, height);
+
+	const auto camera = evaluationCamera(float(width) / float(height));
+	const auto pvmMatrix = camera.projectionMatrix() * camera.viewMatrix() * objectWorldMatrix(pose, m_objectMatrix);
+
+	// Only the tiles covered by the object are rasterized and compared
+	const auto region = m_object.projectedBoundingBox(pvmMatrix, viewport);
+
+	long long truePositives = 0;
+	long long falsePositives = 0;
+	long long diceNumerator = 0;
+	long long diceDenominator = 0;
+	long long meanAbsoluteErrorSum = 0;
+
+	if (!region.isEmpty())
+	{
+		setupTriangles(pvmMatrix, region);
+
+		const int firstTileX = region.left() / TileSize;
+		const int firstTileY = region.top() / TileSize;
+		const int regionTilesX = region.right() / TileSize - firstTileX + 1;
+		const int regionTilesY = region.bottom() / TileSize - firstTileY + 1;
+
+		// Integer sums: the result does not depend on the scheduling of the tiles
+		#pragma omp parallel for schedule(dynamic) reduction(+: truePositives, falsePositives, diceNumerator, diceDenominator, meanAbsoluteErrorSum)
+		for (int tile = 0; tile < regionTilesX * regionTilesY; tile++)
+		{
+			const auto tileStatistics = scoreTile(firstTileX + tile % regionTilesX, firstTileY + tile / regionTilesX, region);
+
+			truePositives += tileStatistics.truePositives;
+			falsePositives += tileStatistics.falsePositives;
+			diceNumerator += tileStatistics.diceNumerator;
+			diceDenominator += tileStatistics.diceDenominator;
+			meanAbsoluteErrorSum += tileStatistics.meanAbsoluteErrorSum;
+		}
+	}
+
+	SimilarityStatistics statistics;
+	statistics.truePositives = truePositives;
+	statistics.falsePositives = falsePositives;
+	statistics.falseNegatives = m_target.area() - truePositives;
+	statistics.diceNumerator = diceNumerator;
+	// Pixels outside of the silhouette of the image only contribute with the target
+	statistics.diceDenominator = diceDenominator + m_target.alphaSum();
+	statistics.meanAbsoluteErrorSum = meanAbsoluteErrorSum;
+
+	if (m_silhouetteOnly)
+	{
+		return silhouetteSimilarityFromStatistics(statistics);
+	}
+
+	return similarityFromStatistics(statistics);
+}
+
+QRect SoftwareRenderer::render(const ObjectPose& pose, bool onlyObjectRegion)
+{
+	const int width = m_size.width();
+	const int height = m_size.height();
+	const QRect viewport(0, 0, width, height);
+
+	if (m_colorBuffer.size() != m_size)
+	{
+		m_colorBuffer = QImage(m_size, QImage::Format_ARGB32);
+		m_colorBuffer.fill(Qt::transparent);
+		m_depthBuffer.assign(std::size_t(width) * height, 1.0f);
+	}
+
+	// Same matrices as the OpenGL renderer
+	const auto camera = evaluationCamera(float(width) / float(height));
+	const auto pvmMatrix = camera.projectionMatrix() * camera.viewMatrix() * objectWorldMatrix(pose, m_objectMatrix);
+
+	// Region of the buffers in which the object is rendered, in OpenGL window coordinates
+	auto region = viewport;
+	if (onlyObjectRegion)
+	{
+		region = m_object.projectedBoundingBox(pvmMatrix, viewport);
+	}
+
+	// Region in image coordinates, from the top to the bottom
+	const QRect imageRegion(region.x(), height - region.y() - region.height(), region.width(), region.height());
+
+	if (region.isEmpty())
+	{
+		return imageRegion;
+	}
+
+	// Transparent background and far depth, only in the region
+	#pragma omp parallel for
+	for (int y = region.top(); y <= region.bottom(); y++)
+	{
+		auto depth = m_depthBuffer.data() + std::size_t(y) * width;
+		std::fill(depth + region.left(), depth + region.right() + 1, 1.0f);
+
+		auto color = reinterpret_cast<QRgb*>(m_colorBuffer.scanLine(height - 1 - y));
+		std::fill(color + region.left(), color + region.right() + 1, QRgb(0));
+	}
+
+	setupTriangles(pvmMatrix, region);
+
+	// Each thread rasterizes whole tiles, triangles are drawn in the order of the mesh in each tile
+	const int firstTileX = region.left() / TileSize;
+	const int firstTileY = region.top() / TileSize;
+	const int regionTilesX = region.right() / TileSize - firstTileX + 1;
+	const int regionTilesY = region.bottom() / TileSize - firstTileY + 1;
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int tile = 0; tile < regionTilesX * regionTilesY; tile++)
+	{
+		const int tileX = firstTileX + tile % regionTilesX;
+		const int tileY = firstTileY + tile / regionTilesX;
+		const auto rect = tileRect(tileX, tileY, region);
+
+		TileBuffers buffers;
+		buffers.depth = m_depthBuffer.data() + std::size_t(rect.top()) * width + rect.left();
+		buffers.depthStride = width;
+		buffers.color = reinterpret_cast<QRgb*>(m_colorBuffer.scanLine(height - 1 - rect.top())) + rect.left();
+		buffers.colorStride = -std::ptrdiff_t(m_colorBuffer.bytesPerLine() / sizeof(QRgb));
+
+		rasterizeTile(tileX, tileY, region, buffers, false);
+	}
+
+	return imageRegion;
+}
+
+void SoftwareRenderer::setupTriangles(const QMatrix4x4& pvmMatrix, const QRect& region)
+{
+	const auto& vertices = m_object.vertices();
+	const auto& uvs = m_object.uvs();
+
+	// Coarsest level of detail within the tolerance at the working resolution
+	const auto level = m_object.selectLevelOfDetail(pvmMatrix, QRect(QPoint(0, 0), m_size), m_levelOfDetailTolerance);
+	const auto& levelOfDetail = m_object.levelsOfDetail()[level];
+	const auto indices = m_object.levelOfDetailIndexData() + levelOfDetail.firstIndex;
+
+	const double width = m_size.width();
+	const double height = m_size.height();
+
+	// Vertex shader
+	std::vector<QVector4D> clipPositions(vertices.size());
+
+	#pragma omp parallel for
+	for (int i = 0; i < int(vertices.size()); i++)
+	{
+		clipPositions[i] = pvmMatrix * QVector4D(vertices[i], 1.0f);
+	}
+
+	// Clipping against the near and far planes gives at most 3 triangles per triangle
+	const int triangleCount = int(levelOfDetail.indexCount / 3);
+	const int maxClippedTriangles = 3;
+
+	std::vector<ScreenTriangle> clippedTriangles(std::size_t(maxClippedTriangles) * triangleCount);
+	std::vector<int> clippedCounts(triangleCount, 0);
+
+	const QVector4D nearPlane(0.0f, 0.0f, 1.0f, 1.0f);
+	const QVector4D farPlane(0.0f, 0.0f, -1.0f, 1.0f);
+
+	#pragma omp parallel for
+	for (int t = 0; t < triangleCount; t++)
+	{
+		ClipVertex polygon[5];
+		ClipVertex clipped[5];
+
+		for (int k = 0; k < 3; k++)
+		{
+			const auto index = indices[3 * std::size_t(t) + k];
+			polygon[k].position = clipPositions[index];
+			polygon[k].u = uvs[index].x();
+			polygon[k].v = uvs[index].y();
+		}
+
+		int count = clipPolygon(polygon, 3, clipped, nearPlane);
+		count = clipPolygon(clipped, count, polygon, farPlane);
+
+		// Triangle fan of the clipped polygon
+		for (int k = 1; k + 1 < count; k++)
+		{
+			const ClipVertex* corners[3] = { &polygon[0], &polygon[k], &polygon[k + 1] };
+
+			ScreenTriangle triangle;
+
+			for (int c = 0; c < 3; c++)
+			{
+				const auto& position = corners[c]->position;
+				const float invW = 1.0f / position.w();
+
+				// Viewport transform of the normalized device coordinates
+				triangle.x[c] = (0.5 * position.x() * invW + 0.5) * width;
+				triangle.y[c] = (0.5 * position.y() * invW + 0.5) * height;
+				triangle.z[c] = 0.5f * position.z() * invW + 0.5f;
+				triangle.invW[c] = invW;
+				triangle.uOverW[c] = corners[c]->u * invW;
+				triangle.vOverW[c] = corners[c]->v * invW;
+			}
+
+			// Both faces are drawn: make the winding counterclockwise
+			const double doubleArea = (triangle.x[1] - triangle.x[0]) * (triangle.y[2] - triangle.y[0])
+			                        - (triangle.x[2] - triangle.x[0]) * (triangle.y[1] - triangle.y[0]);
+
+			if (doubleArea == 0.0 || std::isnan(doubleArea))
+			{
+				continue;
+			}
+
+			if (doubleArea < 0.0)
+			{
+				std::swap(triangle.x[1], triangle.x[2]);
+				std::swap(triangle.y[1], triangle.y[2]);
+				std::swap(triangle.z[1], triangle.z[2]);
+				std::swap(triangle.invW[1], triangle.invW[2]);
+				std::swap(triangle.uOverW[1], triangle.uOverW[2]);
+				std::swap(triangle.vOverW[1], triangle.vOverW[2]);
+			}
+
+			// Pixels whose center is in the bounding box, inside the region
+			const double minX = std::min({ triangle.x[0], triangle.x[1], triangle.x[2] });
+			const double maxX = std::max({ triangle.x[0], triangle.x[1], triangle.x[2] });
+			const double minY = std::min({ triangle.y[0], triangle.y[1], triangle.y[2] });
+			const double maxY = std::max({ triangle.y[0], triangle.y[1], triangle.y[2] });
+
+			triangle.minX = int(std::max(double(region.left()), std::ceil(minX - 0.5)));
+			triangle.maxX = int(std::min(double(region.right()), std::floor(maxX - 0.5)));
+			triangle.minY = int(std::max(double(region.top()), std::ceil(minY - 0.5)));
+			triangle.maxY = int(std::min(double(region.bottom()), std::floor(maxY - 0.5)));
+
+			if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+			{
+				continue;
+			}
+
+			clippedTriangles[std::size_t(maxClippedTriangles) * t + clippedCounts[t]] = triangle;
+			clippedCounts[t]++;
+		}
+	}
+
+	// Keep the order of the mesh, the depth test keeps the first triangle at equal depth
+	m_triangles.clear();
+	for (auto& tileTriangles : m_tileTriangles)
+	{
+		tileTriangles.clear();
+	}
+
+	for (int t = 0; t < triangleCount; t++)
+	{
+		for (int k = 0; k < clippedCounts[t]; k++)
+		{
+			const auto& triangle = clippedTriangles[std::size_t(maxClippedTriangles) * t + k];
+			const int index = int(m_triangles.size());
+			m_triangles.push_back(triangle);
+
+			for (int tileY = triangle.minY / TileSize; tileY <= triangle.maxY / TileSize; tileY++)
+			{
+				for (int tileX = triangle.minX / TileSize; tileX <= triangle.maxX / TileSize; tileX++)
+				{
+					m_tileTriangles[std::size_t(tileY) * m_tilesX + tileX].push_back(index);
+				}
+			}
+		}
+	}
+}
+
+QRect SoftwareRenderer::tileRect(int tileX, int tileY, const QRect& region)
+{
+	return QRect(tileX * TileSize, tileY * TileSize, TileSize, TileSize).intersected(region);
+}
+
+void SoftwareRenderer::rasterizeTile(int tileX, int tileY, const QRect& region, const TileBuffers& buffers, bool silhouetteOnly) const
+{
+	const auto rect = tileRect(tileX, tileY, region);
+
+	const int tileMinX = rect.left();
+	const int tileMaxX = rect.right();
+	const int tileMinY = rect.top();
+	const int tileMaxY = rect.bottom();
+
+	for (const auto index : m_tileTriangles[std::size_t(tileY) * m_tilesX + tileX])
+	{
+		const auto& triangle = m_triangles[index];
+
+		const int minX = std::max(tileMinX, triangle.minX);
+		const int maxX = std::min(tileMaxX, triangle.maxX);
+		const int minY = std::max(tileMinY, triangle.minY);
+		const int maxY = std::min(tileMaxY, triangle.maxY);
+
+		if (minX > maxX || minY > maxY)
+		{
+			continue;
+		}
+
+		// Edge functions E(x, y) = a x + b y + c, the edge k is opposite to the vertex k
+		double a[3];
+		double b[3];
+		double c[3];
+		bool includeZero[3];
+
+		for (int k = 0; k < 3; k++)
+		{
+			const int from = (k + 1) % 3;
+			const int to = (k + 2) % 3;
+
+			a[k] = triangle.y[from] - triangle.y[to];
+			b[k] = triangle.x[to] - triangle.x[from];
+			c[k] = triangle.x[from] * triangle.y[to] - triangle.x[to] * triangle.y[from];
+
+			// Tie-breaking rule: a pixel on an edge shared by two triangles is drawn only once
+			includeZero[k] = a[k] > 0.0 || (a[k] == 0.0 && b[k] > 0.0);
+		}
+
+		const double doubleArea = c[0] + c[1] + c[2];
+
+		for (int y = minY; y <= maxY; y++)
+		{
+			const double py = y + 0.5;
+
+			auto depth = buffers.depth + (y - tileMinY) * buffers.depthStride;
+			auto color = buffers.color + (y - tileMinY) * buffers.colorStride;
+
+			for (int x = minX; x <= maxX; x++)
+			{
+				const double px = x + 0.5;
+
+				double e[3];
+				bool inside = true;
+
+				for (int k = 0; k < 3; k++)
+				{
+					e[k] = a[k] * px + b[k] * py + c[k];
+					inside = inside && (e[k] > 0.0 || (e[k] == 0.0 && includeZero[k]));
+				}
+
+				if (!inside)
+				{
+					continue;
+				}
+
+				// Barycentric coordinates in screen space
+				const float l0 = float(e[0] / doubleArea);
+				const float l1 = float(e[1] / doubleArea);
+				const float l2 = float(e[2] / doubleArea);
+
+				// Depth test (GL_LESS)
+				const float z = l0 * triangle.z[0] + l1 * triangle.z[1] + l2 * triangle.z[2];
+				if (!(z < depth[x - tileMinX]))
+				{
+					continue;
+				}
+
+				depth[x - tileMinX] = z;
+
+				// Coverage only, the texture is not sampled
+				if (silhouetteOnly)
+				{
+					color[x - tileMinX] = qRgba(255, 255, 255, 255);
+					continue;
+				}
+
+				// Perspective-correct texture coordinates
+				const float invW = l0 * triangle.invW[0] + l1 * triangle.invW[1] + l2 * triangle.invW[2];
+				const float u = (l0 * triangle.uOverW[0] + l1 * triangle.uOverW[1] + l2 * triangle.uOverW[2]) / invW;
+				const float v = (l0 * triangle.vOverW[0] + l1 * triangle.vOverW[1] + l2 * triangle.vOverW[2]) / invW;
+
+				// Fragment shader: opaque, so blending keeps the color of the fragment
+				const auto texel = sampleTexture(u, v);
+
+				color[x - tileMinX] = qRgba(toUnorm8(0.1f + 0.8f * texel.x()),
+				                            toUnorm8(0.1f + 0.8f * texel.y()),
+				                            toUnorm8(0.1f + 0.8f * texel.z()),
+				                            255);
+			}
+		}
+	}
+}
+
+SimilarityStatistics SoftwareRenderer::scoreTile(int tileX, int tileY, const QRect& region) const
+{
+	const auto rect = tileRect(tileX, tileY, region);
+	const int height = m_size.height();
+
+	// Local buffers of the tile, they stay in the cache of the thread
+	float depth[TileSize * TileSize];
+	QRgb color[TileSize * TileSize];
+	std::fill(depth, depth + TileSize * TileSize, 1.0f);
+	std::fill(color, color + TileSize * TileSize, QRgb(0));
+
+	rasterizeTile(tileX, tileY, region, { depth, TileSize, color, TileSize }, m_silhouetteOnly);
+
+	// Same sums as computeSimilarityStatistics(), the rendered pixels are opaque
+	SimilarityStatistics statistics;
+
+	for (int y = rect.top(); y <= rect.bottom(); y++)
+	{
+		const auto pixels = color + (y - rect.top()) * TileSize;
+		const auto targetAlpha = m_target.alphaRow(height - 1 - y);
+		const auto targetValue = m_target.valueRow(height - 1 - y);
+
+		for (int x = rect.left(); x <= rect.right(); x++)
+		{
+			const auto pixel = pixels[x - rect.left()];
+			const auto imageAlpha = qAlpha(pixel);
+
+			if (imageAlpha == 0)
+			{
+				continue;
+			}
+
+			statistics.diceNumerator += imageAlpha * targetAlpha[x];
+			statistics.diceDenominator += imageAlpha;
+
+			// Present in the image and in the target
+			if (targetAlpha[x] > 0)
+			{
+				statistics.truePositives++;
+
+				if (!m_silhouetteOnly)
+				{
+					const auto imageValue = std::max({ qRed(pixel), qGreen(pixel), qBlue(pixel) });
+					statistics.meanAbsoluteErrorSum += 255 - std::abs(imageValue - targetValue[x]);
+				}
+			}
+			else
+			{
+				statistics.falsePositives++;
+			}
+		}
+	}
+
+	return statistics;
+}
+
+QVector3D SoftwareRenderer::sampleTexture(float u, float v) const
+{
+	// Incomplete textures are black in OpenGL
+	if (m_texture.isNull())
+	{
+		return QVector3D(0.0f, 0.0f, 0.0f);
+	}
+
+	const int width = m_texture.width();
+	const int height = m_texture.height();
+
+	// Texel centers are at half integers
+	const float x = u * width - 0.5f;
+	const float y = v * height - 0.5f;
+
+	const float x0 = std::floor(x);
+	const float y0 = std::floor(y);
+	const float fx = x - x0;
+	const float fy = y - y0;
+
+	const auto clampX = [width](float value) { return std::min(std::max(int(value), 0), width - 1); };
+	const auto clampY = [height](float value) { return std::min(std::max(int(value), 0), height - 1); };
+
+	const auto row0 = reinterpret_cast<const QRgb*>(m_texture.constScanLine(clampY(y0)));
+	const auto row1 = reinterpret_cast<const QRgb*>(m_texture.constScanLine(clampY(y0 + 1.0f)));
+
+	const QRgb texels[4] = { row0[clampX(x0)], row0[clampX(x0 + 1.0f)], row1[clampX(x0)], row1[clampX(x0 + 1.0f)] };
+	const float weights[4] = { (1.0f - fx) * (1.0f - fy), fx * (1.0f - fy), (1.0f - fx) * fy, fx * fy };
+
+	QVector3D result(0.0f, 0.0f, 0.0f);
+	for (int i = 0; i < 4; i++)
+	{
+		result += weights[i] * QVector3D(qRed(texels[i]), qGreen(texels[i]), qBlue(texels[i]));
+	}
+
+	return result / 255.0f;
+}
+
+void SoftwareRenderer::updateTarget()
+{
+	QSize size(4032, 3024);
+
+	if (!m_targetImage.isNull())
+	{
+		size = m_workingResolution.isValid() ? m_workingResolution : m_targetImage.size();
+
+		if (size == m_targetImage.size())
+		{
+			m_target = TargetDescriptor(m_targetImage);
+		}
+		else
+		{
+			m_target = TargetDescriptor(m_targetImage.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+		}
+	}
+	else if (m_workingResolution.isValid())
+	{
+		size = m_workingResolution;
+	}
+
+	// Tiles at the working resolution, the frame buffer is resized when an image is rendered
+	if (m_size != size)
+	{
+		m_size = size;
+
+		m_tilesX = (size.width() + TileSize - 1) / TileSize;
+		m_tilesY = (size.height() + TileSize - 1) / TileSize;
+		m_tileTriangles.assign(std::size_t(m_tilesX) * m_tilesY, std::vector<int>());
+	}
+}
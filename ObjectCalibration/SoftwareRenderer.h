@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <QImage>
+#include <QMatrix4x4>
+#include <QRect>
+
+#include "Mesh.h"
+#include "Renderer.h"
+#include "Similarity.h"
+#include "TargetDescriptor.h"
+
+/**
+ * \brief Renderer without OpenGL: a tiled and multithreaded rasterizer on the CPU
+ *
+ * It reproduces object_vs.glsl and object_fs.glsl: perspective-correct texture coordinates,
+ * bilinear filtering with clamping to the edges, depth test and opaque coverage.
+ * The similarity is computed tile by tile while rasterizing, without a full frame buffer.
+ * Each instance owns its buffers, threads evaluating poses in parallel need one renderer each.
+ */
+class SoftwareRenderer : public Renderer
+{
+public:
+
+	/**
+	 * \brief Create a renderer for an object
+	 * \param object The mesh of the object, with its texture
+	 * \param objectMatrix Transformation of the mesh in the frame of the object
+	 */
+	SoftwareRenderer(const Mesh& object, const QMatrix4x4& objectMatrix);
+
+	void setTargetImage(const QImage& targetImage) override;
+	void setWorkingResolution(const QSize& size) override;
+	QSize workingResolution() const override;
+
+	void setSilhouetteOnly(bool silhouetteOnly) override;
+	bool silhouetteOnly() const override;
+
+	void setLevelOfDetailTolerance(float pixels) override;
+	float levelOfDetailTolerance() const override;
+
+	QImage renderToImage(const ObjectPose& pose) override;
+	float renderAndComputeSimilarity(const ObjectPose& pose) override;
+
+private:
+
+	/**
+	 * \brief Size in pixels of the square tiles rasterized by each thread
+	 */
+	static constexpr int TileSize = 32;
+
+	/**
+	 * \brief Triangle after clipping, in window coordinates
+	 */
+	struct ScreenTriangle
+	{
+		double x[3];
+		double y[3];
+
+		// Depth in window coordinates, interpolated linearly on the screen
+		float z[3];
+
+		// Attributes divided by w, for perspective-correct interpolation
+		float invW[3];
+		float uOverW[3];
+		float vOverW[3];
+
+		// Pixels covered by the bounding box, in OpenGL window coordinates
+		int minX;
+		int minY;
+		int maxX;
+		int maxY;
+	};
+
+	/**
+	 * \brief Buffers in which a tile is rasterized
+	 *
+	 * The pointers are on the bottom left pixel of the tile, the strides (in pixels)
+	 * go from one row to the row above it in OpenGL window coordinates.
+	 */
+	struct TileBuffers
+	{
+		float* depth;
+		std::ptrdiff_t depthStride;
+		QRgb* color;
+		std::ptrdiff_t colorStride;
+	};
+
+	/**
+	 * \brief Render the object in the color buffer
+	 * \param pose The pose of the object
+	 * \param onlyObjectRegion If true, only clear and rasterize the projected bounding box of the object
+	 * \return The region of the color buffer in which the object has been rendered, in image coordinates
+	 */
+	QRect render(const ObjectPose& pose, bool onlyObjectRegion);
+
+	/**
+	 * \brief Transform and clip the triangles of the level of detail, and sort them in tiles
+	 * \param pvmMatrix Projection * View * Model matrix
+	 * \param region Region to rasterize in OpenGL window coordinates
+	 */
+	void setupTriangles(const QMatrix4x4& pvmMatrix, const QRect& region);
+
+	/**
+	 * \brief Pixels of a tile inside the region to rasterize
+	 * \param tileX Column of the tile
+	 * \param tileY Row of the tile
+	 * \param region Region to rasterize in OpenGL window coordinates
+	 * \return The pixels of the tile in OpenGL window coordinates
+	 */
+	static QRect tileRect(int tileX, int tileY, const QRect& region);
+
+	/**
+	 * \brief Rasterize all the triangles of a tile
+	 * \param tileX Column of the tile
+	 * \param tileY Row of the tile
+	 * \param region Region to rasterize in OpenGL window coordinates
+	 * \param buffers Depth and color of the tile, already cleared
+	 * \param silhouetteOnly If true, write opaque white without sampling the texture
+	 */
+	void rasterizeTile(int tileX, int tileY, const QRect& region, const TileBuffers& buffers, bool silhouetteOnly) const;
+
+	/**
+	 * \brief Rasterize a tile in local buffers and compare it to the target
+	 * \param tileX Column of the tile
+	 * \param tileY Row of the tile
+	 * \param region Region to rasterize in OpenGL window coordinates
+	 * \return The statistics of the pixels covered by the object in the tile: the false negatives
+	 *         and the contribution of the target to the Dice denominator are not included
+	 */
+	SimilarityStatistics scoreTile(int tileX, int tileY, const QRect& region) const;
+
+	/**
+	 * \brief Bilinear sample of the texture, like GL_LINEAR with GL_CLAMP_TO_EDGE
+	 */
+	QVector3D sampleTexture(float u, float v) const;
+
+	/**
+	 * \brief Update the descriptor of the target and the tiles at the working resolution
+	 */
+	void updateTarget();
+
+	Mesh m_object;
+	QMatrix4x4 m_objectMatrix;
+
+	// Texture rows in OpenGL order, from the bottom to the top
+	QImage m_texture;
+
+	// Target image and its descriptor at the working resolution
+	QImage m_targetImage;
+	QSize m_workingResolution;
+	TargetDescriptor m_target;
+
+	// Compare only the silhouettes
+	bool m_silhouetteOnly;
+
+	// Error in pixels accepted when selecting the level of detail
+	float m_levelOfDetailTolerance;
+
+	// Size of the frame buffer
+	QSize m_size;
+
+	// Color buffer (from the top to the bottom) and depth buffer (in OpenGL order),
+	// only allocated when an image is rendered
+	QImage m_colorBuffer;
+	std::vector<float> m_depthBuffer;
+
+	// Triangles of the current render, and the indices of the triangles overlapping each tile
+	std::vector<ScreenTriangle> m_triangles;
+	std::vector<std::vector<int>> m_tileTriangles;
+	int m_tilesX;
+	int m_tilesY;
+};
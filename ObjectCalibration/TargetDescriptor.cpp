@@ -0,0 +1,191 @@
+#include "TargetDescriptor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+	/**
+	 * \brief One dimensional squared Euclidean distance transform
+	 *
+	 * Source: Felzenszwalb, P. F., & Huttenlocher, D. P. (2012).
+	 * Distance transforms of sampled functions. Theory of computing, 8(1), 415-428.
+	 * \param f Sampled function, the squared distance is computed in place
+	 * \param n Number of samples
+	 * \param stride Distance between two samples in f
+	 */
+	void squaredDistanceTransform1D(float* f, int n, int stride)
+	{
+		const float infinity = std::numeric_limits<float>::infinity();
+
+		std::vector<float> values(n);
+		std::vector<int> locations(n);
+		std::vector<float> boundaries(n + 1);
+
+		for (int q = 0; q < n; q++)
+		{
+			values[q] = f[std::size_t(q) * stride];
+		}
+
+		int k = -1;
+		for (int q = 0; q < n; q++)
+		{
+			if (values[q] == infinity)
+			{
+				continue;
+			}
+
+			float s = -infinity;
+			while (k >= 0)
+			{
+				const int p = locations[k];
+				s = ((values[q] + q * q) - (values[p] + p * p)) / (2.0f * (q - p));
+
+				if (s > boundaries[k])
+				{
+					break;
+				}
+
+				k--;
+			}
+
+			k++;
+			locations[k] = q;
+			boundaries[k] = (k == 0) ? -infinity : s;
+			boundaries[k + 1] = infinity;
+		}
+
+		// No finite sample: the distance is infinite everywhere
+		if (k < 0)
+		{
+			return;
+		}
+
+		k = 0;
+		for (int q = 0; q < n; q++)
+		{
+			while (boundaries[k + 1] < q)
+			{
+				k++;
+			}
+
+			const int p = locations[k];
+			f[std::size_t(q) * stride] = float((q - p) * (q - p)) + values[p];
+		}
+	}
+}
+
+TargetDescriptor::TargetDescriptor() :
+	m_width(0),
+	m_height(0),
+	m_area(0),
+	m_alphaSum(0)
+{
+
+}
+
+TargetDescriptor::TargetDescriptor(const QImage& targetImage, bool withDistanceTransform) :
+	m_width(targetImage.width()),
+	m_height(targetImage.height()),
+	m_silhouette(SilhouetteMask::fromAlpha(targetImage)),
+	m_valueMask(targetImage.width(), targetImage.height()),
+	m_alpha(std::size_t(targetImage.width()) * targetImage.height()),
+	m_value(std::size_t(targetImage.width()) * targetImage.height()),
+	m_area(0),
+	m_alphaSum(0)
+{
+	// Work on non premultiplied 32 bits pixels, like QImage::pixelColor() does
+	const auto targetArgb = targetImage.convertToFormat(QImage::Format_ARGB32);
+
+	long long alphaSum = 0;
+
+	#pragma omp parallel for reduction(+: alphaSum)
+	for (int i = 0; i < m_height; i++)
+	{
+		const auto pixels = reinterpret_cast<const QRgb*>(targetArgb.constScanLine(i));
+		auto alpha = m_alpha.data() + std::size_t(i) * m_width;
+		auto value = m_value.data() + std::size_t(i) * m_width;
+		auto valueWords = m_valueMask.row(i);
+
+		for (int j = 0; j < m_width; j++)
+		{
+			alpha[j] = uchar(qAlpha(pixels[j]));
+			// The value in HSV is the maximum of the three channels
+			value[j] = uchar(std::max({ qRed(pixels[j]), qGreen(pixels[j]), qBlue(pixels[j]) }));
+
+			alphaSum += alpha[j];
+
+			// value / 255 > 0.5
+			if (value[j] >= 128)
+			{
+				valueWords[j / 64] |= uint64_t(1) << (j % 64);
+			}
+		}
+	}
+
+	m_area = m_silhouette.area();
+	m_alphaSum = alphaSum;
+
+	if (withDistanceTransform)
+	{
+		computeDistanceTransform();
+	}
+}
+
+void TargetDescriptor::computeDistanceTransform()
+{
+	const float infinity = std::numeric_limits<float>::infinity();
+
+	m_distanceTransform.assign(std::size_t(m_width) * m_height, infinity);
+
+	for (int i = 0; i < m_height; i++)
+	{
+		for (int j = 0; j < m_width; j++)
+		{
+			if (m_silhouette.testPixel(j, i))
+			{
+				m_distanceTransform[std::size_t(i) * m_width + j] = 0.0f;
+			}
+		}
+	}
+
+	// Separable transform: first along columns, then along rows
+	#pragma omp parallel for
+	for (int j = 0; j < m_width; j++)
+	{
+		squaredDistanceTransform1D(m_distanceTransform.data() + j, m_height, m_width);
+	}
+
+	#pragma omp parallel for
+	for (int i = 0; i < m_height; i++)
+	{
+		squaredDistanceTransform1D(m_distanceTransform.data() + std::size_t(i) * m_width, m_width, 1);
+	}
+
+	for (auto& distance : m_distanceTransform)
+	{
+		distance = std::sqrt(distance);
+	}
+}
+
+std::vector<uchar> TargetDescriptor::alphaValueTexture() const
+{
+	std::vector<uchar> texture(2 * std::size_t(m_width) * m_height);
+
+	#pragma omp parallel for
+	for (int i = 0; i < m_height; i++)
+	{
+		// OpenGL textures start from the bottom row
+		auto texels = texture.data() + 2 * std::size_t(m_height - 1 - i) * m_width;
+		const auto alpha = alphaRow(i);
+
+		for (int j = 0; j < m_width; j++)
+		{
+			texels[2 * j + 0] = alpha[j];
+			texels[2 * j + 1] = m_valueMask.testPixel(j, i) ? 255 : 0;
+		}
+	}
+
+	return texture;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <vector>
+
+#include <QImage>
+
+#include "SilhouetteMask.h"
+
+/**
+ * \brief Everything the similarity measure needs to know about the target image
+ *
+ * The descriptor is built once when the target is set, so that evaluating a pose
+ * never converts the target pixels again.
+ */
+class TargetDescriptor
+{
+public:
+
+	TargetDescriptor();
+
+	/**
+	 * \brief Build the descriptor of a target image
+	 * \param targetImage The target image, with an alpha channel
+	 * \param withDistanceTransform If true, also compute the distance transform of the silhouette
+	 */
+	explicit TargetDescriptor(const QImage& targetImage, bool withDistanceTransform = false);
+
+	bool isEmpty() const { return m_width == 0 || m_height == 0; }
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+	QSize size() const { return { m_width, m_height }; }
+
+	/**
+	 * \brief Silhouette of the target: pixels with an alpha greater than 0
+	 */
+	const SilhouetteMask& silhouette() const { return m_silhouette; }
+
+	/**
+	 * \brief Pixels of the target with a value (in HSV) greater than 0.5
+	 */
+	const SilhouetteMask& valueMask() const { return m_valueMask; }
+
+	/**
+	 * \brief Row of the alpha channel of the target
+	 */
+	const uchar* alphaRow(int y) const { return m_alpha.data() + std::size_t(y) * m_width; }
+
+	/**
+	 * \brief Row of the value (in HSV) of the target
+	 */
+	const uchar* valueRow(int y) const { return m_value.data() + std::size_t(y) * m_width; }
+
+	/**
+	 * \brief Number of pixels in the silhouette of the target
+	 */
+	long long area() const { return m_area; }
+
+	/**
+	 * \brief Sum of the alpha channel of the target (in 1/255 units)
+	 */
+	long long alphaSum() const { return m_alphaSum; }
+
+	/**
+	 * \brief Return true if the distance transform has been computed
+	 */
+	bool hasDistanceTransform() const { return !m_distanceTransform.empty(); }
+
+	/**
+	 * \brief Euclidean distance in pixels from each pixel to the silhouette of the target
+	 */
+	const std::vector<float>& distanceTransform() const { return m_distanceTransform; }
+
+	/**
+	 * \brief Compute the Euclidean distance transform of the silhouette
+	 */
+	void computeDistanceTransform();
+
+	/**
+	 * \brief Pack the alpha channel and the binary value in a two channels texture
+	 * \return Interleaved alpha and value mask (0 or 255), rows in OpenGL order (bottom to top)
+	 */
+	std::vector<uchar> alphaValueTexture() const;
+
+private:
+
+	int m_width;
+	int m_height;
+
+	SilhouetteMask m_silhouette;
+	SilhouetteMask m_valueMask;
+
+	std::vector<uchar> m_alpha;
+	std::vector<uchar> m_value;
+
+	long long m_area;
+	long long m_alphaSum;
+
+	std::vector<float> m_distanceTransform;
+};
@@ -0,0 +1,353 @@
+#include "VertexLayout.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+	// Parameters of the vertex scores, from the paper
+	constexpr int CacheSize = 32;
+	constexpr float CacheDecayPower = 1.5f;
+	constexpr float LastTriangleScore = 0.75f;
+	constexpr float ValenceBoostScale = 2.0f;
+	constexpr float ValenceBoostPower = 0.5f;
+
+	/**
+	 * \brief Score of a vertex to be used by the next triangle
+	 * \param cachePosition Position in the LRU cache, -1 if the vertex is not in the cache
+	 * \param remainingTriangles Number of triangles using the vertex which are not emitted yet
+	 */
+	float vertexScore(int cachePosition, int remainingTriangles)
+	{
+		if (remainingTriangles == 0)
+		{
+			return -1.0f;
+		}
+
+		float score = 0.0f;
+
+		if (cachePosition >= 0)
+		{
+			// The vertices of the last triangle have a fixed score, so that it is not reused too eagerly
+			if (cachePosition < 3)
+			{
+				score = LastTriangleScore;
+			}
+			else
+			{
+				const float scaler = 1.0f / (CacheSize - 3);
+				score = std::pow(1.0f - (cachePosition - 3) * scaler, CacheDecayPower);
+			}
+		}
+
+		// Vertices with few remaining triangles are finished first, to leave no isolated triangle behind
+		score += ValenceBoostScale * std::pow(float(remainingTriangles), -ValenceBoostPower);
+
+		return score;
+	}
+
+	float toFloat(const unsigned char* data)
+	{
+		float value;
+		std::memcpy(&value, data, sizeof(value));
+		return value;
+	}
+
+	std::uint16_t toUint16(const unsigned char* data)
+	{
+		std::uint16_t value;
+		std::memcpy(&value, data, sizeof(value));
+		return value;
+	}
+}
+
+VertexLayout vertexLayout(VertexFormat format)
+{
+	switch (format)
+	{
+	case VertexFormat::Unorm16Uv:
+		return { 3 * sizeof(float) + 2 * sizeof(std::uint16_t), 0, 3 * sizeof(float) };
+
+	case VertexFormat::FloatUv:
+	default:
+		return { 5 * sizeof(float), 0, 3 * sizeof(float) };
+	}
+}
+
+VertexFormat selectVertexFormat(const std::vector<QVector3D>& uvs)
+{
+	const bool normalized = std::all_of(uvs.begin(), uvs.end(), [](const QVector3D& uv)
+	{
+		return uv.x() >= 0.0f && uv.x() <= 1.0f && uv.y() >= 0.0f && uv.y() <= 1.0f;
+	});
+
+	return normalized ? VertexFormat::Unorm16Uv : VertexFormat::FloatUv;
+}
+
+std::vector<unsigned char> packVertices(const std::vector<QVector3D>& vertices,
+	                                    std::vector<QVector3D>& uvs,
+	                                    VertexFormat format)
+{
+	const auto layout = vertexLayout(format);
+	std::vector<unsigned char> data(vertices.size() * layout.stride);
+
+	#pragma omp parallel for
+	for (int i = 0; i < int(vertices.size()); i++)
+	{
+		unsigned char* vertex = data.data() + std::size_t(i) * layout.stride;
+
+		const float position[3] = { vertices[i].x(), vertices[i].y(), vertices[i].z() };
+		std::memcpy(vertex + layout.positionOffset, position, sizeof(position));
+
+		if (format == VertexFormat::Unorm16Uv)
+		{
+			// Same conversion as OpenGL for normalized integers: c / 65535
+			const std::uint16_t uv[2] = {
+				std::uint16_t(std::lround(uvs[i].x() * 65535.0f)),
+				std::uint16_t(std::lround(uvs[i].y() * 65535.0f))
+			};
+
+			std::memcpy(vertex + layout.uvOffset, uv, sizeof(uv));
+			uvs[i] = QVector3D(uv[0] / 65535.0f, uv[1] / 65535.0f, 0.0f);
+		}
+		else
+		{
+			const float uv[2] = { uvs[i].x(), uvs[i].y() };
+			std::memcpy(vertex + layout.uvOffset, uv, sizeof(uv));
+		}
+	}
+
+	return data;
+}
+
+void unpackVertices(const unsigned char* data,
+	                std::size_t vertexCount,
+	                VertexFormat format,
+	                std::vector<QVector3D>& vertices,
+	                std::vector<QVector3D>& uvs)
+{
+	const auto layout = vertexLayout(format);
+
+	vertices.resize(vertexCount);
+	uvs.resize(vertexCount);
+
+	#pragma omp parallel for
+	for (int i = 0; i < int(vertexCount); i++)
+	{
+		const unsigned char* vertex = data + std::size_t(i) * layout.stride;
+		const unsigned char* position = vertex + layout.positionOffset;
+		const unsigned char* uv = vertex + layout.uvOffset;
+
+		vertices[i] = QVector3D(toFloat(position), toFloat(position + 4), toFloat(position + 8));
+
+		if (format == VertexFormat::Unorm16Uv)
+		{
+			uvs[i] = QVector3D(toUint16(uv) / 65535.0f, toUint16(uv + 2) / 65535.0f, 0.0f);
+		}
+		else
+		{
+			uvs[i] = QVector3D(toFloat(uv), toFloat(uv + 4), 0.0f);
+		}
+	}
+}
+
+void optimizeVertexCache(unsigned int* indices, std::size_t indexCount, std::size_t vertexCount)
+{
+	const std::size_t triangleCount = indexCount / 3;
+
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	// Triangles of each vertex, in a compressed array
+	std::vector<int> remainingTriangles(vertexCount, 0);
+	for (std::size_t i = 0; i < 3 * triangleCount; i++)
+	{
+		remainingTriangles[indices[i]]++;
+	}
+
+	std::vector<std::size_t> firstTriangle(vertexCount + 1, 0);
+	for (std::size_t v = 0; v < vertexCount; v++)
+	{
+		firstTriangle[v + 1] = firstTriangle[v] + remainingTriangles[v];
+	}
+
+	std::vector<unsigned int> vertexTriangles(firstTriangle.back());
+	std::vector<std::size_t> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+	for (std::size_t t = 0; t < triangleCount; t++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			vertexTriangles[fill[indices[3 * t + k]]++] = static_cast<unsigned int>(t);
+		}
+	}
+
+	// The triangles which are emitted are moved to the end of the lists of their vertices
+	std::vector<int> cachePositions(vertexCount, -1);
+	std::vector<float> vertexScores(vertexCount);
+	for (std::size_t v = 0; v < vertexCount; v++)
+	{
+		vertexScores[v] = vertexScore(-1, remainingTriangles[v]);
+	}
+
+	std::vector<float> triangleScores(triangleCount);
+	for (std::size_t t = 0; t < triangleCount; t++)
+	{
+		triangleScores[t] = vertexScores[indices[3 * t]] + vertexScores[indices[3 * t + 1]] + vertexScores[indices[3 * t + 2]];
+	}
+
+	std::vector<char> emitted(triangleCount, 0);
+	std::vector<unsigned int> output;
+	output.reserve(3 * triangleCount);
+
+	// LRU cache with room for the vertices pushed out by the last triangle
+	std::vector<unsigned int> cache;
+	std::vector<unsigned int> newCache;
+	cache.reserve(CacheSize + 3);
+	newCache.reserve(CacheSize + 3);
+
+	std::size_t nextCandidate = 0;
+	std::size_t bestTriangle = 0;
+
+	while (output.size() < 3 * triangleCount)
+	{
+		const unsigned int* triangle = indices + 3 * bestTriangle;
+
+		emitted[bestTriangle] = 1;
+		output.insert(output.end(), triangle, triangle + 3);
+
+		// Remove the triangle from the remaining triangles of its vertices
+		for (int k = 0; k < 3; k++)
+		{
+			const auto v = triangle[k];
+			auto begin = vertexTriangles.begin() + firstTriangle[v];
+			auto end = begin + remainingTriangles[v];
+
+			std::iter_swap(std::find(begin, end, static_cast<unsigned int>(bestTriangle)), end - 1);
+			remainingTriangles[v]--;
+		}
+
+		// The vertices of the triangle move to the front of the cache
+		newCache.assign(triangle, triangle + 3);
+		for (const auto v : cache)
+		{
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+			{
+				newCache.push_back(v);
+			}
+		}
+
+		std::swap(cache, newCache);
+
+		for (std::size_t i = CacheSize; i < cache.size(); i++)
+		{
+			cachePositions[cache[i]] = -1;
+			vertexScores[cache[i]] = vertexScore(-1, remainingTriangles[cache[i]]);
+		}
+
+		// Update the scores of the vertices in the cache, and of their triangles
+		float bestScore = -1.0f;
+		bool foundCandidate = false;
+
+		const std::size_t cacheCount = std::min<std::size_t>(cache.size(), CacheSize);
+		for (std::size_t i = 0; i < cacheCount; i++)
+		{
+			cachePositions[cache[i]] = int(i);
+			vertexScores[cache[i]] = vertexScore(int(i), remainingTriangles[cache[i]]);
+		}
+
+		for (std::size_t i = 0; i < cache.size(); i++)
+		{
+			const auto v = cache[i];
+
+			for (int j = 0; j < remainingTriangles[v]; j++)
+			{
+				const auto t = vertexTriangles[firstTriangle[v] + j];
+				const unsigned int* vertices = indices + 3 * t;
+
+				triangleScores[t] = vertexScores[vertices[0]] + vertexScores[vertices[1]] + vertexScores[vertices[2]];
+
+				if (triangleScores[t] > bestScore)
+				{
+					bestScore = triangleScores[t];
+					bestTriangle = t;
+					foundCandidate = true;
+				}
+			}
+		}
+
+		cache.resize(cacheCount);
+
+		// No triangle around the cache, continue with the next triangle of the input
+		if (!foundCandidate)
+		{
+			while (nextCandidate < triangleCount && emitted[nextCandidate])
+			{
+				nextCandidate++;
+			}
+
+			bestTriangle = nextCandidate;
+		}
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+std::vector<unsigned int> optimizeVertexFetch(const std::vector<unsigned int>& indices, std::size_t vertexCount)
+{
+	const auto unused = std::numeric_limits<unsigned int>::max();
+
+	std::vector<unsigned int> remap(vertexCount, unused);
+	unsigned int next = 0;
+
+	for (const auto index : indices)
+	{
+		if (remap[index] == unused)
+		{
+			remap[index] = next++;
+		}
+	}
+
+	for (auto& position : remap)
+	{
+		if (position == unused)
+		{
+			position = next++;
+		}
+	}
+
+	return remap;
+}
+
+float averageCacheMissRatio(const unsigned int* indices, std::size_t indexCount, std::size_t vertexCount, int cacheSize)
+{
+	const std::size_t triangleCount = indexCount / 3;
+
+	if (triangleCount == 0)
+	{
+		return 0.0f;
+	}
+
+	// Time at which each vertex entered the FIFO cache
+	std::vector<std::size_t> entered(vertexCount, 0);
+	std::size_t time = 0;
+	std::size_t misses = 0;
+
+	for (std::size_t i = 0; i < 3 * triangleCount; i++)
+	{
+		const auto v = indices[i];
+
+		if (entered[v] == 0 || time - entered[v] >= std::size_t(cacheSize))
+		{
+			time++;
+			entered[v] = time;
+			misses++;
+		}
+	}
+
+	return float(misses) / float(triangleCount);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <QVector3D>
+
+/**
+ * \brief Formats of the vertices in the vertex buffer, the position always comes first as 3 floats
+ */
+enum class VertexFormat
+{
+	/**
+	 * \brief Texture coordinates as 2 floats, 20 bytes per vertex
+	 */
+	FloatUv,
+
+	/**
+	 * \brief Texture coordinates as 2 normalized unsigned 16 bits integers, 16 bytes per vertex.
+	 *        Only for texture coordinates in [0, 1], with a precision of 1/65535
+	 */
+	Unorm16Uv
+};
+
+/**
+ * \brief Position of the attributes in a vertex, in bytes
+ */
+struct VertexLayout
+{
+	int stride;
+	int positionOffset;
+	int uvOffset;
+};
+
+/**
+ * \brief Layout of the vertices of a format
+ */
+VertexLayout vertexLayout(VertexFormat format);
+
+/**
+ * \brief Select the most compact format which represents texture coordinates
+ * \param uvs Texture coordinates, the third coordinate is not stored
+ */
+VertexFormat selectVertexFormat(const std::vector<QVector3D>& uvs);
+
+/**
+ * \brief Interleave the positions and the texture coordinates of the vertices in a format
+ * \param vertices Positions of the vertices
+ * \param uvs Texture coordinates of the vertices, quantized like in the vertex buffer
+ *        so that the CPU and the GPU interpolate the same values
+ * \param format Format of the vertices
+ * \return The bytes of the vertex buffer
+ */
+std::vector<unsigned char> packVertices(const std::vector<QVector3D>& vertices,
+	                                    std::vector<QVector3D>& uvs,
+	                                    VertexFormat format);
+
+/**
+ * \brief Read the positions and the texture coordinates of packed vertices
+ * \param data The bytes of the vertex buffer
+ * \param vertexCount Number of vertices
+ * \param format Format of the vertices
+ * \param vertices Positions of the vertices
+ * \param uvs Texture coordinates of the vertices, with 0 as third coordinate
+ */
+void unpackVertices(const unsigned char* data,
+	                std::size_t vertexCount,
+	                VertexFormat format,
+	                std::vector<QVector3D>& vertices,
+	                std::vector<QVector3D>& uvs);
+
+/**
+ * \brief Reorder triangles to reuse the vertices in the post-transform cache of the GPU
+ *
+ * Triangles are emitted greedily by the score of their vertices, which depends on their position
+ * in a simulated LRU cache and on the number of triangles still using them.
+ *
+ * Source: Forsyth, T. (2006). Linear-speed vertex cache optimisation.
+ * https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+ * \param indices Three indices per triangle, reordered in place
+ * \param indexCount Number of indices
+ * \param vertexCount Number of vertices referenced by the indices
+ */
+void optimizeVertexCache(unsigned int* indices, std::size_t indexCount, std::size_t vertexCount);
+
+/**
+ * \brief Order the vertices by their first use in the triangles, so they are fetched sequentially
+ * \param indices Three indices per triangle
+ * \param vertexCount Number of vertices
+ * \return The new position of each vertex, the vertices which are not used come last
+ */
+std::vector<unsigned int> optimizeVertexFetch(const std::vector<unsigned int>& indices, std::size_t vertexCount);
+
+/**
+ * \brief Average number of vertices transformed per triangle with a FIFO post-transform cache
+ * \param indices Three indices per triangle
+ * \param indexCount Number of indices
+ * \param vertexCount Number of vertices referenced by the indices
+ * \param cacheSize Number of vertices in the cache
+ * \return Between 0.5 (ideal on a regular grid) and 3 (no reuse)
+ */
+float averageCacheMissRatio(const unsigned int* indices, std::size_t indexCount, std::size_t vertexCount, int cacheSize);
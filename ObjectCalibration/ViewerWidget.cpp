@@ -3,8 +3,6 @@
 #include <QtMath>
 #include <QWheelEvent>
 
-#include "Similarity.h"
-
 ViewerWidget::ViewerWidget(QWidget* parent) :
 	QOpenGLWidget(parent),
 	m_logger(new QOpenGLDebugLogger(this)),
@@ -12,12 +10,7 @@ ViewerWidget::ViewerWidget(QWidget* parent) :
 		     { 0.0, 0.0, 0.0 },
 		     { -1.0, 0.0, 0.0 },
 		     qRadiansToDegrees(2.0 * atan(4.29 / (2.0 * 4.5))),
-		     4.0f / 3.0f, 0.01f, 10.0f),
-	m_objectVbo(QOpenGLBuffer::VertexBuffer),
-	m_objectEbo(QOpenGLBuffer::IndexBuffer),
-	m_objectTexture(QOpenGLTexture::Target2D),
-	m_similarityAtomicBuffer(0),
-	m_targetTexture(QOpenGLTexture::Target2D)
+		     4.0f / 3.0f, 0.01f, 10.0f)
 {
 	m_objectMatrix.setToIdentity();
 
@@ -32,6 +25,9 @@ ViewerWidget::ViewerWidget(QWidget* parent) :
 	m_object.load("../blender/objects/phone/phone.obj");
 	m_objectMatrix.translate(0.00155178, -0.0191204, -0.0446233);
 	m_objectMatrix.scale(0.01);
+
+	// OpenGL objects are allocated in initializeGL()
+	m_evaluation = std::make_unique<EvaluationContext>(m_object, m_objectMatrix);
 }
 
 ViewerWidget::~ViewerWidget()
@@ -41,14 +37,11 @@ ViewerWidget::~ViewerWidget()
 
 void ViewerWidget::cleanup()
 {
-	if (m_program)
+	if (m_evaluation->isInitialized())
 	{
-		m_objectVao.destroy();
-		m_objectVbo.destroy();
-		m_objectVbo.destroy();
-		m_objectTexture.destroy();
-		m_program.reset(nullptr);
-		m_frameBuffer.reset(nullptr);
+		makeCurrent();
+		m_evaluation->destroy();
+		doneCurrent();
 	}
 }
 
@@ -88,197 +81,136 @@ void ViewerWidget::moveCamera(const ObjectPose& pose)
 
 void ViewerWidget::moveObject(const ObjectPose& pose)
 {
-	QMatrix4x4 translationMatrix;
-	translationMatrix.translate(pose.translation);
-
-	const auto rotation = QQuaternion::fromEulerAngles(pose.rotation.x(), pose.rotation.y(), pose.rotation.z());
-	const QMatrix4x4 rotationMatrix(rotation.toRotationMatrix());
-	
-	m_objectWorldMatrix = translationMatrix * rotationMatrix * m_objectMatrix;
+	m_objectWorldMatrix = objectWorldMatrix(pose, m_objectMatrix);
 }
 
 void ViewerWidget::setTargetImage(const QImage& targetImage)
 {
-	m_targetImage = targetImage;
+	// makeCurrent() does nothing until OpenGL is initialized
+	makeCurrent();
+	m_evaluation->setTargetImage(targetImage);
+	doneCurrent();
+}
 
+void ViewerWidget::setWorkingResolution(const QSize& size)
+{
 	makeCurrent();
-	initializeTargetTexture();
+	m_evaluation->setWorkingResolution(size);
 	doneCurrent();
 }
 
-void ViewerWidget::render(const ObjectPose& pose)
+QSize ViewerWidget::workingResolution() const
 {
-	auto f = context()->versionFunctions<QOpenGLFunctions_4_3_Core>();
+	return m_evaluation->workingResolution();
+}
 
-	moveObject(pose);
-	
-	if (m_frameBuffer)
-	{
-		// Attach the frame buffer and set the resolution of the viewport
-		m_frameBuffer->bind();
-		glViewport(0, 0, m_frameBuffer->width(), m_frameBuffer->height());
-		m_camera.setAspectRatio(float(m_frameBuffer->width()) / float(m_frameBuffer->height()));
-		m_camera.setEye({ 0.0, 0.0, 1.0 });
-		m_camera.setAt({ 0.0, 0.0, 0.0 });
-		m_camera.setUp({ -1.0, 0.0, 0.0 });
-		m_camera.setFovy(qRadiansToDegrees(2.0 * atan(4.29 / (2.0 * 4.5))));
-		m_camera.setNearPlane(0.01f);
-		m_camera.setFarPlane(10.0f);
-	}
+void ViewerWidget::setSupersampling(int factor)
+{
+	makeCurrent();
+	m_evaluation->setSupersampling(factor);
+	doneCurrent();
+}
 
-	// Transparent background
-	glClearColor(0.0, 0.0, 0.0, 0.0);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glEnable(GL_DEPTH_TEST);
+int ViewerWidget::supersampling() const
+{
+	return m_evaluation->supersampling();
+}
+
+void ViewerWidget::setSilhouetteOnly(bool silhouetteOnly)
+{
+	makeCurrent();
+	m_evaluation->setSilhouetteOnly(silhouetteOnly);
+	doneCurrent();
+}
 
-	// Enable transparency
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+bool ViewerWidget::silhouetteOnly() const
+{
+	return m_evaluation->silhouetteOnly();
+}
 
-	// Paint the object in the frame buffer
-	if (m_program)
-	{
-		// Setup matrices
-		const auto normalMatrix = m_objectWorldMatrix.normalMatrix();
-		const auto viewMatrix = m_camera.viewMatrix();
-		const auto projectionMatrix = m_camera.projectionMatrix();
-		const auto pvMatrix = projectionMatrix * viewMatrix;
-		const auto pvmMatrix = pvMatrix * m_objectWorldMatrix;
-
-		m_program->bind();
-
-		// Update matrices
-		m_program->setUniformValue("P", projectionMatrix);
-		m_program->setUniformValue("V", viewMatrix);
-		m_program->setUniformValue("M", m_objectWorldMatrix);
-		m_program->setUniformValue("N", normalMatrix);
-		m_program->setUniformValue("PV", pvMatrix);
-		m_program->setUniformValue("PVM", pvmMatrix);
-
-		// Bind the VAO containing the patches
-		QOpenGLVertexArrayObject::Binder vaoBinder(&m_objectVao);
-
-		// Bind the texture
-		const auto textureUnit = 0;
-		m_program->setUniformValue("image", textureUnit);
-		m_objectTexture.bind(textureUnit);
-
-		f->glDrawElements(GL_TRIANGLES,
-			m_objectEbo.size(),
-			GL_UNSIGNED_INT,
-			nullptr);
-
-		m_program->release();
-	}
+void ViewerWidget::setLevelOfDetailTolerance(float pixels)
+{
+	m_evaluation->setLevelOfDetailTolerance(pixels);
+}
 
-	if (m_frameBuffer)
-	{
-		m_frameBuffer->release();
-	}
+float ViewerWidget::levelOfDetailTolerance() const
+{
+	return m_evaluation->levelOfDetailTolerance();
 }
 
 QImage ViewerWidget::renderToImage(const ObjectPose& pose)
 {
 	makeCurrent();
+	const auto image = m_evaluation->renderToImage(pose);
+	doneCurrent();
+
+	return image;
+}
+
+std::vector<QImage> ViewerWidget::renderToImageBatch(const std::vector<ObjectPose>& poses)
+{
+	makeCurrent();
+	const auto images = m_evaluation->renderToImageBatch(poses);
+	doneCurrent();
+
+	return images;
+}
+
+PixelBufferReadback ViewerWidget::renderAsync(const ObjectPose& pose)
+{
+	makeCurrent();
+	const auto readback = m_evaluation->renderAsync(pose);
+	doneCurrent();
 
-	// Output the content of the frame buffer
-	render(pose);
-	const auto result = m_frameBuffer->toImage();
+	return readback;
+}
 
+PixelBufferView ViewerWidget::mapReadback(const PixelBufferReadback& readback)
+{
+	makeCurrent();
+	const auto view = m_evaluation->mapReadback(readback);
 	doneCurrent();
 
-	return result;
+	return view;
+}
+
+void ViewerWidget::releaseReadback(const PixelBufferReadback& readback)
+{
+	makeCurrent();
+	m_evaluation->releaseReadback(readback);
+	doneCurrent();
 }
 
 float ViewerWidget::renderAndComputeSimilarityCpu(const ObjectPose& pose)
 {
-	const auto image = renderToImage(pose);
+	makeCurrent();
+	const auto similarity = m_evaluation->renderAndComputeSimilarityCpu(pose);
+	doneCurrent();
 
-	return computeSimilarity(image, m_targetImage);
+	return similarity;
 }
 
 float ViewerWidget::renderAndComputeSimilarityGpu(const ObjectPose& pose)
 {
-	float similarity = 0.0f;
-	
 	makeCurrent();
+	const auto similarity = m_evaluation->renderAndComputeSimilarityGpu(pose);
+	doneCurrent();
 
-	// Render the image in the frame buffer
-	render(pose);
+	return similarity;
+}
 
-	auto f = context()->versionFunctions<QOpenGLFunctions_4_3_Core>();
-	
-	// Use the compute shader
-	if (m_computeSimilarityProgram)
-	{
-		// Local size in the compute shader
-		const int localSizeX = 4;
-		const int localSizeY = 4;
-		const float multiplicationBeforeRound = 100.0;
-
-		m_computeSimilarityProgram->bind();
-
-		// Coefficient when multiplying before rounding (the number of decimals we keep)
-		m_computeSimilarityProgram->setUniformValue("multiplication_before_round", multiplicationBeforeRound);
-
-		// Bind the target texture as an image
-		const auto targetImageUnit = 0;
-		f->glBindImageTexture(targetImageUnit, m_targetTexture.textureId(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8);
-
-		// Bind the frame buffer texture as an image
-		const auto frameBufferImageUnit = 1;
-		f->glBindImageTexture(frameBufferImageUnit, m_frameBuffer->texture(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8);
-
-		// Bind the atomic counters (binding = 2)
-		f->glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, m_similarityAtomicBuffer);
-		f->glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 2, m_similarityAtomicBuffer);
-		// Init the 6 atomic counters with a value of 0
-		GLuint counterValues[6] = { 0, 0, 0, 0, 0, 0 };
-		f->glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, 6 * sizeof(GLuint), counterValues);
-
-		// Compute the number of blocks in each dimensions
-		const int blocksX = std::max(1, 1 + ((m_frameBuffer->width() - 1) / localSizeX));
-		const int blocksY = std::max(1, 1 + ((m_frameBuffer->height() - 1) / localSizeY));
-		// Launch the compute shader and wait for it to finish
-		f->glDispatchCompute(blocksX, blocksY, 1);
-		f->glMemoryBarrier(GL_ATOMIC_COUNTER_BARRIER_BIT);
-
-		// Read back values of the atomic counters
-		f->glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, 6 * sizeof(GLuint), counterValues);
-
-		// Unbind atomic buffer and textures
-		f->glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
-		f->glBindImageTexture(frameBufferImageUnit, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8);
-		f->glBindImageTexture(targetImageUnit, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8);
-
-		m_computeSimilarityProgram->release();
-
-		const auto tp = float(counterValues[0]);
-		const auto fp = float(counterValues[1]);
-		const auto fn = float(counterValues[2]);
-		const auto numerator = float(counterValues[3]) / multiplicationBeforeRound;
-		const auto denominator = float(counterValues[4]) / multiplicationBeforeRound;
-		const auto maeSum = float(counterValues[5]);
-
-		// Compute the Dice Coefficient
-		const auto diceCoefficient = (2.f * tp) / (2.f * tp + fp + fn);
-
-		// Compute the fuzzy Dice Coefficient
-		const auto fuzzyDiceCoefficient = (2.f * numerator + 1.f) / (denominator + 1.f);
-
-		// Compute the mean absolute error
-		float mae = 0.0;
-		if (tp > 0.0)
-		{
-			mae = maeSum / float(tp);
-		}
-
-		// The similarity is 90% based on silhouettes overlap and 10% based on absolute error
-		similarity = 0.9f * fuzzyDiceCoefficient + 0.1f * mae;
-	}
+float ViewerWidget::renderAndComputeSimilarity(const ObjectPose& pose)
+{
+	return renderAndComputeSimilarityGpu(pose);
+}
+
+std::vector<float> ViewerWidget::renderAndComputeSimilarityBatch(const std::vector<ObjectPose>& poses)
+{
+	makeCurrent();
+	const auto similarities = m_evaluation->renderAndComputeSimilarityBatch(poses);
 	doneCurrent();
 
-	return similarity;
+	return similarities;
 }
 
 void ViewerWidget::initializeGL()
@@ -292,7 +224,7 @@ void ViewerWidget::initializeGL()
 	printInfo();
 
 	// Init the scene
-	initialize();
+	m_evaluation->initialize();
 }
 
 void ViewerWidget::resizeGL(int w, int h)
@@ -362,118 +294,3 @@ void ViewerWidget::wheelEvent(QWheelEvent* event)
 
 	update();
 }
-
-void ViewerWidget::initialize()
-{
-	const QString shader_dir = ":/MainWindow/Shaders/";
-
-	// Init shaders
-	m_program = std::make_unique<QOpenGLShaderProgram>();
-	m_program->addShaderFromSourceFile(QOpenGLShader::Vertex, shader_dir + "object_vs.glsl");
-	m_program->addShaderFromSourceFile(QOpenGLShader::Fragment, shader_dir + "object_fs.glsl");
-	m_program->link();
-	m_program->bind();
-
-	// Initialize the frame buffer with a depth buffer
-	QOpenGLFramebufferObjectFormat fboFormat;
-	fboFormat.setAttachment(QOpenGLFramebufferObject::Depth);
-	m_frameBuffer = std::make_unique<QOpenGLFramebufferObject>(QSize(4032, 3024), fboFormat);
-
-	// Initialize vertices
-	initializeVbo();
-	initializeEbo();
-	initializeTexture();
-	initializeTargetTexture();
-	initializeComputeShader();
-
-	// Init VAO
-	m_objectVao.create();
-	QOpenGLVertexArrayObject::Binder vaoBinder(&m_objectVao);
-
-	// Configure VBO
-	m_objectVbo.bind();
-	const auto posLoc = 0;
-	const auto uvLoc = 1;
-	m_program->enableAttributeArray(posLoc);
-	m_program->enableAttributeArray(uvLoc);
-	m_program->setAttributeBuffer(posLoc, GL_FLOAT, 0, 3, 2 * sizeof(QVector3D));
-	m_program->setAttributeBuffer(uvLoc, GL_FLOAT, sizeof(QVector3D), 3, 2 * sizeof(QVector3D));
-
-	// Configure EBO
-	m_objectEbo.bind();
-
-	m_program->release();
-}
-
-void ViewerWidget::initializeVbo()
-{	
-	std::vector<QVector3D> data = m_object.verticesAndUv();
-
-	// Init VBO
-	m_objectVbo.create();
-	m_objectVbo.bind();
-	m_objectVbo.allocate(data.data(), data.size() * sizeof(QVector3D));
-	m_objectVbo.release();
-}
-
-void ViewerWidget::initializeEbo()
-{
-	// Indices of faces
-	std::vector<GLuint> indices = m_object.indices();
-
-	// Init VBO
-	m_objectEbo.create();
-	m_objectEbo.bind();
-	m_objectEbo.allocate(indices.data(), indices.size() * sizeof(GLuint));
-	m_objectEbo.release();
-}
-
-
-void ViewerWidget::initializeTexture()
-{
-	const QImage textureImage = m_object.texture();
-	
-	m_objectTexture.destroy();
-	m_objectTexture.create();
-	m_objectTexture.setFormat(QOpenGLTexture::RGBA8_UNorm);
-	m_objectTexture.setMinificationFilter(QOpenGLTexture::Linear);
-	m_objectTexture.setMagnificationFilter(QOpenGLTexture::Linear);
-	m_objectTexture.setWrapMode(QOpenGLTexture::ClampToEdge);
-	m_objectTexture.setSize(textureImage.width(), textureImage.height());
-	m_objectTexture.setData(textureImage.mirrored(), QOpenGLTexture::DontGenerateMipMaps);
-}
-
-void ViewerWidget::initializeTargetTexture()
-{
-	if (m_targetImage.width() > 0 && m_targetImage.height() > 0)
-	{
-		m_targetTexture.destroy();
-		m_targetTexture.create();
-		m_targetTexture.setFormat(QOpenGLTexture::RGBA8_UNorm);
-		m_targetTexture.setMinificationFilter(QOpenGLTexture::Linear);
-		m_targetTexture.setMagnificationFilter(QOpenGLTexture::Linear);
-		m_targetTexture.setWrapMode(QOpenGLTexture::ClampToEdge);
-		m_targetTexture.setSize(m_targetImage.width(), m_targetImage.height());
-		m_targetTexture.setData(m_targetImage.mirrored(), QOpenGLTexture::DontGenerateMipMaps);
-	}
-}
-
-void ViewerWidget::initializeComputeShader()
-{
-	const QString shader_dir = ":/MainWindow/Shaders/";
-	
-	// Init similarity compute shader
-	m_computeSimilarityProgram = std::make_unique<QOpenGLShaderProgram>();
-	m_computeSimilarityProgram->addShaderFromSourceFile(QOpenGLShader::Compute, shader_dir + "similarity_cs.glsl");
-	m_computeSimilarityProgram->link();
-
-	auto f = context()->versionFunctions<QOpenGLFunctions_4_3_Core>();
-
-	// Declare and generate a buffer object name
-	f->glGenBuffers(1, &m_similarityAtomicBuffer);
-	// Bind the buffer and define its initial storage capacity (6 uint)
-	f->glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, m_similarityAtomicBuffer);
-	f->glBufferData(GL_ATOMIC_COUNTER_BUFFER, 6 * sizeof(GLuint), NULL, GL_DYNAMIC_READ);
-	// Unbind the buffer 
-	f->glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
-}
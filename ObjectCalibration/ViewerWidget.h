@@ -4,17 +4,16 @@
 #include <QOpenGLFunctions_4_3_Core>
 #include <QOpenGLDebugLogger>
 
-#include <QOpenGLShaderProgram>
-#include <QOpenGLVertexArrayObject>
-#include <QOpenGLBuffer>
-#include <QOpenGLTexture>
-#include <QOpenGLFramebufferObject>
+#include <memory>
 
 #include "Camera.h"
+#include "EvaluationContext.h"
 #include "ObjectPose.h"
 #include "Mesh.h"
+#include "PixelBufferRing.h"
+#include "Renderer.h"
 
-class ViewerWidget : public QOpenGLWidget, protected QOpenGLFunctions_4_3_Core
+class ViewerWidget : public QOpenGLWidget, public Renderer, protected QOpenGLFunctions_4_3_Core
 {
 	Q_OBJECT
 
@@ -31,17 +30,85 @@ public slots:
 	void cleanup();
 	void printInfo();
 
-	void setTargetImage(const QImage& targetImage);
+	/**
+	 * \brief Set the target image, the frame buffer is resized to the working resolution
+	 * \param targetImage The target image
+	 */
+	void setTargetImage(const QImage& targetImage) override;
+
+	/**
+	 * \brief Set the resolution at which poses are compared to the target
+	 * \param size The working resolution, or an invalid size to use the resolution of the target
+	 */
+	void setWorkingResolution(const QSize& size) override;
+	QSize workingResolution() const override;
+
+	/**
+	 * \brief Render N x N samples per pixel, averaged before comparing to the target
+	 * \param factor Number of samples in each dimension, a power of two
+	 */
+	void setSupersampling(int factor);
+	int supersampling() const;
+
+	/**
+	 * \brief Compare only the silhouettes, rendered in 8 bits frame buffers without the texture
+	 * \param silhouetteOnly true to skip the texture and the mean absolute error
+	 */
+	void setSilhouetteOnly(bool silhouetteOnly) override;
+	bool silhouetteOnly() const override;
+
+	/**
+	 * \brief Set the error on the screen accepted when selecting the level of detail of the mesh
+	 * \param pixels Largest error in pixels at the working resolution
+	 */
+	void setLevelOfDetailTolerance(float pixels) override;
+	float levelOfDetailTolerance() const override;
 	
 	void moveCamera(const ObjectPose& pose);
 
 	void moveObject(const ObjectPose& pose);
+
+	const Mesh& object() const { return m_object; }
+	const QMatrix4x4& objectMatrix() const { return m_objectMatrix; }
 	
-	QImage renderToImage(const ObjectPose& pose);
+	QImage renderToImage(const ObjectPose& pose) override;
+	std::vector<QImage> renderToImageBatch(const std::vector<ObjectPose>& poses) override;
+
+	/**
+	 * \brief Render a pose and queue the readback of the frame buffer without waiting for it
+	 *
+	 * Several renders can be queued before mapping their results, up to the size of the ring.
+	 * \param pose The pose of the object
+	 * \return A handle on the readback
+	 */
+	PixelBufferReadback renderAsync(const ObjectPose& pose);
+
+	/**
+	 * \brief Wait for a queued readback and map its pixels without copying them
+	 * \param readback The handle returned by renderAsync()
+	 * \return A view on the pixels, valid until releaseReadback() is called
+	 */
+	PixelBufferView mapReadback(const PixelBufferReadback& readback);
+	void releaseReadback(const PixelBufferReadback& readback);
 
 	float renderAndComputeSimilarityCpu(const ObjectPose& pose);
 	float renderAndComputeSimilarityGpu(const ObjectPose& pose);
 
+	/**
+	 * \brief Render a pose and compute its similarity with the target, with the compute shader
+	 */
+	float renderAndComputeSimilarity(const ObjectPose& pose) override;
+
+	/**
+	 * \brief Render several poses in one pass and compute their similarity with the target
+	 *
+	 * Poses are drawn as instances in the layers of a layered frame buffer, compared to the
+	 * target in one dispatch of the compute shader and read back in a single transfer.
+	 * \param poses The poses of the object
+	 * \return The similarity of each pose, in the same order
+	 */
+	std::vector<float> renderAndComputeSimilarityBatch(const std::vector<ObjectPose>& poses) override;
+
 protected:
 	void initializeGL() override;
 	void resizeGL(int w, int h) override;
@@ -53,15 +120,6 @@ protected:
 
 private:
 
-	void initialize();
-	void initializeVbo();
-	void initializeEbo();
-	void initializeTexture();
-	void initializeTargetTexture();
-	void initializeComputeShader();
-
-	void render(const ObjectPose& pose);
-	
 	QOpenGLDebugLogger* m_logger;
 
 	OrbitCamera m_camera;
@@ -69,22 +127,6 @@ private:
 	QMatrix4x4 m_objectMatrix;
 	QMatrix4x4 m_objectWorldMatrix;
 
-	std::unique_ptr<QOpenGLShaderProgram> m_program;
-	std::unique_ptr<QOpenGLShaderProgram> m_computeSimilarityProgram;
-
-	// Add sheet of paper with UV coordinates
-	QOpenGLVertexArrayObject m_objectVao;
-	QOpenGLBuffer m_objectVbo;
-	QOpenGLBuffer m_objectEbo;
-	QOpenGLTexture m_objectTexture;
-
-	// Texture in which to render
-	std::unique_ptr<QOpenGLFramebufferObject> m_frameBuffer;
-
-	// Atomic buffer for computing the similarity in the compute shader
-	GLuint m_similarityAtomicBuffer;
-	
-	// Target texture
-	QImage m_targetImage;
-	QOpenGLTexture m_targetTexture;
+	// Frame buffers, programs and buffers evaluating the poses in the context of the widget
+	std::unique_ptr<EvaluationContext> m_evaluation;
 };
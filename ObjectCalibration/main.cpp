@@ -1,8 +1,17 @@
 #include "MainWindow.h"
 #include <QtWidgets/QApplication>
+#include <QSurfaceFormat>
 
 int main(int argc, char *argv[])
 {
+	// Compute shaders and storage buffers need OpenGL 4.3, the core profile is also
+	// what software implementations like Mesa's llvmpipe expose
+	QSurfaceFormat format;
+	format.setVersion(4, 3);
+	format.setProfile(QSurfaceFormat::CoreProfile);
+	format.setDepthBufferSize(24);
+	QSurfaceFormat::setDefaultFormat(format);
+
 	QApplication a(argc, argv);
 	MainWindow w;
 	w.show();
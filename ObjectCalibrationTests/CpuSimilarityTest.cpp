@@ -0,0 +1,365 @@
+#include "CpuSimilarityTest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <omp.h>
+
+#include <QtTest>
+
+#include "SilhouetteMask.h"
+#include "Similarity.h"
+#include "TargetDescriptor.h"
+
+namespace
+{
+	/**
+	 * \brief Sums of the original formula, per pixel through QColor
+	 */
+	struct ReferenceStatistics
+	{
+		long long truePositives = 0;
+		long long falsePositives = 0;
+		long long falseNegatives = 0;
+		double diceNumerator = 0.0;
+		double diceDenominator = 0.0;
+		double meanAbsoluteErrorSum = 0.0;
+	};
+
+	ReferenceStatistics computeReferenceStatistics(const QImage& image, const QImage& target)
+	{
+		ReferenceStatistics statistics;
+
+		for (int i = 0; i < image.height(); i++)
+		{
+			for (int j = 0; j < image.width(); j++)
+			{
+				const auto imageColor = image.pixelColor(j, i);
+				const auto targetColor = target.pixelColor(j, i);
+
+				const auto imageTransparency = imageColor.alphaF();
+				const auto targetTransparency = targetColor.alphaF();
+
+				statistics.diceNumerator += imageTransparency * targetTransparency;
+				statistics.diceDenominator += imageTransparency + targetTransparency;
+
+				// Present in the image and in the target
+				if (imageTransparency > 0.0 && targetTransparency > 0.0)
+				{
+					statistics.truePositives++;
+					statistics.meanAbsoluteErrorSum += 1.0 - std::abs(imageColor.valueF() - targetColor.valueF());
+				}
+				else if (imageTransparency > 0.0)
+				{
+					statistics.falsePositives++;
+				}
+				else if (targetTransparency > 0.0)
+				{
+					statistics.falseNegatives++;
+				}
+			}
+		}
+
+		return statistics;
+	}
+
+	double referenceSimilarity(const ReferenceStatistics& statistics)
+	{
+		// The original formula divided by zero without overlap
+		const auto mae = (statistics.truePositives > 0) ?
+		                 statistics.meanAbsoluteErrorSum / double(statistics.truePositives) : 0.0;
+
+		const auto diceCoefficient = (2.0 * statistics.diceNumerator + 1.0) / (statistics.diceDenominator + 1.0);
+
+		return 0.9 * diceCoefficient + 0.1 * mae;
+	}
+
+	/**
+	 * \brief Image with random colors and a random alpha channel
+	 * \param binaryAlpha If true, the alpha channel is 0 or 255, otherwise any value
+	 * \param seed Seed of the random generator, the images are the same on each run
+	 */
+	QImage createRandomImage(int width, int height, bool binaryAlpha, unsigned int seed)
+	{
+		std::mt19937 generator(seed);
+		std::uniform_int_distribution<int> channel(0, 255);
+		std::bernoulli_distribution transparent(0.3);
+
+		QImage image(width, height, QImage::Format_ARGB32);
+
+		for (int i = 0; i < height; i++)
+		{
+			for (int j = 0; j < width; j++)
+			{
+				int alpha = 0;
+				if (!transparent(generator))
+				{
+					alpha = binaryAlpha ? 255 : std::max(1, channel(generator));
+				}
+
+				const int red = channel(generator);
+				const int green = channel(generator);
+				const int blue = channel(generator);
+
+				image.setPixel(j, i, qRgba(red, green, blue, alpha));
+			}
+		}
+
+		return image;
+	}
+
+	/**
+	 * \brief Opaque rectangle on a transparent image
+	 */
+	QImage createRectangleImage(const QSize& size, const QRect& rectangle)
+	{
+		QImage image(size, QImage::Format_ARGB32);
+		image.fill(Qt::transparent);
+
+		for (int i = rectangle.top(); i <= rectangle.bottom(); i++)
+		{
+			for (int j = rectangle.left(); j <= rectangle.right(); j++)
+			{
+				image.setPixel(j, i, qRgba(200, 100, 50, 255));
+			}
+		}
+
+		return image;
+	}
+
+	/**
+	 * \brief Create an image filled with one color per square tile, in row-major order from the top
+	 */
+	QImage createTileImage(const QSize& size, int tileSize, const std::vector<QRgb>& colors)
+	{
+		const int tilesX = (size.width() + tileSize - 1) / tileSize;
+
+		QImage image(size, QImage::Format_ARGB32);
+
+		for (int i = 0; i < size.height(); i++)
+		{
+			for (int j = 0; j < size.width(); j++)
+			{
+				image.setPixel(j, i, colors[std::size_t((i / tileSize) * tilesX + j / tileSize)]);
+			}
+		}
+
+		return image;
+	}
+
+	// The CPU sums integers, the reference sums doubles
+	constexpr double Tolerance = 1e-5;
+
+	/**
+	 * \brief Check that the statistics accumulated by the CPU give the same sums and similarity as the reference
+	 */
+	void compareToReference(const SimilarityStatistics& statistics, const ReferenceStatistics& reference)
+	{
+		QCOMPARE(statistics.truePositives, reference.truePositives);
+		QCOMPARE(statistics.falsePositives, reference.falsePositives);
+		QCOMPARE(statistics.falseNegatives, reference.falseNegatives);
+		QVERIFY(std::abs(double(statistics.diceNumerator) / (255.0 * 255.0) - reference.diceNumerator) < Tolerance);
+		QVERIFY(std::abs(double(statistics.diceDenominator) / 255.0 - reference.diceDenominator) < Tolerance);
+		QVERIFY(std::abs(double(statistics.meanAbsoluteErrorSum) / 255.0 - reference.meanAbsoluteErrorSum) < Tolerance);
+		QVERIFY(std::abs(similarityFromStatistics(statistics) - referenceSimilarity(reference)) < Tolerance);
+	}
+}
+
+void CpuSimilarityTest::matchesReference_data()
+{
+	QTest::addColumn<int>("width");
+	QTest::addColumn<int>("height");
+	QTest::addColumn<bool>("binaryAlpha");
+
+	// Odd widths leave pixels after the last full vector of a row
+	QTest::newRow("37x23 binary") << 37 << 23 << true;
+	QTest::newRow("37x23 fuzzy") << 37 << 23 << false;
+	QTest::newRow("61x17 binary") << 61 << 17 << true;
+	QTest::newRow("61x17 fuzzy") << 61 << 17 << false;
+	QTest::newRow("3x5 fuzzy") << 3 << 5 << false;
+	QTest::newRow("64x16 fuzzy") << 64 << 16 << false;
+}
+
+void CpuSimilarityTest::matchesReference()
+{
+	QFETCH(int, width);
+	QFETCH(int, height);
+	QFETCH(bool, binaryAlpha);
+
+	const auto image = createRandomImage(width, height, binaryAlpha, 1);
+	const auto target = createRandomImage(width, height, binaryAlpha, 2);
+
+	const auto reference = computeReferenceStatistics(image, target);
+
+	compareToReference(computeSimilarityStatistics(image, target), reference);
+	QVERIFY(std::abs(computeSimilarity(image, target) - referenceSimilarity(reference)) < Tolerance);
+}
+
+void CpuSimilarityTest::emptyOverlap()
+{
+	const QSize size(37, 23);
+	const auto image = createRectangleImage(size, QRect(0, 0, 10, 23));
+	const auto target = createRectangleImage(size, QRect(20, 0, 10, 23));
+
+	const auto statistics = computeSimilarityStatistics(image, target);
+	QCOMPARE(statistics.truePositives, 0LL);
+
+	// Without overlap the mean absolute error term is 0, not NaN
+	const auto similarity = computeSimilarity(image, target);
+	QVERIFY(!std::isnan(similarity));
+	QVERIFY(std::abs(similarity - 0.9 * silhouetteSimilarityFromStatistics(statistics)) < Tolerance);
+	QVERIFY(std::abs(similarity - referenceSimilarity(computeReferenceStatistics(image, target))) < Tolerance);
+}
+
+void CpuSimilarityTest::independentOfThreadCount()
+{
+	const auto image = createRandomImage(61, 67, false, 3);
+	const auto target = createRandomImage(61, 67, false, 4);
+
+	const auto threadCount = omp_get_max_threads();
+
+	omp_set_num_threads(1);
+	const auto sequential = computeSimilarity(image, target);
+
+	// The rows are split differently between the threads
+	for (int threads : { 2, 3, 7 })
+	{
+		omp_set_num_threads(threads);
+
+		// Bit for bit, not up to a tolerance
+		const auto parallel = computeSimilarity(image, target);
+		QVERIFY(parallel == sequential);
+	}
+
+	omp_set_num_threads(threadCount);
+}
+
+void CpuSimilarityTest::silhouetteOverlap_data()
+{
+	matchesReference_data();
+}
+
+void CpuSimilarityTest::silhouetteOverlap()
+{
+	QFETCH(int, width);
+	QFETCH(int, height);
+	QFETCH(bool, binaryAlpha);
+
+	const auto image = createRandomImage(width, height, binaryAlpha, 5);
+	const auto target = createRandomImage(width, height, binaryAlpha, 6);
+
+	const auto imageMask = SilhouetteMask::fromAlpha(image);
+	const auto targetMask = SilhouetteMask::fromAlpha(target);
+
+	// Binary alpha channels allow the Dice terms to be counted on the masks, the others need the alpha values
+	QCOMPARE(imageMask.isBinary(), binaryAlpha);
+	QCOMPARE(targetMask.isBinary(), binaryAlpha);
+
+	const auto reference = computeReferenceStatistics(image, target);
+	const auto overlap = imageMask.overlap(targetMask);
+
+	QCOMPARE(overlap.truePositives, reference.truePositives);
+	QCOMPARE(overlap.falsePositives, reference.falsePositives);
+	QCOMPARE(overlap.falseNegatives, reference.falseNegatives);
+	QCOMPARE(imageMask.area(), reference.truePositives + reference.falsePositives);
+
+	if (binaryAlpha)
+	{
+		// With binary alpha channels the counts alone give the sums of the fuzzy Dice coefficient
+		QVERIFY(std::abs(double(overlap.truePositives) - reference.diceNumerator) < Tolerance);
+		QVERIFY(std::abs(double(2 * overlap.truePositives + overlap.falsePositives + overlap.falseNegatives)
+		                 - reference.diceDenominator) < Tolerance);
+	}
+}
+
+void CpuSimilarityTest::targetDescriptor_data()
+{
+	matchesReference_data();
+}
+
+void CpuSimilarityTest::targetDescriptor()
+{
+	QFETCH(int, width);
+	QFETCH(int, height);
+	QFETCH(bool, binaryAlpha);
+
+	const auto image = createRandomImage(width, height, binaryAlpha, 7);
+	const auto targetImage = createRandomImage(width, height, binaryAlpha, 8);
+
+	const TargetDescriptor target(targetImage);
+	const auto reference = computeReferenceStatistics(image, targetImage);
+
+	QCOMPARE(target.area(), reference.truePositives + reference.falseNegatives);
+
+	// Only the pixels of the silhouette of the image are visited, the rest comes from the descriptor
+	compareToReference(computeSimilarityStatistics(image, SilhouetteMask::fromAlpha(image), target), reference);
+}
+
+void CpuSimilarityTest::targetDescriptorRegion()
+{
+	const auto targetImage = createRandomImage(61, 37, false, 9);
+	const TargetDescriptor target(targetImage);
+
+	// The object only covers a region of the target, with an odd width
+	const QRect region(13, 5, 29, 21);
+	const auto regionImage = createRandomImage(region.width(), region.height(), false, 10);
+
+	QImage image(targetImage.size(), QImage::Format_ARGB32);
+	image.fill(Qt::transparent);
+
+	for (int i = 0; i < region.height(); i++)
+	{
+		for (int j = 0; j < region.width(); j++)
+		{
+			image.setPixel(region.x() + j, region.y() + i, regionImage.pixel(j, i));
+		}
+	}
+
+	const auto statistics = computeSimilarityStatistics(regionImage, SilhouetteMask::fromAlpha(regionImage),
+	                                                    target, region.topLeft());
+
+	compareToReference(statistics, computeReferenceStatistics(image, targetImage));
+}
+
+void CpuSimilarityTest::tileResiduals()
+{
+	// 3 x 2 tiles of 4 pixels, the last column and the last row are partial
+	const QSize size(10, 6);
+	const int tileSize = 4;
+
+	// The value is the largest channel
+	const auto image = createTileImage(size, tileSize, { qRgba(200, 10, 0, 255), qRgba(0, 0, 0, 0), qRgba(0, 90, 20, 128),
+	                                                     qRgba(10, 0, 0, 255), qRgba(60, 0, 120, 100), qRgba(255, 0, 0, 30) });
+	const auto targetImage = createTileImage(size, tileSize, { qRgba(100, 100, 0, 255), qRgba(50, 0, 0, 255), qRgba(30, 0, 0, 64),
+	                                                           qRgba(0, 240, 0, 0), qRgba(0, 0, 180, 200), qRgba(0, 255, 0, 30) });
+
+	const TargetDescriptor target(targetImage);
+
+	// Sums of the differences over the pixels of each tile: 16, 16, 8, 8, 8 and 4 pixels.
+	// The value only counts where both are present, not on the second and fourth tiles
+	const std::vector<int> alphaSums = { 0, 16 * -255, 8 * 64, 8 * 255, 8 * -100, 0 };
+	const std::vector<int> valueSums = { 16 * 100, 0, 8 * 60, 0, 8 * -60, 0 };
+
+	// Partial tiles are still divided by the area of a full tile
+	const float area = 255.0f * float(tileSize * tileSize);
+
+	const auto residuals = computeTileResiduals(image, target, tileSize, false);
+	QCOMPARE(residuals.size(), alphaSums.size() + valueSums.size());
+
+	for (std::size_t i = 0; i < alphaSums.size(); i++)
+	{
+		QVERIFY(std::abs(residuals[i] - float(alphaSums[i]) / area) < Tolerance);
+		QVERIFY(std::abs(residuals[alphaSums.size() + i] - IntensityResidualWeight * float(valueSums[i]) / area) < Tolerance);
+	}
+
+	// Only the silhouette residuals, in the same order
+	const auto silhouetteResiduals = computeTileResiduals(image, target, tileSize, true);
+	QCOMPARE(silhouetteResiduals.size(), alphaSums.size());
+
+	for (std::size_t i = 0; i < alphaSums.size(); i++)
+	{
+		QCOMPARE(silhouetteResiduals[i], residuals[i]);
+	}
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <QObject>
+
+/**
+ * \brief Compare the similarity computed on the CPU to a scalar reference of the original formula
+ */
+class CpuSimilarityTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void matchesReference_data();
+	void matchesReference();
+	void emptyOverlap();
+	void independentOfThreadCount();
+	void silhouetteOverlap_data();
+	void silhouetteOverlap();
+	void targetDescriptor_data();
+	void targetDescriptor();
+	void targetDescriptorRegion();
+	void tileResiduals();
+};
@@ -0,0 +1,102 @@
+#include "DifferentiableRendererTest.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <QtTest>
+
+#include "DifferentiableRenderer.h"
+#include "Mesh.h"
+#include "SoftwareRenderer.h"
+
+namespace
+{
+	/**
+	 * \brief Move a pose along one of the 6 normalized parameters of BundleAdjustment
+	 */
+	ObjectPose offsetPose(const ObjectPose& pose, int parameter, float step)
+	{
+		auto translation = pose.normalizedTranslation();
+		auto rotation = pose.normalizedRotation();
+
+		if (parameter < 3)
+		{
+			translation[parameter] += step;
+		}
+		else
+		{
+			rotation[parameter - 3] += step;
+		}
+
+		ObjectPose result;
+		result.setNormalizedTranslation(translation);
+		result.setNormalizedRotation(rotation);
+
+		return result;
+	}
+
+	// Step on the normalized parameters, about 0.02 mm and 0.005 degrees (0.02 for the roll)
+	constexpr float Step = 1e-4f;
+
+	// Relative to the largest component of the gradient. The distance to a triangle has kinks where the closest
+	// edge of a pixel changes, so the central differences only converge linearly with the step.
+	constexpr double Tolerance = 0.01;
+}
+
+void DifferentiableRendererTest::gradientMatchesCentralDifferences_data()
+{
+	QTest::addColumn<QVector3D>("translation");
+	QTest::addColumn<QVector3D>("rotation");
+
+	QTest::newRow("translated") << QVector3D(0.02f, -0.015f, 0.03f) << QVector3D(0.0f, 0.0f, 0.0f);
+	QTest::newRow("rotated") << QVector3D(0.0f, 0.0f, 0.0f) << QVector3D(10.0f, -15.0f, 20.0f);
+	QTest::newRow("both") << QVector3D(-0.01f, 0.02f, -0.05f) << QVector3D(-5.0f, 8.0f, -12.0f);
+}
+
+void DifferentiableRendererTest::gradientMatchesCentralDifferences()
+{
+	QFETCH(QVector3D, translation);
+	QFETCH(QVector3D, rotation);
+
+	const auto object = Mesh::createCheckerBoardPattern();
+
+	// The target is the silhouette of the object facing the camera, on a small frame buffer
+	SoftwareRenderer softwareRenderer(object, QMatrix4x4());
+	softwareRenderer.setWorkingResolution(QSize(160, 120));
+	const auto targetImage = softwareRenderer.renderToImage(ObjectPose());
+
+	DifferentiableRenderer renderer(object, QMatrix4x4());
+	renderer.setTargetImage(targetImage);
+	renderer.setSoftness(1.5f);
+
+	ObjectPose pose;
+	pose.translation = translation;
+	pose.rotation = rotation;
+
+	double gradient[6];
+	const double value = renderer.evaluate(pose, gradient);
+
+	// The poses overlap the target without matching it
+	QVERIFY(value > 0.1 && value < 0.99);
+
+	double differences[6];
+	double scale = 0.0;
+
+	for (int i = 0; i < 6; i++)
+	{
+		double unused[6];
+		const double forward = renderer.evaluate(offsetPose(pose, i, Step), unused);
+		const double backward = renderer.evaluate(offsetPose(pose, i, -Step), unused);
+
+		differences[i] = (forward - backward) / (2.0 * double(Step));
+		scale = std::max(scale, std::abs(differences[i]));
+	}
+
+	QVERIFY(scale > 0.0);
+
+	for (int i = 0; i < 6; i++)
+	{
+		const auto message = QString("Parameter %1: analytic %2, central differences %3").arg(i).arg(gradient[i]).arg(differences[i]);
+		QVERIFY2(std::abs(gradient[i] - differences[i]) < Tolerance * scale, qPrintable(message));
+	}
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <QObject>
+
+/**
+ * \brief Gradient of the soft silhouettes with respect to the pose
+ */
+class DifferentiableRendererTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void gradientMatchesCentralDifferences_data();
+	void gradientMatchesCentralDifferences();
+};
@@ -0,0 +1,88 @@
+#include "EvaluationContextPoolTest.h"
+
+#include <vector>
+
+#include <QtTest>
+
+#include "Mesh.h"
+
+namespace
+{
+	/**
+	 * \brief Poses around the target, more than the workers so that each one gets a part of the batch
+	 */
+	std::vector<ObjectPose> createPoses()
+	{
+		std::vector<ObjectPose> poses;
+
+		for (int i = 0; i < 7; i++)
+		{
+			ObjectPose pose;
+			pose.translation = QVector3D(0.01f * (i - 3), -0.005f * i, 0.02f * (i % 3));
+			pose.rotation = QVector3D(2.0f * i, -3.0f * (i % 2), 5.0f * (i - 3));
+			poses.push_back(pose);
+		}
+
+		return poses;
+	}
+
+	// Each context sums the same integers, the results only differ by the conversion to float
+	constexpr float Tolerance = 1e-6f;
+}
+
+void EvaluationContextPoolTest::initTestCase()
+{
+	// Few workers, the batches are still split in parts of different sizes
+	m_pool = std::make_unique<EvaluationContextPool>(Mesh::createCheckerBoardPattern(), QMatrix4x4(), 3);
+
+	if (!m_pool->isValid())
+	{
+		QSKIP("Cannot create offscreen OpenGL 4.3 contexts");
+	}
+
+	// The target is a render of the object facing the camera
+	QImage emptyTarget(320, 240, QImage::Format_ARGB32);
+	emptyTarget.fill(Qt::transparent);
+
+	m_pool->setTargetImage(emptyTarget);
+	m_pool->setTargetImage(m_pool->renderToImage(ObjectPose()));
+}
+
+void EvaluationContextPoolTest::cleanupTestCase()
+{
+	// The workers free their objects on their threads
+	m_pool.reset();
+}
+
+void EvaluationContextPoolTest::similarityBatchMatchesSingleContext()
+{
+	const auto poses = createPoses();
+	const auto similarities = m_pool->renderAndComputeSimilarityBatch(poses);
+	QCOMPARE(similarities.size(), poses.size());
+
+	for (std::size_t i = 0; i < poses.size(); i++)
+	{
+		const float expected = m_pool->worker(0)->renderAndComputeSimilarity(poses[i]);
+
+		QVERIFY(expected > 0.0f);
+		QVERIFY(qAbs(similarities[i] - expected) < Tolerance);
+	}
+}
+
+void EvaluationContextPoolTest::imageBatchMatchesSingleContext()
+{
+	const auto poses = createPoses();
+	const auto images = m_pool->renderToImageBatch(poses);
+	QCOMPARE(images.size(), poses.size());
+
+	for (std::size_t i = 0; i < poses.size(); i++)
+	{
+		QCOMPARE(images[i], m_pool->worker(0)->renderToImage(poses[i]));
+	}
+}
+
+void EvaluationContextPoolTest::emptyBatch()
+{
+	QVERIFY(m_pool->renderAndComputeSimilarityBatch({}).empty());
+	QVERIFY(m_pool->renderToImageBatch({}).empty());
+}
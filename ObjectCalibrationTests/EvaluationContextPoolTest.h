@@ -0,0 +1,30 @@
+#pragma once
+
+#include <memory>
+
+#include <QImage>
+#include <QObject>
+
+#include "EvaluationContextPool.h"
+
+/**
+ * \brief Compare the batches split between the contexts of the pool to evaluations on a single context
+ *
+ * Skipped when no OpenGL 4.3 context can be created.
+ */
+class EvaluationContextPoolTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+	void cleanupTestCase();
+
+	void similarityBatchMatchesSingleContext();
+	void imageBatchMatchesSingleContext();
+	void emptyBatch();
+
+private:
+
+	std::unique_ptr<EvaluationContextPool> m_pool;
+};
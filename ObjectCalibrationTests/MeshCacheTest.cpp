@@ -0,0 +1,202 @@
+#include "MeshCacheTest.h"
+
+#include <cstring>
+#include <vector>
+
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include "Mesh.h"
+#include "MeshCache.h"
+
+namespace
+{
+	constexpr quint64 SourceHash = 0x0123456789abcdefull;
+
+	/**
+	 * \brief Square grid sharing its vertices, large enough to have several levels of detail
+	 * \param resolution Number of quads on each side
+	 */
+	Mesh createGrid(int resolution)
+	{
+		std::vector<QVector3D> vertices;
+		std::vector<QVector3D> uvs;
+		std::vector<unsigned int> indices;
+
+		for (int j = 0; j <= resolution; j++)
+		{
+			for (int i = 0; i <= resolution; i++)
+			{
+				const float u = float(i) / resolution;
+				const float v = float(j) / resolution;
+
+				vertices.push_back(QVector3D(0.2f * u - 0.1f, 0.2f * v - 0.1f, 0.01f * u * v));
+				uvs.push_back(QVector3D(u, v, 0.0f));
+			}
+		}
+
+		const auto vertex = [resolution](int i, int j)
+		{
+			return static_cast<unsigned int>(j * (resolution + 1) + i);
+		};
+
+		for (int j = 0; j < resolution; j++)
+		{
+			for (int i = 0; i < resolution; i++)
+			{
+				indices.insert(indices.end(), { vertex(i, j), vertex(i + 1, j), vertex(i + 1, j + 1) });
+				indices.insert(indices.end(), { vertex(i, j), vertex(i + 1, j + 1), vertex(i, j + 1) });
+			}
+		}
+
+		return Mesh(vertices, uvs, indices, QImage());
+	}
+
+	QByteArray readFile(const QString& filename)
+	{
+		QFile file(filename);
+
+		return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+	}
+
+	bool writeFile(const QString& filename, const QByteArray& content)
+	{
+		QFile file(filename);
+
+		return file.open(QIODevice::WriteOnly) && file.write(content) == content.size();
+	}
+
+	template<typename T>
+	QByteArray toBytes(const T* data, std::size_t count)
+	{
+		return QByteArray(reinterpret_cast<const char*>(data), int(sizeof(T) * count));
+	}
+
+	/**
+	 * \brief Overwrite bytes found in a file, the layout of the cache file is private to MeshCache
+	 * \param filename Path of the file
+	 * \param before Bytes to find, the last occurrence is replaced
+	 * \param after Bytes written instead, with the same size
+	 * \return False if the bytes are not found
+	 */
+	bool replaceInFile(const QString& filename, const QByteArray& before, const QByteArray& after)
+	{
+		auto content = readFile(filename);
+		const auto position = content.lastIndexOf(before);
+
+		if (position < 0 || before.size() != after.size())
+		{
+			return false;
+		}
+
+		content.replace(position, after.size(), after);
+
+		return writeFile(filename, content);
+	}
+}
+
+void MeshCacheTest::roundTrip()
+{
+	QTemporaryDir directory;
+	QVERIFY(directory.isValid());
+
+	const auto mesh = createGrid(40);
+	QVERIFY(mesh.levelsOfDetail().size() > 1);
+
+	const auto filename = directory.filePath("grid.mesh");
+	QVERIFY(MeshCache::write(filename, SourceHash, QString(), mesh));
+
+	MeshCache cache;
+	QVERIFY(cache.open(filename, SourceHash));
+
+	QCOMPARE(cache.vertexFormat(), mesh.vertexFormat());
+	QCOMPARE(cache.vertexCount(), mesh.vertices().size());
+	QVERIFY(std::memcmp(cache.vertexData(), mesh.vertexData(), cache.vertexCount() * vertexLayout(mesh.vertexFormat()).stride) == 0);
+
+	QCOMPARE(cache.indexCount(), mesh.levelOfDetailIndexCount());
+	QVERIFY(std::memcmp(cache.indices(), mesh.levelOfDetailIndexData(), cache.indexCount() * sizeof(unsigned int)) == 0);
+
+	const auto levels = cache.levelsOfDetail();
+	QCOMPARE(levels.size(), mesh.levelsOfDetail().size());
+
+	for (std::size_t i = 0; i < levels.size(); i++)
+	{
+		QCOMPARE(levels[i].firstIndex, mesh.levelsOfDetail()[i].firstIndex);
+		QCOMPARE(levels[i].indexCount, mesh.levelsOfDetail()[i].indexCount);
+		QCOMPARE(levels[i].error, mesh.levelsOfDetail()[i].error);
+	}
+
+	QVERIFY(cache.textureLevels().empty());
+}
+
+void MeshCacheTest::rejectsOtherSource()
+{
+	QTemporaryDir directory;
+	QVERIFY(directory.isValid());
+
+	const auto filename = directory.filePath("grid.mesh");
+	QVERIFY(MeshCache::write(filename, SourceHash, QString(), createGrid(8)));
+
+	MeshCache cache;
+	QVERIFY(!cache.open(filename, SourceHash + 1));
+	QVERIFY(!cache.isOpen());
+}
+
+void MeshCacheTest::rejectsTruncatedFile()
+{
+	QTemporaryDir directory;
+	QVERIFY(directory.isValid());
+
+	const auto filename = directory.filePath("grid.mesh");
+	QVERIFY(MeshCache::write(filename, SourceHash, QString(), createGrid(8)));
+
+	const auto content = readFile(filename);
+	QVERIFY(writeFile(filename, content.left(content.size() - 4)));
+
+	MeshCache cache;
+	QVERIFY(!cache.open(filename, SourceHash));
+}
+
+void MeshCacheTest::rejectsLevelOutsideIndices()
+{
+	QTemporaryDir directory;
+	QVERIFY(directory.isValid());
+
+	const auto mesh = createGrid(40);
+	const auto filename = directory.filePath("grid.mesh");
+	QVERIFY(MeshCache::write(filename, SourceHash, QString(), mesh));
+
+	// The last level of detail ends at the end of the index buffer, make it one triangle longer
+	const auto& level = mesh.levelsOfDetail().back();
+	QCOMPARE(level.firstIndex + level.indexCount, mesh.levelOfDetailIndexCount());
+
+	const quint64 storedRange[2] = { level.firstIndex, level.indexCount };
+	const quint64 corruptedRange[2] = { level.firstIndex, level.indexCount + 3 };
+	QVERIFY(replaceInFile(filename, toBytes(storedRange, 2), toBytes(corruptedRange, 2)));
+
+	MeshCache cache;
+	QVERIFY(!cache.open(filename, SourceHash));
+}
+
+void MeshCacheTest::rejectsIndexOutsideVertices()
+{
+	QTemporaryDir directory;
+	QVERIFY(directory.isValid());
+
+	const auto mesh = createGrid(40);
+	const auto filename = directory.filePath("grid.mesh");
+	QVERIFY(MeshCache::write(filename, SourceHash, QString(), mesh));
+
+	// The first triangle of the coarsest level refers to a vertex past the end of the vertex buffer
+	const auto& level = mesh.levelsOfDetail().back();
+	std::vector<unsigned int> triangle(mesh.levelOfDetailIndexData() + level.firstIndex,
+	                                   mesh.levelOfDetailIndexData() + level.firstIndex + 3);
+	const auto storedTriangle = toBytes(triangle.data(), triangle.size());
+
+	triangle[0] = static_cast<unsigned int>(mesh.vertices().size());
+	QVERIFY(replaceInFile(filename, storedTriangle, toBytes(triangle.data(), triangle.size())));
+
+	MeshCache cache;
+	QVERIFY(!cache.open(filename, SourceHash));
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <QObject>
+
+/**
+ * \brief Writing and mapping the binary cache of the loaded meshes
+ */
+class MeshCacheTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void roundTrip();
+	void rejectsOtherSource();
+	void rejectsTruncatedFile();
+	void rejectsLevelOutsideIndices();
+	void rejectsIndexOutsideVertices();
+};
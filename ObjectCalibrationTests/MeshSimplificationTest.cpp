@@ -0,0 +1,107 @@
+#include "MeshSimplificationTest.h"
+
+#include <cmath>
+#include <vector>
+
+#include <QtTest>
+
+#include "Mesh.h"
+#include "MeshSimplification.h"
+#include "Renderer.h"
+
+namespace
+{
+	/**
+	 * \brief Wavy square in front of the evaluation camera, each triangle with its own three vertices
+	 *
+	 * Like the meshes of OBJ loaders that do not share the vertices of the faces.
+	 * \param resolution Number of quads on each side
+	 */
+	Mesh createSeparateFacesMesh(int resolution)
+	{
+		std::vector<QVector3D> vertices;
+		std::vector<QVector3D> uvs;
+		std::vector<unsigned int> indices;
+
+		const auto corner = [resolution](int i, int j)
+		{
+			const float u = float(i) / resolution;
+			const float v = float(j) / resolution;
+			const float height = 0.01f * std::sin(6.0f * u) * std::cos(6.0f * v);
+
+			return QVector3D(0.2f * u - 0.1f, 0.2f * v - 0.1f, height);
+		};
+
+		const auto addVertex = [&](int i, int j)
+		{
+			indices.push_back(static_cast<unsigned int>(vertices.size()));
+			vertices.push_back(corner(i, j));
+			uvs.push_back(QVector3D(float(i) / resolution, float(j) / resolution, 0.0f));
+		};
+
+		for (int j = 0; j < resolution; j++)
+		{
+			for (int i = 0; i < resolution; i++)
+			{
+				addVertex(i, j);
+				addVertex(i + 1, j);
+				addVertex(i + 1, j + 1);
+
+				addVertex(i, j);
+				addVertex(i + 1, j + 1);
+				addVertex(i, j + 1);
+			}
+		}
+
+		return Mesh(vertices, uvs, indices, QImage());
+	}
+}
+
+void MeshSimplificationTest::weldKeepsUvSeams()
+{
+	// Two triangles sharing an edge, the second one with other texture coordinates on one of its ends
+	const std::vector<QVector3D> vertices = {
+		{ 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f },
+		{ 1.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }
+	};
+
+	const std::vector<QVector3D> uvs = {
+		{ 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f },
+		{ 1.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 0.0f }, { 0.5f, 1.0f, 0.0f }
+	};
+
+	const std::vector<unsigned int> indices = { 0, 1, 2, 3, 4, 5 };
+
+	const std::vector<unsigned int> expected = { 0, 1, 2, 1, 4, 5 };
+	QCOMPARE(weldVertices(vertices, uvs, indices), expected);
+}
+
+void MeshSimplificationTest::levelsOfDetailWithSeparateFaceVertices()
+{
+	const auto mesh = createSeparateFacesMesh(64);
+	const auto& levels = mesh.levelsOfDetail();
+
+	QVERIFY(levels.size() > 1);
+
+	for (std::size_t i = 1; i < levels.size(); i++)
+	{
+		QVERIFY(levels[i].indexCount < levels[i - 1].indexCount);
+		QVERIFY(levels[i].error >= levels[i - 1].error);
+	}
+}
+
+void MeshSimplificationTest::coarserToleranceSelectsFewerIndices()
+{
+	const auto mesh = createSeparateFacesMesh(64);
+	const auto& levels = mesh.levelsOfDetail();
+
+	const QRect viewport(0, 0, 640, 480);
+	const auto camera = evaluationCamera(float(viewport.width()) / float(viewport.height()));
+	const auto pvmMatrix = camera.projectionMatrix() * camera.viewMatrix();
+
+	const int fineLevel = mesh.selectLevelOfDetail(pvmMatrix, viewport, 0.0f);
+	const int coarseLevel = mesh.selectLevelOfDetail(pvmMatrix, viewport, 100.0f);
+
+	QCOMPARE(fineLevel, 0);
+	QVERIFY(levels[coarseLevel].indexCount < levels[fineLevel].indexCount);
+}
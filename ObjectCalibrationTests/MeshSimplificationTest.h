@@ -0,0 +1,16 @@
+#pragma once
+
+#include <QObject>
+
+/**
+ * \brief Levels of detail of meshes loaded with one vertex per face corner
+ */
+class MeshSimplificationTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void weldKeepsUvSeams();
+	void levelsOfDetailWithSeparateFaceVertices();
+	void coarserToleranceSelectsFewerIndices();
+};
@@ -0,0 +1,213 @@
+#include "ObjReaderTest.h"
+
+#include <string>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include "ObjReader.h"
+
+namespace
+{
+	bool writeFile(const QString& filename, const std::string& content)
+	{
+		QFile file(filename);
+
+		return file.open(QIODevice::WriteOnly) && file.write(content.data(), qint64(content.size())) == qint64(content.size());
+	}
+
+	/**
+	 * \brief Grid of quads, each face refers to its corners with negative indices
+	 * \param resolution Number of quads on each side
+	 */
+	std::string createGrid(int resolution)
+	{
+		std::string content = "o grid\n";
+
+		for (int j = 0; j < resolution; j++)
+		{
+			for (int i = 0; i < resolution; i++)
+			{
+				// The four corners of each quad are written just before it
+				for (const auto& corner : { std::make_pair(i, j), std::make_pair(i + 1, j), std::make_pair(i + 1, j + 1), std::make_pair(i, j + 1) })
+				{
+					content += "v " + std::to_string(corner.first) + " " + std::to_string(corner.second) + " 0\n";
+					content += "vt " + std::to_string(double(corner.first) / resolution) + " " + std::to_string(double(corner.second) / resolution) + "\n";
+				}
+
+				content += "f -4/-4 -3/-3 -2/-2 -1/-1\n";
+			}
+		}
+
+		return content;
+	}
+}
+
+void ObjReaderTest::polygonsAndNegativeIndices()
+{
+	QTemporaryDir directory;
+	QVERIFY(directory.isValid());
+
+	const auto filename = directory.filePath("quad.obj");
+	QVERIFY(writeFile(filename,
+	                  "# Quad\n"
+	                  "v 0 0 0\n"
+	                  "v 1 0 0\n"
+	                  "v 1 1 0\n"
+	                  "v 0 1 0\n"
+	                  "vt 0 0\n"
+	                  "vt 1 0\n"
+	                  "vt 1 1\n"
+	                  "vt 0 1\n"
+	                  "vn 0 0 1\n"
+	                  "f -4/-4/1 -3/-3/1 -2/-2/1 -1/-1/1\n"));
+
+	ObjData data;
+	QVERIFY(readObj(filename.toStdString(), data));
+
+	// Triangulated as a fan, the normals are ignored
+	const std::vector<unsigned int> expected = { 0, 1, 2, 0, 2, 3 };
+	QCOMPARE(data.indices, expected);
+	QCOMPARE(data.vertices.size(), std::size_t(4));
+	QCOMPARE(data.vertices[2], QVector3D(1.0f, 1.0f, 0.0f));
+	QCOMPARE(data.uvs[3], QVector3D(0.0f, 1.0f, 0.0f));
+}
+
+void ObjReaderTest::weldsCornersWithSameUv()
+{
+	QTemporaryDir directory;
+	QVERIFY(directory.isValid());
+
+	// The second triangle shares an edge with the first one, with other texture coordinates on one of its ends
+	const auto filename = directory.filePath("seam.obj");
+	QVERIFY(writeFile(filename,
+	                  "v 0 0 0\n"
+	                  "v 1 0 0\n"
+	                  "v 0 1 0\n"
+	                  "v 1 1 0\n"
+	                  "vt 0 0\n"
+	                  "vt 1 0\n"
+	                  "vt 0 1\n"
+	                  "vt 1 1\n"
+	                  "vt 0.5 1\n"
+	                  "f 1/1 2/2 3/3\n"
+	                  "f 2/2 4/4 3/5\n"));
+
+	ObjData data;
+	QVERIFY(readObj(filename.toStdString(), data));
+
+	const std::vector<unsigned int> expected = { 0, 1, 2, 1, 3, 4 };
+	QCOMPARE(data.indices, expected);
+	QCOMPARE(data.vertices.size(), std::size_t(5));
+}
+
+void ObjReaderTest::groupsAndMaterials()
+{
+	QTemporaryDir directory;
+	QVERIFY(directory.isValid());
+
+	QVERIFY(writeFile(directory.filePath("materials.mtl"),
+	                  "newmtl red\n"
+	                  "map_Kd red.png\n"
+	                  "newmtl blue\n"
+	                  "map_Ka blue.png\n"));
+
+	const auto filename = directory.filePath("groups.obj");
+	QVERIFY(writeFile(filename,
+	                  "mtllib materials.mtl\n"
+	                  "v 0 0 0\n"
+	                  "v 1 0 0\n"
+	                  "v 0 1 0\n"
+	                  "o first\n"
+	                  "usemtl red\n"
+	                  "f 1 2 3\n"
+	                  "f 1 3 2\n"
+	                  "usemtl blue\n"
+	                  "f 2 3 1\n"
+	                  "o second\n"
+	                  "usemtl unknown\n"
+	                  "f 3 2 1\n"));
+
+	ObjData data;
+	QVERIFY(readObj(filename.toStdString(), data));
+
+	QCOMPARE(data.materials.size(), std::size_t(2));
+	QCOMPARE(data.materials[0].name, std::string("red"));
+	QCOMPARE(data.materials[0].diffuseTexture, QFileInfo(directory.filePath("red.png")).absoluteFilePath().toStdString());
+	QCOMPARE(data.materials[1].ambientTexture, QFileInfo(directory.filePath("blue.png")).absoluteFilePath().toStdString());
+
+	QCOMPARE(data.groups.size(), std::size_t(3));
+
+	QCOMPARE(data.groups[0].name, std::string("first"));
+	QCOMPARE(data.groups[0].material, 0);
+	QCOMPARE(data.groups[0].firstIndex, std::size_t(0));
+	QCOMPARE(data.groups[0].indexCount, std::size_t(6));
+
+	QCOMPARE(data.groups[1].name, std::string("first"));
+	QCOMPARE(data.groups[1].material, 1);
+	QCOMPARE(data.groups[1].firstIndex, std::size_t(6));
+	QCOMPARE(data.groups[1].indexCount, std::size_t(3));
+
+	QCOMPARE(data.groups[2].name, std::string("second"));
+	QCOMPARE(data.groups[2].material, -1);
+	QCOMPARE(data.groups[2].firstIndex, std::size_t(9));
+	QCOMPARE(data.groups[2].indexCount, std::size_t(3));
+}
+
+void ObjReaderTest::severalChunks()
+{
+	QTemporaryDir directory;
+	QVERIFY(directory.isValid());
+
+	// Several megabytes, parsed in chunks which split the relative indices from their elements
+	const int resolution = 200;
+	const auto filename = directory.filePath("grid.obj");
+	QVERIFY(writeFile(filename, createGrid(resolution)));
+
+	ObjData data;
+	QVERIFY(readObj(filename.toStdString(), data));
+
+	// Corners are welded on their indices, the neighbouring quads have their own copies of the elements
+	QCOMPARE(data.vertices.size(), std::size_t(4 * resolution * resolution));
+	QCOMPARE(data.indices.size(), std::size_t(6 * resolution * resolution));
+
+	for (int j = 0; j < resolution; j++)
+	{
+		for (int i = 0; i < resolution; i++)
+		{
+			const auto first = 6 * std::size_t(j * resolution + i);
+
+			QCOMPARE(data.vertices[data.indices[first]], QVector3D(float(i), float(j), 0.0f));
+			QCOMPARE(data.vertices[data.indices[first + 1]], QVector3D(float(i + 1), float(j), 0.0f));
+			QCOMPARE(data.vertices[data.indices[first + 2]], QVector3D(float(i + 1), float(j + 1), 0.0f));
+			QCOMPARE(data.vertices[data.indices[first + 5]], QVector3D(float(i), float(j + 1), 0.0f));
+		}
+	}
+}
+
+void ObjReaderTest::readLargeFile()
+{
+	// Writing and reading the file takes seconds, only run it when benchmarking
+	if (!qEnvironmentVariableIsSet("OBJECTCALIBRATION_BENCHMARK"))
+	{
+		QSKIP("Set OBJECTCALIBRATION_BENCHMARK to benchmark the reader on a large file");
+	}
+
+	QTemporaryDir directory;
+	QVERIFY(directory.isValid());
+
+	// About 60 MB, run with -tickcounter or -callgrind for stable timings
+	const auto filename = directory.filePath("large.obj");
+	QVERIFY(writeFile(filename, createGrid(700)));
+
+	ObjData data;
+
+	QBENCHMARK
+	{
+		QVERIFY(readObj(filename.toStdString(), data));
+	}
+
+	QCOMPARE(data.indices.size(), std::size_t(6 * 700 * 700));
+}
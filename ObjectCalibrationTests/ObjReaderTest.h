@@ -0,0 +1,18 @@
+#pragma once
+
+#include <QObject>
+
+/**
+ * \brief Parsing of OBJ and MTL files, in one or several chunks
+ */
+class ObjReaderTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void polygonsAndNegativeIndices();
+	void weldsCornersWithSameUv();
+	void groupsAndMaterials();
+	void severalChunks();
+	void readLargeFile();
+};
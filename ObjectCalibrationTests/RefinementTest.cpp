@@ -0,0 +1,243 @@
+#include "RefinementTest.h"
+
+#include <cmath>
+
+#include <QThread>
+#include <QtTest>
+
+#include <dlib/matrix.h>
+
+#include "BundleAdjustment.h"
+#include "RefinementMonitor.h"
+#include "Renderer.h"
+#include "Similarity.h"
+
+namespace
+{
+	/**
+	 * \brief Renderer whose similarity is a function of the parameters of the pose, without rendering anything
+	 *
+	 * The similarity has its global optimum at the true pose. A decoy, a narrower and lower optimum,
+	 * can be added at another pose to trap local searches.
+	 * The rendered images are a smooth function of the parameters as well, for the refinements that compare
+	 * images to the target: the one rendered at the true pose.
+	 */
+	class SyntheticRenderer : public Renderer
+	{
+	public:
+
+		SyntheticRenderer(const ObjectPose& truePose, unsigned long delay = 0) :
+			m_truePose(BundleAdjustment::objectPoseToParameters(truePose)),
+			m_hasDecoy(false),
+			m_delay(delay),
+			m_silhouetteOnly(false),
+			m_levelOfDetailTolerance(0.0f),
+			m_evaluations(0)
+		{
+
+		}
+
+		void setDecoy(const ObjectPose& pose)
+		{
+			m_decoy = BundleAdjustment::objectPoseToParameters(pose);
+			m_hasDecoy = true;
+		}
+
+		long evaluations() const { return m_evaluations; }
+
+		void setTargetImage(const QImage&) override {}
+
+		void setWorkingResolution(const QSize& size) override { m_workingResolution = size; }
+		QSize workingResolution() const override { return m_workingResolution; }
+
+		void setSilhouetteOnly(bool silhouetteOnly) override { m_silhouetteOnly = silhouetteOnly; }
+		bool silhouetteOnly() const override { return m_silhouetteOnly; }
+
+		void setLevelOfDetailTolerance(float pixels) override { m_levelOfDetailTolerance = pixels; }
+		float levelOfDetailTolerance() const override { return m_levelOfDetailTolerance; }
+
+		QImage renderToImage(const ObjectPose& pose) override
+		{
+			m_evaluations++;
+
+			const auto parameters = BundleAdjustment::objectPoseToParameters(pose);
+
+			QImage image(m_workingResolution, QImage::Format_ARGB32);
+
+			for (int i = 0; i < image.height(); i++)
+			{
+				const double v = 2.0 * (i + 0.5) / image.height() - 1.0;
+
+				for (int j = 0; j < image.width(); j++)
+				{
+					const double u = 2.0 * (j + 0.5) / image.width() - 1.0;
+
+					// One independent function of the position per parameter, the alpha never reaches 0
+					const double basis[] = { 1.0, u, v, u * v, u * u - 1.0 / 3.0, v * v - 1.0 / 3.0 };
+
+					double sum = 0.0;
+					for (long k = 0; k < parameters.size(); k++)
+					{
+						sum += parameters(k) * basis[k];
+					}
+
+					const int alpha = int(std::lround(127.5 + 120.0 * std::tanh(1.5 * sum)));
+					image.setPixel(j, i, qRgba(200, 200, 200, alpha));
+				}
+			}
+
+			return image;
+		}
+
+		float renderAndComputeSimilarity(const ObjectPose& pose) override
+		{
+			m_evaluations++;
+
+			// Stands for the time of a rendering
+			if (m_delay > 0)
+			{
+				QThread::msleep(m_delay);
+			}
+
+			const auto parameters = BundleAdjustment::objectPoseToParameters(pose);
+			double similarity = std::exp(-length_squared(parameters - m_truePose) / 0.02);
+
+			if (m_hasDecoy)
+			{
+				similarity += 0.5 * std::exp(-length_squared(parameters - m_decoy) / 0.002);
+			}
+
+			return float(similarity);
+		}
+
+	private:
+
+		BundleAdjustment::ColumnVector m_truePose;
+		BundleAdjustment::ColumnVector m_decoy;
+		bool m_hasDecoy;
+		unsigned long m_delay;
+
+		QSize m_workingResolution;
+		bool m_silhouetteOnly;
+		float m_levelOfDetailTolerance;
+
+		long m_evaluations;
+	};
+
+	ObjectPose truePose()
+	{
+		ObjectPose pose;
+		pose.translation = QVector3D(0.02f, -0.01f, 0.03f);
+		pose.rotation = QVector3D(12.0f, -10.0f, 20.0f);
+		return pose;
+	}
+
+	QImage createTargetImage()
+	{
+		QImage targetImage(64, 48, QImage::Format_ARGB32);
+		targetImage.fill(Qt::transparent);
+		return targetImage;
+	}
+
+	/**
+	 * \brief Default pyramid with finite differences and BFGS at every level, the only ones the synthetic renderer supports
+	 */
+	std::vector<PyramidLevel> scalarPyramidLevels()
+	{
+		auto levels = defaultPyramidLevels();
+
+		for (auto& level : levels)
+		{
+			level.analyticGradient = false;
+			level.residualTileSize = 0;
+		}
+
+		return levels;
+	}
+}
+
+void RefinementTest::cmaEsEscapesLocalOptimum()
+{
+	// The search starts on the decoy, where the gradient is zero
+	const ObjectPose initialPose;
+	SyntheticRenderer renderer(truePose());
+	renderer.setDecoy(initialPose);
+
+	const auto trueParameters = BundleAdjustment::objectPoseToParameters(truePose());
+
+	// BFGS stays there
+	const auto localPose = runBundleAdjustment(&renderer, createTargetImage(), initialPose);
+	const BundleAdjustment::ColumnVector localError = BundleAdjustment::objectPoseToParameters(localPose) - trueParameters;
+	QVERIFY(length(localError) > 0.1);
+
+	const auto pose = runBundleAdjustmentCmaEs(&renderer, createTargetImage(), initialPose);
+	const BundleAdjustment::ColumnVector error = BundleAdjustment::objectPoseToParameters(pose) - trueParameters;
+	QVERIFY(length(error) < 1e-2);
+}
+
+void RefinementTest::levenbergMarquardtConverges()
+{
+	SyntheticRenderer renderer(truePose());
+	renderer.setWorkingResolution(createTargetImage().size());
+
+	const auto targetImage = renderer.renderToImage(truePose());
+
+	// A single level on the residuals of 4 x 4 tiles, larger steps than the quantization of the alpha
+	const std::vector<PyramidLevel> levels = { { 1, 1e-12, 20, 5e-2, true, 0.0f, false, 4 } };
+
+	const auto pose = runBundleAdjustmentPyramid(&renderer, targetImage, ObjectPose(), levels);
+
+	const BundleAdjustment::ColumnVector error = BundleAdjustment::objectPoseToParameters(pose)
+	                                           - BundleAdjustment::objectPoseToParameters(truePose());
+	QVERIFY(length(error) < 1e-2);
+}
+
+void RefinementTest::spsaImprovesSimilarity()
+{
+	SyntheticRenderer renderer(truePose());
+	renderer.setWorkingResolution(createTargetImage().size());
+
+	const auto targetImage = renderer.renderToImage(truePose());
+	const auto initialSimilarity = computeSimilarity(renderer.renderToImage(ObjectPose()), targetImage);
+
+	const SpsaSettings settings;
+	const long previousEvaluations = renderer.evaluations();
+
+	const auto pose = runBundleAdjustmentSpsa(&renderer, targetImage, ObjectPose(), settings);
+
+	// Two renderings per iteration
+	QCOMPARE(renderer.evaluations() - previousEvaluations, long(2 * settings.iterations));
+	QVERIFY(computeSimilarity(renderer.renderToImage(pose), targetImage) > initialSimilarity);
+}
+
+void RefinementTest::evaluationLimit()
+{
+	SyntheticRenderer renderer(truePose());
+
+	RefinementBudget budget;
+	budget.evaluationLimit = 40;
+
+	const auto result = runBundleAdjustmentWithBudget(&renderer, createTargetImage(), ObjectPose(), budget, scalarPyramidLevels());
+
+	QCOMPARE(result.status, RefinementStatus::EvaluationLimitReached);
+	QCOMPARE(result.evaluations, budget.evaluationLimit);
+	QCOMPARE(renderer.evaluations(), budget.evaluationLimit);
+}
+
+void RefinementTest::timeLimit()
+{
+	// 1 ms per evaluation, the refinement would take seconds without a limit
+	SyntheticRenderer renderer(truePose(), 1);
+
+	RefinementBudget budget;
+	budget.timeLimit = 100;
+
+	const auto result = runBundleAdjustmentWithBudget(&renderer, createTargetImage(), ObjectPose(), budget, scalarPyramidLevels());
+
+	// The budget is used up rather than abandoned early
+	QCOMPARE(result.status, RefinementStatus::TimeLimitReached);
+	QVERIFY(result.elapsed >= budget.timeLimit);
+
+	// The line search in progress stops at the next evaluation, the overrun stays small even on slow machines
+	QVERIFY(result.elapsed < 2 * budget.timeLimit);
+}
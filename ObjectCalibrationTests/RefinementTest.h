@@ -0,0 +1,18 @@
+#pragma once
+
+#include <QObject>
+
+/**
+ * \brief Global search, least squares and budgets of the refinement, on a synthetic renderer
+ */
+class RefinementTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void cmaEsEscapesLocalOptimum();
+	void levenbergMarquardtConverges();
+	void spsaImprovesSimilarity();
+	void evaluationLimit();
+	void timeLimit();
+};
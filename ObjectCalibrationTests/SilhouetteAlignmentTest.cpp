@@ -0,0 +1,179 @@
+#include "SilhouetteAlignmentTest.h"
+
+#include <cmath>
+
+#include <QQuaternion>
+#include <QtMath>
+#include <QtTest>
+#include <QVector2D>
+
+#include "Camera.h"
+#include "Renderer.h"
+#include "SilhouetteAlignment.h"
+
+namespace
+{
+	// Radius of the disc standing for the object
+	constexpr float DiscRadius = 0.1f;
+
+	/**
+	 * \brief Directions of the evaluation camera in world space
+	 */
+	struct CameraAxes
+	{
+		QVector3D eye;
+		QVector3D forward;
+		QVector3D right;
+		QVector3D up;
+		float fovy;
+	};
+
+	CameraAxes cameraAxes(const QSize& size)
+	{
+		const auto camera = evaluationCamera(float(size.width()) / size.height());
+
+		CameraAxes axes;
+		axes.eye = camera.eye();
+		axes.forward = (camera.at() - camera.eye()).normalized();
+		axes.right = camera.right();
+		axes.up = QVector3D::crossProduct(axes.right, axes.forward);
+		axes.fovy = camera.fovy();
+		return axes;
+	}
+
+	/**
+	 * \brief Silhouette of a disc facing the evaluation camera, centered on the position of the object
+	 *
+	 * With an axis ratio below 1, the disc is flattened into an ellipse whose major axis is the X axis of
+	 * the object, so that the silhouette turns with the rotation of the object around the axis of the camera.
+	 */
+	QImage renderDisc(const ObjectPose& pose, const QSize& size, float axisRatio = 1.0f)
+	{
+		const auto axes = cameraAxes(size);
+
+		const auto offset = pose.translation - axes.eye;
+		const float depth = QVector3D::dotProduct(offset, axes.forward);
+		const float pixelsPerUnit = size.height() / (2.0f * depth * std::tan(qDegreesToRadians(0.5f * axes.fovy)));
+
+		const float centerX = 0.5f * size.width() + QVector3D::dotProduct(offset, axes.right) * pixelsPerUnit;
+		const float centerY = 0.5f * size.height() - QVector3D::dotProduct(offset, axes.up) * pixelsPerUnit;
+		const float radius = DiscRadius * pixelsPerUnit;
+
+		// Direction of the major axis on the image, the rows go down
+		const auto majorAxis = QQuaternion::fromEulerAngles(pose.rotation).rotatedVector(QVector3D(1.0f, 0.0f, 0.0f));
+		const auto direction = QVector2D(QVector3D::dotProduct(majorAxis, axes.right),
+		                                 -QVector3D::dotProduct(majorAxis, axes.up)).normalized();
+
+		QImage image(size, QImage::Format_ARGB32);
+
+		for (int y = 0; y < size.height(); y++)
+		{
+			for (int x = 0; x < size.width(); x++)
+			{
+				const float dx = x + 0.5f - centerX;
+				const float dy = y + 0.5f - centerY;
+
+				const float major = dx * direction.x() + dy * direction.y();
+				const float minor = (dy * direction.x() - dx * direction.y()) / axisRatio;
+				image.setPixel(x, y, major * major + minor * minor < radius * radius ? qRgba(0, 0, 0, 255) : qRgba(0, 0, 0, 0));
+			}
+		}
+
+		return image;
+	}
+
+	/**
+	 * \brief Renderer of the silhouette of a disc or of an ellipse, the only images the alignment needs
+	 */
+	class DiscRenderer : public Renderer
+	{
+	public:
+
+		explicit DiscRenderer(float axisRatio = 1.0f) :
+			m_axisRatio(axisRatio)
+		{
+
+		}
+
+		void setTargetImage(const QImage&) override {}
+
+		void setWorkingResolution(const QSize& size) override { m_workingResolution = size; }
+		QSize workingResolution() const override { return m_workingResolution; }
+
+		void setSilhouetteOnly(bool) override {}
+		bool silhouetteOnly() const override { return true; }
+
+		void setLevelOfDetailTolerance(float) override {}
+		float levelOfDetailTolerance() const override { return 0.0f; }
+
+		QImage renderToImage(const ObjectPose& pose) override { return renderDisc(pose, m_workingResolution, m_axisRatio); }
+		float renderAndComputeSimilarity(const ObjectPose&) override { return 0.0f; }
+
+	private:
+
+		float m_axisRatio;
+		QSize m_workingResolution;
+	};
+}
+
+void SilhouetteAlignmentTest::shiftAndScale()
+{
+	ObjectPose truePose;
+	truePose.translation = QVector3D(0.05f, -0.03f, 0.1f);
+
+	DiscRenderer renderer;
+	renderer.setWorkingResolution(QSize(64, 48));
+
+	const auto pose = alignSilhouette(&renderer, renderDisc(truePose, QSize(256, 192)), ObjectPose());
+
+	QCOMPARE(renderer.workingResolution(), QSize(64, 48));
+
+	// Within a pixel of the working resolution, and the step between the scales for the depth
+	QVERIFY((pose.translation - truePose.translation).length() < 0.02f);
+}
+
+void SilhouetteAlignmentTest::shiftLargerThanHalfTheImage()
+{
+	// The disc moves by 133 of the 192 rows of the target, the correlation must not wrap around
+	ObjectPose initialPose;
+	initialPose.translation = QVector3D(-0.33f, 0.0f, 0.0f);
+
+	ObjectPose truePose;
+	truePose.translation = QVector3D(0.33f, 0.0f, 0.0f);
+
+	DiscRenderer renderer;
+	const auto pose = alignSilhouette(&renderer, renderDisc(truePose, QSize(256, 192)), initialPose);
+
+	QVERIFY((pose.translation - truePose.translation).length() < 0.01f);
+}
+
+void SilhouetteAlignmentTest::momentsOfEllipse()
+{
+	const QSize targetSize(256, 192);
+	const auto axes = cameraAxes(targetSize);
+
+	// Shifted, further away and rolled by 20 degrees counterclockwise on the image
+	ObjectPose truePose;
+	truePose.translation = QVector3D(0.04f, -0.03f, 0.0f) + 0.1f * axes.forward;
+	truePose.rotation = QQuaternion::fromAxisAndAngle(-axes.forward, 20.0f).toEulerAngles();
+
+	DiscRenderer renderer(0.5f);
+	renderer.setWorkingResolution(QSize(64, 48));
+
+	const auto pose = alignSilhouetteMoments(&renderer, renderDisc(truePose, targetSize, 0.5f), ObjectPose());
+
+	QCOMPARE(renderer.workingResolution(), QSize(64, 48));
+
+	// Translation in the plane of the image and depth
+	const auto error = pose.translation - truePose.translation;
+	QVERIFY(std::abs(QVector3D::dotProduct(error, axes.right)) < 0.005f);
+	QVERIFY(std::abs(QVector3D::dotProduct(error, axes.up)) < 0.005f);
+	QVERIFY(std::abs(QVector3D::dotProduct(error, axes.forward)) < 0.01f);
+
+	// Roll, the angle of the remaining rotation
+	const auto remaining = QQuaternion::fromEulerAngles(pose.rotation).inverted() * QQuaternion::fromEulerAngles(truePose.rotation);
+	float angle = 0.0f;
+	QVector3D axis;
+	remaining.getAxisAndAngle(&axis, &angle);
+	QVERIFY(std::abs(std::remainder(angle, 360.0f)) < 1.0f);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <QObject>
+
+/**
+ * \brief Alignment of the rendered silhouette with the one of the target, by correlation and by image moments
+ */
+class SilhouetteAlignmentTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void shiftAndScale();
+	void shiftLargerThanHalfTheImage();
+	void momentsOfEllipse();
+};
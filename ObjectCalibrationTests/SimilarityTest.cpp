@@ -0,0 +1,161 @@
+#include "SimilarityTest.h"
+
+#include <vector>
+
+#include <QtTest>
+
+#include "Similarity.h"
+
+namespace
+{
+	/**
+	 * \brief Pose of the target, the pattern faces the evaluation camera
+	 */
+	ObjectPose targetPose()
+	{
+		return ObjectPose();
+	}
+
+	/**
+	 * \brief Pose compared to the target, overlapping it partially
+	 */
+	ObjectPose evaluatedPose()
+	{
+		ObjectPose pose;
+		pose.translation = QVector3D(0.02f, -0.01f, 0.05f);
+		pose.rotation = QVector3D(5.0f, -8.0f, 10.0f);
+
+		return pose;
+	}
+
+	/**
+	 * \brief Pose of the current row of a test using poseData()
+	 */
+	ObjectPose fetchPose()
+	{
+		QFETCH(QVector3D, translation);
+		QFETCH(QVector3D, rotation);
+
+		ObjectPose pose;
+		pose.translation = translation;
+		pose.rotation = rotation;
+
+		return pose;
+	}
+
+	// The GPU and the CPU sum the same integers, up to the thresholds on the value computed in floats
+	constexpr float Tolerance = 1e-3f;
+}
+
+void SimilarityTest::initTestCase()
+{
+	m_surface = std::make_unique<QOffscreenSurface>();
+	m_surface->setFormat(QSurfaceFormat::defaultFormat());
+	m_surface->create();
+
+	m_context = std::make_unique<QOpenGLContext>();
+	m_context->setFormat(QSurfaceFormat::defaultFormat());
+
+	if (!m_context->create() || !m_context->makeCurrent(m_surface.get()))
+	{
+		QSKIP("Cannot create an offscreen OpenGL context");
+	}
+
+	if (m_context->format().version() < qMakePair(4, 3))
+	{
+		QSKIP("The OpenGL context does not support compute shaders");
+	}
+
+	m_object = Mesh::createCheckerBoardPattern();
+
+	m_evaluation = std::make_unique<EvaluationContext>(m_object, QMatrix4x4());
+	m_evaluation->initialize();
+
+	// The target is a render of the object, the frame buffer takes the size of the first target
+	QImage emptyTarget(320, 240, QImage::Format_ARGB32);
+	emptyTarget.fill(Qt::transparent);
+
+	m_evaluation->setTargetImage(emptyTarget);
+	m_targetImage = m_evaluation->renderToImage(targetPose());
+	m_evaluation->setTargetImage(m_targetImage);
+}
+
+void SimilarityTest::cleanupTestCase()
+{
+	if (m_evaluation)
+	{
+		m_evaluation->destroy();
+		m_evaluation.reset();
+	}
+
+	if (m_context)
+	{
+		m_context->doneCurrent();
+	}
+}
+
+void SimilarityTest::poseData()
+{
+	QTest::addColumn<QVector3D>("translation");
+	QTest::addColumn<QVector3D>("rotation");
+
+	const auto pose = evaluatedPose();
+	QTest::newRow("partial overlap") << pose.translation << pose.rotation;
+
+	// Regions of a few workgroups and of most of the frame buffer, not multiples of the local size
+	QTest::newRow("far") << QVector3D(0.01f, 0.02f, -1.5f) << QVector3D(10.0f, 20.0f, 0.0f);
+	QTest::newRow("close") << QVector3D(0.0f, 0.0f, 0.45f) << QVector3D(0.0f, 0.0f, 30.0f);
+}
+
+void SimilarityTest::gpuMatchesCpu_data()
+{
+	poseData();
+}
+
+void SimilarityTest::gpuMatchesCpu()
+{
+	const auto pose = fetchPose();
+
+	const float expected = computeSimilarity(m_evaluation->renderToImage(pose), m_targetImage);
+	const float similarity = m_evaluation->renderAndComputeSimilarity(pose);
+
+	// The poses overlap, a similarity of 0 means that the compute shader ignored the render
+	QVERIFY(expected > 0.0f);
+	QVERIFY(qAbs(similarity - expected) < Tolerance);
+}
+
+void SimilarityTest::gpuSilhouetteMatchesCpu_data()
+{
+	poseData();
+}
+
+void SimilarityTest::gpuSilhouetteMatchesCpu()
+{
+	const auto pose = fetchPose();
+
+	// The coverage of the silhouette is the alpha of the textured render
+	const auto statistics = computeSimilarityStatistics(m_evaluation->renderToImage(pose), m_targetImage);
+	const float expected = silhouetteSimilarityFromStatistics(statistics);
+
+	m_evaluation->setSilhouetteOnly(true);
+	const float similarity = m_evaluation->renderAndComputeSimilarity(pose);
+	m_evaluation->setSilhouetteOnly(false);
+
+	QVERIFY(expected > 0.0f);
+	QVERIFY(qAbs(similarity - expected) < Tolerance);
+}
+
+void SimilarityTest::gpuBatchMatchesCpu()
+{
+	const std::vector<ObjectPose> poses = { evaluatedPose(), targetPose() };
+
+	const auto similarities = m_evaluation->renderAndComputeSimilarityBatch(poses);
+	QCOMPARE(similarities.size(), poses.size());
+
+	for (std::size_t i = 0; i < poses.size(); i++)
+	{
+		const float expected = computeSimilarity(m_evaluation->renderToImage(poses[i]), m_targetImage);
+
+		QVERIFY(qAbs(similarities[i] - expected) < Tolerance);
+	}
+}
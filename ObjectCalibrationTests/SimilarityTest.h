@@ -0,0 +1,45 @@
+#pragma once
+
+#include <memory>
+
+#include <QObject>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+
+#include "EvaluationContext.h"
+#include "Mesh.h"
+
+/**
+ * \brief Compare the similarity computed by the compute shader to the reference on the CPU
+ *
+ * Skipped when no OpenGL 4.3 context can be created.
+ */
+class SimilarityTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+	void cleanupTestCase();
+
+	void gpuMatchesCpu_data();
+	void gpuMatchesCpu();
+	void gpuSilhouetteMatchesCpu_data();
+	void gpuSilhouetteMatchesCpu();
+	void gpuBatchMatchesCpu();
+
+private:
+
+	/**
+	 * \brief Rows of poses compared to the target, with a translation and a rotation column
+	 */
+	void poseData();
+
+	std::unique_ptr<QOffscreenSurface> m_surface;
+	std::unique_ptr<QOpenGLContext> m_context;
+
+	Mesh m_object;
+	std::unique_ptr<EvaluationContext> m_evaluation;
+
+	QImage m_targetImage;
+};
@@ -0,0 +1,95 @@
+#include "SoftwareRendererTest.h"
+
+#include <cmath>
+
+#include <QtTest>
+
+#include "Similarity.h"
+
+namespace
+{
+	/**
+	 * \brief Pose of the current row of a test using poseData()
+	 */
+	ObjectPose fetchPose()
+	{
+		QFETCH(QVector3D, translation);
+		QFETCH(QVector3D, rotation);
+
+		ObjectPose pose;
+		pose.translation = translation;
+		pose.rotation = rotation;
+
+		return pose;
+	}
+
+	// Both paths sum the same integers, only the conversion to float can differ
+	constexpr float Tolerance = 1e-6f;
+}
+
+void SoftwareRendererTest::initTestCase()
+{
+	m_object = Mesh::createCheckerBoardPattern();
+	m_renderer = std::make_unique<SoftwareRenderer>(m_object, QMatrix4x4());
+
+	// The target is a render of the object facing the camera, the frame buffer takes the size of the target
+	QImage emptyTarget(320, 240, QImage::Format_ARGB32);
+	emptyTarget.fill(Qt::transparent);
+
+	m_renderer->setTargetImage(emptyTarget);
+	m_targetImage = m_renderer->renderToImage(ObjectPose());
+	m_renderer->setTargetImage(m_targetImage);
+}
+
+void SoftwareRendererTest::poseData()
+{
+	QTest::addColumn<QVector3D>("translation");
+	QTest::addColumn<QVector3D>("rotation");
+
+	QTest::newRow("partial overlap") << QVector3D(0.02f, -0.01f, 0.05f) << QVector3D(5.0f, -8.0f, 10.0f);
+	QTest::newRow("far") << QVector3D(0.01f, 0.02f, -1.5f) << QVector3D(10.0f, 20.0f, 0.0f);
+
+	// Partly outside of the viewport, the tiles on the border are clipped
+	QTest::newRow("clipped bottom") << QVector3D(0.45f, 0.0f, 0.0f) << QVector3D(0.0f, 0.0f, 15.0f);
+	QTest::newRow("clipped side") << QVector3D(0.05f, 0.6f, 0.0f) << QVector3D(-10.0f, 5.0f, 0.0f);
+
+	// Part of the object is behind the near plane of the camera
+	QTest::newRow("clipped near plane") << QVector3D(0.0f, 0.0f, 0.95f) << QVector3D(0.0f, 80.0f, 0.0f);
+
+	// Nothing is rasterized, only the target contributes
+	QTest::newRow("outside") << QVector3D(2.0f, 0.0f, 0.0f) << QVector3D(0.0f, 0.0f, 0.0f);
+}
+
+void SoftwareRendererTest::fusedMatchesImage_data()
+{
+	poseData();
+}
+
+void SoftwareRendererTest::fusedMatchesImage()
+{
+	const auto pose = fetchPose();
+
+	const float expected = computeSimilarity(m_renderer->renderToImage(pose), m_targetImage);
+	const float similarity = m_renderer->renderAndComputeSimilarity(pose);
+
+	QVERIFY(std::abs(similarity - expected) < Tolerance);
+}
+
+void SoftwareRendererTest::fusedSilhouetteMatchesImage_data()
+{
+	poseData();
+}
+
+void SoftwareRendererTest::fusedSilhouetteMatchesImage()
+{
+	const auto pose = fetchPose();
+
+	const auto statistics = computeSimilarityStatistics(m_renderer->renderToImage(pose), m_targetImage);
+	const float expected = silhouetteSimilarityFromStatistics(statistics);
+
+	m_renderer->setSilhouetteOnly(true);
+	const float similarity = m_renderer->renderAndComputeSimilarity(pose);
+	m_renderer->setSilhouetteOnly(false);
+
+	QVERIFY(std::abs(similarity - expected) < Tolerance);
+}
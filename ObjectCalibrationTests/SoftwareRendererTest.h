@@ -0,0 +1,37 @@
+#pragma once
+
+#include <memory>
+
+#include <QImage>
+#include <QObject>
+
+#include "Mesh.h"
+#include "SoftwareRenderer.h"
+
+/**
+ * \brief Compare the similarity scored tile by tile by the software renderer to the similarity of its images
+ */
+class SoftwareRendererTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+
+	void fusedMatchesImage_data();
+	void fusedMatchesImage();
+	void fusedSilhouetteMatchesImage_data();
+	void fusedSilhouetteMatchesImage();
+
+private:
+
+	/**
+	 * \brief Rows of poses compared to the target, with a translation and a rotation column
+	 */
+	void poseData();
+
+	Mesh m_object;
+	std::unique_ptr<SoftwareRenderer> m_renderer;
+
+	QImage m_targetImage;
+};
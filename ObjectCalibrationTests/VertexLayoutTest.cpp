@@ -0,0 +1,129 @@
+#include "VertexLayoutTest.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <QtTest>
+
+#include "VertexLayout.h"
+
+namespace
+{
+	// Like the post-transform caches of current GPUs
+	constexpr int CacheSize = 16;
+
+	/**
+	 * \brief Triangles of a regular grid of vertices, in random order
+	 * \param resolution Number of quads on each side
+	 */
+	std::vector<unsigned int> createShuffledGrid(int resolution)
+	{
+		std::vector<std::array<unsigned int, 3>> triangles;
+
+		const auto vertex = [resolution](int i, int j)
+		{
+			return static_cast<unsigned int>(j * (resolution + 1) + i);
+		};
+
+		for (int j = 0; j < resolution; j++)
+		{
+			for (int i = 0; i < resolution; i++)
+			{
+				triangles.push_back({ vertex(i, j), vertex(i + 1, j), vertex(i + 1, j + 1) });
+				triangles.push_back({ vertex(i, j), vertex(i + 1, j + 1), vertex(i, j + 1) });
+			}
+		}
+
+		std::mt19937 generator(42);
+		std::shuffle(triangles.begin(), triangles.end(), generator);
+
+		std::vector<unsigned int> indices;
+
+		for (const auto& triangle : triangles)
+		{
+			indices.insert(indices.end(), triangle.begin(), triangle.end());
+		}
+
+		return indices;
+	}
+
+	/**
+	 * \brief Triangles with their smallest index first, sorted, to compare meshes whatever the order of their triangles
+	 */
+	std::vector<std::array<unsigned int, 3>> sortedTriangles(const std::vector<unsigned int>& indices)
+	{
+		std::vector<std::array<unsigned int, 3>> triangles;
+
+		for (std::size_t i = 0; i < indices.size(); i += 3)
+		{
+			std::array<unsigned int, 3> triangle = { indices[i], indices[i + 1], indices[i + 2] };
+			std::rotate(triangle.begin(), std::min_element(triangle.begin(), triangle.end()), triangle.end());
+			triangles.push_back(triangle);
+		}
+
+		std::sort(triangles.begin(), triangles.end());
+
+		return triangles;
+	}
+}
+
+void VertexLayoutTest::unorm16RoundTrip()
+{
+	const std::vector<QVector3D> vertices = { { 0.0f, 1.0f, 2.0f }, { -3.0f, 4.5f, 0.25f } };
+	const std::vector<QVector3D> originalUvs = { { 0.0f, 1.0f, 0.0f }, { 0.123456f, 0.654321f, 0.0f } };
+
+	QCOMPARE(selectVertexFormat(originalUvs), VertexFormat::Unorm16Uv);
+
+	auto uvs = originalUvs;
+	const auto data = packVertices(vertices, uvs, VertexFormat::Unorm16Uv);
+	QCOMPARE(data.size(), vertices.size() * std::size_t(vertexLayout(VertexFormat::Unorm16Uv).stride));
+
+	std::vector<QVector3D> unpackedVertices;
+	std::vector<QVector3D> unpackedUvs;
+	unpackVertices(data.data(), vertices.size(), VertexFormat::Unorm16Uv, unpackedVertices, unpackedUvs);
+
+	// The quantized coordinates are returned by packVertices(), so the CPU uses the values of the GPU
+	QCOMPARE(unpackedVertices, vertices);
+	QCOMPARE(unpackedUvs, uvs);
+
+	for (std::size_t i = 0; i < uvs.size(); i++)
+	{
+		QVERIFY(std::abs(uvs[i].x() - originalUvs[i].x()) <= 0.5f / 65535.0f);
+		QVERIFY(std::abs(uvs[i].y() - originalUvs[i].y()) <= 0.5f / 65535.0f);
+	}
+
+	// Texture coordinates out of [0, 1] need floats
+	QCOMPARE(selectVertexFormat({ { 1.5f, 0.0f, 0.0f } }), VertexFormat::FloatUv);
+}
+
+void VertexLayoutTest::vertexCacheLowersMissRatio()
+{
+	const int resolution = 64;
+	const std::size_t vertexCount = (resolution + 1) * (resolution + 1);
+	const auto shuffled = createShuffledGrid(resolution);
+
+	auto optimized = shuffled;
+	optimizeVertexCache(optimized.data(), optimized.size(), vertexCount);
+
+	// Same triangles, with the same orientation
+	QVERIFY(sortedTriangles(optimized) == sortedTriangles(shuffled));
+
+	const float shuffledRatio = averageCacheMissRatio(shuffled.data(), shuffled.size(), vertexCount, CacheSize);
+	const float optimizedRatio = averageCacheMissRatio(optimized.data(), optimized.size(), vertexCount, CacheSize);
+
+	// Almost every vertex is transformed again in random order, a good order stays close to 0.5 on a grid
+	QVERIFY(shuffledRatio > 2.0f);
+	QVERIFY(optimizedRatio < 0.8f);
+}
+
+void VertexLayoutTest::vertexFetchFollowsFirstUse()
+{
+	// Vertex 1 is not used
+	const std::vector<unsigned int> indices = { 4, 2, 0, 0, 2, 3 };
+
+	const std::vector<unsigned int> expected = { 2, 4, 1, 3, 0 };
+	QCOMPARE(optimizeVertexFetch(indices, 5), expected);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <QObject>
+
+/**
+ * \brief Packing and ordering of the vertices of the vertex buffer
+ */
+class VertexLayoutTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void unorm16RoundTrip();
+	void vertexCacheLowersMissRatio();
+	void vertexFetchFollowsFirstUse();
+};
@@ -0,0 +1,64 @@
+#include <QGuiApplication>
+#include <QSurfaceFormat>
+#include <QtTest>
+
+#include "CpuSimilarityTest.h"
+#include "DifferentiableRendererTest.h"
+#include "EvaluationContextPoolTest.h"
+#include "MeshCacheTest.h"
+#include "MeshSimplificationTest.h"
+#include "ObjReaderTest.h"
+#include "RefinementTest.h"
+#include "SilhouetteAlignmentTest.h"
+#include "SimilarityTest.h"
+#include "SoftwareRendererTest.h"
+#include "VertexLayoutTest.h"
+
+int main(int argc, char *argv[])
+{
+	// Same contexts as the application, the compute shaders need OpenGL 4.3
+	QSurfaceFormat format;
+	format.setVersion(4, 3);
+	format.setProfile(QSurfaceFormat::CoreProfile);
+	format.setDepthBufferSize(24);
+	QSurfaceFormat::setDefaultFormat(format);
+
+	QGuiApplication application(argc, argv);
+
+	int status = 0;
+
+	CpuSimilarityTest cpuSimilarityTest;
+	status |= QTest::qExec(&cpuSimilarityTest, argc, argv);
+
+	DifferentiableRendererTest differentiableRendererTest;
+	status |= QTest::qExec(&differentiableRendererTest, argc, argv);
+
+	EvaluationContextPoolTest evaluationContextPoolTest;
+	status |= QTest::qExec(&evaluationContextPoolTest, argc, argv);
+
+	MeshCacheTest meshCacheTest;
+	status |= QTest::qExec(&meshCacheTest, argc, argv);
+
+	MeshSimplificationTest meshSimplificationTest;
+	status |= QTest::qExec(&meshSimplificationTest, argc, argv);
+
+	ObjReaderTest objReaderTest;
+	status |= QTest::qExec(&objReaderTest, argc, argv);
+
+	RefinementTest refinementTest;
+	status |= QTest::qExec(&refinementTest, argc, argv);
+
+	SilhouetteAlignmentTest silhouetteAlignmentTest;
+	status |= QTest::qExec(&silhouetteAlignmentTest, argc, argv);
+
+	SimilarityTest similarityTest;
+	status |= QTest::qExec(&similarityTest, argc, argv);
+
+	SoftwareRendererTest softwareRendererTest;
+	status |= QTest::qExec(&softwareRendererTest, argc, argv);
+
+	VertexLayoutTest vertexLayoutTest;
+	status |= QTest::qExec(&vertexLayoutTest, argc, argv);
+
+	return status;
+}